@@ -77,6 +77,7 @@ struct CLAMFI {
     char *msg_date;
     char *msg_id;
     char **recipients;
+    struct CP_ENTRY *cpe;
     int local;
     int main;
     int alt;
@@ -137,6 +138,8 @@ static void nullify(SMFICTX *ctx, struct CLAMFI *cf, enum CFWHAT closewhat) {
 	close(cf->main);
     if(closewhat & CF_ALT || ((closewhat & CF_ANY) && cf->alt >= 0))
 	close(cf->alt);
+    if(cf->cpe)
+	cpool_put(cf->cpe, -1);
     if(cf->msg_subj) free(cf->msg_subj);
     if(cf->msg_date) free(cf->msg_date);
     if(cf->msg_id) free(cf->msg_id);
@@ -158,7 +161,7 @@ static sfsistat sendchunk(struct CLAMFI *cf, unsigned char *bodyp, size_t len, S
 
     if(!cf->totsz) {
 	sfsistat ret;
-	if(nc_connect_rand(&cf->main, &cf->alt, &cf->local)) {
+	if(nc_connect_pool(&cf->main, &cf->alt, &cf->local, &cf->cpe)) {
 	    logg("!Failed to initiate streaming/fdpassing\n");
 	    nullify(ctx, cf, CF_NONE);
 	    return FailAction;
@@ -199,10 +202,18 @@ static sfsistat sendchunk(struct CLAMFI *cf, unsigned char *bodyp, size_t len, S
 	    memcpy(cf->buffer, &bodyp[CLAMFIBUFSZ - cf->bufsz], len);
 	    cf->bufsz = len;
 	} else {
+	    /* what's buffered and the new chunk go out together */
 	    uint32_t sendmetoo = htonl(len);
+	    struct iovec iov[3];
+
 	    cf->sendme = htonl(cf->bufsz);
-	    if((cf->bufsz && nc_send(cf->main, &cf->sendme, cf->bufsz + 4)) || nc_send(cf->main, &sendmetoo, 4) || nc_send(cf->main, bodyp, len))
-		sendfailed = 1;
+	    iov[0].iov_base = &cf->sendme;
+	    iov[0].iov_len = cf->bufsz ? cf->bufsz + 4 : 0;
+	    iov[1].iov_base = &sendmetoo;
+	    iov[1].iov_len = 4;
+	    iov[2].iov_base = bodyp;
+	    iov[2].iov_len = len;
+	    sendfailed = nc_sendv(cf->main, iov, 3);
 	    cf->bufsz = 0;
 	}
 	if(sendfailed) {
@@ -306,8 +317,14 @@ sfsistat clamfi_eom(SMFICTX *ctx) {
 	}
     } else {
 	uint32_t sendmetoo = 0;
+	struct iovec iov[2];
+
 	cf->sendme = htonl(cf->bufsz);
-	if((cf->bufsz && nc_send(cf->main, &cf->sendme, cf->bufsz + 4)) || nc_send(cf->main, &sendmetoo, 4))  {
+	iov[0].iov_base = &cf->sendme;
+	iov[0].iov_len = cf->bufsz ? cf->bufsz + 4 : 0;
+	iov[1].iov_base = &sendmetoo;
+	iov[1].iov_len = 4;
+	if(nc_sendv(cf->main, iov, 2))  {
 	    logg("!Failed to flush STREAM\n");
 	    nullify(ctx, cf, CF_NONE);
 	    return FailAction;
@@ -455,9 +472,15 @@ sfsistat clamfi_eom(SMFICTX *ctx) {
     } else {
 	logg("!Unknown reply from clamd\n");
 	ret = FailAction;
+	close(cf->main);
+	cf->main = -1;
     }
 
-    nullify(ctx, cf, CF_MAIN);
+    /* the request is complete, the session can take the next message */
+    if(cf->main >= 0)
+	cpool_put(cf->cpe, cf->main);
+    cf->cpe = NULL;
+    nullify(ctx, cf, CF_NONE);
 
     free(reply);
     return ret;
@@ -687,6 +710,7 @@ sfsistat clamfi_envfrom(SMFICTX *ctx, char **argv) {
     cf->totsz = 0;
     cf->bufsz = 0;
     cf->main = cf->alt = -1;
+    cf->cpe = NULL;
     cf->all_whitelisted = 1;
     cf->gotbody = 0;
     cf->msg_subj = cf->msg_date = cf->msg_id = NULL;
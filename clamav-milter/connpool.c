@@ -34,6 +34,8 @@
 #include <unistd.h>
 #include <time.h>
 #include <netdb.h>
+#include <limits.h>
+#include <sys/select.h>
 
 #include "shared/optparser.h"
 #include "shared/output.h"
@@ -42,6 +44,11 @@
 #include "connpool.h"
 #include "netcode.h"
 
+/* how often clamd is asked for its load */
+#define CP_STATS_INTERVAL 10
+/* idle sessions are dropped well before clamd's ReadTimeout hits them */
+#define CP_IDLE_TIMEOUT 30
+
 #define SETGAI(k, v) {(k)->gai = (void *)(v);} while(0)
 #define FREESRV(k) { if((k).gai) freeaddrinfo((k).gai); else if((k).server) free((k).server); } while(0)
 
@@ -145,9 +152,11 @@ static int addslot(void) {
 
 
 /* Probe strategy:
-- wake up every minute
+- wake up every CP_STATS_INTERVAL seconds
 - probe alive if last check > 15 min
 - probe dead if (last check > 2 min || no clamd available)
+- ask the alive ones for STATS, the load drives cpool_get()
+- close the sessions idle for more than CP_IDLE_TIMEOUT
 */
 
 static void cpool_probe(void) {
@@ -161,6 +170,8 @@ static void cpool_probe(void) {
 	    nc_ping_entry(cpe);
 	    logg("*Probe for slot %u returned: %s\n", i, cpe->dead ? "failed" : "success");
 	}
+	if(!cpe->dead && nc_stats_entry(cpe))
+	    logg("*STATS for slot %u failed\n", i);
 	dead += cpe->dead;
 	cpe++;
     }
@@ -171,6 +182,26 @@ static void cpool_probe(void) {
 }
 
 
+static void cpool_expire(void) {
+    unsigned int i, j, k;
+    struct CP_ENTRY *cpe;
+    time_t old = time(NULL) - CP_IDLE_TIMEOUT;
+
+    pthread_mutex_lock(&cp->mutex);
+    for(i=0; i<cp->entries; i++) {
+	cpe = &cp->pool[i];
+	for(j=0, k=0; j<cpe->nidle; j++) {
+	    if(cpe->dead || cpe->idle[j].since < old)
+		close(cpe->idle[j].s);
+	    else
+		cpe->idle[k++] = cpe->idle[j];
+	}
+	cpe->nidle = k;
+    }
+    pthread_mutex_unlock(&cp->mutex);
+}
+
+
 static void *cpool_mon(_UNUSED_ void *v) {
     pthread_mutex_t conv;
 
@@ -181,7 +212,8 @@ static void *cpool_mon(_UNUSED_ void *v) {
 	struct timespec t;
 
 	cpool_probe();
-	t.tv_sec = time(NULL) + 60;
+	cpool_expire();
+	t.tv_sec = time(NULL) + CP_STATS_INTERVAL;
 	t.tv_nsec = 0;
 	pthread_cond_timedwait(&mon_cond, &conv, &t);
     }
@@ -201,6 +233,7 @@ void cpool_init(struct optstruct *opts) {
     }
 
     cp->local_cpe = NULL;
+    pthread_mutex_init(&cp->mutex, NULL);
 
     if((opt = optget(opts, "ClamdSocket"))->enabled) {
 	while(opt) {
@@ -234,6 +267,19 @@ void cpool_init(struct optstruct *opts) {
 	cpool_free();
 	return;
     }
+
+    cp->maxidle = optget(opts, "ClamdPoolSize")->numarg;
+    if(cp->maxidle) {
+	unsigned int i;
+
+	for(i=0; i<cp->entries; i++) {
+	    if(!(cp->pool[i].idle = calloc(cp->maxidle, sizeof(struct CP_SESSION)))) {
+		logg("!Out of memory while initializing the connection pool\n");
+		cpool_free();
+		return;
+	    }
+	}
+    }
     quitting = 0;
     pthread_create(&probe_th, NULL, cpool_mon, NULL);
     srand(time(NULL));
@@ -252,39 +298,109 @@ void cpool_free(void) {
 
     if(cp) {
 	if(cp->pool) {
-	    for(i=0; i<cp->entries; i++)
+	    for(i=0; i<cp->entries; i++) {
+		while(cp->pool[i].nidle)
+		    close(cp->pool[i].idle[--cp->pool[i].nidle].s);
+		free(cp->pool[i].idle);
 		FREESRV(cp->pool[i]);
+	    }
 	    free(cp->pool);
 	}
+	pthread_mutex_destroy(&cp->mutex);
 	free(cp);
 	cp = NULL;
     }
 }
 
 
-struct CP_ENTRY *cpool_get_rand(int *s) {
-    unsigned int start, i;
-    struct CP_ENTRY *cpe;
+/* A pooled session is usable if clamd hasn't closed it or sent anything */
+static int cpool_session_ok(int s) {
+    struct timeval tv;
+    fd_set fds;
+
+    if(s >= FD_SETSIZE)
+	return 1;
+    tv.tv_sec = 0;
+    tv.tv_usec = 0;
+    FD_ZERO(&fds);
+    FD_SET(s, &fds);
+    return select(s+1, &fds, NULL, NULL, &tv) == 0;
+}
 
-    if(cp->alive) {
+
+/* Picks the alive clamd with the least outstanding work relative to its
+ * threads, ours in flight plus its own load at the last STATS, and
+ * returns a connection to it: a pooled IDSESSION if one is available, a
+ * new one otherwise.
+ * The entry must be given back with cpool_put() */
+struct CP_ENTRY *cpool_get(int *s) {
+    unsigned int start, i, score, best_score = 0;
+    struct CP_ENTRY *cpe, *best;
+    struct CP_SESSION *ss;
+
+    while(cp->alive) {
+	pthread_mutex_lock(&cp->mutex);
+	best = NULL;
 	start = rand() % cp->entries;
 	for(i=0; i<cp->entries; i++) {
 	    cpe = &cp->pool[(i+start) % cp->entries];
 	    if(cpe->dead) continue;
-	    if(cpe->local && cp->local_cpe && !cp->local_cpe->dead)
-		cpe = cp->local_cpe;
-	    if((*s = nc_connect_entry(cpe)) == -1) {
-		cpe->dead = 1;
-		continue;
+	    score = (cpe->inflight + cpe->load) * 1024 / (cpe->threads ? cpe->threads : 1);
+	    if(!best || score < best_score) {
+		best = cpe;
+		best_score = score;
 	    }
-	    return cpe;
 	}
+	if(best && best->local && cp->local_cpe && !cp->local_cpe->dead)
+	    best = cp->local_cpe;
+	if(!best) {
+	    pthread_mutex_unlock(&cp->mutex);
+	    break;
+	}
+	best->inflight++;
+	*s = -1;
+	while(best->nidle) {
+	    ss = &best->idle[--best->nidle];
+	    if(ss->since >= time(NULL) - CP_IDLE_TIMEOUT && cpool_session_ok(ss->s)) {
+		*s = ss->s;
+		break;
+	    }
+	    close(ss->s);
+	}
+	pthread_mutex_unlock(&cp->mutex);
+	if(*s != -1)
+	    return best;
+
+	if((*s = nc_connect_entry(best)) != -1 && (!cp->maxidle || !nc_send(*s, "nIDSESSION\n", 11)))
+	    return best;
+	pthread_mutex_lock(&cp->mutex);
+	best->dead = 1;
+	best->inflight--;
+	pthread_mutex_unlock(&cp->mutex);
     }
     pthread_cond_signal(&mon_cond);
     return NULL;
 }
 
 
+/* Gives back an entry taken with cpool_get(); s is the connection after a
+ * completed request, to be pooled, or -1 if it was closed already */
+void cpool_put(struct CP_ENTRY *cpe, int s) {
+    pthread_mutex_lock(&cp->mutex);
+    if(cpe->inflight)
+	cpe->inflight--;
+    if(s != -1 && cp->maxidle && cpe->nidle < cp->maxidle && !cpe->dead) {
+	cpe->idle[cpe->nidle].s = s;
+	cpe->idle[cpe->nidle].since = time(NULL);
+	cpe->nidle++;
+	s = -1;
+    }
+    pthread_mutex_unlock(&cp->mutex);
+    if(s != -1)
+	close(s);
+}
+
+
 /*
  * Local Variables:
  * mode: c
@@ -33,6 +33,12 @@
 
 #include "shared/optparser.h"
 
+/* an IDSESSION connection waiting for the next message */
+struct CP_SESSION {
+    int s;
+    time_t since;
+};
+
 struct CP_ENTRY {
     struct sockaddr *server;
     void *gai;
@@ -41,18 +47,28 @@ struct CP_ENTRY {
     uint8_t type;
     uint8_t dead;
     uint8_t local;
+    /* our messages being scanned, and clamd's busy threads plus queued
+     * jobs out of max threads at the last STATS probe */
+    unsigned int inflight;
+    unsigned int load;
+    unsigned int threads;
+    struct CP_SESSION *idle;
+    unsigned int nidle;
 };
 
 struct CPOOL {
     unsigned int entries;
     unsigned int alive;
+    unsigned int maxidle;
+    pthread_mutex_t mutex;
     struct CP_ENTRY *local_cpe;
     struct CP_ENTRY *pool;
 };
 
 void cpool_init(struct optstruct *copt);
 void cpool_free(void);
-struct CP_ENTRY *cpool_get_rand(int *s);
+struct CP_ENTRY *cpool_get(int *s);
+void cpool_put(struct CP_ENTRY *cpe, int s);
 
 extern struct CPOOL *cp;
 
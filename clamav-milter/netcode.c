@@ -39,6 +39,8 @@
 #include <errno.h>
 #include <netdb.h>
 #include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #include "shared/output.h"
 #include "shared/optparser.h"
@@ -90,6 +92,14 @@ static int nc_socket(struct CP_ENTRY *cpe) {
 	close(s);
 	return -1;
     }
+#ifdef TCP_NODELAY
+    /* chunks are coalesced before they are sent, don't hold the last one
+     * back waiting for an ack */
+    if (cpe->server->sa_family != AF_UNIX) {
+	flags = 1;
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &flags, sizeof(flags));
+    }
+#endif
     return s;
 }
 
@@ -191,6 +201,74 @@ int nc_send(int s, const void *buff, size_t len) {
 }
 
 
+/* Like nc_send() but for several buffers, which go out in as few
+ * segments as the socket allows. The iovec array is consumed */
+int nc_sendv(int s, struct iovec *iov, int cnt) {
+    while(cnt) {
+	ssize_t res;
+	time_t timeout;
+	struct timeval tv;
+	char er[256];
+
+	if(!iov->iov_len) {
+	    iov++;
+	    cnt--;
+	    continue;
+	}
+	res = writev(s, iov, cnt);
+	if(!res) {
+	    logg("!Connection closed while sending data\n");
+	    close(s);
+	    return 1;
+	}
+	if(res!=-1) {
+	    while(cnt && (size_t)res >= iov->iov_len) {
+		res -= iov->iov_len;
+		iov++;
+		cnt--;
+	    }
+	    if(cnt) {
+		iov->iov_base = (char *)iov->iov_base + res;
+		iov->iov_len -= res;
+	    }
+	    continue;
+	}
+	if(errno == EINTR)
+	    continue;
+	if(errno != EAGAIN && errno != EWOULDBLOCK) {
+	    strerror_print("!writev failed");
+	    close(s);
+	    return 1;
+	}
+
+	timeout = time(NULL) + TIMEOUT;
+	tv.tv_sec = TIMEOUT;
+	tv.tv_usec = 0;
+	while(1) {
+	    fd_set fds;
+
+	    FD_ZERO(&fds);
+	    FD_SET(s, &fds);
+	    res = select(s+1, NULL, &fds, NULL, &tv);
+	    if(res < 1) {
+		time_t now;
+
+		if (res == -1 && errno == EINTR && ((now = time(NULL)) < timeout)) {
+		    tv.tv_sec = timeout - now;
+		    tv.tv_usec = 0;
+		    continue;
+		}
+		logg("!Failed to stream to clamd\n");
+		close(s);
+		return 1;
+	    }
+	    break;
+	}
+    }
+    return 0;
+}
+
+
 int nc_sendmsg(int s, int fd) {
     struct iovec iov[1];
     struct msghdr msg;
@@ -221,19 +299,26 @@ int nc_sendmsg(int s, int fd) {
     return ret;
 }
 
-char *nc_recv(int s) {
-    char buf[128], *ret=NULL;
+/* Reads a reply up to maxlen bytes long, ending with term */
+static char *nc_recv_until(int s, unsigned int maxlen, const char *term) {
+    char *buf, *ret=NULL;
     time_t now, timeout = time(NULL) + readtimeout;
     struct timeval tv;
     fd_set fds;
     int res;
-    unsigned int len = 0;
+    unsigned int len = 0, tlen = strlen(term);
 
+    if(!(buf = (char *)malloc(maxlen + 1))) {
+	logg("!malloc(%u) failed\n", maxlen + 1);
+	close(s);
+	return NULL;
+    }
     while(1) {
 	now = time(NULL);
 	if(now >= timeout) {
 	    logg("!Timed out while reading clamd reply\n");
 	    close(s);
+	    free(buf);
 	    return NULL;
 	}
 	tv.tv_sec = timeout - now;
@@ -249,10 +334,11 @@ char *nc_recv(int s) {
 	    continue;
 	}
 
-	res = recv(s, &buf[len], sizeof(buf) - len, 0);
+	res = recv(s, &buf[len], maxlen - len, 0);
 	if(!res) {
 	    logg("!Connection closed while reading from socket\n");
 	    close(s);
+	    free(buf);
 	    return NULL;
 	}
 	if(res==-1) {
@@ -261,26 +347,28 @@ char *nc_recv(int s) {
 		continue;
 	    strerror_print("!recv failed after successful select");
 	    close(s);
+	    free(buf);
 	    return NULL;
 	}
 	len += res;
-	if(len && buf[len-1] == '\n') break;
-	if(len >= sizeof(buf)) {
+	if(len >= tlen && !memcmp(&buf[len - tlen], term, tlen)) break;
+	if(len >= maxlen) {
 	    logg("!Overlong reply from clamd\n");
 	    close(s);
+	    free(buf);
 	    return NULL;
 	}
     }
-    if(!(ret = (char *)malloc(len+1))) {
-	logg("!malloc(%d) failed\n", len+1);
-	close(s);
-	return NULL;
-    }
-    memcpy(ret, buf, len);
-    ret[len]='\0';
+    buf[len]='\0';
+    if(!(ret = (char *)realloc(buf, len+1)))
+	ret = buf;
     return ret;
 }
 
+char *nc_recv(int s) {
+    return nc_recv_until(s, 128, "\n");
+}
+
 
 int nc_connect_entry(struct CP_ENTRY *cpe) {
     int s = nc_socket(cpe);
@@ -306,8 +394,40 @@ void nc_ping_entry(struct CP_ENTRY *cpe) {
 }
 
 
-int nc_connect_rand(int *main, int *alt, int *local) {
-    struct CP_ENTRY *cpe = cpool_get_rand(main);
+/* Asks clamd how busy it is: threads at work plus queued jobs
+ * Returns 0 on success, the entry is marked dead otherwise */
+int nc_stats_entry(struct CP_ENTRY *cpe) {
+    int s = nc_connect_entry(cpe);
+    unsigned int live, idle, max, queue;
+    char *reply, *p;
+
+    if(s>=0) {
+	if(!nc_send(s, "nSTATS\n", 7) && (reply = nc_recv_until(s, 8192, "END\n"))) {
+	    close(s);
+	    if((p = strstr(reply, "THREADS: ")) && sscanf(p, "THREADS: live %u idle %u max %u", &live, &idle, &max) == 3 &&
+	       (p = strstr(reply, "QUEUE: ")) && sscanf(p, "QUEUE: %u", &queue) == 1) {
+		/* cpool_get() reads these under the pool lock */
+		pthread_mutex_lock(&cp->mutex);
+		cpe->load = (live > idle ? live - idle : 0) + queue;
+		cpe->threads = max;
+		pthread_mutex_unlock(&cp->mutex);
+		free(reply);
+		return 0;
+	    }
+	    logg("^Failed to parse the STATS reply from clamd\n");
+	    free(reply);
+	    return 0;
+	}
+    }
+    pthread_mutex_lock(&cp->mutex);
+    cpe->dead = 1;
+    pthread_mutex_unlock(&cp->mutex);
+    return 1;
+}
+
+
+int nc_connect_pool(int *main, int *alt, int *local, struct CP_ENTRY **pcpe) {
+    struct CP_ENTRY *cpe = cpool_get(main);
 
     if(!cpe) return 1;
     *local = (cpe->server->sa_family == AF_UNIX);
@@ -316,6 +436,7 @@ int nc_connect_rand(int *main, int *alt, int *local) {
 	if(cli_gentempfd(tempdir, &unlinkme, alt) != CL_SUCCESS) {
 	    logg("!Failed to create temporary file\n");
 	    close(*main);
+	    cpool_put(cpe, -1);
 	    return 1;
 	}
 	unlink(unlinkme);
@@ -323,16 +444,17 @@ int nc_connect_rand(int *main, int *alt, int *local) {
 	if(nc_send(*main, "nFILDES\n", 8)) {
 	    logg("!FD scan request failed\n");
 	    close(*alt);
-	    close(*main);
+	    cpool_put(cpe, -1);
 	    return 1;
 	}
     } else {
 	if(nc_send(*main, "nINSTREAM\n", 10)) {
 	    logg("!Failed to communicate with clamd\n");
-	    close(*main);
+	    cpool_put(cpe, -1);
 	    return 1;
 	}
     }
+    *pcpe = cpe;
     return 0;
 }
 
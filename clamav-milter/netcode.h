@@ -23,13 +23,16 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #include "shared/optparser.h"
 #include "connpool.h"
 
 void nc_ping_entry(struct CP_ENTRY *cpe);
-int nc_connect_rand(int *main, int *alt, int *local);
+int nc_stats_entry(struct CP_ENTRY *cpe);
+int nc_connect_pool(int *main, int *alt, int *local, struct CP_ENTRY **cpe);
 int nc_send(int s, const void *buf, size_t len);
+int nc_sendv(int s, struct iovec *iov, int cnt);
 char *nc_recv(int s);
 int nc_sendmsg(int s, int fd);
 int nc_connect_entry(struct CP_ENTRY *cpe);
@@ -70,6 +70,7 @@
 #include "others.h"
 #include "shared.h"
 #include "scanner.h"
+#include "uring.h"
 
 short debug_mode = 0, logok = 0;
 short foreground = 0;
@@ -428,6 +429,21 @@ int main(int argc, char **argv)
     cl_engine_set_clcb_hash(engine, hash_callback);
     detstats_clear();
 
+    if((opt = optget(opts, "TelemetryRecords"))->numarg) {
+	if(telemetry_init(opt->numarg)) {
+	    logg("!Can't allocate memory for %lld telemetry records\n", opt->numarg);
+	    ret = 1;
+	    break;
+	}
+	cl_engine_set_clcb_stats(engine, stats_callback);
+	logg("#Scan telemetry: keeping the last %lld records\n", opt->numarg);
+    }
+
+    if(optget(opts, "PerfCounters")->enabled) {
+	cl_counters_enable(1);
+	logg("#Performance counters enabled\n");
+    }
+
     if(optget(opts, "LeaveTemporaryFiles")->enabled)
 	cl_engine_set_num(engine, CL_ENGINE_KEEPTMP, 1);
 
@@ -495,6 +511,37 @@ int main(int argc, char **argv)
 	logg("#Max A-C depth set to %u\n", (unsigned int) opt->numarg);
     }
 
+    if(optget(opts,"DevBMLiteral")->enabled) {
+	logg("#Using the multi-literal matcher for static signatures.\n");
+	cl_engine_set_num(engine, CL_ENGINE_BM_LITERAL, 1);
+    }
+
+    if(optget(opts,"DevFmapMmap")->enabled || optget(opts,"DevFmapHugePages")->enabled) {
+	unsigned int fmapflags = 0;
+
+	if(optget(opts,"DevFmapMmap")->enabled) {
+	    logg("#Mapping the scanned files directly.\n");
+	    fmapflags |= CL_FMAP_MMAP;
+	}
+	if(optget(opts,"DevFmapHugePages")->enabled) {
+	    logg("#Using huge pages for the file maps.\n");
+	    fmapflags |= CL_FMAP_HUGEPAGES;
+	}
+	cl_engine_set_num(engine, CL_ENGINE_FMAP_FLAGS, fmapflags);
+    }
+
+    if((opt = optget(opts, "DevFmapReadahead"))->enabled) {
+	cl_engine_set_num(engine, CL_ENGINE_FMAP_READAHEAD, opt->numarg);
+	logg("#File map readahead set to %u bytes\n", (unsigned int) opt->numarg);
+    }
+
+    if(optget(opts, "IOUring")->enabled) {
+	if(uring_enable())
+	    logg("^io_uring is not available, scanned files will be read with pread()\n");
+	else
+	    logg("#Reading scanned files with io_uring.\n");
+    }
+
     if((ret = cl_load(dbdir, engine, &sigs, dboptions))) {
 	logg("!%s\n", cl_strerror(ret));
 	ret = 1;
@@ -591,6 +638,9 @@ int main(int argc, char **argv)
         foreground = 1;
 #endif
 
+    if(optget(opts, "LogAsync")->enabled && logg_async_start())
+	logg("^Can't start the log writer thread, logging synchronously\n");
+
     ret = recvloop_th(lsockets, nlsockets, engine, dboptions, opts);
 
     } while (0);
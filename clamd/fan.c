@@ -25,14 +25,17 @@
 #ifdef FANOTIFY
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/select.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <pthread.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 
 #include <linux/fanotify.h>
 #include "fan-syscalllib.h"
@@ -48,26 +51,152 @@
 #include "others.h"
 #include "scanner.h"
 
+/*
+ * The fanotify thread only reads the events and dispatches them to a pool
+ * of scanning threads. Events for a file that is already queued or being
+ * scanned wait for that scan's verdict instead of scanning it again, and
+ * files found clean are remembered by (dev, inode, mtime, ctime, size) so
+ * they can be allowed without being opened by libclamav at all. The kernel
+ * gets its answer as soon as the verdict is known.
+ */
+
+#define FAN_INFLIGHT_SIZE 256	/* buckets */
+#define FAN_CACHE_SIZE 4096	/* clean files remembered, direct mapped */
+#define FAN_QUEUE_PER_THREAD 64
+
+struct fan_event {
+    struct fan_event *next;
+    int fd;
+    uint64_t mask;
+};
+
+struct fan_job {
+    struct fan_job *next;	/* queue */
+    struct fan_job *hnext;	/* in-flight table */
+    STATBUF sb;
+    struct fan_event ev;
+    struct fan_event *waiters;	/* same file, arrived while in flight */
+};
+
+struct fan_cache_ent {
+    dev_t dev;
+    ino_t ino;
+    time_t mtime, ctime;
+    off_t size;
+};
+
+struct fan_pool {
+    pthread_mutex_t mutex;
+    pthread_cond_t work, space;
+    struct fan_job *qhead, **qtail;
+    unsigned int queued, max_queued;
+    struct fan_job *inflight[FAN_INFLIGHT_SIZE];
+    struct fan_cache_ent cache[FAN_CACHE_SIZE];
+    int stop;
+    int fan_fd;
+    int extinfo;
+    struct thrarg *tharg;
+    pthread_t *workers;
+    unsigned int nworkers;
+};
+
+static volatile sig_atomic_t fan_stopping;
+
 static void fan_exit(int sig)
 {
-
+    if(sig == SIGUSR1) {
+	/* noticed by pselect() in fan_th() */
+	fan_stopping = 1;
+	return;
+    }
     logg("*ScanOnAccess: fan_exit(), signal %d\n", sig);
     pthread_exit(NULL);
-    logg("ScanOnAccess: stopped\n");
 }
 
-static int fan_scanfile(int fan_fd, const char *fname, struct fanotify_event_metadata *fmd, int scan, int extinfo, struct thrarg *tharg)
+static const char *fan_fname(int fd, char *fname, size_t len)
+{
+	char path[32];
+	ssize_t l;
+
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    if((l = readlink(path, fname, len - 1)) == -1)
+	return NULL;
+    fname[l] = 0;
+    return fname;
+}
+
+static void fan_respond(int fan_fd, int fd, uint64_t mask, uint32_t response)
 {
 	struct fanotify_response res;
+
+    if(mask & FAN_ALL_PERM_EVENTS) {
+	res.fd = fd;
+	res.response = response;
+	if(write(fan_fd, &res, sizeof(res)) == -1)
+	    logg("!ScanOnAccess: Internal error (can't write to fanotify)\n");
+    }
+    if(close(fd) == -1)
+	logg("!ScanOnAccess: Internal error (close(%d) failed)\n", fd);
+}
+
+static inline unsigned int fan_hash(dev_t dev, ino_t ino)
+{
+    uint64_t h = ((uint64_t) dev << 32) ^ (uint64_t) ino;
+
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    return (unsigned int) (h ^ (h >> 32));
+}
+
+/* pool->mutex held */
+static int fan_cache_check(struct fan_pool *pool, const STATBUF *sb)
+{
+	const struct fan_cache_ent *ent = &pool->cache[fan_hash(sb->st_dev, sb->st_ino) % FAN_CACHE_SIZE];
+
+    return ent->ino == sb->st_ino && ent->dev == sb->st_dev && ent->mtime == sb->st_mtime &&
+	ent->ctime == sb->st_ctime && ent->size == sb->st_size;
+}
+
+/* pool->mutex held */
+static void fan_cache_add(struct fan_pool *pool, const STATBUF *sb, time_t started)
+{
+	struct fan_cache_ent *ent = &pool->cache[fan_hash(sb->st_dev, sb->st_ino) % FAN_CACHE_SIZE];
+
+    /* changed while, or just before, it was scanned: the times alone won't
+     * tell the next change */
+    if(sb->st_ctime >= started || sb->st_mtime >= started)
+	return;
+    ent->dev = sb->st_dev;
+    ent->ino = sb->st_ino;
+    ent->mtime = sb->st_mtime;
+    ent->ctime = sb->st_ctime;
+    ent->size = sb->st_size;
+}
+
+/* pool->mutex held */
+static struct fan_job **fan_inflight(struct fan_pool *pool, const STATBUF *sb)
+{
+	struct fan_job **jp = &pool->inflight[fan_hash(sb->st_dev, sb->st_ino) % FAN_INFLIGHT_SIZE];
+
+    while(*jp && ((*jp)->sb.st_ino != sb->st_ino || (*jp)->sb.st_dev != sb->st_dev))
+	jp = &(*jp)->hnext;
+    return jp;
+}
+
+/* returns FAN_ALLOW or FAN_DENY */
+static uint32_t fan_scanfile(int fd, int extinfo, struct thrarg *tharg)
+{
 	struct cb_context context;
 	const char *virname;
-	int ret = 0;
+	char fname[1024];
 
-    res.fd = fmd->fd;
-    res.response = FAN_ALLOW;
+    if(!fan_fname(fd, fname, sizeof(fname))) {
+	logg("!ScanOnAccess: Internal error (readlink() failed)\n");
+	return FAN_ALLOW;
+    }
     context.filename = fname;
     context.virsize = 0;
-    if(scan && cl_scandesc_callback(fmd->fd, &virname, NULL, tharg->engine, tharg->options, &context) == CL_VIRUS) {
+    if(cl_scandesc_context(fd, &virname, NULL, tharg->engine, tharg->options, &context, scan_context()) == CL_VIRUS) {
 	if(context.virsize)
 	    detstats_add(virname, fname, context.virsize, context.virhash);
 	if(extinfo && context.virsize)
@@ -75,40 +204,214 @@ static int fan_scanfile(int fan_fd, const char *fname, struct fanotify_event_met
 	else
 	    logg("ScanOnAccess: %s: %s FOUND\n", fname, virname);
 	virusaction(fname, virname, tharg->opts);
-	res.response = FAN_DENY;
+	return FAN_DENY;
     }
+    return FAN_ALLOW;
+}
 
-    if(fmd->mask & FAN_ALL_PERM_EVENTS) {
-	ret = write(fan_fd, &res, sizeof(res));
-	if(ret == -1)
-	    logg("!ScanOnAccess: Internal error (can't write to fanotify)\n");
+static void *fan_worker(void *arg)
+{
+	struct fan_pool *pool = arg;
+	struct fan_job *job, **jp;
+	struct fan_event *ev;
+	uint32_t response;
+	time_t started;
+
+    pthread_mutex_lock(&pool->mutex);
+    while(1) {
+	while(!pool->qhead && !pool->stop)
+	    pthread_cond_wait(&pool->work, &pool->mutex);
+	if(pool->stop)
+	    break;
+	job = pool->qhead;
+	if(!(pool->qhead = job->next))
+	    pool->qtail = &pool->qhead;
+	pool->queued--;
+	pthread_cond_signal(&pool->space);
+	pthread_mutex_unlock(&pool->mutex);
+
+	time(&started);
+	response = fan_scanfile(job->ev.fd, pool->extinfo, pool->tharg);
+
+	pthread_mutex_lock(&pool->mutex);
+	jp = fan_inflight(pool, &job->sb);
+	*jp = job->hnext;
+	if(response == FAN_ALLOW)
+	    fan_cache_add(pool, &job->sb, started);
+	pthread_mutex_unlock(&pool->mutex);
+
+	fan_respond(pool->fan_fd, job->ev.fd, job->ev.mask, response);
+	while((ev = job->waiters)) {
+	    job->waiters = ev->next;
+	    fan_respond(pool->fan_fd, ev->fd, ev->mask, response);
+	    free(ev);
+	}
+	free(job);
+
+	pthread_mutex_lock(&pool->mutex);
     }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
 
-    return ret;
+static struct fan_pool *fan_pool_init(int fan_fd, unsigned int threads, int extinfo, struct thrarg *tharg)
+{
+	struct fan_pool *pool;
+	unsigned int i;
+
+    if(!(pool = calloc(1, sizeof(*pool))))
+	return NULL;
+    if(!(pool->workers = calloc(threads, sizeof(*pool->workers)))) {
+	free(pool);
+	return NULL;
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->space, NULL);
+    pool->qtail = &pool->qhead;
+    pool->max_queued = threads * FAN_QUEUE_PER_THREAD;
+    pool->fan_fd = fan_fd;
+    pool->extinfo = extinfo;
+    pool->tharg = tharg;
+    /* the workers inherit our signal mask, SIGUSR1 is blocked */
+    for(i = 0; i < threads; i++) {
+	if(pthread_create(&pool->workers[i], NULL, fan_worker, pool))
+	    break;
+	pool->nworkers++;
+    }
+    if(!pool->nworkers) {
+	pthread_cond_destroy(&pool->space);
+	pthread_cond_destroy(&pool->work);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->workers);
+	free(pool);
+	return NULL;
+    }
+    if(pool->nworkers < threads)
+	logg("^ScanOnAccess: Only %u of %u scanning threads could be started\n", pool->nworkers, threads);
+    return pool;
+}
+
+static void fan_pool_free(struct fan_pool *pool)
+{
+	struct fan_job *job;
+	struct fan_event *ev;
+	unsigned int i;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->mutex);
+    for(i = 0; i < pool->nworkers; i++)
+	pthread_join(pool->workers[i], NULL);
+
+    /* don't leave anybody blocked in open() */
+    while((job = pool->qhead)) {
+	pool->qhead = job->next;
+	fan_respond(pool->fan_fd, job->ev.fd, job->ev.mask, FAN_ALLOW);
+	while((ev = job->waiters)) {
+	    job->waiters = ev->next;
+	    fan_respond(pool->fan_fd, ev->fd, ev->mask, FAN_ALLOW);
+	    free(ev);
+	}
+	free(job);
+    }
+    pthread_cond_destroy(&pool->space);
+    pthread_cond_destroy(&pool->work);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->workers);
+    free(pool);
+}
+
+/* takes care of fmd->fd */
+static void fan_dispatch(struct fan_pool *pool, const struct fanotify_event_metadata *fmd, int sizelimit)
+{
+	struct fan_job *job, **jp;
+	struct fan_event *ev;
+	STATBUF sb;
+	char fname[1024];
+
+    if(fmd->pid == getpid()) {
+	/* the workers' own accesses (temporary files, databases): they can't
+	 * wait for a worker, and the reader blocks below when the queue is
+	 * full */
+	fan_respond(pool->fan_fd, fmd->fd, fmd->mask, FAN_ALLOW);
+	return;
+    }
+    if(fan_checkowner(fmd->pid, pool->tharg->opts)) {
+	logg("*ScanOnAccess: %s skipped (excluded UID)\n", fan_fname(fmd->fd, fname, sizeof(fname)) ? fname : "?");
+	fan_respond(pool->fan_fd, fmd->fd, fmd->mask, FAN_ALLOW);
+	return;
+    }
+    if(FSTAT(fmd->fd, &sb) != 0 || (sizelimit && sb.st_size > sizelimit)) {
+	/* logg("*ScanOnAccess: %s skipped (size > %d)\n", fname, sizelimit); */
+	fan_respond(pool->fan_fd, fmd->fd, fmd->mask, FAN_ALLOW);
+	return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    if(fan_cache_check(pool, &sb)) {
+	pthread_mutex_unlock(&pool->mutex);
+	fan_respond(pool->fan_fd, fmd->fd, fmd->mask, FAN_ALLOW);
+	return;
+    }
+    jp = fan_inflight(pool, &sb);
+    if((job = *jp)) {
+	/* already on its way, share the verdict */
+	if((ev = malloc(sizeof(*ev)))) {
+	    ev->fd = fmd->fd;
+	    ev->mask = fmd->mask;
+	    ev->next = job->waiters;
+	    job->waiters = ev;
+	    pthread_mutex_unlock(&pool->mutex);
+	    return;
+	}
+    } else if((job = calloc(1, sizeof(*job)))) {
+	/* a permission event is never answered before it is scanned: with
+	 * the queue full the reader waits for a worker */
+	while(pool->queued >= pool->max_queued)
+	    pthread_cond_wait(&pool->space, &pool->mutex);
+	memcpy(&job->sb, &sb, sizeof(sb));
+	job->ev.fd = fmd->fd;
+	job->ev.mask = fmd->mask;
+	/* the table may have changed while we waited */
+	jp = fan_inflight(pool, &sb);
+	job->hnext = *jp;
+	*jp = job;
+	*pool->qtail = job;
+	pool->qtail = &job->next;
+	pool->queued++;
+	pthread_cond_signal(&pool->work);
+	pthread_mutex_unlock(&pool->mutex);
+	return;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    /* out of memory, do it here */
+    fan_respond(pool->fan_fd, fmd->fd, fmd->mask, fan_scanfile(fmd->fd, pool->extinfo, pool->tharg));
 }
 
 void *fan_th(void *arg)
 {
 	struct thrarg *tharg = (struct thrarg *) arg;
-	sigset_t sigset;
+	sigset_t sigset, waitset;
         struct sigaction act;
 	const struct optstruct *pt;
-	short int scan;
 	int sizelimit = 0, extinfo;
-	STATBUF sb;
         uint64_t fan_mask = FAN_ACCESS | FAN_EVENT_ON_CHILD;
 	int fan_fd;
         fd_set rfds;
 	char buf[4096];
 	ssize_t bread;
 	struct fanotify_event_metadata *fmd;
-	char fname[1024];
-	int ret, len;
+	struct fan_pool *pool;
+	unsigned int threads;
+	int ret;
 	char err[128];
 
-    /* ignore all signals except SIGUSR1 */
+    /* block all signals, SIGUSR1 is only let in while waiting for events */
+    fan_stopping = 0;
     sigfillset(&sigset);
-    sigdelset(&sigset, SIGUSR1);
     /* The behavior of a process is undefined after it ignores a 
      * SIGFPE, SIGILL, SIGSEGV, or SIGBUS signal */
     sigdelset(&sigset, SIGFPE);
@@ -118,13 +421,21 @@ void *fan_th(void *arg)
     sigdelset(&sigset, SIGBUS);
 #endif
     pthread_sigmask(SIG_SETMASK, &sigset, NULL);
+    memcpy(&waitset, &sigset, sizeof(sigset));
+    sigdelset(&waitset, SIGUSR1);
     memset(&act, 0, sizeof(struct sigaction));
     act.sa_handler = fan_exit;
     sigfillset(&(act.sa_mask));
     sigaction(SIGUSR1, &act, NULL);
     sigaction(SIGSEGV, &act, NULL);
 
-    fan_fd = fanotify_init(0, O_RDONLY);
+    if(optget(tharg->opts, "OnAccessPrevention")->enabled) {
+	/* the process waits in open() until we answer */
+	fan_mask = FAN_OPEN_PERM | FAN_EVENT_ON_CHILD;
+	fan_fd = fanotify_init(FAN_CLASS_CONTENT, O_RDONLY);
+    } else {
+	fan_fd = fanotify_init(FAN_CLASS_NOTIF, O_RDONLY);
+    }
     if(fan_fd < 0) {
 	logg("!ScanOnAccess: fanotify_init failed: %s\n", cli_strerror(errno, err, sizeof(err)));
 	if(errno == EPERM)
@@ -136,6 +447,7 @@ void *fan_th(void *arg)
 	while(pt) {
 	    if(fanotify_mark(fan_fd, FAN_MARK_ADD, fan_mask, fan_fd, pt->strarg) != 0) {
 		logg("!ScanOnAccess: Can't include path '%s'\n", pt->strarg);
+		close(fan_fd);
 		return NULL;
 	    } else
 		logg("ScanOnAccess: Protecting directory '%s'\n", pt->strarg);
@@ -143,6 +455,7 @@ void *fan_th(void *arg)
 	}
     } else {
 	logg("!ScanOnAccess: Please specify at least one path with OnAccessIncludePath\n");
+	close(fan_fd);
 	return NULL;
     }
 
@@ -150,6 +463,7 @@ void *fan_th(void *arg)
 	while(pt) {
             if(fanotify_mark(fan_fd, FAN_MARK_REMOVE, fan_mask, fan_fd, pt->strarg) != 0) {
 		logg("!ScanOnAccess: Can't exclude path %s\n", pt->strarg);
+		close(fan_fd);
 		return NULL;
 	    } else
 		logg("ScanOnAccess: Excluded path %s\n", pt->strarg);
@@ -165,59 +479,45 @@ void *fan_th(void *arg)
 
     extinfo = optget(tharg->opts, "ExtendedDetectionInfo")->enabled;
 
-    FD_ZERO(&rfds);
-    FD_SET(fan_fd, &rfds);
-    do {
-        ret = select(fan_fd + 1, &rfds, NULL, NULL, NULL);
-    } while(ret == -1 && errno == EINTR);
+    threads = optget(tharg->opts, "OnAccessScanThreads")->numarg;
+    if(!threads)
+	threads = 1;
+    if(!(pool = fan_pool_init(fan_fd, threads, extinfo, tharg))) {
+	logg("!ScanOnAccess: Can't start the scanning threads\n");
+	close(fan_fd);
+	return NULL;
+    }
+    logg("ScanOnAccess: Using %u scanning threads\n", pool->nworkers);
+
+    while(!fan_stopping) {
+	FD_ZERO(&rfds);
+	FD_SET(fan_fd, &rfds);
+	ret = pselect(fan_fd + 1, &rfds, NULL, NULL, NULL, &waitset);
+	if(ret == -1) {
+	    if(errno == EINTR)
+		continue;
+	    logg("!ScanOnAccess: Internal error (select() failed)\n");
+	    break;
+	}
 
-    while((bread = read(fan_fd, buf, sizeof(buf))) > 0) {
+	if((bread = read(fan_fd, buf, sizeof(buf))) <= 0) {
+	    if(bread < 0 && errno == EINTR)
+		continue;
+	    if(bread < 0)
+		logg("!ScanOnAccess: Internal error (failed to read data)\n");
+	    break;
+	}
 	fmd = (struct fanotify_event_metadata *) buf;
 	while(FAN_EVENT_OK(fmd, bread)) {
-	    scan = 1;
-	    if(fmd->fd >= 0) {
-		sprintf(fname, "/proc/self/fd/%d", fmd->fd);
-		len = readlink(fname, fname, sizeof(fname) - 1);
-		if(len == -1) {
-		    close(fmd->fd);
-		    logg("!ScanOnAccess: Internal error (readlink() failed)\n");
-		    return NULL;
-		}
-		fname[len] = 0;
-
-		if(fan_checkowner(fmd->pid, tharg->opts)) {
-		    scan = 0;
-		    logg("*ScanOnAccess: %s skipped (excluded UID)\n", fname);
-		}
-
-		if(sizelimit) {
-		    if(FSTAT(fmd->fd, &sb) != 0 || sb.st_size > sizelimit) {
-			scan = 0;
-			/* logg("*ScanOnAccess: %s skipped (size > %d)\n", fname, sizelimit); */
-		    }
-		}
-
-		if(fan_scanfile(fan_fd, fname, fmd, scan, extinfo, tharg) == -1) {
-		    close(fmd->fd);
-		    return NULL;
-		}
-
-		if(close(fmd->fd) == -1) {
-		    printf("!ScanOnAccess: Internal error (close(%d) failed)\n", fmd->fd);
-		    close(fmd->fd);
-		    return NULL;
-		}
-	    }
+	    if(fmd->fd >= 0)
+		fan_dispatch(pool, fmd, sizelimit);
 	    fmd = FAN_EVENT_NEXT(fmd, bread);
 	}
-	do {
-	    ret = select(fan_fd + 1, &rfds, NULL, NULL, NULL);
-	} while(ret == -1 && errno == EINTR);
     }
 
-    if(bread < 0)
-	logg("!ScanOnAccess: Internal error (failed to read data)\n");
-
+    fan_pool_free(pool);
+    close(fan_fd);
+    logg("ScanOnAccess: stopped\n");
     return NULL;
 }
 
@@ -276,7 +576,7 @@ static int cauth_scanfile(const char *fname, int extinfo, struct thrarg *tharg)
     if(fd == -1)
 	return -1;
 
-    if(cl_scandesc_callback(fd, &virname, NULL, tharg->engine, tharg->options, &context) == CL_VIRUS) {
+    if(cl_scandesc_context(fd, &virname, NULL, tharg->engine, tharg->options, &context, scan_context()) == CL_VIRUS) {
 	if(context.virsize)
 	    detstats_add(virname, fname, context.virsize, context.virhash);
 	if(extinfo && context.virsize)
@@ -76,6 +76,7 @@
 
 static pthread_mutex_t virusaction_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t detstats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t telemetry_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static void xfree(void *p)
 {
@@ -864,6 +865,130 @@ detstats_print (int desc, char term)
     pthread_mutex_unlock (&detstats_lock);
 }
 
+struct telemetry_s
+{
+    struct cl_scan_stats stats;
+    long queue_wait;
+    unsigned int time;
+    int result;
+};
+static struct telemetry_s *telemetry_data = NULL;
+static unsigned int telemetry_max = 0, telemetry_idx = 0, telemetry_total = 0;
+static unsigned long long telemetry_cache_hits = 0, telemetry_cache_misses = 0;
+static unsigned long long telemetry_queue_wait = 0;
+static long telemetry_queue_wait_max = 0;
+
+int
+telemetry_init (unsigned int records)
+{
+    struct telemetry_s *data = NULL;
+
+    if (records && !(data = calloc (records, sizeof (*data))))
+        return -1;
+    pthread_mutex_lock (&telemetry_lock);
+    xfree (telemetry_data);
+    telemetry_data = data;
+    telemetry_max = records;
+    telemetry_idx = telemetry_total = 0;
+    telemetry_cache_hits = telemetry_cache_misses = 0;
+    telemetry_queue_wait = 0;
+    telemetry_queue_wait_max = 0;
+    pthread_mutex_unlock (&telemetry_lock);
+    return 0;
+}
+
+void
+telemetry_add (const struct cl_scan_stats *stats, int result, long queue_wait)
+{
+    struct telemetry_s *t;
+
+    pthread_mutex_lock (&telemetry_lock);
+    if (!telemetry_max)
+    {
+        pthread_mutex_unlock (&telemetry_lock);
+        return;
+    }
+    t = &telemetry_data[telemetry_idx++];
+    memcpy (&t->stats, stats, sizeof (t->stats));
+    t->queue_wait = queue_wait;
+    t->result = result;
+    t->time = time (NULL);
+    if (telemetry_idx == telemetry_max)
+        telemetry_idx = 0;
+    telemetry_total++;
+    telemetry_cache_hits += stats->cache_hits;
+    telemetry_cache_misses += stats->cache_misses;
+    telemetry_queue_wait += queue_wait;
+    if (queue_wait > telemetry_queue_wait_max)
+        telemetry_queue_wait_max = queue_wait;
+    pthread_mutex_unlock (&telemetry_lock);
+}
+
+/* one JSON object per line, oldest first, followed by a summary object */
+void
+telemetry_print (int desc, char term)
+{
+    unsigned int i, j, n, first, last;
+    const struct telemetry_s *t;
+    char roots[CL_STATS_ROOTS * 21 + 3], *p;
+    unsigned long long lookups;
+
+    pthread_mutex_lock (&telemetry_lock);
+    n = telemetry_total < telemetry_max ? telemetry_total : telemetry_max;
+    first = telemetry_total < telemetry_max ? 0 : telemetry_idx;
+    for (i = 0; i < n; i++)
+    {
+        t = &telemetry_data[(first + i) % telemetry_max];
+        for (last = CL_STATS_ROOTS; last > 1 && !t->stats.bytes_root[last - 1]; last--);
+        p = roots;
+        *p++ = '[';
+        for (j = 0; j < last; j++)
+            p += sprintf (p, "%s%llu", j ? "," : "", t->stats.bytes_root[j]);
+        *p++ = ']';
+        *p = '\0';
+        mdprintf (desc, "{\"time\":%u,\"result\":\"%s\",\"queue_wait_us\":%ld,"
+                  "\"total_us\":%llu,\"filetype_us\":%llu,\"cache_us\":%llu,"
+                  "\"raw_us\":%llu,\"container_us\":%llu,\"bytecode_us\":%llu,"
+                  "\"files\":%u,\"cache_hits\":%u,\"cache_misses\":%u,"
+                  "\"bytes_root\":%s}%c",
+                  t->time, t->result == CL_VIRUS ? "virus" : (t->result == CL_CLEAN ? "clean" : "error"),
+                  t->queue_wait, t->stats.time_total, t->stats.time_filetype,
+                  t->stats.time_cache, t->stats.time_raw, t->stats.time_container,
+                  t->stats.time_bytecode, t->stats.files, t->stats.cache_hits,
+                  t->stats.cache_misses, roots, term);
+    }
+    lookups = telemetry_cache_hits + telemetry_cache_misses;
+    mdprintf (desc, "{\"summary\":{\"scans\":%u,\"records\":%u,\"cache_hits\":%llu,"
+              "\"cache_misses\":%llu,\"cache_hit_ratio\":%.4f,"
+              "\"queue_wait_avg_us\":%llu,\"queue_wait_max_us\":%ld}}%c",
+              telemetry_total, n, telemetry_cache_hits, telemetry_cache_misses,
+              lookups ? (double) telemetry_cache_hits / lookups : 0.0,
+              telemetry_total ? telemetry_queue_wait / telemetry_total : 0,
+              telemetry_queue_wait_max, term);
+    pthread_mutex_unlock (&telemetry_lock);
+}
+
+void
+counters_print (int desc, char term)
+{
+    unsigned long long val[CL_COUNTER_LAST];
+    unsigned int i, n;
+
+    if (!cl_counters_enabled ())
+    {
+        mdprintf (desc, "COUNTERS: disabled\nEND%c", term);
+        return;
+    }
+    n = cl_counters_get (val, CL_COUNTER_LAST);
+    mdprintf (desc, "COUNTERS: enabled\n");
+    for (i = 0; i < n; i++)
+        mdprintf (desc, "%s: %llu\n", cl_counter_name (i), val[i]);
+    mdprintf (desc, "filter_reject_ratio: %.4f\nEND%c",
+              val[CL_COUNTER_FILTER_CALLS] ?
+              (double) val[CL_COUNTER_FILTER_REJECTS] / val[CL_COUNTER_FILTER_CALLS] : 0.0,
+              term);
+}
+
 #ifdef FANOTIFY
 int
 fan_checkowner (int pid, const struct optstruct *opts)
@@ -86,6 +86,12 @@ void detstats_clear(void);
 void detstats_add(const char *virname, const char *fname, unsigned int fsize, const char *md5);
 void detstats_print(int desc, char term);
 
+struct cl_scan_stats;
+int telemetry_init(unsigned int records);
+void telemetry_add(const struct cl_scan_stats *stats, int result, long queue_wait);
+void telemetry_print(int desc, char term);
+void counters_print(int desc, char term);
+
 #ifdef FANOTIFY
 int fan_checkowner(int pid, const struct optstruct *opts);
 #endif
@@ -27,6 +27,7 @@
 #include <string.h>
 #ifdef	HAVE_UNISTD_H
 #include <unistd.h>
+#include <fcntl.h>
 #endif
 #include <errno.h>
 #include <sys/stat.h>
@@ -59,6 +60,7 @@
 
 #include "others.h"
 #include "scanner.h"
+#include "uring.h"
 #include "shared.h"
 #include "thrmgr.h"
 #include "server.h"
@@ -102,6 +104,59 @@ void hash_callback(int fd, unsigned long long size, const unsigned char *md5, co
     c->virhash[32] = '\0';
 }
 
+void stats_callback(const struct cl_scan_stats *stats, cl_error_t result, void *ctx)
+{
+    telemetry_add(stats, result, thrmgr_queue_wait());
+}
+
+static pthread_key_t sctx_key;
+static pthread_once_t sctx_key_once = PTHREAD_ONCE_INIT;
+
+static void sctx_destroy(void *sctx)
+{
+    cl_scan_context_free(sctx);
+}
+
+static void sctx_key_alloc(void)
+{
+    pthread_key_create(&sctx_key, sctx_destroy);
+}
+
+/* every scanning thread keeps its own scan context until it exits; NULL
+ * (scan without one) if it can't be allocated */
+struct cl_scan_context *scan_context(void)
+{
+	struct cl_scan_context *sctx;
+
+    pthread_once(&sctx_key_once, sctx_key_alloc);
+    if(!(sctx = pthread_getspecific(sctx_key)) && (sctx = cl_scan_context_new())) {
+	if(pthread_setspecific(sctx_key, sctx)) {
+	    cl_scan_context_free(sctx);
+	    sctx = NULL;
+	}
+    }
+    return sctx;
+}
+
+/* cl_scanfile_context(), reading the file through io_uring with IOUring */
+static int scanfile(const char *filename, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int options, void *context)
+{
+	cl_fmap_t *map;
+	int fd, ret;
+
+    if(!uring_enabled() || (fd = open(filename, O_RDONLY)) == -1)
+	return cl_scanfile_context(filename, virname, scanned, engine, options, context, scan_context());
+
+    if((map = uring_fmap(fd))) {
+	ret = cl_scanmap_context(map, virname, scanned, engine, options, context, scan_context());
+	uring_funmap(map);
+    } else {
+	ret = cl_scandesc_context(fd, virname, scanned, engine, options, context, scan_context());
+    }
+    close(fd);
+    return ret;
+}
+
 #define BUFFSIZE 1024
 int scan_callback(STATBUF *sb, char *filename, const char *msg, enum cli_ftw_reason reason, struct cli_ftw_cbdata *data)
 {
@@ -228,7 +283,7 @@ int scan_callback(STATBUF *sb, char *filename, const char *msg, enum cli_ftw_rea
     thrmgr_setactivetask(filename, NULL);
     context.filename = filename;
     context.virsize = 0;
-    ret = cl_scanfile_callback(filename, virpp, &scandata->scanned, scandata->engine, scandata->options, &context);
+    ret = scanfile(filename, virpp, &scandata->scanned, scandata->engine, scandata->options, &context);
     thrmgr_setactivetask(NULL, NULL);
 
     if (scandata->options & CL_SCAN_ALLMATCHES) {
@@ -362,7 +417,7 @@ int scanfd(const client_conn_t *conn, unsigned long int *scanned,
 	thrmgr_setactivetask(fdstr, NULL);
 	context.filename = fdstr;
 	context.virsize = 0;
-	ret = cl_scandesc_callback(fd, &virname, scanned, engine, options, &context);
+	ret = cl_scandesc_context(fd, &virname, scanned, engine, options, &context, scan_context());
 	thrmgr_setactivetask(NULL, NULL);
 
 	if (thrmgr_group_need_terminate(conn->group)) {
@@ -527,7 +582,7 @@ int scanstream(int odesc, unsigned long int *scanned, const struct cl_engine *en
 	thrmgr_setactivetask(peer_addr, NULL);
 	context.filename = peer_addr;
 	context.virsize = 0;
-	ret = cl_scandesc_callback(tmpd, &virname, scanned, engine, options, &context);
+	ret = cl_scandesc_context(tmpd, &virname, scanned, engine, options, &context, scan_context());
 	thrmgr_setactivetask(NULL, NULL);
     } else {
     	ret = -1;
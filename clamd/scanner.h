@@ -62,6 +62,8 @@ int scanstream(int odesc, unsigned long int *scanned, const struct cl_engine *en
 int scan_callback(STATBUF *sb, char *filename, const char *msg, enum cli_ftw_reason reason, struct cli_ftw_cbdata *data);
 int scan_pathchk(const char *path, struct cli_ftw_cbdata *data);
 void hash_callback(int fd, unsigned long long size, const unsigned char *md5, const char *virname, void *ctx);
+void stats_callback(const struct cl_scan_stats *stats, cl_error_t result, void *ctx);
 void msg_callback(enum cl_msg severity, const char *fullmsg, const char *msg, void *ctx);
+struct cl_scan_context *scan_context(void);
 
 #endif
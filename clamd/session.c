@@ -95,7 +95,10 @@ static struct {
     {CMD17, sizeof(CMD17)-1,	COMMAND_INSTREAM,   0,	0, 1},
     {CMD19, sizeof(CMD19)-1,	COMMAND_DETSTATSCLEAR,	0, 1, 1},
     {CMD20, sizeof(CMD20)-1,	COMMAND_DETSTATS,   0, 1, 1},
-    {CMD21, sizeof(CMD21)-1,	COMMAND_ALLMATCHSCAN,  1, 0, 1}
+    {CMD21, sizeof(CMD21)-1,	COMMAND_ALLMATCHSCAN,  1, 0, 1},
+    {CMD22, sizeof(CMD22)-1,	COMMAND_TELEMETRY,  0, 0, 1},
+    {CMD23, sizeof(CMD23)-1,	COMMAND_COUNTERSCLEAR,	0, 0, 1},
+    {CMD24, sizeof(CMD24)-1,	COMMAND_COUNTERS,   0, 0, 1}
 };
 
 enum commands parse_command(const char *cmd, const char **argument, int oldstyle)
@@ -382,7 +385,11 @@ int command(client_conn_t *conn, int *virus)
 	 if(STAT(conn->filename, &sb) == 0)
 	     scandata.dev = sb.st_dev;
 
-     ret = cli_ftw(conn->filename, flags,  maxdirrec ? maxdirrec : INT_MAX, scan_callback, &data, scan_pathchk);
+     if (type == TYPE_MULTISCAN)
+	 ret = cli_ftw_mt(conn->filename, flags | CLI_FTW_READAHEAD, maxdirrec ? maxdirrec : INT_MAX,
+			  optget(opts, "MultiscanWalkThreads")->numarg, scan_callback, &data, scan_pathchk);
+     else
+	 ret = cli_ftw(conn->filename, flags,  maxdirrec ? maxdirrec : INT_MAX, scan_callback, &data, scan_pathchk);
      if (ret == CL_EMEM) {
 	 if(optget(opts, "ExitOnOOM")->enabled)
 	     return -1;
@@ -599,6 +606,21 @@ int execute_or_dispatch_command(client_conn_t *conn, enum commands cmd, const ch
 		detstats_print(desc, conn->term);
 		return 1;
 	    }
+	case COMMAND_TELEMETRY:
+	    {
+		telemetry_print(desc, conn->term);
+		return 1;
+	    }
+	case COMMAND_COUNTERSCLEAR:
+	    {
+		cl_counters_reset();
+		return 1;
+	    }
+	case COMMAND_COUNTERS:
+	    {
+		counters_print(desc, conn->term);
+		return 1;
+	    }
 	case COMMAND_INSTREAM:
 	    {
 		int rc = cli_gentempfd(optget(conn->opts, "TemporaryDirectory")->strarg, &conn->filename, &conn->scanfd);
@@ -44,6 +44,9 @@
 #define CMD20 "DETSTATS"
 
 #define CMD21 "ALLMATCHSCAN"
+#define CMD22 "TELEMETRY"
+#define CMD23 "COUNTERSCLEAR"
+#define CMD24 "COUNTERS"
 
 #include "libclamav/clamav.h"
 #include "shared/optparser.h"
@@ -70,6 +73,9 @@ enum commands {
     COMMAND_COMMANDS,
     COMMAND_DETSTATSCLEAR,
     COMMAND_DETSTATS,
+    COMMAND_TELEMETRY,
+    COMMAND_COUNTERSCLEAR,
+    COMMAND_COUNTERS,
     /* internal commands */
     COMMAND_MULTISCANFILE,
     COMMAND_INSTREAMSCAN,
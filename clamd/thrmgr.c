@@ -88,7 +88,7 @@ static int work_queue_add(work_queue_t *work_q, void *data)
 	return TRUE;
 }
 
-static void *work_queue_pop(work_queue_t *work_q)
+static void *work_queue_pop(work_queue_t *work_q, struct timeval *time_queued)
 {
 	work_item_t *work_item;
 	void *data;
@@ -98,6 +98,7 @@ static void *work_queue_pop(work_queue_t *work_q)
 	}
 	work_item = work_q->head;
 	data = work_item->data;
+	*time_queued = work_item->time_queued;
 	work_q->head = work_item->next;
 	if (work_q->head == NULL) {
 		work_q->tail = NULL;
@@ -525,6 +526,14 @@ void thrmgr_setactiveengine(const struct cl_engine *engine)
 	desc->engine = engine;
 }
 
+long thrmgr_queue_wait(void)
+{
+	struct task_desc *desc;
+	pthread_once(&stats_tls_key_once, stats_tls_key_alloc);
+	desc = pthread_getspecific(stats_tls_key);
+	return desc ? desc->queue_wait : 0;
+}
+
 /* thread pool mutex must be held on entry */
 static void stats_init(threadpool_t *pool)
 {
@@ -581,6 +590,8 @@ static void *thrmgr_pop(threadpool_t *pool)
     void *task;
     work_queue_t *first, *second;
     int ratio;
+    struct timeval tv_queued;
+    struct task_desc *desc;
 
     if (pool->single_queue->popped < SINGLE_BULK_RATIO) {
 	first = pool->single_queue;
@@ -592,18 +603,25 @@ static void *thrmgr_pop(threadpool_t *pool)
 	ratio = SINGLE_BULK_SUM - SINGLE_BULK_RATIO;
     }
 
-    task = work_queue_pop(first);
+    task = work_queue_pop(first, &tv_queued);
     if (task) {
 	if (++first->popped == ratio)
 	    second->popped = 0;
     } else {
-	task = work_queue_pop(second);
+	task = work_queue_pop(second, &tv_queued);
 	if (task) {
 	    if (++second->popped == ratio)
 		first->popped = 0;
 	}
     }
 
+    if (task && (desc = pthread_getspecific(stats_tls_key))) {
+	struct timeval tv_now;
+	gettimeofday(&tv_now, NULL);
+	desc->queue_wait = (tv_now.tv_sec - tv_queued.tv_sec)*1000000 +
+	    tv_now.tv_usec - tv_queued.tv_usec;
+    }
+
     if (!thrmgr_contended(pool, 0)) {
 	logg("$THRMGR: queue (single) crossed low threshold -> signaling\n");
 	pthread_cond_signal(&pool->queueable_single_cond);
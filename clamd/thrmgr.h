@@ -51,6 +51,7 @@ struct task_desc {
 	const char *filename;
 	const char *command;
 	struct timeval tv;
+	long queue_wait; /* usecs the current job spent queued */
 	struct task_desc *prv;
 	struct task_desc *nxt;
 	const struct cl_engine *engine;
@@ -108,5 +109,6 @@ jobgroup_t *thrmgr_group_new(void);
 int thrmgr_printstats(int outfd, char term);
 void thrmgr_setactivetask(const char *filename, const char* command);
 void thrmgr_setactiveengine(const struct cl_engine *engine);
+long thrmgr_queue_wait(void);
 
 #endif
@@ -0,0 +1,336 @@
+/*
+ *  io_uring file reader for the scanning threads
+ *
+ *  Copyright (C) 2026 agent <agent@local>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#ifdef HAVE_LINUX_IO_URING_H
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "libclamav/clamav.h"
+#include "shared/output.h"
+
+#include "uring.h"
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+
+/*
+ * Each scanning thread gets a small ring. The fmap of the file being scanned
+ * reads through uring_pread(), which submits the read together with a
+ * POSIX_FADV_WILLNEED of the window past it, so that the next pages are on
+ * their way while the matchers run on these. The fadvise requests are not
+ * waited for; uring_funmap() reaps what is left before the file is closed,
+ * since the kernel may only look the descriptor up when it runs them.
+ */
+
+#define URING_ENTRIES 8
+#define URING_READAHEAD (1024 * 1024)
+#define URING_MAXREAD (1U << 30)
+#define URING_READ 1 /* user_data of the read, the readahead uses 0 */
+
+struct uring {
+    int ringfd;
+    unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array, sq_entries;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ringsz, cq_ringsz, sqesz;
+    unsigned int pending; /* readahead requests not reaped yet */
+    int broken;
+
+    /* the file being scanned */
+    int fd;
+    off_t size;
+    off_t ra_next;
+};
+
+static int uring_on = 0;
+static pthread_key_t uring_key;
+static pthread_once_t uring_key_once = PTHREAD_ONCE_INIT;
+
+static void uring_free(struct uring *r)
+{
+    if(r->sqes)
+	munmap(r->sqes, r->sqesz);
+    if(r->cq_ring)
+	munmap(r->cq_ring, r->cq_ringsz);
+    if(r->sq_ring)
+	munmap(r->sq_ring, r->sq_ringsz);
+    close(r->ringfd);
+    free(r);
+}
+
+static void uring_destroy(void *r)
+{
+    uring_free(r);
+}
+
+static void uring_key_alloc(void)
+{
+    pthread_key_create(&uring_key, uring_destroy);
+}
+
+static struct uring *uring_new(void)
+{
+	struct io_uring_params p;
+	struct uring *r;
+	char *sq, *cq;
+	int fd;
+
+    memset(&p, 0, sizeof(p));
+    if((fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p)) < 0)
+	return NULL;
+    if(!(r = calloc(1, sizeof(*r)))) {
+	close(fd);
+	return NULL;
+    }
+    r->ringfd = fd;
+    r->sq_ringsz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    r->cq_ringsz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqesz = p.sq_entries * sizeof(struct io_uring_sqe);
+    if((r->sq_ring = mmap(NULL, r->sq_ringsz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING)) == MAP_FAILED)
+	r->sq_ring = NULL;
+    if((r->cq_ring = mmap(NULL, r->cq_ringsz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING)) == MAP_FAILED)
+	r->cq_ring = NULL;
+    if((r->sqes = mmap(NULL, r->sqesz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES)) == MAP_FAILED)
+	r->sqes = NULL;
+    if(!r->sq_ring || !r->cq_ring || !r->sqes) {
+	uring_free(r);
+	return NULL;
+    }
+
+    sq = r->sq_ring;
+    r->sq_head = (unsigned int *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned int *)(sq + p.sq_off.array);
+    r->sq_entries = p.sq_entries;
+    cq = r->cq_ring;
+    r->cq_head = (unsigned int *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    r->fd = -1;
+    return r;
+}
+
+/* the ring of the calling thread, NULL if it can't have one */
+static struct uring *uring_get(void)
+{
+	struct uring *r;
+
+    pthread_once(&uring_key_once, uring_key_alloc);
+    if(!(r = pthread_getspecific(uring_key)) && (r = uring_new())) {
+	if(pthread_setspecific(uring_key, r)) {
+	    uring_free(r);
+	    r = NULL;
+	}
+    }
+    return r;
+}
+
+static struct io_uring_sqe *uring_sqe(struct uring *r, int opcode, off_t offset, unsigned int len, uint64_t data)
+{
+	unsigned int tail = *r->sq_tail, idx;
+	struct io_uring_sqe *sqe;
+
+    if(tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->sq_entries)
+	return NULL;
+    idx = tail & *r->sq_mask;
+    sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = r->fd;
+    sqe->off = offset;
+    sqe->len = len;
+    sqe->user_data = data;
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+/* submits whatever is queued and waits for one completion if wait is set */
+static int uring_enter(struct uring *r, int wait)
+{
+	unsigned int submit;
+	int ret;
+
+    do {
+	submit = *r->sq_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+	ret = syscall(__NR_io_uring_enter, r->ringfd, submit, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while(ret < 0 && errno == EINTR);
+    return ret < 0 ? -1 : 0;
+}
+
+/* reaps the completions, returns 1 and the result of the read if it's done */
+static int uring_reap(struct uring *r, int *res)
+{
+	unsigned int head = *r->cq_head, tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+	int found = 0;
+
+    for(; head != tail; head++) {
+	struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+
+	if(cqe->user_data == URING_READ) {
+	    *res = cqe->res;
+	    found = 1;
+	} else if(r->pending) {
+	    r->pending--;
+	}
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    return found;
+}
+
+static off_t uring_pread(void *handle, void *buf, size_t count, off_t offset)
+{
+	struct uring *r = handle;
+	struct io_uring_sqe *sqe;
+	off_t end;
+	int res;
+
+    if(r->broken)
+	return pread(r->fd, buf, count, offset);
+    if(count > URING_MAXREAD)
+	count = URING_MAXREAD;
+    if(!(sqe = uring_sqe(r, IORING_OP_READ, offset, count, URING_READ)))
+	return pread(r->fd, buf, count, offset);
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+
+    /* batch the readahead of the next window with the read */
+    end = offset + count;
+    if(end < r->size && end + URING_READAHEAD / 2 > r->ra_next && r->pending < URING_ENTRIES / 2) {
+	off_t start = end > r->ra_next ? end : r->ra_next;
+
+	r->ra_next = end + URING_READAHEAD < r->size ? end + URING_READAHEAD : r->size;
+	if(start < r->ra_next && (sqe = uring_sqe(r, IORING_OP_FADVISE, start, r->ra_next - start, 0))) {
+	    sqe->fadvise_advice = POSIX_FADV_WILLNEED;
+	    r->pending++;
+	}
+    }
+
+    while(!uring_reap(r, &res)) {
+	if(uring_enter(r, 1)) {
+	    logg("^io_uring_enter() failed (%s), reading with pread()\n", strerror(errno));
+	    r->broken = 1;
+	    return pread(r->fd, buf, count, offset);
+	}
+    }
+    if(res == -EINVAL || res == -EOPNOTSUPP) {
+	/* no IORING_OP_READ before Linux 5.6 */
+	logg("^io_uring can't read files here, reading with pread()\n");
+	r->broken = 1;
+	return pread(r->fd, buf, count, offset);
+    }
+    if(res < 0) {
+	errno = -res;
+	return -1;
+    }
+    return res;
+}
+
+int uring_enable(void)
+{
+	struct uring *r;
+
+    if(!(r = uring_new()))
+	return -1;
+    uring_free(r);
+    uring_on = 1;
+    return 0;
+}
+
+int uring_enabled(void)
+{
+    return uring_on;
+}
+
+cl_fmap_t *uring_fmap(int fd)
+{
+	struct uring *r;
+	cl_fmap_t *map;
+	struct stat sb;
+
+    if(!uring_on || !(r = uring_get()) || r->broken || r->fd != -1)
+	return NULL;
+    if(fstat(fd, &sb) || !sb.st_size)
+	return NULL;
+    r->fd = fd;
+    r->size = sb.st_size;
+    r->ra_next = 0;
+    if(!(map = cl_fmap_open_fd_cb(fd, 0, sb.st_size, r, uring_pread)))
+	r->fd = -1;
+    return map;
+}
+
+void uring_funmap(cl_fmap_t *map)
+{
+	struct uring *r = pthread_getspecific(uring_key);
+	int res;
+
+    cl_fmap_close(map);
+    if(!r)
+	return;
+    while(r->pending && !r->broken) {
+	uring_reap(r, &res);
+	if(r->pending && uring_enter(r, 1))
+	    r->broken = 1;
+    }
+    r->fd = -1;
+}
+
+#else
+
+int uring_enable(void)
+{
+    return -1;
+}
+
+int uring_enabled(void)
+{
+    return 0;
+}
+
+cl_fmap_t *uring_fmap(int fd)
+{
+    return NULL;
+}
+
+void uring_funmap(cl_fmap_t *map)
+{
+    cl_fmap_close(map);
+}
+
+#endif
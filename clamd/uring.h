@@ -0,0 +1,35 @@
+/*
+ *  Copyright (C) 2026 agent <agent@local>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#ifndef __URING_H
+#define __URING_H
+
+#include "libclamav/clamav.h"
+
+/* Enables the io_uring reader (IOUring), returns -1 if the kernel doesn't
+ * provide io_uring */
+int uring_enable(void);
+int uring_enabled(void);
+
+/* Maps fd for scanning with reads going through the io_uring of the calling
+ * thread, NULL if that isn't possible (the caller scans fd as usual). One
+ * map per thread at a time; release it with uring_funmap() */
+cl_fmap_t *uring_fmap(int fd);
+void uring_funmap(cl_fmap_t *map);
+
+#endif
@@ -201,6 +201,7 @@ void help(void)
     mprintf("    --reload                           Request clamd to reload virus database\n");
     mprintf("    --fdpass                           Pass filedescriptor to clamd (useful if clamd is running as a different user)\n");
     mprintf("    --stream                           Force streaming files to clamd (for debugging and unit testing)\n");
+    mprintf("    --connections=#n                   With --stream or --fdpass, pipeline the files over #n sessions (1)\n");
     mprintf("\n");
 
     exit(0);
@@ -151,7 +151,8 @@ static char *makeabs(const char *basepath) {
     return ret;
 }
 
-/* Recursively scans a path with the given scantype
+/* Recursively scans a path with the given scantype, over that many
+ * IDSESSIONs or one connection per file if session is 0
  * Returns non zero for serious errors, zero otherwise */
 static int client_scan(const char *file, int scantype, int *infected, int *err, int maxlevel, int session, int flags) {
     int ret;
@@ -162,7 +163,7 @@ static int client_scan(const char *file, int scantype, int *infected, int *err,
     if (!session)
 	ret = serial_client_scan(fullpath, scantype, infected, err, maxlevel, flags);
     else
-	ret = parallel_client_scan(fullpath, scantype, infected, err, maxlevel, flags);
+	ret = parallel_client_scan(fullpath, scantype, infected, err, maxlevel, flags, session);
     free(fullpath);
     return ret;
 }
@@ -222,20 +223,25 @@ int reload_clamd_database(const struct optstruct *opts)
 
 int client(const struct optstruct *opts, int *infected, int *err)
 {
-	int remote, scantype, session = 0, errors = 0, scandash = 0, maxrec, flags = 0;
+	int remote, scantype, session = 0, errors = 0, scandash = 0, maxrec, flags = 0, sessions;
 	const char *fname;
 
+    if((sessions = optget(opts, "connections")->numarg) < 1) {
+	logg("!--connections requires a positive number\n");
+	return 2;
+    }
+
     scandash = (opts->filename && opts->filename[0] && !strcmp(opts->filename[0], "-") && !optget(opts, "file-list")->enabled && !opts->filename[1]);
     remote = isremote(opts) | optget(opts, "stream")->enabled;
 #ifdef HAVE_FD_PASSING
     if(!remote && optget(clamdopts, "LocalSocket")->enabled && (optget(opts, "fdpass")->enabled || scandash)) {
 	scantype = FILDES;
-	session = optget(opts, "multiscan")->enabled;
+	session = (optget(opts, "multiscan")->enabled || sessions > 1) ? sessions : 0;
     } else 
 #endif
     if(remote || scandash) {
 	scantype = STREAM;
-	session = optget(opts, "multiscan")->enabled;
+	session = (optget(opts, "multiscan")->enabled || sessions > 1) ? sessions : 0;
     } 
     else if(optget(opts, "multiscan")->enabled) scantype = MULTI;
     else if(optget(opts, "allmatch")->enabled) scantype = ALLMATCH;
@@ -410,6 +410,7 @@ struct client_parallel_data {
     int sockd;
     int lastid;
     int printok;
+    int pending;
     struct SCANID {
 	unsigned int id;
 	const char *file;
@@ -467,36 +468,249 @@ static int dspresult(struct client_parallel_data *c) {
 	bol = (char *)*id;
 	*id = (*id)->next;
 	free(bol);
+	c->pending--;
     } while(rcv.cur != rcv.buf); /* clamd sends whole lines, so, on partial lines, we just assume
 				    more data can be recv()'d with close to zero latency */
     return 0;
 }
 
+/* requests a session keeps in flight at most */
+#define SESSION_DEPTH 16
+
+#ifdef MSG_DONTWAIT
+#define SEND_NOWAIT MSG_DONTWAIT
+#else
+#define SEND_NOWAIT 0
+#endif
+
+/* One IDSESSION of the pipelined client. INSTREAM uploads are pushed out
+ * whenever the socket has room, so a big file or a slow link on one
+ * session doesn't hold up the others */
+struct client_session {
+    struct client_parallel_data c;
+    int uploading;
+    int fd;
+    char *upfile;
+    unsigned long todo;
+    unsigned int outlen;
+    unsigned int outoff;
+    /* clamd takes chunks no bigger than its own BUFSIZ buffer */
+    char out[BUFSIZ];
+};
+
+/* Used by pipe_callback() */
+struct client_pipeline {
+    struct client_session *s;
+    int nsessions;
+    int scantype;
+    int files;
+    int errors;
+    int printok;
+    int queued;
+    struct PIPEFILE {
+	char *file;
+	struct PIPEFILE *next;
+    } *head, *tail;
+};
+
+/* Sends as much of the current INSTREAM upload as the socket takes
+ * Returns 0 on success, -1 on hard failures */
+static int pipe_upload(struct client_pipeline *p, struct client_session *s) {
+    uint32_t n;
+    int len;
+
+    while(1) {
+	if(s->outoff == s->outlen) {
+	    if(s->fd < 0) {
+		/* the terminator is out */
+		s->uploading = 0;
+		free(s->upfile);
+		s->upfile = NULL;
+		return 0;
+	    }
+	    len = s->todo ? read(s->fd, s->out + sizeof(n), sizeof(s->out) - sizeof(n)) : 0;
+	    if(len < 0) {
+		logg("!Failed to read from %s.\n", s->upfile ? s->upfile : "file");
+		p->errors++;
+		p->printok = 0;
+		len = 0;
+	    }
+	    if((unsigned int)len > s->todo) len = s->todo;
+	    s->todo -= len;
+	    if(!len) {
+		close(s->fd);
+		s->fd = -1;
+	    }
+	    n = htonl(len);
+	    memcpy(s->out, &n, sizeof(n));
+	    s->outlen = len + sizeof(n);
+	    s->outoff = 0;
+	}
+	len = send(s->c.sockd, s->out + s->outoff, s->outlen - s->outoff, SEND_NOWAIT);
+	if(len < 0) {
+	    if(errno == EINTR) continue;
+	    if(errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+	    logg("!Can't send to clamd: %s\n", strerror(errno));
+	    return -1;
+	}
+	s->outoff += len;
+    }
+}
+
+/* Starts the request for the first queued file on a session
+ * Returns 0 on success, -1 on hard failures */
+static int pipe_start(struct client_pipeline *p, struct client_session *s) {
+    struct PIPEFILE *pf = p->head;
+    char *filename = pf->file;
+    struct SCANID *cid;
+    int fd = -1, res;
+
+    if(!(p->head = pf->next))
+	p->tail = NULL;
+    p->queued--;
+    free(pf);
+
+    if(p->scantype == STREAM && (fd = safe_open(filename, O_RDONLY | O_BINARY)) < 0) {
+	logg("~%s: Access denied. ERROR\n", filename);
+	p->errors++;
+	p->printok = 0;
+	free(filename);
+	return 0;
+    }
+    cid = (struct SCANID *)malloc(sizeof(struct SCANID));
+    if(!cid) {
+	logg("!Failed to allocate scanid entry: %s\n", strerror(errno));
+	if(fd >= 0) close(fd);
+	free(filename);
+	return -1;
+    }
+    cid->id = ++s->c.lastid;
+    cid->file = filename;
+    cid->next = s->c.ids;
+    s->c.ids = cid;
+    s->c.pending++;
+
+#ifdef HAVE_FD_PASSING
+    if(p->scantype == FILDES) {
+	if((res = send_fdpass(s->c.sockd, filename)) <= 0) {
+	    p->errors++;
+	    p->printok = 0;
+	    s->c.ids = cid->next;
+	    s->c.lastid--;
+	    s->c.pending--;
+	    free(cid);
+	    free(filename);
+	    return res ? -1 : 0;
+	}
+	return 0;
+    }
+#endif
+
+    /* the command goes out with the first chunk */
+    memcpy(s->out, "zINSTREAM", 10);
+    s->outlen = 10;
+    s->outoff = 0;
+    s->fd = fd;
+    s->todo = maxstream;
+    s->upfile = strdup(filename);
+    s->uploading = 1;
+    return pipe_upload(p, s);
+}
+
+/* Moves the pipeline along: collects the replies that came in, starts
+ * queued requests on the sessions with room and pushes the uploads
+ * Returns 0 on success, -1 on hard failures */
+static int pipe_pump(struct client_pipeline *p) {
+    struct client_session *s;
+    fd_set rfds, wfds;
+    int i, maxfd = -1;
+
+    FD_ZERO(&rfds);
+    FD_ZERO(&wfds);
+    for(i = 0; i < p->nsessions; i++) {
+	s = &p->s[i];
+	if(s->c.pending)
+	    FD_SET(s->c.sockd, &rfds);
+	if(s->uploading || (p->head && s->c.pending < SESSION_DEPTH))
+	    FD_SET(s->c.sockd, &wfds);
+	else if(!s->c.pending)
+	    continue;
+	if(s->c.sockd > maxfd)
+	    maxfd = s->c.sockd;
+    }
+    if(maxfd < 0)
+	return 0;
+    if(select(maxfd + 1, &rfds, &wfds, NULL, NULL) < 0) {
+	if(errno == EINTR) return 0;
+	logg("!select() failed during session: %s\n", strerror(errno));
+	return -1;
+    }
+    for(i = 0; i < p->nsessions; i++) {
+	s = &p->s[i];
+	if(FD_ISSET(s->c.sockd, &rfds)) {
+	    switch(dspresult(&s->c)) {
+	    case 0:
+		break;
+	    case 2:
+		logg("!Clamd closed the connection before scanning all files.\n");
+		/* fall through */
+	    default:
+		return -1;
+	    }
+	}
+	if(!FD_ISSET(s->c.sockd, &wfds))
+	    continue;
+	while(1) {
+	    if(s->uploading) {
+		if(pipe_upload(p, s))
+		    return -1;
+		if(s->uploading)
+		    break;
+	    }
+	    if(!p->head || s->c.pending >= SESSION_DEPTH)
+		break;
+	    if(pipe_start(p, s))
+		return -1;
+	}
+    }
+    return 0;
+}
+
+static int pipe_busy(const struct client_pipeline *p) {
+    int i;
+
+    if(p->head)
+	return 1;
+    for(i = 0; i < p->nsessions; i++)
+	if(p->s[i].uploading || p->s[i].c.pending)
+	    return 1;
+    return 0;
+}
+
 /* FTW callback for scanning in IDSESSION mode
  * Returns SUCCESS on success, CL_EXXX or BREAK on error */
-static int parallel_callback(STATBUF *sb, char *filename, const char *path, enum cli_ftw_reason reason, struct cli_ftw_cbdata *data) {
-    struct client_parallel_data *c = (struct client_parallel_data *)data->data;
-    struct SCANID *cid;
-    int res = CL_CLEAN;
+static int pipe_callback(STATBUF *sb, char *filename, const char *path, enum cli_ftw_reason reason, struct cli_ftw_cbdata *data) {
+    struct client_pipeline *p = (struct client_pipeline *)data->data;
+    struct PIPEFILE *pf;
 
     if(chkpath(path))
 	return CL_SUCCESS;
-    c->files++;
+    p->files++;
     switch(reason) {
     case error_stat:
 	logg("!Can't access file %s\n", path);
-	c->errors++;
+	p->errors++;
 	return CL_SUCCESS;
     case error_mem:
 	logg("!Memory allocation failed in ftw\n");
-	c->errors++;
+	p->errors++;
 	return CL_EMEM;
     case warning_skipped_dir:
 	logg("^Directory recursion limit reached\n");
 	return CL_SUCCESS;
     case warning_skipped_special:
 	logg("^%s: Not supported file type\n", path);
-	c->errors++;
+	p->errors++;
     case warning_skipped_link:
     case visit_directory_toplev:
 	return CL_SUCCESS;
@@ -504,114 +718,97 @@ static int parallel_callback(STATBUF *sb, char *filename, const char *path, enum
 	break;
     }
 
-    while(1) {
-	/* consume all the available input to let some of the clamd
-	 * threads blocked on send() to be dead.
-	 * by doing so we shouldn't deadlock on the next recv() */
-	fd_set rfds, wfds;
-	FD_ZERO(&rfds);
-	FD_SET(c->sockd, &rfds);
-	FD_ZERO(&wfds);
-	FD_SET(c->sockd, &wfds);
-	if(select(c->sockd + 1, &rfds, &wfds, NULL, NULL) < 0) {
-	    if(errno == EINTR) continue;
-	    free(filename);
-	    logg("!select() failed during session: %s\n", strerror(errno));
-	    return CL_BREAK;
-	}
-	if(FD_ISSET(c->sockd, &rfds)) {
-	    if(dspresult(c)) {
-		free(filename);
-		return CL_BREAK;
-	    } else continue;
-	}
-	if(FD_ISSET(c->sockd, &wfds)) break;
-    }
-
-    cid = (struct SCANID *)malloc(sizeof(struct SCANID));
-    if(!cid) {
+    if(!(pf = (struct PIPEFILE *)malloc(sizeof(*pf)))) {
 	free(filename);
-	logg("!Failed to allocate scanid entry: %s\n", strerror(errno));
+	logg("!Failed to allocate a queue entry: %s\n", strerror(errno));
 	return CL_BREAK;
     }
-    cid->id = ++c->lastid;
-    cid->file = filename;
-    cid->next = c->ids;
-    c->ids = cid;
-
-    switch(c->scantype) {
-#ifdef HAVE_FD_PASSING
-    case FILDES:
-	res = send_fdpass(c->sockd, filename);
-	break;
-#endif
-    case STREAM:
-	res = send_stream(c->sockd, filename);
-	break;
-    }
-    if(res <= 0) {
-	c->printok = 0;
-	c->errors++;
-	c->ids = cid->next;
-	c->lastid--;
-	free(cid);
-	free(filename);
-	return res ? CL_BREAK : CL_SUCCESS;
-    }
+    pf->file = filename;
+    pf->next = NULL;
+    if(p->tail)
+	p->tail->next = pf;
+    else
+	p->head = pf;
+    p->tail = pf;
+    p->queued++;
+
+    /* the walker only needs to stay a file per session ahead */
+    while(p->queued >= p->nsessions)
+	if(pipe_pump(p))
+	    return CL_BREAK;
     return CL_SUCCESS;
 }
 
-/* IDSESSION handler
+/* IDSESSION handler, spreading the requests over the given number of
+ * sessions and keeping up to SESSION_DEPTH of them in flight on each
  * Returns non zero for serious errors, zero otherwise */
-int parallel_client_scan(char *file, int scantype, int *infected, int *err, int maxlevel, int flags) {
+int parallel_client_scan(char *file, int scantype, int *infected, int *err, int maxlevel, int flags, int sessions) {
     struct cli_ftw_cbdata data;
-    struct client_parallel_data cdata;
-    int ftw;
-
-    if((cdata.sockd = dconnect()) < 0)
-	return 1;
+    struct client_pipeline p;
+    struct client_session *s;
+    struct PIPEFILE *pf;
+    struct SCANID *cid;
+    int ftw = CL_BREAK, i;
 
-    if(sendln(cdata.sockd, "zIDSESSION", 11)) {
-	closesocket(cdata.sockd);
+    memset(&p, 0, sizeof(p));
+    p.scantype = scantype;
+    p.printok = printinfected^1;
+    if(!(p.s = (struct client_session *)calloc(sessions, sizeof(*p.s)))) {
+	logg("!Failed to allocate the sessions: %s\n", strerror(errno));
 	return 1;
     }
-
-    cdata.infected = 0;
-    cdata.files = 0;
-    cdata.errors = 0;
-    cdata.scantype = scantype;
-    cdata.lastid = 0;
-    cdata.ids = NULL;
-    cdata.printok = printinfected^1;
-    data.data = &cdata;
-
-    ftw = cli_ftw(file, flags, maxlevel ? maxlevel : INT_MAX, parallel_callback, &data, ftw_chkpath);
-
-    if(ftw != CL_SUCCESS) {
-	*err += cdata.errors;
-	*infected += cdata.infected;
-	closesocket(cdata.sockd);
-	return 1;
+    for(i = 0; i < sessions; i++) {
+	s = &p.s[i];
+	s->fd = -1;
+	s->c.printok = 1;
+	if((s->c.sockd = dconnect()) < 0)
+	    break;
+	p.nsessions++;
+	if(sendln(s->c.sockd, "zIDSESSION", 11))
+	    break;
     }
 
-    sendln(cdata.sockd, "zEND", 5);
-    while(cdata.ids && !dspresult(&cdata));
-    closesocket(cdata.sockd);
-
-    *infected += cdata.infected;
-    *err += cdata.errors;
+    if(p.nsessions == sessions) {
+	data.data = &p;
+	ftw = cli_ftw(file, flags, maxlevel ? maxlevel : INT_MAX, pipe_callback, &data, ftw_chkpath);
+	while(ftw == CL_SUCCESS && pipe_busy(&p))
+	    if(pipe_pump(&p))
+		ftw = CL_BREAK;
+    }
 
-    if(cdata.ids) {
-	logg("!Clamd closed the connection before scanning all files.\n");
-	return 1;
+    for(i = 0; i < p.nsessions; i++) {
+	s = &p.s[i];
+	if(ftw == CL_SUCCESS)
+	    sendln(s->c.sockd, "zEND", 5);
+	closesocket(s->c.sockd);
+	if(s->fd >= 0)
+	    close(s->fd);
+	free(s->upfile);
+	while((cid = s->c.ids)) {
+	    s->c.ids = cid->next;
+	    free((void *)cid->file);
+	    free(cid);
+	}
+	p.files += s->c.files;
+	p.errors += s->c.errors;
+	p.printok &= s->c.printok;
+	*infected += s->c.infected;
+    }
+    while((pf = p.head)) {
+	p.head = pf->next;
+	free(pf->file);
+	free(pf);
     }
-    if(cdata.errors)
+    free(p.s);
+    *err += p.errors;
+
+    if(ftw != CL_SUCCESS || p.errors)
 	return 1;
 
-    if(!cdata.files)
+    if(!p.files)
 	return 0;
 
-    if(cdata.printok)
+    if(p.printok)
 	logg("~%s: OK\n", file);
     return 0;
 }
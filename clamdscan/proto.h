@@ -24,6 +24,6 @@
 
 int dconnect(void);
 int serial_client_scan(char *file, int scantype, int *infected, int *err, int maxlevel, int flags);
-int parallel_client_scan(char *file, int scantype, int *infected, int *err, int maxlevel, int flags);
+int parallel_client_scan(char *file, int scantype, int *infected, int *err, int maxlevel, int flags, int sessions);
 int dsresult(int sockd, int scantype, const char *filename, int *printok, int *errors);
 #endif
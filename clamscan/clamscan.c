@@ -227,6 +227,8 @@ void help(void)
     mprintf("    --exclude-dir=REGEX                  Don't scan directories matching REGEX\n");
     mprintf("    --include=REGEX                      Only scan file names matching REGEX\n");
     mprintf("    --include-dir=REGEX                  Only scan directories matching REGEX\n");
+    mprintf("    --threads=#n                         Scan #n files at the same time (1)\n");
+    mprintf("    --ordered-output[=yes(*)/no]         With --threads, report files in the order they were found\n");
     mprintf("\n");
     mprintf("    --bytecode[=yes(*)/no]               Load bytecode from the database\n");
     mprintf("    --bytecode-unsigned[=yes/no(*)]      Load unsigned bytecode\n");
@@ -46,7 +46,11 @@
 #include <sys/types.h>
 #include <signal.h>
 #include <errno.h>
+#include <stdarg.h>
 #include <target.h>
+#ifdef CL_THREAD_SAFE
+#include <pthread.h>
+#endif
 
 #include "manager.h"
 #include "global.h"
@@ -78,6 +82,7 @@ static int checkaccess(const char *path, const char *username, int mode)
 {
 	struct passwd *user;
 	int ret = 0, status;
+	pid_t pid;
 
     if(!geteuid()) {
 
@@ -85,7 +90,7 @@ static int checkaccess(const char *path, const char *username, int mode)
 	    return -1;
 	}
 
-	switch(fork()) {
+	switch((pid = fork())) {
 	    case -1:
 		return -2;
 
@@ -106,7 +111,8 @@ static int checkaccess(const char *path, const char *username, int mode)
 		    exit(1);
 
 	    default:
-		wait(&status);
+		/* other threads may have children of their own */
+		waitpid(pid, &status, 0);
 		if(WIFEXITED(status) && WEXITSTATUS(status) == 1)
 		    ret = 1;
 	}
@@ -120,12 +126,358 @@ static int checkaccess(const char *path, const char *username, int mode)
 }
 #endif
 
+/*
+ * With --threads=N the main thread walks the tree and queues the files,
+ * N workers scan them with the shared engine. Everything a file prints is
+ * kept in its job and printed, together with the statistics, the bell and
+ * the action, when the job completes: in walk order, or as soon as it's
+ * done with --ordered-output=no. Without a pool the messages go out right
+ * away as before.
+ */
+struct scan_msg {
+    struct scan_msg *next;
+    int log; /* logg() or mprintf() */
+    char text[1];
+};
+
+struct scan_job {
+    struct scan_job *next;	/* queue */
+    struct scan_job *onext;	/* output order */
+    char *filename;
+    struct scan_msg *msgs, **mtail;
+    struct s_info info;
+    struct cl_scan_context *sctx;	/* the worker's */
+    int ret;
+    int done;
+};
+
+/* scan context of the main thread, the workers have their own */
+static struct cl_scan_context *main_sctx = NULL;
+
+static void emit(int log, const char *text)
+{
+    /* keep the message type character a literal, logg() checks the
+     * format for it */
+#define EMIT(fmt, t) do { if(log) logg(fmt, t); else mprintf(fmt, t); } while(0)
+    switch(*text) {
+	case '!': EMIT("!%s", text + 1); break;
+	case '^': EMIT("^%s", text + 1); break;
+	case '~': EMIT("~%s", text + 1); break;
+	case '*': EMIT("*%s", text + 1); break;
+	case '#': EMIT("#%s", text + 1); break;
+	case '$': EMIT("$%s", text + 1); break;
+	default: EMIT("%s", text);
+    }
+#undef EMIT
+}
+
+static void jvmsg(struct scan_job *job, int log, const char *str, va_list args)
+{
+	struct scan_msg *msg;
+	char buff[1024];
+	va_list cargs;
+	int len;
+
+    va_copy(cargs, args);
+    len = vsnprintf(buff, sizeof(buff), str, cargs);
+    va_end(cargs);
+    if(len < 0)
+	return;
+    if(!job && (size_t) len < sizeof(buff)) {
+	emit(log, buff);
+	return;
+    }
+    if(!(msg = malloc(sizeof(*msg) + len))) {
+	emit(log, buff);
+	return;
+    }
+    vsnprintf(msg->text, len + 1, str, args);
+    msg->log = log;
+    if(!job) {
+	emit(log, msg->text);
+	free(msg);
+	return;
+    }
+    msg->next = NULL;
+    *job->mtail = msg;
+    job->mtail = &msg->next;
+}
+
+static void jlogg(struct scan_job *job, const char *str, ...)
+{
+	va_list args;
+
+    va_start(args, str);
+    jvmsg(job, 1, str, args);
+    va_end(args);
+}
+
+static void jmprintf(struct scan_job *job, const char *str, ...)
+{
+	va_list args;
+
+    va_start(args, str);
+    jvmsg(job, 0, str, args);
+    va_end(args);
+}
+
+/* what's left to do after a file was scanned */
+static void scan_done(const char *filename, int ret)
+{
+    if(ret == CL_VIRUS) {
+	if(bell)
+	    fprintf(stderr, "\007");
+	if(action)
+	    action(filename);
+    }
+}
+
+static void scanfile(const char *filename, struct cl_engine *engine, const struct optstruct *opts, unsigned int options, struct scan_job *job);
+
+#ifdef CL_THREAD_SAFE
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t work, space;
+    struct scan_job *qhead, **qtail;	/* waiting for a worker */
+    struct scan_job *ohead, **otail;	/* not printed yet, in walk order */
+    unsigned int pending, max_pending;
+    int ordered, finished;
+    pthread_t *workers;
+    unsigned int nworkers;
+    struct cl_engine *engine;
+    const struct optstruct *opts;
+    unsigned int options;
+} *pool = NULL;
+
+static void job_free(struct scan_job *job)
+{
+	struct scan_msg *msg;
+
+    while((msg = job->msgs)) {
+	job->msgs = msg->next;
+	free(msg);
+    }
+    free(job->filename);
+    free(job);
+}
+
+static struct scan_job *job_new(const char *filename)
+{
+	struct scan_job *job;
+
+    if(!(job = calloc(1, sizeof(*job))))
+	return NULL;
+    if(filename && !(job->filename = strdup(filename))) {
+	free(job);
+	return NULL;
+    }
+    job->mtail = &job->msgs;
+    return job;
+}
+
+/* pool->mutex held */
+static void pool_output(void)
+{
+	struct scan_job **jp = &pool->ohead, *job;
+	struct scan_msg *msg;
+
+    while((job = *jp)) {
+	if(!job->done) {
+	    if(pool->ordered)
+		break;
+	    jp = &job->onext;
+	    continue;
+	}
+	if(!(*jp = job->onext))
+	    pool->otail = jp;
+	for(msg = job->msgs; msg; msg = msg->next)
+	    emit(msg->log, msg->text);
+	info.files += job->info.files;
+	info.ifiles += job->info.ifiles;
+	info.errors += job->info.errors;
+	info.blocks += job->info.blocks;
+	info.rblocks += job->info.rblocks;
+	if(job->filename)
+	    scan_done(job->filename, job->ret);
+	job_free(job);
+	pool->pending--;
+	pthread_cond_signal(&pool->space);
+    }
+}
+
+/* pool->mutex held */
+static void pool_append(struct scan_job *job)
+{
+    job->onext = NULL;
+    *pool->otail = job;
+    pool->otail = &job->onext;
+    pool->pending++;
+}
+
+static void *pool_worker(void *arg)
+{
+	struct scan_job *job;
+	struct cl_scan_context *sctx = cl_scan_context_new();
+
+    pthread_mutex_lock(&pool->mutex);
+    while(1) {
+	while(!pool->qhead && !pool->finished)
+	    pthread_cond_wait(&pool->work, &pool->mutex);
+	if(!(job = pool->qhead))
+	    break;
+	if(!(pool->qhead = job->next))
+	    pool->qtail = &pool->qhead;
+	pthread_mutex_unlock(&pool->mutex);
+
+	job->sctx = sctx;
+	scanfile(job->filename, pool->engine, pool->opts, pool->options, job);
+
+	pthread_mutex_lock(&pool->mutex);
+	job->done = 1;
+	pool_output();
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    cl_scan_context_free(sctx);
+    return arg;
+}
+
+static int pool_init(unsigned int threads, struct cl_engine *engine, const struct optstruct *opts, unsigned int options)
+{
+	unsigned int i;
+
+    if(!(pool = calloc(1, sizeof(*pool))) || !(pool->workers = calloc(threads, sizeof(*pool->workers)))) {
+	free(pool);
+	pool = NULL;
+	return -1;
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->space, NULL);
+    pool->qtail = &pool->qhead;
+    pool->otail = &pool->ohead;
+    /* bounds both the queue and the output waiting for a slow file */
+    pool->max_pending = threads * 64;
+    pool->ordered = optget(opts, "ordered-output")->enabled;
+    pool->engine = engine;
+    pool->opts = opts;
+    pool->options = options;
+    for(i = 0; i < threads; i++) {
+	if(pthread_create(&pool->workers[i], NULL, pool_worker, NULL))
+	    break;
+	pool->nworkers++;
+    }
+    if(!pool->nworkers) {
+	free(pool->workers);
+	free(pool);
+	pool = NULL;
+	return -1;
+    }
+    if(pool->nworkers < threads)
+	logg("^Only %u of %u scanning threads could be started\n", pool->nworkers, threads);
+    return 0;
+}
+
+static void pool_done(void)
+{
+	unsigned int i;
+
+    if(!pool)
+	return;
+    pthread_mutex_lock(&pool->mutex);
+    pool->finished = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->mutex);
+    for(i = 0; i < pool->nworkers; i++)
+	pthread_join(pool->workers[i], NULL);
+    pool_output();
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->space);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->workers);
+    free(pool);
+    pool = NULL;
+}
+
+static void queuefile(const char *filename, struct cl_engine *engine, const struct optstruct *opts, unsigned int options)
+{
+	struct scan_job *job;
+
+    if(!pool) {
+	scanfile(filename, engine, opts, options, NULL);
+	return;
+    }
+    if(!(job = job_new(filename))) {
+	/* scan it here rather than not at all */
+	pthread_mutex_lock(&pool->mutex);
+	pool_output();
+	scanfile(filename, engine, opts, options, NULL);
+	pthread_mutex_unlock(&pool->mutex);
+	return;
+    }
+    pthread_mutex_lock(&pool->mutex);
+    while(pool->pending >= pool->max_pending)
+	pthread_cond_wait(&pool->space, &pool->mutex);
+    job->next = NULL;
+    *pool->qtail = job;
+    pool->qtail = &job->next;
+    pool_append(job);
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/* messages and errors of the walk itself keep their place in the output */
+static void walk_msg(const char *str, ...)
+{
+	struct scan_job *job = NULL;
+	va_list args;
+
+    if(pool && !(job = job_new(NULL)))
+	return;
+    va_start(args, str);
+    jvmsg(job, 1, str, args);
+    va_end(args);
+    if(job) {
+	job->done = 1;
+	pthread_mutex_lock(&pool->mutex);
+	pool_append(job);
+	pool_output();
+	pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+static void walk_error(void)
+{
+    if(pool) {
+	pthread_mutex_lock(&pool->mutex);
+	info.errors++;
+	pthread_mutex_unlock(&pool->mutex);
+    } else {
+	info.errors++;
+    }
+}
+
+#else
+
+static void queuefile(const char *filename, struct cl_engine *engine, const struct optstruct *opts, unsigned int options)
+{
+    scanfile(filename, engine, opts, options, NULL);
+}
+
+#define walk_msg logg
+
+static void walk_error(void)
+{
+    info.errors++;
+}
+#endif
+
 struct metachain {
     char **chains;
     unsigned lastadd;
     unsigned lastvir;
     unsigned level;
     unsigned n;
+    struct scan_job *job;
 };
 
 static cl_error_t pre(int fd, const char *type, void *context)
@@ -207,11 +559,11 @@ static cl_error_t meta(const char* container_type, unsigned long fsize_container
     }
     c->chains[c->n-1] = chain;
     toolong = print_chain(c, prev, sizeof(prev));
-    logg("*Scanning %s%s!%s\n", prev,toolong ? "..." : "", chain);
+    jlogg(c->job, "*Scanning %s%s!%s\n", prev,toolong ? "..." : "", chain);
     return CL_CLEAN;
 }
 
-static void scanfile(const char *filename, struct cl_engine *engine, const struct optstruct *opts, unsigned int options)
+static void scanfile(const char *filename, struct cl_engine *engine, const struct optstruct *opts, unsigned int options, struct scan_job *job)
 {
 	int ret = 0, fd, included;
 	unsigned i;
@@ -220,12 +572,13 @@ static void scanfile(const char *filename, struct cl_engine *engine, const struc
 	const char **virpp = &virname;
 	STATBUF sb;
 	struct metachain chain;
+	struct s_info *inf = job ? &job->info : &info;
 
     if((opt = optget(opts, "exclude"))->enabled) {
 	while(opt) {
 	    if(match_regex(filename, opt->strarg) == 1) {
 		if(!printinfected)
-		    logg("~%s: Excluded\n", filename);
+		    jlogg(job, "~%s: Excluded\n", filename);
 		return;
 	    }
 	    opt = opt->nextarg;
@@ -243,7 +596,7 @@ static void scanfile(const char *filename, struct cl_engine *engine, const struc
 	}
 	if(!included) {
 	    if(!printinfected)
-		logg("~%s: Excluded\n", filename);
+		jlogg(job, "~%s: Excluded\n", filename);
 	    return;
 	}
     }
@@ -253,29 +606,30 @@ static void scanfile(const char *filename, struct cl_engine *engine, const struc
 #ifdef C_LINUX
 	if(procdev && sb.st_dev == procdev) {
 	    if(!printinfected)
-		logg("~%s: Excluded (/proc)\n", filename);
+		jlogg(job, "~%s: Excluded (/proc)\n", filename);
 		return;
 	}
 #endif    
 	if(!sb.st_size) {
 	    if(!printinfected)
-		logg("~%s: Empty file\n", filename);
+		jlogg(job, "~%s: Empty file\n", filename);
 	    return;
 	}
-	info.rblocks += sb.st_size / CL_COUNT_PRECISION;
+	inf->rblocks += sb.st_size / CL_COUNT_PRECISION;
     }
 
 #ifndef _WIN32
     if(geteuid())
 	if(checkaccess(filename, NULL, R_OK) != 1) {
 	    if(!printinfected)
-		logg("~%s: Access denied\n", filename);
-	    info.errors++;
+		jlogg(job, "~%s: Access denied\n", filename);
+	    inf->errors++;
 	    return;
 	}
 #endif
 
     memset(&chain, 0, sizeof(chain));
+    chain.job = job;
     if(optget(opts, "archive-verbose")->enabled) {
 	chain.chains = malloc(sizeof(*chain.chains));
 	if (chain.chains) {
@@ -283,48 +637,44 @@ static void scanfile(const char *filename, struct cl_engine *engine, const struc
 	    chain.n = 1;
 	}
     }
-    logg("*Scanning %s\n", filename);
+    jlogg(job, "*Scanning %s\n", filename);
 
     if((fd = safe_open(filename, O_RDONLY|O_BINARY)) == -1) {
-	logg("^Can't open file %s: %s\n", filename, strerror(errno));
-	info.errors++;
+	jlogg(job, "^Can't open file %s: %s\n", filename, strerror(errno));
+	inf->errors++;
 	return;
     }
 
 
-    if((ret = cl_scandesc_callback(fd, virpp, &info.blocks, engine, options, &chain)) == CL_VIRUS) {
+    if((ret = cl_scandesc_context(fd, virpp, &inf->blocks, engine, options, &chain, job ? job->sctx : main_sctx)) == CL_VIRUS) {
 	if(optget(opts, "archive-verbose")->enabled) {
 	    if (chain.n > 1) {
 		char str[128];
 		int toolong = print_chain(&chain, str, sizeof(str));
-		logg("~%s%s!(%d)%s: %s FOUND\n", str, toolong ? "..." : "", chain.lastvir-1, chain.chains[chain.n-1], virname);
+		jlogg(job, "~%s%s!(%d)%s: %s FOUND\n", str, toolong ? "..." : "", chain.lastvir-1, chain.chains[chain.n-1], virname);
 	    } else if (chain.lastvir)
-		logg("~%s!(%d): %s FOUND\n", filename, chain.lastvir-1, virname);
+		jlogg(job, "~%s!(%d): %s FOUND\n", filename, chain.lastvir-1, virname);
 	}
 	if (options & CL_SCAN_ALLMATCHES) {
 	    int i = 0;
 	    virpp = (const char **)*virpp; /* horrible */
 	    virname = virpp[0];
 	    while (virpp[i])
-		logg("~%s: %s FOUND\n", filename, virpp[i++]);
+		jlogg(job, "~%s: %s FOUND\n", filename, virpp[i++]);
 	    free((void *)virpp);
 	}
 	else
-	    logg("~%s: %s FOUND\n", filename, virname);
-	info.files++;
-	info.ifiles++;
-
-	if(bell)
-	    fprintf(stderr, "\007");
-
+	    jlogg(job, "~%s: %s FOUND\n", filename, virname);
+	inf->files++;
+	inf->ifiles++;
     } else if(ret == CL_CLEAN) {
 	if(!printinfected && printclean)
-	    mprintf("~%s: OK\n", filename);
-	info.files++;
+	    jmprintf(job, "~%s: OK\n", filename);
+	inf->files++;
     } else {
 	if(!printinfected)
-	    logg("~%s: %s ERROR\n", filename, cl_strerror(ret));
-	info.errors++;
+	    jlogg(job, "~%s: %s ERROR\n", filename, cl_strerror(ret));
+	inf->errors++;
     }
 
     for (i=0;i<chain.n;i++)
@@ -332,8 +682,10 @@ static void scanfile(const char *filename, struct cl_engine *engine, const struc
     free(chain.chains);
     close(fd);
 
-    if(ret == CL_VIRUS && action)
-	action(filename);
+    if(job)
+	job->ret = ret;
+    else
+	scan_done(filename, ret);
 }
 
 static void scandirs(const char *dirname, struct cl_engine *engine, const struct optstruct *opts, unsigned int options, unsigned int depth, dev_t dev)
@@ -351,7 +703,7 @@ static void scandirs(const char *dirname, struct cl_engine *engine, const struct
 	while(opt) {
 	    if(match_regex(dirname, opt->strarg) == 1) {
 		if(!printinfected)
-		    logg("~%s: Excluded\n", dirname);
+		    walk_msg("~%s: Excluded\n", dirname);
 		return;
 	    }
 	    opt = opt->nextarg;
@@ -369,7 +721,7 @@ static void scandirs(const char *dirname, struct cl_engine *engine, const struct
 	}
 	if(!included) {
 	    if(!printinfected)
-		logg("~%s: Excluded\n", dirname);
+		walk_msg("~%s: Excluded\n", dirname);
 	    return;
 	}
     }
@@ -390,7 +742,7 @@ static void scandirs(const char *dirname, struct cl_engine *engine, const struct
 		    /* build the full name */
 		    fname = malloc(strlen(dirname) + strlen(dent->d_name) + 2);
 		    if (fname == NULL) { /* oops, malloc() failed, print warning and return */
-			logg("!scandirs: Memory allocation failed for fname\n");
+			walk_msg("!scandirs: Memory allocation failed for fname\n");
 			return;
 		    }
 
@@ -404,7 +756,7 @@ static void scandirs(const char *dirname, struct cl_engine *engine, const struct
 			if(!optget(opts, "cross-fs")->enabled) {
 			    if(sb.st_dev != dev) {
 				if(!printinfected)
-				    logg("~%s: Excluded\n", fname);
+				    walk_msg("~%s: Excluded\n", fname);
 				free(fname);
 				continue;
 			    }
@@ -412,20 +764,20 @@ static void scandirs(const char *dirname, struct cl_engine *engine, const struct
 			if(S_ISLNK(sb.st_mode)) {
 			    if(dirlnk != 2 && filelnk != 2) {
 				if(!printinfected)
-				    logg("%s: Symbolic link\n", fname);
+				    walk_msg("%s: Symbolic link\n", fname);
 			    } else if(STAT(fname, &sb) != -1) {
 				if(S_ISREG(sb.st_mode) && filelnk == 2) {
-				    scanfile(fname, engine, opts, options);
+				    queuefile(fname, engine, opts, options);
 				} else if(S_ISDIR(sb.st_mode) && dirlnk == 2) {
 				    if(recursion)
 					scandirs(fname, engine, opts, options, depth, dev);
 				} else {
 				    if(!printinfected)
-					logg("%s: Symbolic link\n", fname);
+					walk_msg("%s: Symbolic link\n", fname);
 				}
 			    }
 			} else if(S_ISREG(sb.st_mode)) {
-			    scanfile(fname, engine, opts, options);
+			    queuefile(fname, engine, opts, options);
 			} else if(S_ISDIR(sb.st_mode) && recursion) {
 			    scandirs(fname, engine, opts, options, depth, dev);
 			}
@@ -437,8 +789,8 @@ static void scandirs(const char *dirname, struct cl_engine *engine, const struct
 	closedir(dd);
     } else {
 	if(!printinfected)
-	    logg("~%s: Can't open directory.\n", dirname);
-	info.errors++;
+	    walk_msg("~%s: Can't open directory.\n", dirname);
+	walk_error();
     }
 }
 
@@ -524,7 +876,7 @@ static int scanstdin(const struct cl_engine *engine, const struct optstruct *opt
 int scanmanager(const struct optstruct *opts)
 {
 	int ret = 0, i;
-	unsigned int options = 0, dboptions = 0, dirlnk = 1, filelnk = 1;
+	unsigned int options = 0, dboptions = 0, dirlnk = 1, filelnk = 1, threads;
 	struct cl_engine *engine;
 	STATBUF sb;
 	char *file, cwd[1024], *pua_cats = NULL;
@@ -546,6 +898,11 @@ int scanmanager(const struct optstruct *opts)
 	return 2;
     }
 
+    if(optget(opts, "threads")->numarg < 1) {
+	logg("!--threads: Invalid argument\n");
+	return 2;
+    }
+
     if(optget(opts, "phishing-sigs")->enabled)
 	dboptions |= CL_DB_PHISHING;
 
@@ -629,6 +986,17 @@ int scanmanager(const struct optstruct *opts)
     if(optget(opts, "dev-ac-depth")->enabled)
 	cl_engine_set_num(engine, CL_ENGINE_AC_MAXDEPTH, optget(opts, "dev-ac-depth")->numarg);
 
+    if(optget(opts, "dev-bm-literal")->enabled)
+	cl_engine_set_num(engine, CL_ENGINE_BM_LITERAL, 1);
+
+    if(optget(opts, "dev-fmap-mmap")->enabled || optget(opts, "dev-fmap-hugepages")->enabled)
+	cl_engine_set_num(engine, CL_ENGINE_FMAP_FLAGS,
+			  (optget(opts, "dev-fmap-mmap")->enabled ? CL_FMAP_MMAP : 0) |
+			  (optget(opts, "dev-fmap-hugepages")->enabled ? CL_FMAP_HUGEPAGES : 0));
+
+    if(optget(opts, "dev-fmap-readahead")->enabled)
+	cl_engine_set_num(engine, CL_ENGINE_FMAP_READAHEAD, optget(opts, "dev-fmap-readahead")->numarg);
+
     if(optget(opts, "leave-temps")->enabled)
 	cl_engine_set_num(engine, CL_ENGINE_KEEPTMP, 1);
 
@@ -877,6 +1245,18 @@ int scanmanager(const struct optstruct *opts)
 	procdev = sb.st_dev;
 #endif
 
+    threads = optget(opts, "threads")->numarg;
+    if(threads > 1 && opts->filename && !optget(opts, "file-list")->enabled && !strcmp(opts->filename[0], "-"))
+	threads = 1;
+#ifdef CL_THREAD_SAFE
+    if(threads > 1 && pool_init(threads, engine, opts, options))
+	logg("^Can't start the scanning threads, scanning with a single thread\n");
+#else
+    if(threads > 1)
+	logg("^--threads is not supported on this system, scanning with a single thread\n");
+#endif
+    main_sctx = cl_scan_context_new();
+
     /* check filetype */
     if(!opts->filename && !optget(opts, "file-list")->enabled) {
 	/* we need full path for some reasons (eg. archive handling) */
@@ -897,7 +1277,7 @@ int scanmanager(const struct optstruct *opts)
 
 	while((filename = filelist(opts, &ret)) && (file = strdup(filename))) {
 	    if(LSTAT(file, &sb) == -1) {
-		logg("^%s: Can't access file\n", file);
+		walk_msg("^%s: Can't access file\n", file);
 		perror(file);
 		ret = 2;
 	    } else {
@@ -911,23 +1291,23 @@ int scanmanager(const struct optstruct *opts)
 		if(S_ISLNK(sb.st_mode)) {
 		    if(dirlnk == 0 && filelnk == 0) {
 			if(!printinfected)
-			    logg("%s: Symbolic link\n", file);
+			    walk_msg("%s: Symbolic link\n", file);
 		    } else if(STAT(file, &sb) != -1) {
 			if(S_ISREG(sb.st_mode) && filelnk) {
-			    scanfile(file, engine, opts, options);
+			    queuefile(file, engine, opts, options);
 			} else if(S_ISDIR(sb.st_mode) && dirlnk) {
 			    scandirs(file, engine, opts, options, 1, sb.st_dev);
 			} else {
 			    if(!printinfected)
-				logg("%s: Symbolic link\n", file);
+				walk_msg("%s: Symbolic link\n", file);
 			}
 		    }
 		} else if(S_ISREG(sb.st_mode)) {
-		    scanfile(file, engine, opts, options);
+		    queuefile(file, engine, opts, options);
 		} else if(S_ISDIR(sb.st_mode)) {
 		    scandirs(file, engine, opts, options, 1, sb.st_dev);
 		} else {
-		    logg("^%s: Not supported file type\n", file);
+		    walk_msg("^%s: Not supported file type\n", file);
 		    ret = 2;
 		}
 	    }
@@ -935,6 +1315,12 @@ int scanmanager(const struct optstruct *opts)
 	}
     }
 
+#ifdef CL_THREAD_SAFE
+    pool_done();
+#endif
+    cl_scan_context_free(main_sctx);
+    main_sctx = NULL;
+
     /* free the engine */
     cl_engine_free(engine);
 
@@ -0,0 +1,304 @@
+/*
+ *  Per-scan arena for short lived allocations
+ *
+ *  Copyright (C) 2026 agent <agent@local>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef CL_THREAD_SAFE
+#include <pthread.h>
+#endif
+
+#include "cltypes.h"
+#include "others.h"
+#include "arena.h"
+
+/* Every block starts with this header, arena and malloc() blocks alike */
+struct arena_block {
+    uint32_t magic;
+    uint32_t freed;
+    uint64_t prev; /* offset of the previous block in the chunk */
+};
+
+#define ARENA_MAGIC 0xa7e4a001
+#define HEAP_MAGIC 0xa7e4a0ff
+#define ARENA_NONE ((uint64_t)-1)
+#define ARENA_ALIGN(x) (((x) + 15) & ~(size_t)15)
+
+struct arena_chunk {
+    struct arena_chunk *prev, *next;
+    size_t size;
+    size_t used;
+    uint64_t last; /* offset of the topmost block */
+};
+
+#define CHUNK_HDR ARENA_ALIGN(sizeof(struct arena_chunk))
+#define CHUNK_DATA(c) ((char *)(c) + CHUNK_HDR)
+#define CHUNK_BLOCK(c, off) ((struct arena_block *)(CHUNK_DATA(c) + (off)))
+
+struct cli_arena {
+    struct arena_chunk *first, *cur;
+    unsigned int depth;
+    unsigned int pinned;
+};
+
+static void arena_destroy(void *ptr)
+{
+    struct cli_arena *a = ptr;
+    struct arena_chunk *c, *next;
+
+    if(!a)
+	return;
+    for(c = a->first; c; c = next) {
+	next = c->next;
+	free(c);
+    }
+    free(a);
+}
+
+#ifdef CL_THREAD_SAFE
+static pthread_key_t arena_tls_key;
+static pthread_once_t arena_tls_key_once = PTHREAD_ONCE_INIT;
+
+static void arena_tls_key_alloc(void)
+{
+    pthread_key_create(&arena_tls_key, arena_destroy);
+}
+
+static inline struct cli_arena *arena_get(void)
+{
+    pthread_once(&arena_tls_key_once, arena_tls_key_alloc);
+    return pthread_getspecific(arena_tls_key);
+}
+
+static inline int arena_set(struct cli_arena *a)
+{
+    return pthread_setspecific(arena_tls_key, a);
+}
+#else
+static struct cli_arena *the_arena = NULL;
+
+static inline struct cli_arena *arena_get(void)
+{
+    return the_arena;
+}
+
+static inline int arena_set(struct cli_arena *a)
+{
+    the_arena = a;
+    return 0;
+}
+#endif
+
+int cli_arena_enter(void)
+{
+    struct cli_arena *a = arena_get();
+
+    if(!a) {
+	if(!(a = cli_calloc(1, sizeof(*a))))
+	    return CL_EMEM;
+	if(arena_set(a)) {
+	    free(a);
+	    return CL_EMEM;
+	}
+    }
+    a->depth++;
+    return CL_SUCCESS;
+}
+
+void cli_arena_leave(void)
+{
+    struct cli_arena *a = arena_get();
+    struct arena_chunk *c, *next, *keep = NULL;
+    size_t kept = 0;
+
+    if(!a || !a->depth || --a->depth)
+	return;
+
+    /* drop whatever was not freed and trim the chunk list */
+    for(c = a->first; c; c = next) {
+	next = c->next;
+	if(c->used)
+	    cli_dbgmsg("cli_arena_leave: %lu bytes still allocated\n", (unsigned long)c->used);
+	if(kept + c->size <= CLI_ARENA_KEEP) {
+	    kept += c->size;
+	    c->used = 0;
+	    c->last = ARENA_NONE;
+	    c->prev = keep;
+	    c->next = NULL;
+	    if(keep)
+		keep->next = c;
+	    else
+		a->first = c;
+	    keep = c;
+	} else
+	    free(c);
+    }
+    if(!keep)
+	a->first = NULL;
+    a->cur = a->first;
+}
+
+void cli_arena_pin(void)
+{
+    struct cli_arena *a = arena_get();
+
+    if(a)
+	a->pinned++;
+}
+
+void cli_arena_unpin(void)
+{
+    struct cli_arena *a = arena_get();
+
+    if(a && a->pinned)
+	a->pinned--;
+}
+
+static void *arena_alloc(struct cli_arena *a, size_t size)
+{
+    size_t need = ARENA_ALIGN(size) + sizeof(struct arena_block);
+    struct arena_chunk *c = a->cur;
+    struct arena_block *b;
+
+    if(!c || c->size - c->used < need) {
+	/* chunks past the current one are empty, reuse the first one that
+	 * fits and drop the smaller ones in front of it */
+	while(c && c->next && c->next->size < need) {
+	    struct arena_chunk *drop = c->next;
+
+	    c->next = drop->next;
+	    if(c->next)
+		c->next->prev = c;
+	    free(drop);
+	}
+	if(c && c->next) {
+	    c = c->next;
+	} else {
+	    struct arena_chunk *n;
+	    size_t csize = CHUNK_HDR + need;
+
+	    if(csize < CLI_ARENA_CHUNK)
+		csize = CLI_ARENA_CHUNK;
+	    if(!(n = malloc(csize)))
+		return NULL;
+	    n->size = csize - CHUNK_HDR;
+	    n->prev = c;
+	    n->next = NULL;
+	    if(c)
+		c->next = n;
+	    else
+		a->first = n;
+	    c = n;
+	}
+	c->used = 0;
+	c->last = ARENA_NONE;
+	a->cur = c;
+    }
+
+    b = CHUNK_BLOCK(c, c->used);
+    b->magic = ARENA_MAGIC;
+    b->freed = 0;
+    b->prev = c->last;
+    c->last = c->used;
+    c->used += need;
+    return b + 1;
+}
+
+/* release the freed blocks at the top of the stack */
+static void arena_pop(struct cli_arena *a)
+{
+    struct arena_chunk *c = a->cur;
+
+    while(c) {
+	while(c->last != ARENA_NONE && CHUNK_BLOCK(c, c->last)->freed) {
+	    c->used = c->last;
+	    c->last = CHUNK_BLOCK(c, c->last)->prev;
+	}
+	if(c->used || !c->prev)
+	    break;
+	c = a->cur = c->prev;
+    }
+}
+
+void *cli_arena_malloc(size_t size)
+{
+    struct cli_arena *a = arena_get();
+    struct arena_block *b;
+
+    if(!size || size > CLI_MAX_ALLOCATION) {
+	cli_errmsg("cli_arena_malloc(): Attempt to allocate %lu bytes. Please report to http://bugs.clamav.net\n", (unsigned long int) size);
+	return NULL;
+    }
+
+    if(a && a->depth && !a->pinned) {
+	void *ptr = arena_alloc(a, size);
+
+	if(!ptr)
+	    cli_errmsg("cli_arena_malloc(): Can't allocate memory (%lu bytes).\n", (unsigned long int) size);
+	return ptr;
+    }
+
+    if(!(b = malloc(sizeof(*b) + size))) {
+	cli_errmsg("cli_arena_malloc(): Can't allocate memory (%lu bytes).\n", (unsigned long int) size);
+	return NULL;
+    }
+    b->magic = HEAP_MAGIC;
+    return b + 1;
+}
+
+void *cli_arena_calloc(size_t nmemb, size_t size)
+{
+    void *ptr;
+
+    if(!nmemb || !size || size > CLI_MAX_ALLOCATION || nmemb > CLI_MAX_ALLOCATION
+	|| (nmemb * size > CLI_MAX_ALLOCATION)) {
+	cli_errmsg("cli_arena_calloc(): Attempt to allocate %lu bytes. Please report to http://bugs.clamav.net\n", (unsigned long int) nmemb * size);
+	return NULL;
+    }
+
+    if((ptr = cli_arena_malloc(nmemb * size)))
+	memset(ptr, 0, nmemb * size);
+    return ptr;
+}
+
+void cli_arena_free(void *ptr)
+{
+    struct arena_block *b;
+    struct cli_arena *a;
+
+    if(!ptr)
+	return;
+
+    b = (struct arena_block *)ptr - 1;
+    if(b->magic == HEAP_MAGIC) {
+	free(b);
+	return;
+    }
+    if(b->magic != ARENA_MAGIC || b->freed) {
+	cli_errmsg("cli_arena_free(): Attempt to free an invalid pointer\n");
+	return;
+    }
+    b->freed = 1;
+    if((a = arena_get()) && a->cur)
+	arena_pop(a);
+}
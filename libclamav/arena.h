@@ -0,0 +1,56 @@
+/*
+ *  Per-scan arena for short lived allocations
+ *
+ *  Copyright (C) 2026 agent <agent@local>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#ifndef __ARENA_H
+#define __ARENA_H
+
+#include <stdlib.h>
+
+/*
+ * Each thread owns one arena, active between cli_arena_enter() and the
+ * matching cli_arena_leave() (scan_common() brackets every scan with them).
+ * While it is active cli_arena_malloc() bumps a pointer in the current chunk
+ * instead of going to the system allocator; cli_arena_free() gives the space
+ * back as soon as everything allocated after it has been freed too, so the
+ * usual nested init/free pairs of the matchers reuse the same memory.
+ * Whatever is left is dropped when the outermost scan ends, and up to
+ * CLI_ARENA_KEEP bytes of chunks stay with the thread for the next scan.
+ *
+ * Outside of a scan the calls fall back to malloc(); cli_arena_free() tells
+ * the two kinds apart, so it must be used for everything the cli_arena_*
+ * allocators returned and for nothing else.
+ *
+ * Between cli_arena_pin() and cli_arena_unpin() the allocators take the
+ * malloc() path even inside a scan; that is for data which is set up during
+ * a scan but cached past its end (see scanctx.c).
+ */
+#define CLI_ARENA_CHUNK (256 * 1024)
+#define CLI_ARENA_KEEP (8 * 1024 * 1024)
+
+int cli_arena_enter(void);
+void cli_arena_leave(void);
+void cli_arena_pin(void);
+void cli_arena_unpin(void);
+
+void *cli_arena_malloc(size_t size);
+void *cli_arena_calloc(size_t nmemb, size_t size);
+void cli_arena_free(void *ptr);
+
+#endif
@@ -38,6 +38,7 @@
 #include "bytecode_api.h"
 #include "bytecode_api_impl.h"
 #include "builtin_bytecodes.h"
+#include "perflogging.h"
 #include <string.h>
 
 /* dummy values */
@@ -102,6 +103,14 @@ struct cli_bc_ctx *cli_bytecode_context_alloc(void)
     return ctx;
 }
 
+/* puts ctx back into the state cli_bytecode_context_alloc() returns it in */
+void cli_bytecode_context_reinit(struct cli_bc_ctx *ctx)
+{
+    cli_bytecode_context_clear(ctx);
+    ctx->bytecode_timeout = 60000;
+    cli_bytecode_context_reset(ctx);
+}
+
 void cli_bytecode_context_destroy(struct cli_bc_ctx *ctx)
 {
    cli_bytecode_context_clear(ctx);
@@ -167,6 +176,8 @@ static int cli_bytecode_context_reset(struct cli_bc_ctx *ctx)
 	if (ret != CL_CLEAN)
 	    ctx->found = 1;
     }
+    cli_bcapi_file_view_release(ctx);
+    ctx->find_idx = -1;
     ctx->numParams = 0;
     ctx->funcid = 0;
     /* don't touch fmap, file_size, and hooks, sections, ctx, timeout, pdf* */
@@ -1633,6 +1644,7 @@ int cli_bytecode_run(const struct cli_all_bc *bcs, const struct cli_bc *bc, stru
 	cli_dbgmsg("bytecode triggered but running bytecodes is disabled\n");
 	return CL_SUCCESS;
     }
+    cli_counter_add(CL_COUNTER_BYTECODE_RUNS, 1);
     if (cctx)
         cli_event_time_start(cctx->perf, PERFT_BYTECODE);
     ctx->env = &bcs->env;
@@ -1652,6 +1664,8 @@ int cli_bytecode_run(const struct cli_all_bc *bcs, const struct cli_bc *bc, stru
 	    return CL_EBYTECODE_TESTFAIL;
 	}
     }
+    if (cctx)
+	cli_stats_start(cctx, PERFT_BYTECODE);
     if (bc->state == bc_interp || test_mode) {
 	ctx->bc_events = interp_ev;
 	memset(&func, 0, sizeof(func));
@@ -1747,8 +1761,10 @@ int cli_bytecode_run(const struct cli_all_bc *bcs, const struct cli_bc *bc, stru
     }
     cli_events_free(jit_ev);
     cli_events_free(interp_ev);
-    if (cctx)
+    if (cctx) {
         cli_event_time_stop(cctx->perf, PERFT_BYTECODE);
+        cli_stats_stop(cctx, PERFT_BYTECODE);
+    }
     return ret;
 }
 
@@ -98,6 +98,7 @@ int cli_bytecode_context_clear(struct cli_bc_ctx *ctx);
 int cli_bytecode_context_getresult_file(struct cli_bc_ctx *ctx, char **tempfilename);
 uint64_t cli_bytecode_context_getresult_int(struct cli_bc_ctx *ctx);
 void cli_bytecode_context_destroy(struct cli_bc_ctx *ctx);
+void cli_bytecode_context_reinit(struct cli_bc_ctx *ctx);
 
 #ifdef __cplusplus
 extern "C" {
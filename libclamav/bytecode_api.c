@@ -330,32 +330,6 @@ uint32_t cli_bcapi_pe_rawaddr(struct cli_bc_ctx *ctx, uint32_t rva)
   return ret;
 }
 
-static inline const char* cli_memmem(const char *haystack, unsigned hlen,
-				     const unsigned char *needle, unsigned nlen)
-{
-    const char *p;
-    unsigned char c;
-    if (!needle || !haystack) {
-	return NULL;
-    }
-    c = *needle++;
-    if (nlen == 1)
-	return memchr(haystack, c, hlen);
-
-    while (hlen >= nlen) {
-	p = haystack;
-	haystack = memchr(haystack, c, hlen - nlen + 1);
-	if (!haystack)
-	    return NULL;
-	hlen -= haystack+1 - p;
-	p = haystack + 1;
-	if (!memcmp(p, needle, nlen-1))
-	    return haystack;
-	haystack = p;
-    }
-    return NULL;
-}
-
 int32_t cli_bcapi_file_find(struct cli_bc_ctx *ctx, const uint8_t* data, uint32_t len)
 {
     fmap_t *map = ctx->fmap;
@@ -367,14 +341,15 @@ int32_t cli_bcapi_file_find(struct cli_bc_ctx *ctx, const uint8_t* data, uint32_
     return cli_bcapi_file_find_limit(ctx, data, len, map->len);
 }
 
+/* the file is searched in place, this much at a time */
+#define BC_FIND_WINDOW (64 * 1024)
+
 int32_t cli_bcapi_file_find_limit(struct cli_bc_ctx *ctx , const uint8_t* data, uint32_t len, int32_t limit)
 {
-    char buf[4096];
     fmap_t *map = ctx->fmap;
-    uint32_t off = ctx->off;
-    int n;
+    uint32_t off = ctx->off, n;
 
-    if (!map || len > sizeof(buf)/4 || len <= 0 || limit <= 0) {
+    if (!map || len > 1024 || len <= 0 || limit <= 0) {
 	cli_dbgmsg("bcapi_file_find_limit preconditions not met\n");
 	API_MISUSE();
 	return -1;
@@ -382,38 +357,38 @@ int32_t cli_bcapi_file_find_limit(struct cli_bc_ctx *ctx , const uint8_t* data,
 
     cli_event_int(EV, BCEV_OFFSET, off);
     cli_event_fastdata(EV, BCEV_FIND, data, len);
-    for (;;) {
-	const char *p;
-	int32_t readlen = sizeof(buf);
-	if (off + readlen > limit) {
-	    readlen = limit - off;
-	    if (readlen < 0)
-		return -1;
-	}
-	n = fmap_readn(map, buf, off, readlen);
-	if ((unsigned)n < len || n < 0)
+    if ((uint32_t)limit > map->len)
+	limit = map->len;
+    while (off + len <= (uint32_t)limit) {
+	const char *buf, *p;
+
+	n = MIN(BC_FIND_WINDOW, limit - off);
+	if (!(buf = fmap_need_off_once(map, off, n)))
 	    return -1;
-	p = cli_memmem(buf, n, data, len);
+	p = cli_memstr(buf, n, (const char *)data, len);
 	if (p)
 	    return off + p - buf;
-	off += n;
+	if (off + n == (uint32_t)limit)
+	    break;
+	/* the next window starts where a match could still begin */
+	off += n - len + 1;
     }
     return -1;
 }
 
 int32_t cli_bcapi_file_byteat(struct cli_bc_ctx *ctx, uint32_t off)
 {
-    unsigned char c;
+    const unsigned char *p;
     if (!ctx->fmap) {
 	cli_dbgmsg("bcapi_file_byteat: no fmap\n");
 	return -1;
     }
     cli_event_int(EV, BCEV_OFFSET, off);
-    if (fmap_readn(ctx->fmap, &c, off, 1) != 1) {
-	cli_dbgmsg("bcapi_file_byteat: fmap_readn failed at %u\n", off);
+    if (!(p = fmap_need_off_once(ctx->fmap, off, 1))) {
+	cli_dbgmsg("bcapi_file_byteat: fmap_need_off_once failed at %u\n", off);
 	return -1;
     }
-    return c;
+    return *p;
 }
 
 uint8_t* cli_bcapi_malloc(struct cli_bc_ctx *ctx, uint32_t size)
@@ -1259,6 +1234,8 @@ int32_t cli_bcapi_input_switch(struct cli_bc_ctx *ctx , int32_t extracted_file)
     fmap_t *map;
     if (ctx->extracted_file_input == extracted_file)
 	return 0;
+    /* a view belongs to the map it was taken from */
+    cli_bcapi_file_view_release(ctx);
     if (!extracted_file) {
 	cli_dbgmsg("bytecode api: input switched back to main file\n");
 	ctx->fmap = ctx->save_map;
@@ -1514,3 +1491,97 @@ int32_t cli_bcapi_get_file_reliability(struct cli_bc_ctx *ctx )
     cli_ctx *cctx = (cli_ctx*)ctx->ctx;
     return cctx ? cctx->corrupted_input : 3;
 }
+
+void cli_bcapi_file_view_release(struct cli_bc_ctx *ctx)
+{
+    if (ctx->view_map) {
+	fmap_unneed_off(ctx->view_map, ctx->view_off, ctx->view_len);
+	ctx->view_map = NULL;
+	ctx->view_off = ctx->view_len = 0;
+    }
+}
+
+const uint8_t* cli_bcapi_file_view(struct cli_bc_ctx *ctx , int32_t offset, uint32_t size)
+{
+    fmap_t *map = ctx->fmap;
+    const uint8_t *p;
+
+    /* only one view at a time: the pages of the previous one can go */
+    cli_bcapi_file_view_release(ctx);
+    if (!map || offset < 0 || !size || (uint32_t)offset >= map->len || size > map->len - offset) {
+	cli_dbgmsg("bcapi_file_view: invalid view %d+%u\n", offset, size);
+	return NULL;
+    }
+    cli_event_int(EV, BCEV_OFFSET, offset);
+    if (!(p = fmap_need_off(map, offset, size))) {
+	cli_dbgmsg("bcapi_file_view: fmap_need_off failed at %d+%u\n", offset, size);
+	cli_event_count(EV, BCEV_READ_ERR);
+	return NULL;
+    }
+    ctx->view_map = map;
+    ctx->view_off = offset;
+    ctx->view_len = size;
+    return p;
+}
+
+#define BC_FIND_MAXPATTERNS 64
+
+int32_t cli_bcapi_file_find_any(struct cli_bc_ctx *ctx , const uint8_t* patterns, int32_t len, int32_t limit)
+{
+    fmap_t *map = ctx->fmap;
+    const char *pat[BC_FIND_MAXPATTERNS], *s;
+    unsigned int plen[BC_FIND_MAXPATTERNS], idx;
+    unsigned npat = 0, maxlen = 0, minlen = 256, i;
+    uint32_t off = ctx->off, n, end;
+
+    ctx->find_idx = -1;
+    if (!map || !patterns || len <= 0 || limit <= 0) {
+	cli_dbgmsg("bcapi_file_find_any preconditions not met\n");
+	API_MISUSE();
+	return -1;
+    }
+    for (i = 0; i < (unsigned)len; i += plen[npat++] + 1) {
+	if (npat == BC_FIND_MAXPATTERNS || !patterns[i] || patterns[i] > len - i - 1) {
+	    cli_dbgmsg("bcapi_file_find_any: invalid pattern list\n");
+	    API_MISUSE();
+	    return -1;
+	}
+	plen[npat] = patterns[i];
+	pat[npat] = (const char*)&patterns[i + 1];
+	if (plen[npat] > maxlen)
+	    maxlen = plen[npat];
+	if (plen[npat] < minlen)
+	    minlen = plen[npat];
+    }
+
+    cli_event_int(EV, BCEV_OFFSET, off);
+    cli_event_fastdata(EV, BCEV_FIND, patterns, len);
+    if ((uint32_t)limit > map->len)
+	limit = map->len;
+    while (off + minlen <= (uint32_t)limit) {
+	const uint8_t *buf;
+	int last;
+
+	n = MIN(BC_FIND_WINDOW, limit - off);
+	if (!(buf = fmap_need_off_once(map, off, n)))
+	    return -1;
+	/* a match past the positions every pattern fits at may hide an
+	 * earlier one of a longer pattern, the next window decides */
+	last = off + n == (uint32_t)limit;
+	end = last ? n - minlen + 1 : n - maxlen + 1;
+	s = cli_memstr_any((const char*)buf, n, pat, plen, npat, &idx);
+	if (s && (last || s - (const char*)buf < end)) {
+	    ctx->find_idx = idx;
+	    return off + (s - (const char*)buf);
+	}
+	if (last)
+	    break;
+	off += end;
+    }
+    return -1;
+}
+
+int32_t cli_bcapi_file_find_any_index(struct cli_bc_ctx *ctx )
+{
+    return ctx->find_idx;
+}
@@ -997,5 +997,34 @@ int32_t running_on_jit(void);
 int32_t get_file_reliability(void);
 
 /* ----------------- END 0.96.4 APIs ---------------------------------- */
+/* ----------------- BEGIN zero-copy file APIs ------------------------ */
+/** Returns a read-only view of the current file, without copying it.
+  \group_file
+  * The view points into the file's map and stays valid until the next
+  * file_view() call or the end of the bytecode, whichever comes first.
+  * Only \p size bytes can be accessed through it.
+  * @param offset file offset where the view starts
+  * @param size length of the view, must be within the file
+  * @return pointer to the data, or NULL if the range is invalid */
+const uint8_t* file_view(int32_t offset, uint32_t size);
+
+/** Looks for the first occurrence of any of several byte sequences in the
+ * current file, starting at the current position, up to \p maxpos.
+  \group_file
+  * The file is searched in place. If more patterns match at the same
+  * offset the first one in \p patterns wins.
+  * @param[in] patterns up to 64 patterns, each one a length byte (1-255)
+  * followed by that many bytes
+  * @param len total length of \p patterns
+  * @param maxpos 1 byte after the end of the last possible match
+  * @return offset of the match, -1 if none. See file_find_any_index() for
+  * which pattern matched */
+int32_t file_find_any(const uint8_t* patterns, int32_t len, int32_t maxpos);
+
+/** Returns the index (from 0) in \p patterns of the pattern found by the
+ * last file_find_any() call, -1 if it found nothing.
+  \group_file */
+int32_t file_find_any_index(void);
+/* ----------------- END zero-copy file APIs -------------------------- */
 #endif
 #endif
@@ -124,6 +124,9 @@ int32_t cli_bcapi_pdf_get_dumpedobjid(struct cli_bc_ctx *ctx );
 int32_t cli_bcapi_matchicon(struct cli_bc_ctx *ctx , const uint8_t*, int32_t, const uint8_t*, int32_t);
 int32_t cli_bcapi_running_on_jit(struct cli_bc_ctx *ctx );
 int32_t cli_bcapi_get_file_reliability(struct cli_bc_ctx *ctx );
+const uint8_t* cli_bcapi_file_view(struct cli_bc_ctx *ctx , int32_t, uint32_t);
+int32_t cli_bcapi_file_find_any(struct cli_bc_ctx *ctx , const uint8_t*, int32_t, int32_t);
+int32_t cli_bcapi_file_find_any_index(struct cli_bc_ctx *ctx );
 
 const struct cli_apiglobal cli_globals[] = {
 /* Bytecode globals BEGIN */
@@ -299,7 +302,10 @@ const struct cli_apicall cli_apicalls[]={
 	{"pdf_get_dumpedobjid", 8, 8, 5},
 	{"matchicon", 9, 2, 8},
 	{"running_on_jit", 8, 9, 5},
-	{"get_file_reliability", 8, 10, 5}
+	{"get_file_reliability", 8, 10, 5},
+	{"file_view", 12, 4, 6},
+	{"file_find_any", 14, 7, 9},
+	{"file_find_any_index", 8, 11, 5}
 /* Bytecode APIcalls END */
 };
 const cli_apicall_int2 cli_apicalls0[] = {
@@ -383,13 +389,15 @@ const cli_apicall_allocobj cli_apicalls5[] = {
 	(cli_apicall_allocobj)cli_bcapi_pdf_get_phase,
 	(cli_apicall_allocobj)cli_bcapi_pdf_get_dumpedobjid,
 	(cli_apicall_allocobj)cli_bcapi_running_on_jit,
-	(cli_apicall_allocobj)cli_bcapi_get_file_reliability
+	(cli_apicall_allocobj)cli_bcapi_get_file_reliability,
+	(cli_apicall_allocobj)cli_bcapi_file_find_any_index
 };
 const cli_apicall_bufget cli_apicalls6[] = {
 	(cli_apicall_bufget)cli_bcapi_buffer_pipe_read_get,
 	(cli_apicall_bufget)cli_bcapi_buffer_pipe_write_get,
 	(cli_apicall_bufget)cli_bcapi_map_getvalue,
-	(cli_apicall_bufget)cli_bcapi_pdf_getobj
+	(cli_apicall_bufget)cli_bcapi_pdf_getobj,
+	(cli_apicall_bufget)cli_bcapi_file_view
 };
 const cli_apicall_int3 cli_apicalls7[] = {
 	(cli_apicall_int3)cli_bcapi_inflate_init,
@@ -411,6 +419,7 @@ const cli_apicall_ptrbufid cli_apicalls9[] = {
 	(cli_apicall_ptrbufid)cli_bcapi_map_find,
 	(cli_apicall_ptrbufid)cli_bcapi_file_find_limit,
 	(cli_apicall_ptrbufid)cli_bcapi_disable_bytecode_if,
-	(cli_apicall_ptrbufid)cli_bcapi_disable_jit_if
+	(cli_apicall_ptrbufid)cli_bcapi_disable_jit_if,
+	(cli_apicall_ptrbufid)cli_bcapi_file_find_any
 };
 const unsigned cli_apicall_maxapi = sizeof(cli_apicalls)/sizeof(cli_apicalls[0]);
@@ -122,5 +122,8 @@ int32_t cli_bcapi_pdf_get_dumpedobjid(struct cli_bc_ctx *ctx );
 int32_t cli_bcapi_matchicon(struct cli_bc_ctx *ctx , const uint8_t*, int32_t, const uint8_t*, int32_t);
 int32_t cli_bcapi_running_on_jit(struct cli_bc_ctx *ctx );
 int32_t cli_bcapi_get_file_reliability(struct cli_bc_ctx *ctx );
+const uint8_t* cli_bcapi_file_view(struct cli_bc_ctx *ctx , int32_t, uint32_t);
+int32_t cli_bcapi_file_find_any(struct cli_bc_ctx *ctx , const uint8_t*, int32_t, int32_t);
+int32_t cli_bcapi_file_find_any_index(struct cli_bc_ctx *ctx );
 
 #endif
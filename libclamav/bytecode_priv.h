@@ -227,6 +227,9 @@ struct cli_bc_ctx {
     cli_events_t *bc_events;
     int on_jit;
     int no_diff;
+    fmap_t *view_map;
+    size_t view_off, view_len;
+    int32_t find_idx;
 };
 struct cli_all_bc;
 int cli_vm_execute(const struct cli_bc *bc, struct cli_bc_ctx *ctx, const struct cli_bc_func *func, const struct cli_bc_inst *inst);
@@ -239,6 +242,8 @@ int cli_vm_execute_jit(const struct cli_all_bc *bcs, struct cli_bc_ctx *ctx, con
 int cli_bytecode_prepare_jit(struct cli_all_bc *bc);
 int cli_bytecode_init_jit(struct cli_all_bc *bc, unsigned dconfmask);
 int cli_bytecode_done_jit(struct cli_all_bc *bc, int partial);
+/* drops the pages locked by the last file_view() */
+void cli_bcapi_file_view_release(struct cli_bc_ctx *ctx);
 
 #ifdef __cplusplus
 }
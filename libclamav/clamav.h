@@ -190,9 +190,23 @@ enum cl_engine_field {
     CL_ENGINE_MAX_HTMLNORMALIZE,    /* uint64_t */
     CL_ENGINE_MAX_HTMLNOTAGS,       /* uint64_t */
     CL_ENGINE_MAX_SCRIPTNORMALIZE,  /* uint64_t */
-    CL_ENGINE_MAX_ZIPTYPERCG        /* uint64_t */
+    CL_ENGINE_MAX_ZIPTYPERCG,       /* uint64_t */
+    CL_ENGINE_BM_LITERAL,           /* uint32_t */
+    CL_ENGINE_FMAP_FLAGS,           /* uint32_t */
+    CL_ENGINE_FMAP_READAHEAD        /* uint32_t */
 };
 
+/* CL_ENGINE_FMAP_FLAGS: how the files scanned by descriptor are mapped
+ * CL_FMAP_MMAP - map the file itself read-only instead of reading it into an
+ *     anonymous map with pread(); the file must not be truncated while it is
+ *     being scanned (SIGBUS), which the pread() path would detect
+ * CL_FMAP_HUGEPAGES - ask for transparent huge pages to back the anonymous
+ *     map of the pread() path
+ * CL_ENGINE_FMAP_READAHEAD is the size in bytes of the window the kernel is
+ * asked to read ahead of the matchers, 0 leaves it to the default readahead */
+#define CL_FMAP_MMAP		0x1
+#define CL_FMAP_HUGEPAGES	0x2
+
 enum bytecode_security {
     CL_BYTECODE_TRUST_ALL=0, /* obsolete */
     CL_BYTECODE_TRUST_SIGNED, /* default */
@@ -340,6 +354,61 @@ typedef cl_error_t (*clcb_meta)(const char* container_type, unsigned long fsize_
 			  unsigned long fsize_real,  int is_encrypted, unsigned int filepos_container, void *context);
 extern void cl_engine_set_clcb_meta(struct cl_engine *engine, clcb_meta callback);
 
+/* Per-scan statistics callback, called at the end of each cl_scan* call.
+ * Times are wall clock microseconds; nested files add to the stage they
+ * were scanned in (e.g. a PE inside a ZIP adds to time_container).
+ * Statistics are only collected when the callback is set; it receives the
+ * result of the scan and the context of cl_scandesc_callback.
+ */
+#define CL_STATS_ROOTS 16
+struct cl_scan_stats {
+    unsigned long long time_total;	/* the whole scan */
+    unsigned long long time_filetype;	/* file type detection */
+    unsigned long long time_cache;	/* cache lookups */
+    unsigned long long time_raw;	/* raw signature matching */
+    unsigned long long time_container;	/* format/container handlers */
+    unsigned long long time_bytecode;	/* bytecode execution */
+    unsigned long long bytes_root[CL_STATS_ROOTS]; /* bytes fed to each
+					 * matcher root: 0 generic, 1 PE,
+					 * 2 OLE2, 3 HTML, 4 MAIL, 5 GRAPHICS,
+					 * 6 ELF, 7 ASCII, 9 MACH-O, 10 PDF */
+    unsigned int files;			/* files scanned, embedded included */
+    unsigned int cache_hits;
+    unsigned int cache_misses;
+};
+typedef void (*clcb_stats)(const struct cl_scan_stats *stats, cl_error_t result, void *context);
+extern void cl_engine_set_clcb_stats(struct cl_engine *engine, clcb_stats callback);
+
+/* Process wide hot path counters. They are off by default and can be
+ * switched on and off at any time; each thread counts into its own block
+ * and cl_counters_get() sums the blocks up, so the values are a close
+ * (not atomic) snapshot while scans are running.
+ */
+enum cl_counter {
+    CL_COUNTER_FILTER_CALLS,	/* buffers checked by the prefilter */
+    CL_COUNTER_FILTER_REJECTS,	/* ... where no pattern could start */
+    CL_COUNTER_FILTER_SKIPPED,	/* bytes the tries didn't have to scan */
+    CL_COUNTER_AC_BYTES,	/* bytes scanned = AC trie nodes visited */
+    CL_COUNTER_AC_FINAL,	/* final AC nodes reached */
+    CL_COUNTER_AC_VERIFY,	/* AC pattern candidates verified */
+    CL_COUNTER_BM_BYTES,	/* bytes given to Boyer-Moore */
+    CL_COUNTER_BM_SHIFTS,	/* BM shifts taken */
+    CL_COUNTER_BM_VERIFY,	/* BM pattern candidates verified */
+    CL_COUNTER_LSIG_EVALS,	/* logical signature evaluations */
+    CL_COUNTER_FMAP_READS,	/* reads issued by fmap */
+    CL_COUNTER_FMAP_PAGES,	/* pages faulted into fmap */
+    CL_COUNTER_BYTECODE_RUNS,	/* bytecode executions */
+    CL_COUNTER_LAST
+};
+extern void cl_counters_enable(int enable);
+extern int cl_counters_enabled(void);
+/* Fills up to count values (indexed by enum cl_counter) and returns the
+ * number of values filled in */
+extern unsigned int cl_counters_get(unsigned long long *values, unsigned int count);
+/* Counters start from zero again; blocks of running threads are kept */
+extern void cl_counters_reset(void);
+extern const char *cl_counter_name(enum cl_counter counter);
+
 struct cl_stat {
     char *dir;
     STATBUF *stattab;
@@ -366,6 +435,22 @@ extern int cl_scandesc_callback(int desc, const char **virname, unsigned long in
 extern int cl_scanfile(const char *filename, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions);
 extern int cl_scanfile_callback(const char *filename, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, void *context);
 
+/* Reusable scan state. A scan context caches the matcher working data
+ * sized by the loaded database between the scans made with it, instead
+ * of setting it up and tearing it down for every file. Use one per thread:
+ * it must not be used by two scans at the same time. It may be used with
+ * different engines, switching drops whatever was cached for the old one;
+ * cl_scan_context_reset() does the same explicitly (e.g. after a reload).
+ */
+struct cl_scan_context;
+extern struct cl_scan_context *cl_scan_context_new(void);
+extern void cl_scan_context_reset(struct cl_scan_context *sctx);
+extern void cl_scan_context_free(struct cl_scan_context *sctx);
+
+/* same as the *_callback functions, sctx may be NULL */
+extern int cl_scandesc_context(int desc, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, void *context, struct cl_scan_context *sctx);
+extern int cl_scanfile_context(const char *filename, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, void *context, struct cl_scan_context *sctx);
+
 /* database handling */
 extern int cl_load(const char *path, struct cl_engine *engine, unsigned int *signo, unsigned int dboptions);
 extern const char *cl_retdbdir(void);
@@ -418,6 +503,14 @@ typedef off_t (*clcb_pread)(void* handle, void *buf, size_t count, off_t offset)
 extern cl_fmap_t *cl_fmap_open_handle(void* handle, size_t offset, size_t len,
 				      clcb_pread, int use_aging);
 
+/* Open a map of the file descriptor fd whose reads go through pread_cb
+ * (which gets handle), e.g. to schedule them differently. Unlike a map from
+ * cl_fmap_open_handle(), the scanners that need a real descriptor (RAR,
+ * callbacks, ...) get fd. fd must stay open until the map is closed.
+ */
+extern cl_fmap_t *cl_fmap_open_fd_cb(int fd, size_t offset, size_t len,
+				     void *handle, clcb_pread pread_cb);
+
 /* Open a map for scanning custom data, where the data is already in memory,
  * either in the form of a buffer, a memory mapped file, etc.
  * Note that the memory [start, start+len) must be the _entire_ file,
@@ -431,6 +524,26 @@ extern void cl_fmap_close(cl_fmap_t*);
 
 /* Scan custom data */
 extern int cl_scanmap_callback(cl_fmap_t *map, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, void *context);
+extern int cl_scanmap_context(cl_fmap_t *map, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, void *context, struct cl_scan_context *sctx);
+
+/* Scan many (typically small) objects in one call. Each item is either a
+ * map or, with map == NULL, the len bytes at data. context is passed to the
+ * callbacks of that item. On return result and virname hold what
+ * cl_scanmap_callback() would have returned and stored for the item.
+ * The items are spread over up to threads threads (the calling one
+ * included); each thread scans with its own struct cl_scan_context, so the
+ * per-object setup is paid once per thread rather than once per item.
+ * Returns CL_SUCCESS once all items have been scanned.
+ */
+struct cl_scan_item {
+    cl_fmap_t *map;
+    const void *data;
+    size_t len;
+    void *context;
+    const char *virname;
+    int result;
+};
+extern int cl_scanmap_batch(struct cl_scan_item *items, unsigned int nitems, const struct cl_engine *engine, unsigned int scanoptions, unsigned int threads);
 
 #ifdef __cplusplus
 }
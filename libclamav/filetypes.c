@@ -43,6 +43,7 @@
 #include "htmlnorm.h"
 #include "entconv.h"
 #include "mpool.h"
+#include "scanctx.h"
 
 static const struct ftmap_s {
     const char *name;
@@ -158,7 +159,7 @@ cli_file_t cli_filetype(const unsigned char *buf, size_t buflen, const struct cl
 
 int is_tar(const unsigned char *buf, unsigned int nbytes);
 
-cli_file_t cli_filetype2(fmap_t *map, const struct cl_engine *engine)
+cli_file_t cli_filetype2(fmap_t *map, const struct cl_engine *engine, struct cl_scan_context *sctx)
 {
 	unsigned char buffer[MAGIC_BUFFER_SIZE];
 	const unsigned char *buff;
@@ -206,17 +207,17 @@ cli_file_t cli_filetype2(fmap_t *map, const struct cl_engine *engine)
 	if(!root)
 	    return ret;
 
-	if(cli_ac_initdata(&mdata, root->ac_partsigs, root->ac_lsigs, root->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN))
+	if(cli_scanctx_initdata(sctx, &mdata, root))
 	    return ret;
 
 	sret = cli_ac_scanbuff(buff, bread, NULL, NULL, NULL, engine->root[0], &mdata, 0, ret, NULL, AC_SCAN_FT, NULL);
 
-	cli_ac_freedata(&mdata);
+	cli_scanctx_freedata(sctx, &mdata);
 
 	if(sret >= CL_TYPENO) {
 	    ret = sret;
 	} else {
-	    if(cli_ac_initdata(&mdata, root->ac_partsigs, root->ac_lsigs, root->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN))
+	    if(cli_scanctx_initdata(sctx, &mdata, root))
 		return ret;
 
 	    decoded = (unsigned char *) cli_utf16toascii((char *) buff, bread);
@@ -226,7 +227,7 @@ cli_file_t cli_filetype2(fmap_t *map, const struct cl_engine *engine)
 		if(sret == CL_TYPE_HTML)
 		    ret = CL_TYPE_HTML_UTF16;
 	    }
-	    cli_ac_freedata(&mdata);
+	    cli_scanctx_freedata(sctx, &mdata);
 
 	    if((((struct cli_dconf*) engine->dconf)->phishing & PHISHING_CONF_ENTCONV) && ret != CL_TYPE_HTML_UTF16) {
 		    const char* encoding;
@@ -252,7 +253,7 @@ cli_file_t cli_filetype2(fmap_t *map, const struct cl_engine *engine)
 			     * However when detecting whether a file is HTML or not, we need exact conversion.
 			     * (just eliminating zeros and matching would introduce false positives */
 			    if(encoding_normalize_toascii(&in_area, encoding, &out_area) >= 0 && out_area.length > 0) {
-				    if(cli_ac_initdata(&mdata, root->ac_partsigs, root->ac_lsigs, root->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN))
+				    if(cli_scanctx_initdata(sctx, &mdata, root))
 					    return ret;
 
 				    if(out_area.length > 0) {
@@ -264,7 +265,7 @@ cli_file_t cli_filetype2(fmap_t *map, const struct cl_engine *engine)
 					    }
 				    }
 
-				    cli_ac_freedata(&mdata);
+				    cli_scanctx_freedata(sctx, &mdata);
 			    }
 		    }
 	    }
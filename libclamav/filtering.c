@@ -26,7 +26,6 @@
 #include "matcher-ac.h"
 #include <string.h>
 #include <assert.h>
-#include "perflogging.h"
 /* ----- shift-or filtering -------------- */
 
 /*
@@ -154,7 +153,6 @@ static inline int filter_isset(const struct filter *m, unsigned pos, uint16_t va
 static inline void filter_set_atpos(struct filter *m, unsigned pos, uint16_t val)
 {
 	if (!filter_isset(m, pos, val)) {
-		cli_perf_log_count(FILTER_LOAD, pos);
 		m->B[val] &= ~(1<<pos);
 	}
 }
@@ -168,7 +166,6 @@ static inline int filter_end_isset(const struct filter *m, unsigned pos, uint16_
 static inline void filter_set_end(struct filter *m, unsigned pos, uint16_t a)
 {
 	if (!filter_end_isset(m, pos, a)) {
-		cli_perf_log_count(FILTER_END_LOAD, pos);
 		m->end[a] &= ~(1 << pos);
 	}
 }
@@ -188,7 +185,6 @@ int filter_add_static(struct filter *m, const unsigned char *pattern, unsigned l
 	uint32_t best = 0xffffffff;
 	uint8_t best_pos = 0;
 
-	cli_perf_log_count(TRIE_ORIG_LEN, len > 8 ? 8 : len);
 	/* TODO: choose best among MAXCHOICES */
 	/* cut length */
 	if(len > MAXPATLEN) {
@@ -453,7 +449,6 @@ int  filter_add_acpatt(struct filter *m, const struct cli_ac_patt *pat)
 		 * case */
 		return filter_add_static(m, patc, j, pat->virname);
 	}
-	cli_perf_log_count(TRIE_ORIG_LEN, j > 8 ? 8 : j);
 	i = 0;
 	if (!prefix_len) {
 	    while ((pat->pattern[i] & CLI_MATCH_WILDCARD) == CLI_MATCH_SPECIAL) {
@@ -30,6 +30,9 @@
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#ifndef _WIN32
+#include <fcntl.h>
+#endif
 #ifdef ANONYMOUS_MAP
 #ifdef HAVE_SYS_MMAN_H
 #include <sys/mman.h>
@@ -43,10 +46,15 @@
 
 #include "others.h"
 #include "cltypes.h"
+#include "perflogging.h"
 
 static inline unsigned int fmap_align_items(unsigned int sz, unsigned int al);
 static inline unsigned int fmap_align_to(unsigned int sz, unsigned int al);
 static inline unsigned int fmap_which_page(fmap_t *m, size_t at);
+static cl_fmap_t *fmap_open_handle(void *handle, size_t offset, size_t len, clcb_pread pread_cb, int use_aging, int hugepages);
+#ifdef ANONYMOUS_MAP
+static fmap_t *fmap_mmap_file(int fd, off_t offset, size_t len, size_t window);
+#endif
 
 #ifndef _WIN32
 /* pread proto here in order to avoid the use of XOPEN and BSD_SOURCE
@@ -61,8 +69,12 @@ static off_t pread_cb(void *handle, void *buf, size_t count, off_t offset)
 
 
 fmap_t *fmap_check_empty(int fd, off_t offset, size_t len, int *empty) {
-    unsigned int pages, mapsz, hdrsz;
-    unsigned short dumb = 1;
+    return fmap_check_empty_engine(fd, offset, len, empty, NULL);
+}
+
+fmap_t *fmap_check_empty_engine(int fd, off_t offset, size_t len, int *empty, const struct cl_engine *engine) {
+    uint32_t flags = engine ? engine->fmap_flags : 0;
+    size_t window = engine ? engine->fmap_readahead : 0;
     int pgsz = cli_getpagesize();
     STATBUF st;
     fmap_t *m;
@@ -84,11 +96,19 @@ fmap_t *fmap_check_empty(int fd, off_t offset, size_t len, int *empty) {
 	cli_warnmsg("fmap: attempted oof mapping\n");
 	return NULL;
     }
-    m = cl_fmap_open_handle((void*)(ssize_t)fd, offset, len, pread_cb, 1);
+    m = NULL;
+#ifdef ANONYMOUS_MAP
+    if((flags & CL_FMAP_MMAP) && !(m = fmap_mmap_file(fd, offset, len, window)))
+	cli_dbgmsg("fmap: mmap of descriptor %d failed, using pread\n", fd);
+#endif
+    if(!m)
+	m = fmap_open_handle((void*)(ssize_t)fd, offset, len, pread_cb, 1, flags & CL_FMAP_HUGEPAGES);
     if (!m)
 	return NULL;
+    m->handle = handle;
     m->mtime = st.st_mtime;
     m->handle_is_fd = 1;
+    m->ra_window = window;
     return m;
 }
 #else
@@ -159,6 +179,10 @@ fmap_t *fmap_check_empty(int fd, off_t offset, size_t len, int *empty) { /* WIN3
     m->unmap = unmap_win32;
     return m;
 }
+
+fmap_t *fmap_check_empty_engine(int fd, off_t offset, size_t len, int *empty, const struct cl_engine *engine) { /* WIN32 */
+    return fmap_check_empty(fd, offset, len, empty);
+}
 #endif /* _WIN32 */
 
 /* vvvvv SHARED STUFF BELOW vvvvv */
@@ -209,6 +233,31 @@ static void unmap_malloc(fmap_t *m);
 
 extern cl_fmap_t *cl_fmap_open_handle(void *handle, size_t offset, size_t len,
 				      clcb_pread pread_cb, int use_aging)
+{
+    return fmap_open_handle(handle, offset, len, pread_cb, use_aging, 0);
+}
+
+extern cl_fmap_t *cl_fmap_open_fd_cb(int fd, size_t offset, size_t len,
+				     void *handle, clcb_pread pread_cb)
+{
+    STATBUF st;
+    cl_fmap_t *m;
+
+    if(FSTAT(fd, &st)) {
+	cli_warnmsg("fmap: fstat failed\n");
+	return NULL;
+    }
+    if(!(m = fmap_open_handle(handle, offset, len, pread_cb, 1, 0)))
+	return NULL;
+    /* the scanners that need the descriptor get it from fmap_fd() */
+    m->handle = (void*)(ssize_t)fd;
+    m->mtime = st.st_mtime;
+    m->handle_is_fd = 1;
+    return m;
+}
+
+static cl_fmap_t *fmap_open_handle(void *handle, size_t offset, size_t len,
+				   clcb_pread pread_cb, int use_aging, int hugepages)
 {
     unsigned int pages, mapsz, hdrsz;
     cl_fmap_t *m;
@@ -241,7 +290,13 @@ extern cl_fmap_t *cl_fmap_open_handle(void *handle, size_t offset, size_t len,
 	    m = NULL;
 	} else {
 #if HAVE_MADVISE
-	    madvise((void *)m, mapsz, MADV_RANDOM|MADV_DONTFORK);
+	    /* the advice values are not flags, they can't be or'ed */
+	    madvise((void *)m, mapsz, MADV_RANDOM);
+	    madvise((void *)m, mapsz, MADV_DONTFORK);
+#ifdef MADV_HUGEPAGE
+	    if(hugepages)
+		madvise((void *)m, mapsz, MADV_HUGEPAGE);
+#endif
 #endif /* madvise */
 	    /* fault the header while we still have the lock - we DO context switch here a lot here :@ */
 	    memset(fmap_bitmap, 0, sizeof(uint32_t) * pages);
@@ -259,6 +314,7 @@ extern cl_fmap_t *cl_fmap_open_handle(void *handle, size_t offset, size_t len,
     }
     m->handle = handle;
     m->pread_cb = pread_cb;
+    m->pread_handle = handle;
     m->aging = use_aging;
     m->offset = offset;
     m->len = len;/* m->nested_offset + m->len = m->real_len */
@@ -420,7 +476,8 @@ static int fmap_readpage(fmap_t *m, unsigned int first_page, unsigned int count,
 	    eintr_off = 0;
 	    while(readsz) {
 		ssize_t got;
-		got=m->pread_cb(m->handle, pptr, readsz, eintr_off + m->offset + first_page * m->pgsz);
+		got=m->pread_cb(m->pread_handle, pptr, readsz, eintr_off + m->offset + first_page * m->pgsz);
+		cli_counter_add(CL_COUNTER_FMAP_READS, 1);
 
 		if(got < 0 && errno == EINTR)
 		    continue;
@@ -460,6 +517,7 @@ static int fmap_readpage(fmap_t *m, unsigned int first_page, unsigned int count,
 	else /* no locking: set paged and set aging to max */
 	    fmap_bitmap[page] = FM_MASK_PAGED | FM_MASK_COUNT;
 	m->paged++;
+	cli_counter_add(CL_COUNTER_FMAP_PAGES, 1);
     }
     return 0;
 }
@@ -663,6 +721,75 @@ extern cl_fmap_t *cl_fmap_open_memory(const void *start, size_t len)
 }
 
 
+#ifdef ANONYMOUS_MAP
+/* vvvvv FILE MAPPING STUFF BELOW vvvvv */
+
+static void unmap_file(fmap_t *m) {
+    fmap_lock;
+    munmap((void *)m->data, m->real_len);
+    fmap_unlock;
+    free((void *)m);
+}
+
+/* CL_FMAP_MMAP: a memory map of the file itself */
+static fmap_t *fmap_mmap_file(int fd, off_t offset, size_t len, size_t window) {
+    int flags = MAP_PRIVATE;
+    void *data;
+    fmap_t *m;
+
+    if(offset % cli_getpagesize())
+	return NULL;
+#ifdef MAP_POPULATE
+    /* the readahead window covers the whole file: fault it in at once */
+    if(len <= window)
+	flags |= MAP_POPULATE;
+#endif
+    fmap_lock;
+    data = mmap(NULL, len, PROT_READ, flags, fd, offset);
+    fmap_unlock;
+    if(data == MAP_FAILED)
+	return NULL;
+#if HAVE_MADVISE
+    madvise(data, len, MADV_SEQUENTIAL);
+#endif
+    if(!(m = cl_fmap_open_memory(data, len))) {
+	fmap_lock;
+	munmap(data, len);
+	fmap_unlock;
+	return NULL;
+    }
+    m->offset = offset;
+    m->unmap = unmap_file;
+    if(flags != MAP_PRIVATE)
+	m->ra_next = len;
+    return m;
+}
+#endif /* ANONYMOUS_MAP */
+
+void fmap_readahead_window(fmap_t *m, size_t at) {
+    size_t start, end;
+
+    at += m->nested_offset;
+    start = at > m->ra_next ? at : m->ra_next;
+    end = at + m->ra_window;
+    m->ra_next = end;
+    if(end > m->real_len)
+	end = m->real_len;
+    if(start >= end)
+	return;
+    if(m->data) {
+#if HAVE_MADVISE
+	size_t pgoff = start % m->pgsz;
+
+	madvise((char *)m->data + start - pgoff, end - start + pgoff, MADV_WILLNEED);
+#endif
+    } else if(m->handle_is_fd) {
+#ifdef POSIX_FADV_WILLNEED
+	posix_fadvise((int)(ssize_t)m->handle, m->offset + start, end - start, POSIX_FADV_WILLNEED);
+#endif
+    }
+}
+
 static const void *mem_need(fmap_t *m, size_t at, size_t len, int lock) { /* WIN32 */
     if(!len) {
 	return NULL;
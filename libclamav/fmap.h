@@ -41,6 +41,7 @@ struct cl_fmap {
     /* handle interface */
     void *handle;
     clcb_pread pread_cb;
+    void *pread_handle; /* what pread_cb gets, handle unless cl_fmap_open_fd_cb() */
 
     /* internal */
     time_t mtime;
@@ -55,6 +56,10 @@ struct cl_fmap {
     /* memory interface */
     const void *data;
 
+    /* readahead window, see fmap_readahead() */
+    size_t ra_window;
+    size_t ra_next;
+
     /* common interface */
     size_t offset;/* file offset */
     size_t nested_offset;/* buffer offset for nested scan*/
@@ -84,12 +89,22 @@ struct cl_fmap {
 
 fmap_t *fmap(int fd, off_t offset, size_t len);
 fmap_t *fmap_check_empty(int fd, off_t offset, size_t len, int *empty);
+fmap_t *fmap_check_empty_engine(int fd, off_t offset, size_t len, int *empty, const struct cl_engine *engine);
+void fmap_readahead_window(fmap_t *m, size_t at);
 
 static inline void funmap(fmap_t *m)
 {
     m->unmap(m);
 }
 
+/* Tells the map a sequential reader is at offset at: the kernel is asked to
+ * start reading the window ahead of it once half of the last one was used */
+static inline void fmap_readahead(fmap_t *m, size_t at)
+{
+    if(m->ra_window && at + m->nested_offset + m->ra_window / 2 > m->ra_next)
+	fmap_readahead_window(m, at);
+}
+
 static inline const void *fmap_need_off(fmap_t *m, size_t at, size_t len)
 {
     return m->need(m, at, len, 1);
@@ -91,6 +91,10 @@ typedef struct file_buff_tag {
 	int fd;
 	unsigned char buffer[HTML_FILE_BUFF_LEN];
 	int length;
+	/* with to_mem set the output is collected in mem instead of fd */
+	int to_mem;
+	unsigned char *mem;
+	size_t mem_len, mem_size;
 } file_buff_t;
 
 struct tag_contents {
@@ -296,10 +300,46 @@ static unsigned char *cli_readchunk(FILE *stream, m_area_t *m_area, unsigned int
 	return chunk;
 }
 
+/* plain text bytes HTML_NORM can copy without going through the state
+ * machine: printable ASCII other than '<' and '&'. A run doesn't only end at
+ * '<' and '&' but at any control, 8-bit or repeated whitespace byte, more
+ * stop bytes than cli_memstr_any() takes, and searching ahead for just '<'
+ * and '&' with it before this loop made HTML_NORM slower, so the run is
+ * classified here a byte at a time. */
+static const unsigned char html_plain[256] = {
+    0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0,
+    0,1,1,1, 1,1,0,1, 1,1,1,1, 1,1,1,1, 1,1,1,1, 1,1,1,1, 1,1,1,1, 0,1,1,1,
+    1,1,1,1, 1,1,1,1, 1,1,1,1, 1,1,1,1, 1,1,1,1, 1,1,1,1, 1,1,1,1, 1,1,1,1,
+    1,1,1,1, 1,1,1,1, 1,1,1,1, 1,1,1,1, 1,1,1,1, 1,1,1,1, 1,1,1,1, 1,1,1,1
+};
+
+static void html_output_write(file_buff_t *fbuff, const unsigned char *data, size_t len)
+{
+	if (!fbuff->to_mem) {
+		cli_writen(fbuff->fd, data, len);
+		return;
+	}
+	if (fbuff->mem_len + len > fbuff->mem_size) {
+		size_t size = fbuff->mem_size ? fbuff->mem_size : HTML_FILE_BUFF_LEN * 4;
+		unsigned char *mem;
+
+		while (size < fbuff->mem_len + len)
+			size *= 2;
+		if (!(mem = cli_realloc(fbuff->mem, size))) {
+			/* keep what we have, the view is just truncated */
+			return;
+		}
+		fbuff->mem = mem;
+		fbuff->mem_size = size;
+	}
+	memcpy(fbuff->mem + fbuff->mem_len, data, len);
+	fbuff->mem_len += len;
+}
+
 static void html_output_flush(file_buff_t *fbuff)
 {
 	if (fbuff && (fbuff->length > 0)) {
-		cli_writen(fbuff->fd, fbuff->buffer, fbuff->length);
+		html_output_write(fbuff, fbuff->buffer, fbuff->length);
 		fbuff->length = 0;
 	}
 }
@@ -322,7 +362,7 @@ static void html_output_str(file_buff_t *fbuff, const unsigned char *str, size_t
 		}
 		if (len >= HTML_FILE_BUFF_LEN) {
 			html_output_flush(fbuff);
-			cli_writen(fbuff->fd, str, len);
+			html_output_write(fbuff, str, len);
 		} else {
 			memcpy(fbuff->buffer + fbuff->length, str, len);
 			fbuff->length += len;
@@ -330,6 +370,25 @@ static void html_output_str(file_buff_t *fbuff, const unsigned char *str, size_t
 	}
 }
 
+/* same as html_output_c() on every byte of str, lowercased */
+static void html_output_lower(file_buff_t *fbuff, const unsigned char *str, size_t len)
+{
+	size_t i, n;
+
+	if (!fbuff)
+		return;
+	while (len) {
+		if (fbuff->length == HTML_FILE_BUFF_LEN)
+			html_output_flush(fbuff);
+		n = MIN(len, (size_t)(HTML_FILE_BUFF_LEN - fbuff->length));
+		for (i = 0; i < n; i++)
+			fbuff->buffer[fbuff->length + i] = tolower(str[i]);
+		fbuff->length += n;
+		str += n;
+		len -= n;
+	}
+}
+
 static char *html_tag_arg_value(tag_arguments_t *tags, const char *tag)
 {
 	int i;
@@ -617,8 +676,30 @@ static void screnc_decode(unsigned char *ptr, struct screnc_state *s)
 	}
 }
 
+/* with views, dirname only holds the scripts and the RFC2397 data and is
+ * created when the first of them shows up */
+static int html_tmpdir(const char *dirname, struct html_views *views)
+{
+	char filename[1024];
+
+	if (!views || views->tmpdir)
+		return 1;
+	if (mkdir(dirname, 0700)) {
+		cli_dbgmsg("html_tmpdir: can't create %s\n", dirname);
+		return 0;
+	}
+	views->tmpdir = 1;
+	snprintf(filename, 1024, "%s"PATHSEP"rfc2397", dirname);
+	if (mkdir(filename, 0700) && errno != EEXIST) {
+		cli_dbgmsg("html_tmpdir: can't create %s\n", filename);
+		return 0;
+	}
+	return 1;
+}
+
 static void js_process(struct parser_state *js_state, const unsigned char *js_begin, const unsigned char *js_end,
-		const unsigned char *line, const unsigned char *ptr, int in_script, const char *dirname)
+		const unsigned char *line, const unsigned char *ptr, int in_script, const char *dirname,
+		struct html_views *views)
 {
 	if(!js_begin)
 		js_begin = line;
@@ -632,12 +713,13 @@ static void js_process(struct parser_state *js_state, const unsigned char *js_be
 	if(!in_script) {
 		/*  we found a /script, normalize script now */
 		cli_js_parse_done(js_state);
-		cli_js_output(js_state, dirname);
+		if (html_tmpdir(dirname, views))
+			cli_js_output(js_state, dirname);
 		cli_js_destroy(js_state);
 	}
 }
 
-static int cli_html_normalise(int fd, m_area_t *m_area, const char *dirname, tag_arguments_t *hrefs,const struct cli_dconf* dconf)
+static int cli_html_normalise(int fd, m_area_t *m_area, const char *dirname, tag_arguments_t *hrefs,const struct cli_dconf* dconf, struct html_views *views)
 {
 	int fd_tmp, tag_length = 0, tag_arg_length = 0, binary;
 	int retval=FALSE, escape=FALSE, value = 0, hex=FALSE, tag_val_length=0;
@@ -693,7 +775,22 @@ static int cli_html_normalise(int fd, m_area_t *m_area, const char *dirname, tag
 	tag_args.tag = NULL;
 	tag_args.value = NULL;
 	tag_args.contents = NULL;
-	if (dirname) {
+	if (views) {
+		/* the views stay in memory, dirname is made by html_tmpdir() */
+		file_buff_o2 = file_buff_text = NULL;
+		if (views->want & HTML_VIEW_NOCOMMENT) {
+			if (!(file_buff_o2 = (file_buff_t *) cli_calloc(1, sizeof(file_buff_t))))
+				goto abort;
+			file_buff_o2->fd = -1;
+			file_buff_o2->to_mem = 1;
+		}
+		if (views->want & HTML_VIEW_NOTAGS) {
+			if (!(file_buff_text = (file_buff_t *) cli_calloc(1, sizeof(file_buff_t))))
+				goto abort;
+			file_buff_text->fd = -1;
+			file_buff_text->to_mem = 1;
+		}
+	} else if (dirname) {
 		snprintf(filename, 1024, "%s"PATHSEP"rfc2397", dirname);
 		if (mkdir(filename, 0700) && errno != EEXIST) {
 			file_buff_o2 = file_buff_text = NULL;
@@ -735,7 +832,9 @@ static int cli_html_normalise(int fd, m_area_t *m_area, const char *dirname, tag
 			goto abort;
 		}
 		file_buff_o2->length = 0;
+		file_buff_o2->to_mem = 0;
 		file_buff_text->length = 0;
+		file_buff_text->to_mem = 0;
 	} else {
 		file_buff_o2 = NULL;
 		file_buff_text = NULL;
@@ -860,6 +959,17 @@ static int cli_html_normalise(int fd, m_area_t *m_area, const char *dirname, tag
                                         next_state = HTML_NORM;
                                         mbchar = *ptr;
                                         ptr++;
+				} else if (!in_script && html_plain[*ptr]) {
+					/* copy the whole run of plain text at once, single
+					 * spaces between words come out the same in both
+					 * views as through HTML_TRIM_WS */
+					const unsigned char *run = ptr;
+
+					while (html_plain[*ptr] || (*ptr == ' ' && html_plain[ptr[1]]))
+						ptr++;
+					html_output_lower(file_buff_o2, run, ptr - run);
+					html_output_lower(file_buff_text, run, ptr - run);
+					text_space_written = FALSE;
 				} else {
 					unsigned char c = tolower(*ptr);
 					/* normalize ' to " for scripts */
@@ -1160,7 +1270,7 @@ static int cli_html_normalise(int fd, m_area_t *m_area, const char *dirname, tag
 						in_script = FALSE;
 						if(js_state) {
 							js_end = ptr;
-							js_process(js_state, js_begin, js_end, line, ptr, in_script, dirname);
+							js_process(js_state, js_begin, js_end, line, ptr, in_script, dirname, views);
 							js_state = NULL;
 							js_begin = js_end = NULL;
 						}
@@ -1593,11 +1703,12 @@ static int cli_html_normalise(int fd, m_area_t *m_area, const char *dirname, tag
 				}
 				break;
 			case HTML_RFC2397_INIT:
-				if (dirname) {
-					file_tmp_o1 = (file_buff_t *) cli_malloc(sizeof(file_buff_t));
+				if (dirname && html_tmpdir(dirname, views)) {
+					file_tmp_o1 = (file_buff_t *) cli_calloc(1, sizeof(file_buff_t));
 					if (!file_tmp_o1) {
 						goto abort;
 					}
+					file_tmp_o1->fd = -1;
 					snprintf(filename, 1024, "%s"PATHSEP"rfc2397", dirname);
 					tmp_file = cli_gentemp(filename);
 					if(!tmp_file) {
@@ -1723,7 +1834,7 @@ static int cli_html_normalise(int fd, m_area_t *m_area, const char *dirname, tag
 		ptrend = NULL;
 
 		if(js_state) {
-			js_process(js_state, js_begin, js_end, line, ptr, in_script, dirname);
+			js_process(js_state, js_begin, js_end, line, ptr, in_script, dirname, views);
 			js_begin = js_end = NULL;
 			if(!in_script) {
 				js_state = NULL;
@@ -1783,7 +1894,8 @@ abort:
 	if(js_state) {
 		/*  output script so far */
 		cli_js_parse_done(js_state);
-		cli_js_output(js_state, dirname);
+		if (html_tmpdir(dirname, views))
+			cli_js_output(js_state, dirname);
 		cli_js_destroy(js_state);
 		js_state = NULL;
 	}
@@ -1795,17 +1907,26 @@ abort:
 		html_output_flush(file_buff_o2);
 		if(file_buff_o2->fd != -1)
 			close(file_buff_o2->fd);
+		if(views) {
+			views->nocomment = file_buff_o2->mem;
+			views->nocomment_len = file_buff_o2->mem_len;
+		}
 		free(file_buff_o2);
 	}
 	if(file_buff_text) {
 		html_output_flush(file_buff_text);
 		if(file_buff_text->fd != -1)
 			close(file_buff_text->fd);
+		if(views) {
+			views->notags = file_buff_text->mem;
+			views->notags_len = file_buff_text->mem_len;
+		}
 		free(file_buff_text);
 	}
 	if(file_tmp_o1) {
 		html_output_flush(file_tmp_o1);
-		close(file_tmp_o1->fd);
+		if(file_tmp_o1->fd != -1)
+			close(file_tmp_o1->fd);
 		free(file_tmp_o1);
 	}
 	return retval;
@@ -1820,7 +1941,7 @@ int html_normalise_mem(unsigned char *in_buff, off_t in_size, const char *dirnam
 	m_area.offset = 0;
 	m_area.map = NULL;
 
-	return cli_html_normalise(-1, &m_area, dirname, hrefs, dconf);
+	return cli_html_normalise(-1, &m_area, dirname, hrefs, dconf, NULL);
 }
 
 int html_normalise_map(fmap_t *map, const char *dirname, tag_arguments_t *hrefs,const struct cli_dconf* dconf)
@@ -1831,10 +1952,32 @@ int html_normalise_map(fmap_t *map, const char *dirname, tag_arguments_t *hrefs,
 	m_area.length = map->len;
 	m_area.offset = 0;
 	m_area.map = map;
-	retval = cli_html_normalise(-1, &m_area, dirname, hrefs, dconf);
+	retval = cli_html_normalise(-1, &m_area, dirname, hrefs, dconf, NULL);
 	return retval;
 }
 
+int html_normalise_map_views(fmap_t *map, const char *dirname, struct html_views *views, const struct cli_dconf* dconf)
+{
+	m_area_t m_area;
+
+	views->nocomment = views->notags = NULL;
+	views->nocomment_len = views->notags_len = 0;
+	views->tmpdir = 0;
+
+	m_area.length = map->len;
+	m_area.offset = 0;
+	m_area.map = map;
+	return cli_html_normalise(-1, &m_area, dirname, NULL, dconf, views);
+}
+
+void html_views_free(struct html_views *views)
+{
+	free(views->nocomment);
+	free(views->notags);
+	views->nocomment = views->notags = NULL;
+	views->nocomment_len = views->notags_len = 0;
+}
+
 int html_screnc_decode(fmap_t *map, const char *dirname)
 {
 	int count, retval=FALSE;
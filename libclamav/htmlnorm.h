@@ -37,8 +37,25 @@ typedef struct m_area_tag {
 	fmap_t *map;
 } m_area_t;
 
+/* Normalized views html_normalise_map_views() keeps in memory instead of
+ * writing nocomment.html and notags.html. Scripts and RFC2397 data still
+ * go to dirname, which is only created (and tmpdir set) if there are any */
+#define HTML_VIEW_NOCOMMENT	0x1
+#define HTML_VIEW_NOTAGS	0x2
+
+struct html_views {
+	unsigned int want;	/* HTML_VIEW_* to produce */
+	unsigned char *nocomment;
+	size_t nocomment_len;
+	unsigned char *notags;
+	size_t notags_len;
+	int tmpdir;
+};
+
 int html_normalise_mem(unsigned char *in_buff, off_t in_size, const char *dirname, tag_arguments_t *hrefs,const struct cli_dconf* dconf);
 int html_normalise_map(fmap_t *map, const char *dirname, tag_arguments_t *hrefs, const struct cli_dconf* dconf);
+int html_normalise_map_views(fmap_t *map, const char *dirname, struct html_views *views, const struct cli_dconf* dconf);
+void html_views_free(struct html_views *views);
 void html_tag_arg_free(tag_arguments_t *tags);
 int html_screnc_decode(fmap_t *map, const char *dirname);
 void html_tag_arg_add(tag_arguments_t *tags, const char *tag, char *value);
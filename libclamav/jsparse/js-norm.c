@@ -36,7 +36,6 @@
 
 #include "cltypes.h"
 #include "jsparse/lexglobal.h"
-#include "hashtab.h"
 #include "others.h"
 #include "str.h"
 #include "js-norm.h"
@@ -88,8 +87,24 @@ enum fsm_state {
 	InsideFunctionDecl
 };
 
+/* identifiers seen in a scope, keyed by name */
+struct id_entry {
+	const char *key;/* NULL if the slot is free */
+	size_t len;
+	size_t hash;
+	long data;/* unique id, -1 if not declared in this scope */
+	long resolved;/* cached scope_lookup() result */
+	unsigned long resolved_gen;/* valid if equal to parser_state's id_gen */
+};
+
+struct id_map {
+	struct id_entry *htable;
+	size_t capacity;/* power of 2 */
+	size_t used;
+};
+
 struct scope {
-	struct cli_hashtable id_map;
+	struct id_map id_map;
 	struct scope *parent;/* hierarchy */
 	struct scope *nxt;/* all scopes kept in a list so we can easily free all of them */
 	enum fsm_state fsm_state;
@@ -104,6 +119,21 @@ struct tokens {
 	size_t   capacity;
 };
 
+/* Scopes, their identifier maps and the names in them live until the parser
+ * state is destroyed, so they are carved out of large chunks instead of being
+ * malloc()ed one by one, and released together by cli_js_destroy().
+ * Unlike the per-scan cli_arena_*() allocator this one belongs to the parser
+ * state, which sigtool and the unit tests also use outside of any scan. */
+#define JS_ARENA_CHUNK 65536
+
+struct js_arena_chunk {
+	struct js_arena_chunk *nxt;
+	size_t used;
+	size_t size;
+};
+
+#define JS_ARENA_HDR ((sizeof(struct js_arena_chunk) + 15) & ~(size_t)15)
+
 /* state for the current JS file being parsed */
 struct parser_state {
 	unsigned long     var_uniq;
@@ -114,18 +144,158 @@ struct parser_state {
 	yyscan_t scanner;
 	struct tokens tokens;
 	unsigned int      rec;
+	unsigned long     id_gen;/* bumped when a declaration changes lookups */
+	struct js_arena_chunk *arena;
 };
 
+static void *js_arena_alloc(struct parser_state *state, size_t size)
+{
+	struct js_arena_chunk *c = state->arena;
+	void *p;
+
+	size = (size + 7) & ~(size_t)7;
+	if(!c || c->size - c->used < size) {
+		const size_t csize = MAX(JS_ARENA_CHUNK, JS_ARENA_HDR + size);
+		struct js_arena_chunk *n = cli_malloc(csize);
+		if(!n)
+			return NULL;
+		n->used = JS_ARENA_HDR;
+		n->size = csize;
+		if(c && size > JS_ARENA_CHUNK / 4) {
+			/* large block, keep allocating from the current chunk */
+			n->nxt = c->nxt;
+			c->nxt = n;
+		} else {
+			n->nxt = c;
+			state->arena = n;
+		}
+		c = n;
+	}
+	p = (char*)c + c->used;
+	c->used += size;
+	return p;
+}
+
+static void js_arena_free_all(struct parser_state *state)
+{
+	struct js_arena_chunk *c = state->arena, *nxt;
+	while(c) {
+		nxt = c->nxt;
+		free(c);
+		c = nxt;
+	}
+	state->arena = NULL;
+}
+
+static char *js_arena_strdup(struct parser_state *state, const char *s, size_t len)
+{
+	char *d = js_arena_alloc(state, len + 1);
+	if(!d)
+		return NULL;
+	memcpy(d, s, len);
+	d[len] = '\0';
+	return d;
+}
+
+static inline size_t id_hash(const char *key, size_t len)
+{
+	/* FNV-1a */
+	size_t h = 2166136261U;
+	while(len--)
+		h = (h ^ (unsigned char)*key++) * 16777619U;
+	return h;
+}
+
+static int id_map_init(struct parser_state *state, struct id_map *map, size_t capacity)
+{
+	map->htable = js_arena_alloc(state, capacity * sizeof(*map->htable));
+	if(!map->htable)
+		return -1;
+	memset(map->htable, 0, capacity * sizeof(*map->htable));
+	map->capacity = capacity;
+	map->used = 0;
+	return 0;
+}
+
+static struct id_entry *id_map_find(const struct id_map *map, const char *key, size_t len, size_t hash)
+{
+	const size_t mask = map->capacity - 1;
+	size_t idx = hash & mask;
+	struct id_entry *el;
+
+	while((el = &map->htable[idx])->key) {
+		if(el->hash == hash && el->len == len && !memcmp(el->key, key, len))
+			return el;
+		idx = (idx + 1) & mask;
+	}
+	return NULL;
+}
+
+/* adds an entry for key, which is not in the map yet and must stay valid as
+ * long as the map */
+static struct id_entry *id_map_add(struct parser_state *state, struct id_map *map, const char *key, size_t len, size_t hash, long data)
+{
+	struct id_entry *el;
+	size_t idx;
+
+	if((map->used + 1) * 4 > map->capacity * 3) {
+		/* the old table stays in the arena, the sizes add up to less than
+		 * the final one */
+		struct id_map grown;
+		size_t i;
+		if(id_map_init(state, &grown, map->capacity * 2))
+			return NULL;
+		for(i = 0; i < map->capacity; i++) {
+			const struct id_entry *old = &map->htable[i];
+			if(old->key) {
+				idx = old->hash & (grown.capacity - 1);
+				while(grown.htable[idx].key)
+					idx = (idx + 1) & (grown.capacity - 1);
+				grown.htable[idx] = *old;
+			}
+		}
+		grown.used = map->used;
+		*map = grown;
+	}
+	idx = hash & (map->capacity - 1);
+	while(map->htable[idx].key)
+		idx = (idx + 1) & (map->capacity - 1);
+	el = &map->htable[idx];
+	el->key = key;
+	el->len = len;
+	el->hash = hash;
+	el->data = data;
+	map->used++;
+	return el;
+}
+
+/* returns the existing entry (with data updated if update is set), or a new
+ * one holding a copy of key */
+static struct id_entry *id_map_insert(struct parser_state *state, struct id_map *map, const char *key, size_t len, long data, int update)
+{
+	const size_t hash = id_hash(key, len);
+	struct id_entry *el = id_map_find(map, key, len, hash);
+	char *copy;
+
+	if(el) {
+		if(update)
+			el->data = data;
+		return el;
+	}
+	if(!(copy = js_arena_strdup(state, key, len)))
+		return NULL;
+	return id_map_add(state, map, copy, len, hash, data);
+}
+
 static struct scope* scope_new(struct parser_state *state)
 {
 	struct scope *parent = state->current;
-	struct scope *s = cli_calloc(1, sizeof(*s));
+	struct scope *s = js_arena_alloc(state, sizeof(*s));
 	if(!s)
 		return NULL;
-	if(cli_hashtab_init(&s->id_map, 10) < 0) {
-		free(s);
+	memset(s, 0, sizeof(*s));
+	if(id_map_init(state, &s->id_map, 16) < 0)
 		return NULL;
-	}
 	s->parent = parent;
 	s->fsm_state = Base;
 	s->nxt = state->list;
@@ -134,16 +304,6 @@ static struct scope* scope_new(struct parser_state *state)
 	return s;
 }
 
-static struct scope* scope_done(struct scope *s)
-{
-	struct scope* parent = s->parent;
-	/* TODO: have a hashtab_destroy */
-	cli_hashtab_clear(&s->id_map);
-	free(s->id_map.htable);
-	free(s);
-	return parent;
-}
-
 /* transitions:
  *   Base --(VAR)--> InsideVar
  *   InsideVar --(Identifier)-->InsideInitializer
@@ -250,46 +410,65 @@ static struct scope* scope_done(struct scope *s)
 
 static const char* scope_declare(struct scope *s, const char *token, const size_t len, struct parser_state *state)
 {
-	const struct cli_element *el = cli_hashtab_insert(&s->id_map, token, len, state->var_uniq++);
-	/* cli_hashtab_insert either finds an already existing entry, or allocates a
+	const struct id_entry *el = id_map_insert(state, &s->id_map, token, len, state->var_uniq++, 1);
+	/* id_map_insert either finds an already existing entry, or allocates a
 	 * new one, we return the allocated string */
+	state->id_gen++;
 	return el ? el->key : NULL;
 }
 
-static const char* scope_use(struct scope *s, const char *token, const size_t len)
+static const char* scope_use(struct scope *s, const char *token, const size_t len, struct parser_state *state)
 {
-	const struct cli_element *el = cli_hashtab_find(&s->id_map, token, len);
-	if(el) {
-		/* identifier already found in current scope,
-		 * return here to avoid overwriting uniq id */
-		return el->key;
-	}
-	/* identifier not yet in current scope's hashtab, add with ID -1.
+	/* identifier not yet in current scope's map is added with ID -1,
+	 * an existing one is returned as is to avoid overwriting its uniq id.
 	 * Later if we find a declaration it will automatically assign a uniq ID
 	 * to it. If not, we'll know that we have to push ID == -1 tokens to an
 	 * outer scope.*/
-	el = cli_hashtab_insert(&s->id_map, token, len, -1);
+	const struct id_entry *el = id_map_insert(state, &s->id_map, token, len, -1, 0);
 	return el ? el->key : NULL;
 }
 
-static long scope_lookup(struct scope *s, const char *token, const size_t len)
+/* token is the key of an identifier token, it lives in the arena */
+static long scope_lookup(struct scope *s, const char *token, const size_t len, struct parser_state *state)
 {
-	while(s) {
-		const struct cli_element *el = cli_hashtab_find(&s->id_map, token, len);
-		if(el && el->data != -1) {
-			return el->data;
+	const size_t hash = id_hash(token, len);
+	struct scope *p, *q;
+	long id = -1;
+
+	for(p = s; p; p = p->parent) {
+		const struct id_entry *el = id_map_find(&p->id_map, token, len, hash);
+		if(el) {
+			if(el->resolved_gen == state->id_gen) {
+				id = el->resolved;
+				break;
+			}
+			if(el->data != -1) {
+				id = el->data;
+				break;
+			}
 		}
 		/* not found in current scope, try in outer scope */
-		s = s->parent;
 	}
-	return -1;
+	/* The output looks up the identifiers of every function body, and
+	 * nested functions share most of the chain: remember the result in the
+	 * scopes walked, adding ID -1 entries where needed (those are skipped
+	 * by the lookup and updated by a later declaration, like the ones
+	 * scope_use() adds) */
+	for(q = s; q != p; q = q->parent) {
+		struct id_entry *el = id_map_find(&q->id_map, token, len, hash);
+		if(!el && !(el = id_map_add(state, &q->id_map, token, len, hash, -1)))
+			break;
+		el->resolved = id;
+		el->resolved_gen = state->id_gen;
+	}
+	return id;
 }
 
 static int tokens_ensure_capacity(struct tokens *tokens, size_t cap)
 {
 	if(tokens->capacity < cap) {
 	        yystype *data;
-		cap += 1024;
+		cap = MAX(cap + 1024, tokens->capacity * 2);
 		/* Keep old data if OOM */
 		data = cli_realloc(tokens->data, cap * sizeof(*tokens->data));
 		if(!data)
@@ -357,7 +536,7 @@ static inline void output_space(char last, char current, struct buf *out)
 
 
 /* return class of last character */
-static char output_token(const yystype *token, struct scope *scope, struct buf *out, char lastchar)
+static char output_token(const yystype *token, struct parser_state *state, struct buf *out, char lastchar)
 {
 	char sbuf[128];
 	const char *s = TOKEN_GET(token, cstring);
@@ -384,7 +563,7 @@ static char output_token(const yystype *token, struct scope *scope, struct buf *
 		case TOK_IDENTIFIER_NAME:
 			output_space(lastchar,'a', out);
 			if(s) {
-				long id = scope_lookup(scope, s, strlen(s));
+				long id = scope_lookup(state->current, s, strlen(s), state);
 				if(id == -1) {
 					/* identifier not normalized */
 					buf_outs(s, out);
@@ -416,7 +595,7 @@ static char output_token(const yystype *token, struct scope *scope, struct buf *
  * If we would normalize all the identifiers, and output when a scope is closed,
  * then it would be impossible to normalize calls to other functions.
  *
- * So we need to keep all scopes in memory, to do this instead of scope_done, we
+ * So we need to keep all scopes in memory, to do this instead of freeing it, we
  * simply just set current = current->parent when a scope is closed.
  * We keep a list of all scopes created in parser_state-> When we parsed
  * everything, we output everything, and then delete all scopes.
@@ -443,10 +622,11 @@ static char output_token(const yystype *token, struct scope *scope, struct buf *
  * and push them up one level (careful not to overwrite existing IDs).
  *
  * it would be nice if the tokens would contain a link to the entry in the
- * hashtab, a link that automatically gets updated when the element is moved
+ * map, a link that automatically gets updated when the element is moved
  * (pushed up). This would prevent subsequent lookups in the map,
  * when we want to output the tokens.
- * There is no easy way to do that, so we just do another lookup
+ * There is no easy way to do that, so we do another lookup, but
+ * scope_lookup() caches its result in the entry it starts from
  *
  */
 
@@ -463,16 +643,6 @@ static char output_token(const yystype *token, struct scope *scope, struct buf *
  * function ... (.
  */
 
-static void scope_free_all(struct scope *p)
-{
-	struct scope *nxt;
-	do {
-		nxt = p->nxt;
-		scope_done(p);
-		p = nxt;
-	} while(p);
-}
-
 size_t cli_strtokenize(char *buffer, const char delim, const size_t token_count, const char **tokens);
 static int match_parameters(const yystype *tokens, const char ** param_names, size_t count)
 {
@@ -682,22 +852,19 @@ static void handle_de(yystype *tokens, size_t start, const size_t cnt, const cha
 	}
 }
 
-static int handle_unescape(struct tokens *tokens, size_t start)
+/* replaces the 4 tokens of unescape("...") at start with the unescaped
+ * string literal, returns the number of tokens consumed */
+static size_t handle_unescape(yystype *tokens, size_t start, yystype *dst)
 {
-	if(tokens->data[start].type == TOK_StringLiteral) {
-		char *R;
-		struct tokens new_tokens;
-		yystype tok;
-
-		R = cli_unescape(TOKEN_GET(&tokens->data[start], cstring));
-		tok.type = TOK_StringLiteral;
-		TOKEN_SET(&tok, string, R);
-		new_tokens.capacity = new_tokens.cnt = 1;
-		new_tokens.data = &tok;
-		if(replace_token_range(tokens, start-2, start+2, &new_tokens) < 0)
-			return CL_EMEM;
-	}
-	return CL_SUCCESS;
+	char *R;
+	size_t i;
+
+	R = cli_unescape(TOKEN_GET(&tokens[start+2], cstring));
+	for(i = start; i < start+4; i++)
+		free_token(&tokens[i]);
+	dst->type = TOK_StringLiteral;
+	TOKEN_SET(dst, string, R);
+	return 4;
 }
 
 
@@ -747,17 +914,25 @@ static void handle_eval(struct tokens *tokens, size_t start, struct decode_resul
 
 static void run_folders(struct tokens *tokens)
 {
-  size_t i;
+  size_t i, j;
 
-  for(i = 0; i < tokens->cnt; i++) {
+  /* the folded tokens are compacted in a single pass, replacing them one
+   * range at a time would move the rest of the array for each of them */
+  for(i = 0, j = 0; i < tokens->cnt; j++) {
 	  const char *cstring = TOKEN_GET(&tokens->data[i], cstring);
-	  if(i+2 < tokens->cnt && tokens->data[i].type == TOK_IDENTIFIER_NAME &&
+	  if(i+4 <= tokens->cnt && tokens->data[i].type == TOK_IDENTIFIER_NAME &&
 		    cstring &&
-		    !strcmp("unescape", cstring) && tokens->data[i+1].type == TOK_PAR_OPEN) {
+		    !strcmp("unescape", cstring) && tokens->data[i+1].type == TOK_PAR_OPEN &&
+		    tokens->data[i+2].type == TOK_StringLiteral) {
 
-		  handle_unescape(tokens, i+2);
+		  i += handle_unescape(tokens->data, i, &tokens->data[j]);
+		  continue;
 	  }
+	  if(j != i)
+		  tokens->data[j] = tokens->data[i];
+	  i++;
   }
+  tokens->cnt = j;
 }
 
 static inline int state_update_scope(struct parser_state *state, const yystype *token)
@@ -916,7 +1091,7 @@ void cli_js_output(struct parser_state *state, const char *tempdir)
 	state->current = state->global;
 	for(i = 0; i < state->tokens.cnt; i++) {
 		if(state_update_scope(state, &state->tokens.data[i]))
-			lastchar = output_token(&state->tokens.data[i], state->current, &buf, lastchar);
+			lastchar = output_token(&state->tokens.data[i], state, &buf, lastchar);
 	}
 	/* add /script if not already there */
 	if(buf.pos < 9 || memcmp(buf.buf + buf.pos - 9, "</script>", 9))
@@ -933,7 +1108,8 @@ void cli_js_destroy(struct parser_state *state)
 	size_t i;
 	if(!state)
 		return;
-	scope_free_all(state->list);
+	/* scopes and member names */
+	js_arena_free_all(state);
 	for(i=0;i<state->tokens.cnt;i++) {
 		free_token(&state->tokens.data[i]);
 	}
@@ -985,7 +1161,7 @@ void cli_js_process_buffer(struct parser_state *state, const char *buf, size_t n
 				if(current->last_token == TOK_DOT) {
 					/* this is a member name, don't normalize
 					*/
-					TOKEN_SET(&val, string, cli_strdup(text));
+					TOKEN_SET(&val, cstring, js_arena_strdup(state, text, leng));
 					val.type = TOK_UNNORM_IDENTIFIER;
 				} else {
 					switch(current->fsm_state) {
@@ -994,7 +1170,7 @@ void cli_js_process_buffer(struct parser_state *state, const char *buf, size_t n
 							/* fall through */
 						case Base:
 						case InsideInitializer:
-							TOKEN_SET(&val, cstring, scope_use(current, text, leng));
+							TOKEN_SET(&val, cstring, scope_use(current, text, leng, state));
 							break;
 						case InsideVar:
 						case InsideFunctionDecl:
@@ -1154,14 +1330,16 @@ struct parser_state *cli_js_init(void)
 	struct parser_state *state = cli_calloc(1, sizeof(*state));
 	if(!state)
 		return NULL;
+	state->id_gen = 1;
 	if(!scope_new(state)) {
+		js_arena_free_all(state);
 		free(state);
 		return NULL;
 	}
 	state->global = state->current;
 
 	if(yylex_init(&state->scanner)) {
-		scope_done(state->global);
+		js_arena_free_all(state);
 		free(state);
 		return NULL;
 	}
@@ -1320,7 +1498,12 @@ static inline int parseNumber(YYSTYPE *lvalp, yyscan_t scanner)
 	while(scanner->pos < scanner->insize) {
 		unsigned char c = in[scanner->pos++];
 		if(isdigit(c)) {
-			textbuffer_putc(&scanner->buf, c);
+			/* copy the whole run of digits at once */
+			size_t end = scanner->pos;
+			while(end < scanner->insize && isdigit(in[end]))
+				end++;
+			textbuffer_append_len(&scanner->buf, (const char*)&in[scanner->pos-1], end - scanner->pos + 1);
+			scanner->pos = end;
 			continue;
 		}
 		if(c =='.' && !is_float) {
@@ -1363,9 +1546,15 @@ static inline int parseId(YYSTYPE *lvalp, yyscan_t scanner)
 	while(scanner->pos < scanner->insize) {
 		unsigned char c = in[scanner->pos++];
 		enum char_class cClass = id_ctype[c];
+		size_t end;
 		switch(cClass) {
 			case IdStart:
-				textbuffer_putc(&scanner->buf, c);
+				/* copy the whole run of identifier characters at once */
+				end = scanner->pos;
+				while(end < scanner->insize && id_ctype[in[end]] == IdStart)
+					end++;
+				textbuffer_append_len(&scanner->buf, (const char*)&in[scanner->pos-1], end - scanner->pos + 1);
+				scanner->pos = end;
 				break;
 			case Operator:
 				/* the table contains OP only for \ */
@@ -43,8 +43,10 @@
 #include "readdb.h"
 #include "default.h"
 #include "filtering.h"
+#include "perflogging.h"
 
 #include "mpool.h"
+#include "arena.h"
 
 #define AC_SPECIAL_ALT_CHAR	1
 #define AC_SPECIAL_ALT_STR	2
@@ -372,9 +374,24 @@ static int ac_maketrans(struct cli_matcher *root)
 
 int cli_ac_buildtrie(struct cli_matcher *root)
 {
+	uint32_t i;
+
     if(!root)
 	return CL_EMALFDB;
 
+    if(root->ac_lsigs) {
+	if(root->ac_lsig_always)
+	    mpool_free(root->mempool, root->ac_lsig_always);
+	root->ac_lsig_always = (uint32_t *) mpool_calloc(root->mempool, (root->ac_lsigs + 31) / 32, sizeof(uint32_t));
+	if(!root->ac_lsig_always) {
+	    cli_errmsg("cli_ac_buildtrie: Can't allocate memory for ac_lsig_always\n");
+	    return CL_EMEM;
+	}
+	for(i = 0; i < root->ac_lsigs; i++)
+	    if(root->ac_lsigtable[i]->always)
+		root->ac_lsig_always[i / 32] |= 1u << (i % 32);
+    }
+
     if(!root->ac_root) {
 	cli_dbgmsg("cli_ac_buildtrie: AC pattern matcher is not initialised\n");
 	return CL_SUCCESS;
@@ -485,6 +502,8 @@ void cli_ac_free(struct cli_matcher *root)
     }
     if (root->filter)
 	mpool_free(root->mempool, root->filter);
+    if(root->ac_lsig_always)
+	mpool_free(root->mempool, root->ac_lsig_always);
 }
 
 /*
@@ -718,6 +737,269 @@ int cli_ac_chklsig(const char *expr, const char *end, uint32_t *lsigcnt, unsigne
     }
 }
 
+/*
+ * Logical expressions are compiled into postfix programs when loaded so
+ * cli_lsig_eval() doesn't have to parse the text again for every file.
+ * lsig_compile() follows cli_ac_chklsig() step by step and
+ * cli_ac_lsig_match() must give the very same answers.
+ */
+#define LSIG_STACK 64
+
+static int lsig_compile(const char *expr, const char *end, struct cli_lsig_op *prog, unsigned int *len, unsigned int max)
+{
+	unsigned int i, elen = end - expr, pth = 0, opoff = 0, op1off = 0;
+	unsigned int blkend = 0, id, modval1, modval2 = 0, modoff = 0;
+	int ret;
+	char op = 0, op1 = 0, mod = 0, blkmod = 0;
+	const char *lstart = expr, *lend = NULL, *rstart = NULL, *rend = end;
+
+
+    for(i = 0; i < elen; i++) {
+	switch(expr[i]) {
+	    case '(':
+		pth++;
+		break;
+
+	    case ')':
+		if(!pth)
+		    return -1;
+		pth--;
+
+	    case '>':
+	    case '<':
+	    case '=':
+		mod = expr[i];
+		modoff = i;
+		break;
+
+	    default:
+		if(strchr("&|", expr[i])) {
+		    if(!pth) {
+			op = expr[i];
+			opoff = i;
+		    } else if(pth == 1) {
+			op1 = expr[i];
+			op1off = i;
+		    }
+		}
+	}
+
+	if(op)
+	    break;
+
+	if(op1 && !pth) {
+	    blkend = i;
+	    if(expr[i + 1] == '>' || expr[i + 1] == '<' || expr[i + 1] == '=') {
+		blkmod = expr[i + 1];
+		ret = sscanf(&expr[i + 2], "%u,%u", &modval1, &modval2);
+		if(ret != 2)
+		    ret = sscanf(&expr[i + 2], "%u", &modval1);
+		if(!ret || ret == EOF)
+		    return -1;
+		for(i += 2; i + 1 < elen && (isdigit(expr[i + 1]) || expr[i + 1] == ','); i++);
+	    }
+
+	    if(&expr[i + 1] == rend)
+		break;
+	    else
+		blkmod = 0;
+	}
+    }
+
+    if(pth)
+	return -1;
+
+    if(*len >= max)
+	return -1;
+
+    if(!op && !op1) {
+	if(expr[0] == '(')
+	    return lsig_compile(++expr, --end, prog, len, max);
+
+	ret = sscanf(expr, "%u", &id);
+	if(!ret || ret == EOF || id >= 64)
+	    return -1;
+
+	prog[*len].type = CLI_LSIG_OP_LEAF;
+	prog[*len].id = id;
+	prog[*len].mod = mod;
+	prog[*len].val1 = prog[*len].val2 = 0;
+	if(mod) {
+	    ret = sscanf(expr + modoff + 1, "%u", &prog[*len].val1);
+	    if(!ret || ret == EOF)
+		return -1;
+	}
+	(*len)++;
+	return 0;
+    }
+
+    if(!op) {
+	op = op1;
+	opoff = op1off;
+	lstart++;
+	rend = &expr[blkend];
+    }
+
+    if(!opoff || opoff + 1 == elen)
+	return -1;
+    lend = &expr[opoff];
+    rstart = &expr[opoff + 1];
+
+    if(lsig_compile(lstart, lend, prog, len, max) || lsig_compile(rstart, rend, prog, len, max))
+	return -1;
+
+    if(*len >= max)
+	return -1;
+    prog[*len].type = (op == '&') ? CLI_LSIG_OP_AND : CLI_LSIG_OP_OR;
+    prog[*len].id = 0;
+    prog[*len].mod = blkmod;
+    prog[*len].val1 = blkmod ? modval1 : 0;
+    prog[*len].val2 = blkmod ? modval2 : 0;
+    (*len)++;
+    return 0;
+}
+
+static int lsig_run(const struct cli_lsig_op *prog, unsigned int len, const uint32_t *lsigcnt)
+{
+	unsigned int i, sp = 0, val;
+	uint32_t cnt[LSIG_STACK];
+	uint64_t ids[LSIG_STACK];
+	uint8_t ret[LSIG_STACK];
+	const struct cli_lsig_op *op;
+
+    for(i = 0; i < len; i++) {
+	op = &prog[i];
+	if(op->type == CLI_LSIG_OP_LEAF) {
+	    val = lsigcnt[op->id];
+	    switch(op->mod) {
+		case 0:
+		    ret[sp] = !!val;
+		    break;
+		case '=':
+		    ret[sp] = (val == op->val1);
+		    break;
+		case '<':
+		    ret[sp] = (val < op->val1);
+		    break;
+		case '>':
+		    ret[sp] = (val > op->val1);
+		    break;
+		default:
+		    ret[sp] = 0;
+	    }
+	    cnt[sp] = ret[sp] ? val : 0;
+	    ids[sp] = ret[sp] ? (uint64_t) 1 << op->id : 0;
+	    sp++;
+	    continue;
+	}
+
+	sp--;
+	if(op->type == CLI_LSIG_OP_AND)
+	    ret[sp - 1] = ret[sp - 1] && ret[sp];
+	else
+	    ret[sp - 1] = ret[sp - 1] || ret[sp];
+	if(ret[sp - 1]) {
+	    cnt[sp - 1] += cnt[sp];
+	    ids[sp - 1] |= ids[sp];
+	} else {
+	    cnt[sp - 1] = 0;
+	    ids[sp - 1] = 0;
+	}
+	if(!op->mod)
+	    continue;
+
+	/* block modifier, checked even if the block itself failed */
+	switch(op->mod) {
+	    case '=':
+		ret[sp - 1] = (cnt[sp - 1] == op->val1);
+		break;
+	    case '<':
+		ret[sp - 1] = (cnt[sp - 1] < op->val1);
+		break;
+	    case '>':
+		ret[sp - 1] = (cnt[sp - 1] > op->val1);
+		break;
+	    default:
+		ret[sp - 1] = 0;
+	}
+	if(ret[sp - 1] && op->val2) {
+	    for(val = 0; ids[sp - 1]; ids[sp - 1] &= ids[sp - 1] - 1)
+		val++;
+	    if(val < op->val2)
+		ret[sp - 1] = 0;
+	}
+	if(!ret[sp - 1])
+	    cnt[sp - 1] = 0;
+	/* the ids of a block don't go any further up */
+	ids[sp - 1] = 0;
+    }
+
+    return ret[0];
+}
+
+int cli_ac_lsig_compile(struct cli_matcher *root, struct cli_ac_lsig *lsig)
+{
+	struct cli_lsig_op *prog;
+	unsigned int i, len = 0, sp = 0, maxsp = 0, max = strlen(lsig->logic) + 1;
+	uint32_t zero[64];
+
+    lsig->prog = NULL;
+    lsig->proglen = 0;
+    lsig->always = 1;
+
+    if(max > 65535)
+	return CL_SUCCESS;
+    prog = (struct cli_lsig_op *) cli_malloc(max * sizeof(struct cli_lsig_op));
+    if(!prog)
+	return CL_EMEM;
+
+    if(lsig_compile(lsig->logic, lsig->logic + strlen(lsig->logic), prog, &len, max) || !len) {
+	/* leave it to cli_ac_chklsig() */
+	cli_dbgmsg("cli_ac_lsig_compile: Can't compile %s\n", lsig->logic);
+	free(prog);
+	return CL_SUCCESS;
+    }
+    for(i = 0; i < len; i++) {
+	if(prog[i].type == CLI_LSIG_OP_LEAF) {
+	    if(++sp > maxsp)
+		maxsp = sp;
+	} else {
+	    sp--;
+	}
+    }
+    if(maxsp > LSIG_STACK) {
+	cli_dbgmsg("cli_ac_lsig_compile: Expression too deep: %s\n", lsig->logic);
+	free(prog);
+	return CL_SUCCESS;
+    }
+
+    lsig->prog = (struct cli_lsig_op *) mpool_malloc(root->mempool, len * sizeof(struct cli_lsig_op));
+    if(!lsig->prog) {
+	cli_errmsg("cli_ac_lsig_compile: Can't allocate memory for lsig->prog\n");
+	free(prog);
+	return CL_EMEM;
+    }
+    memcpy(lsig->prog, prog, len * sizeof(struct cli_lsig_op));
+    lsig->proglen = len;
+    free(prog);
+
+    /* an untouched lsig has all its counters at zero */
+    memset(zero, 0, sizeof(zero));
+    lsig->always = lsig_run(lsig->prog, lsig->proglen, zero);
+    return CL_SUCCESS;
+}
+
+int cli_ac_lsig_match(const struct cli_ac_lsig *lsig, const uint32_t *lsigcnt)
+{
+	unsigned int evalcnt = 0;
+	uint64_t evalids = 0;
+
+    if(lsig->prog)
+	return lsig_run(lsig->prog, lsig->proglen, lsigcnt);
+
+    return cli_ac_chklsig(lsig->logic, lsig->logic + strlen(lsig->logic), (uint32_t *) lsigcnt, &evalcnt, &evalids, 0) == 1;
+}
+
 /* 
  * FIXME: the current support for string alternatives uses a brute-force
  *        approach and doesn't perform any kind of verification and
@@ -901,9 +1183,24 @@ inline static int ac_findmatch(const unsigned char *buffer, uint32_t offset, uin
     return 1;
 }
 
+/* Per-lsig counters and subsig offsets, handed out AC_LSIG_PAGE at a time */
+#define AC_LSIG_PAGE 8
+struct cli_ac_lsig_page {
+    struct cli_ac_lsig_page *next;
+    unsigned int used;
+    uint32_t state[AC_LSIG_PAGE][3][64];
+};
+
+#define AC_OFF_NONE4 CLI_OFF_NONE, CLI_OFF_NONE, CLI_OFF_NONE, CLI_OFF_NONE
+#define AC_OFF_NONE16 AC_OFF_NONE4, AC_OFF_NONE4, AC_OFF_NONE4, AC_OFF_NONE4
+static const uint32_t ac_lsig_nocnt[64];
+static const uint32_t ac_lsig_nooff[64] = {
+    AC_OFF_NONE16, AC_OFF_NONE16, AC_OFF_NONE16, AC_OFF_NONE16
+};
+
 int cli_ac_initdata(struct cli_ac_data *data, uint32_t partsigs, uint32_t lsigs, uint32_t reloffsigs, uint8_t tracklen)
 {
-	unsigned int i, j;
+	unsigned int i;
 
 
     if(!data) {
@@ -913,7 +1210,7 @@ int cli_ac_initdata(struct cli_ac_data *data, uint32_t partsigs, uint32_t lsigs,
 
     data->reloffsigs = reloffsigs;
     if(reloffsigs) {
-	data->offset = (uint32_t *) cli_malloc(reloffsigs * 2 * sizeof(uint32_t));
+	data->offset = (uint32_t *) cli_arena_malloc(reloffsigs * 2 * sizeof(uint32_t));
 	if(!data->offset) {
 	    cli_errmsg("cli_ac_init: Can't allocate memory for data->offset\n");
 	    return CL_EMEM;
@@ -924,81 +1221,45 @@ int cli_ac_initdata(struct cli_ac_data *data, uint32_t partsigs, uint32_t lsigs,
 
     data->partsigs = partsigs;
     if(partsigs) {
-	data->offmatrix = (int32_t ***) cli_calloc(partsigs, sizeof(int32_t **));
+	data->offmatrix = (int32_t ***) cli_arena_calloc(partsigs, sizeof(int32_t **));
 	if(!data->offmatrix) {
 	    cli_errmsg("cli_ac_init: Can't allocate memory for data->offmatrix\n");
 	    if(reloffsigs)
-		free(data->offset);
+		cli_arena_free(data->offset);
 	    return CL_EMEM;
 	}
     }
  
     data->lsigs = lsigs;
+    data->lsig_pages = NULL;
     if(lsigs) {
-	data->lsigcnt = (uint32_t **) cli_malloc(lsigs * sizeof(uint32_t *));
+	/* the per-lsig state is allocated on the first subsig match, until
+	 * then all three tables point to the shared empty state */
+	data->lsigcnt = (uint32_t **) cli_arena_malloc(lsigs * 3 * sizeof(uint32_t *));
 	if(!data->lsigcnt) {
 	    if(partsigs)
-		free(data->offmatrix);
+		cli_arena_free(data->offmatrix);
 	    if(reloffsigs)
-		free(data->offset);
+		cli_arena_free(data->offset);
 	    cli_errmsg("cli_ac_init: Can't allocate memory for data->lsigcnt\n");
 	    return CL_EMEM;
 	}
-	data->lsigcnt[0] = (uint32_t *) cli_calloc(lsigs * 64, sizeof(uint32_t));
-	if(!data->lsigcnt[0]) {
-	    free(data->lsigcnt);
+	data->lsigsuboff_last = data->lsigcnt + lsigs;
+	data->lsigsuboff_first = data->lsigcnt + 2 * lsigs;
+	data->lsig_touched = (uint32_t *) cli_arena_calloc((lsigs + 31) / 32, sizeof(uint32_t));
+	if(!data->lsig_touched) {
+	    cli_arena_free(data->lsigcnt);
 	    if(partsigs)
-		free(data->offmatrix);
+		cli_arena_free(data->offmatrix);
 	    if(reloffsigs)
-		free(data->offset);
-	    cli_errmsg("cli_ac_init: Can't allocate memory for data->lsigcnt[0]\n");
+		cli_arena_free(data->offset);
+	    cli_errmsg("cli_ac_init: Can't allocate memory for data->lsig_touched\n");
 	    return CL_EMEM;
 	}
-	for(i = 1; i < lsigs; i++)
-	    data->lsigcnt[i] = data->lsigcnt[0] + 64 * i;
-
-	/* subsig offsets */
-	data->lsigsuboff_last = (uint32_t **) cli_malloc(lsigs * sizeof(uint32_t *));
-	data->lsigsuboff_first = (uint32_t **) cli_malloc(lsigs * sizeof(uint32_t *));
-	if(!data->lsigsuboff_last || !data->lsigsuboff_first) {
-	    free(data->lsigsuboff_last);
-	    free(data->lsigsuboff_first);
-	    free(data->lsigcnt[0]);
-	    free(data->lsigcnt);
-	    if(partsigs)
-		free(data->offmatrix);
-	    if(reloffsigs)
-		free(data->offset);
-	    cli_errmsg("cli_ac_init: Can't allocate memory for data->lsigsuboff_(last|first)\n");
-	    return CL_EMEM;
-	}
-	data->lsigsuboff_last[0] = (uint32_t *) cli_calloc(lsigs * 64, sizeof(uint32_t));
-	data->lsigsuboff_first[0] = (uint32_t *) cli_calloc(lsigs * 64, sizeof(uint32_t));
-	if(!data->lsigsuboff_last[0] || !data->lsigsuboff_first[0]) {
-	    free(data->lsigsuboff_last[0]);
-	    free(data->lsigsuboff_first[0]);
-	    free(data->lsigsuboff_last);
-	    free(data->lsigsuboff_first);
-	    free(data->lsigcnt[0]);
-	    free(data->lsigcnt);
-	    if(partsigs)
-		free(data->offmatrix);
-	    if(reloffsigs)
-		free(data->offset);
-	    cli_errmsg("cli_ac_init: Can't allocate memory for data->lsigsuboff_(last|first)[0]\n");
-	    return CL_EMEM;
-	}
-	for(j = 0; j < 64; j++) {
-	    data->lsigsuboff_last[0][j] = CLI_OFF_NONE;
-	    data->lsigsuboff_first[0][j] = CLI_OFF_NONE;
-	}
-	for(i = 1; i < lsigs; i++) {
-	    data->lsigsuboff_last[i] = data->lsigsuboff_last[0] + 64 * i;
-	    data->lsigsuboff_first[i] = data->lsigsuboff_first[0] + 64 * i;
-	    for(j = 0; j < 64; j++) {
-		data->lsigsuboff_last[i][j] = CLI_OFF_NONE;
-		data->lsigsuboff_first[i][j] = CLI_OFF_NONE;
-	    }
+	for(i = 0; i < lsigs; i++) {
+	    data->lsigcnt[i] = (uint32_t *) ac_lsig_nocnt;
+	    data->lsigsuboff_last[i] = (uint32_t *) ac_lsig_nooff;
+	    data->lsigsuboff_first[i] = (uint32_t *) ac_lsig_nooff;
 	}
     }
     for (i=0;i<32;i++)
@@ -1040,30 +1301,76 @@ void cli_ac_freedata(struct cli_ac_data *data)
     if(data && data->partsigs) {
 	for(i = 0; i < data->partsigs; i++) {
 	    if(data->offmatrix[i]) {
-		free(data->offmatrix[i][0]);
-		free(data->offmatrix[i]);
+		cli_arena_free(data->offmatrix[i][0]);
+		cli_arena_free(data->offmatrix[i]);
 	    }
 	}
-	free(data->offmatrix);
+	cli_arena_free(data->offmatrix);
 	data->partsigs = 0;
     }
 
     if(data && data->lsigs) {
-	free(data->lsigcnt[0]);
-	free(data->lsigcnt);
-	free(data->lsigsuboff_last[0]);
-	free(data->lsigsuboff_last);
-	free(data->lsigsuboff_first[0]);
-	free(data->lsigsuboff_first);
+	struct cli_ac_lsig_page *page;
+
+	while((page = data->lsig_pages)) {
+	    data->lsig_pages = page->next;
+	    cli_arena_free(page);
+	}
+	cli_arena_free(data->lsig_touched);
+	cli_arena_free(data->lsigcnt);
 	data->lsigs = 0;
     }
 
     if(data && data->reloffsigs) {
-	free(data->offset);
+	cli_arena_free(data->offset);
 	data->reloffsigs = 0;
     }
 }
 
+/* brings data back to the state cli_ac_initdata() left it in, touching
+ * only what the last scan used */
+void cli_ac_resetdata(struct cli_ac_data *data)
+{
+	uint32_t i, j, bits;
+
+    for(i = 0; i < data->partsigs; i++) {
+	if(data->offmatrix[i]) {
+	    cli_arena_free(data->offmatrix[i][0]);
+	    cli_arena_free(data->offmatrix[i]);
+	    data->offmatrix[i] = NULL;
+	}
+    }
+
+    if(data->lsigs) {
+	struct cli_ac_lsig_page *page;
+
+	for(i = 0; i < (data->lsigs + 31) / 32; i++) {
+	    if(!(bits = data->lsig_touched[i]))
+		continue;
+	    data->lsig_touched[i] = 0;
+	    for(j = i * 32; bits; j++, bits >>= 1) {
+		if(!(bits & 1))
+		    continue;
+		data->lsigcnt[j] = (uint32_t *) ac_lsig_nocnt;
+		data->lsigsuboff_last[j] = (uint32_t *) ac_lsig_nooff;
+		data->lsigsuboff_first[j] = (uint32_t *) ac_lsig_nooff;
+	    }
+	}
+	while((page = data->lsig_pages)) {
+	    data->lsig_pages = page->next;
+	    cli_arena_free(page);
+	}
+    }
+
+    for(i = 0; i < data->reloffsigs * 2; i += 2)
+	data->offset[i] = CLI_OFF_NONE;
+
+    for(i = 0; i < 32; i++)
+	data->macro_lastmatch[i] = CLI_OFF_NONE;
+    data->vinfo = NULL;
+    data->min_partno = 1;
+}
+
 inline static int ac_addtype(struct cli_matched_type **list, cli_file_t type, off_t offset, const cli_ctx *ctx)
 {
 	struct cli_matched_type *tnode, *tnode_last;
@@ -1096,15 +1403,44 @@ inline static int ac_addtype(struct cli_matched_type **list, cli_file_t type, of
     return CL_SUCCESS;
 }
 
-static inline void lsig_sub_matched(const struct cli_matcher *root, struct cli_ac_data *mdata, uint32_t lsigid1, uint32_t lsigid2, uint32_t realoff, int partial)
+static int lsig_state_alloc(struct cli_ac_data *mdata, uint32_t lsigid1)
+{
+	struct cli_ac_lsig_page *page = mdata->lsig_pages;
+	uint32_t (*state)[64];
+	unsigned int j;
+
+    if(!page || page->used == AC_LSIG_PAGE) {
+	page = (struct cli_ac_lsig_page *) cli_arena_malloc(sizeof(struct cli_ac_lsig_page));
+	if(!page) {
+	    cli_errmsg("lsig_state_alloc: Can't allocate memory for lsig state\n");
+	    return CL_EMEM;
+	}
+	page->next = mdata->lsig_pages;
+	page->used = 0;
+	mdata->lsig_pages = page;
+    }
+    state = page->state[page->used++];
+    memset(state[0], 0, sizeof(state[0]));
+    for(j = 0; j < 64; j++)
+	state[1][j] = state[2][j] = CLI_OFF_NONE;
+    mdata->lsigcnt[lsigid1] = state[0];
+    mdata->lsigsuboff_last[lsigid1] = state[1];
+    mdata->lsigsuboff_first[lsigid1] = state[2];
+    mdata->lsig_touched[lsigid1 / 32] |= 1u << (lsigid1 % 32);
+    return CL_SUCCESS;
+}
+
+static inline int lsig_sub_matched(const struct cli_matcher *root, struct cli_ac_data *mdata, uint32_t lsigid1, uint32_t lsigid2, uint32_t realoff, int partial)
 {
 	const struct cli_lsig_tdb *tdb = &root->ac_lsigtable[lsigid1]->tdb;
 
     if(realoff != CLI_OFF_NONE) {
+	if(!(mdata->lsig_touched[lsigid1 / 32] & (1u << (lsigid1 % 32))) && lsig_state_alloc(mdata, lsigid1))
+	    return CL_EMEM;
 	if(mdata->lsigsuboff_first[lsigid1][lsigid2] == CLI_OFF_NONE)
 	    mdata->lsigsuboff_first[lsigid1][lsigid2] = realoff;
 	if(mdata->lsigsuboff_last[lsigid1][lsigid2] != CLI_OFF_NONE && ((!partial && realoff <= mdata->lsigsuboff_last[lsigid1][lsigid2]) || (partial && realoff < mdata->lsigsuboff_last[lsigid1][lsigid2])))
-	    return;
+	    return CL_SUCCESS;
 	mdata->lsigcnt[lsigid1][lsigid2]++;
 	if(mdata->lsigcnt[lsigid1][lsigid2] <= 1 || !tdb->macro_ptids || !tdb->macro_ptids[lsigid2])
 	    mdata->lsigsuboff_last[lsigid1][lsigid2] = realoff;
@@ -1116,10 +1452,10 @@ static inline void lsig_sub_matched(const struct cli_matcher *root, struct cli_a
 	const struct cli_ac_patt *macropt;
 	uint32_t id, last_macro_match, smin, smax, last_macroprev_match;
 	if (!tdb->macro_ptids)
-	    return;
+	    return CL_SUCCESS;
 	id = tdb->macro_ptids[lsigid2];
 	if (!id)
-	    return;
+	    return CL_SUCCESS;
 	macropt = root->ac_pattable[id];
 	smin = macropt->ch_mindist[0];
 	smax = macropt->ch_maxdist[0];
@@ -1143,6 +1479,7 @@ static inline void lsig_sub_matched(const struct cli_matcher *root, struct cli_a
 	    mdata->lsigsuboff_last[lsigid1][lsigid2+1] = last_macro_match;
 	}
     }
+    return CL_SUCCESS;
 }
 
 void cli_ac_chkmacro(struct cli_matcher *root, struct cli_ac_data *data, unsigned lsigid1)
@@ -1167,6 +1504,7 @@ int cli_ac_scanbuff(const unsigned char *buffer, uint32_t length, const char **v
 	uint8_t found;
 	int type = CL_CLEAN;
 	struct cli_ac_result *newres;
+	uint64_t *cnt;
 
     if(!root->ac_root)
 	return CL_CLEAN;
@@ -1177,12 +1515,15 @@ int cli_ac_scanbuff(const unsigned char *buffer, uint32_t length, const char **v
     }
 
     current = root->ac_root;
+    cnt = cli_counters();
 
     for(i = 0; i < length; i++)  {
 	current = current->trans[buffer[i]];
 
 	if(UNLIKELY(IS_FINAL(current))) {
 	    struct cli_ac_patt *faillist = current->fail->list;
+	    if(cnt)
+		cnt[CL_COUNTER_AC_FINAL]++;
 	    patt = current->list;
 	    while(patt) {
 		if(patt->partno > mdata->min_partno) {
@@ -1210,6 +1551,8 @@ int cli_ac_scanbuff(const unsigned char *buffer, uint32_t length, const char **v
 		    }
 		}
 		pt = patt;
+		if(cnt)
+		    cnt[CL_COUNTER_AC_VERIFY]++;
 		if(ac_findmatch(buffer, bp, offset + bp - patt->prefix_length, length, patt, &matchend)) {
 		    while(pt) {
 			if(pt->partno > mdata->min_partno)
@@ -1257,16 +1600,16 @@ int cli_ac_scanbuff(const unsigned char *buffer, uint32_t length, const char **v
 				mdata->min_partno = pt->partno + 1;
 
 			    if(!mdata->offmatrix[pt->sigid - 1]) {
-				mdata->offmatrix[pt->sigid - 1] = cli_malloc(pt->parts * sizeof(int32_t *));
+				mdata->offmatrix[pt->sigid - 1] = cli_arena_malloc(pt->parts * sizeof(int32_t *));
 				if(!mdata->offmatrix[pt->sigid - 1]) {
 				    cli_errmsg("cli_ac_scanbuff: Can't allocate memory for mdata->offmatrix[%u]\n", pt->sigid - 1);
 				    return CL_EMEM;
 				}
 
-				mdata->offmatrix[pt->sigid - 1][0] = cli_malloc(pt->parts * (CLI_DEFAULT_AC_TRACKLEN + 2) * sizeof(int32_t));
+				mdata->offmatrix[pt->sigid - 1][0] = cli_arena_malloc(pt->parts * (CLI_DEFAULT_AC_TRACKLEN + 2) * sizeof(int32_t));
 				if(!mdata->offmatrix[pt->sigid - 1][0]) {
 				    cli_errmsg("cli_ac_scanbuff: Can't allocate memory for mdata->offmatrix[%u][0]\n", pt->sigid - 1);
-				    free(mdata->offmatrix[pt->sigid - 1]);
+				    cli_arena_free(mdata->offmatrix[pt->sigid - 1]);
 				    mdata->offmatrix[pt->sigid - 1] = NULL;
 				    return CL_EMEM;
 				}
@@ -1341,7 +1684,8 @@ int cli_ac_scanbuff(const unsigned char *buffer, uint32_t length, const char **v
 
 				} else { /* !pt->type */
 				    if(pt->lsigid[0]) {
-					lsig_sub_matched(root, mdata, pt->lsigid[1], pt->lsigid[2], offmatrix[pt->parts - 1][1], 1);
+					if(lsig_sub_matched(root, mdata, pt->lsigid[1], pt->lsigid[2], offmatrix[pt->parts - 1][1], 1))
+					    return CL_EMEM;
 					pt = pt->next_same;
 					continue;
 				    }
@@ -1392,7 +1736,8 @@ int cli_ac_scanbuff(const unsigned char *buffer, uint32_t length, const char **v
 				}
 			    } else {
 				if(pt->lsigid[0]) {
-				    lsig_sub_matched(root, mdata, pt->lsigid[1], pt->lsigid[2], realoff, 0);
+				    if(lsig_sub_matched(root, mdata, pt->lsigid[1], pt->lsigid[2], realoff, 0))
+					return CL_EMEM;
 				    pt = pt->next_same;
 				    continue;
 				}
@@ -38,6 +38,8 @@ struct cli_ac_data {
     uint32_t partsigs, lsigs, reloffsigs;
     uint32_t **lsigcnt;
     uint32_t **lsigsuboff_last, **lsigsuboff_first;
+    uint32_t *lsig_touched; /* bitmap of the lsigs with a subsig match */
+    struct cli_ac_lsig_page *lsig_pages;
     uint32_t *offset;
     uint32_t macro_lastmatch[32];
     /** Hashset for versioninfo matching */
@@ -88,11 +90,16 @@ struct cli_ac_result {
 
 #include "matcher.h"
 
+struct cli_ac_lsig;
+
 int cli_ac_addpatt(struct cli_matcher *root, struct cli_ac_patt *pattern);
 int cli_ac_initdata(struct cli_ac_data *data, uint32_t partsigs, uint32_t lsigs, uint32_t reloffsigs, uint8_t tracklen);
 void cli_ac_chkmacro(struct cli_matcher *root, struct cli_ac_data *data, unsigned lsigid1);
 int cli_ac_chklsig(const char *expr, const char *end, uint32_t *lsigcnt, unsigned int *cnt, uint64_t *ids, unsigned int parse_only);
+int cli_ac_lsig_compile(struct cli_matcher *root, struct cli_ac_lsig *lsig);
+int cli_ac_lsig_match(const struct cli_ac_lsig *lsig, const uint32_t *lsigcnt);
 void cli_ac_freedata(struct cli_ac_data *data);
+void cli_ac_resetdata(struct cli_ac_data *data);
 int cli_ac_scanbuff(const unsigned char *buffer, uint32_t length, const char **virname, void **customdata, struct cli_ac_result **res, const struct cli_matcher *root, struct cli_ac_data *mdata, uint32_t offset, cli_file_t ftype, struct cli_matched_type **ftoffset, unsigned int mode, cli_ctx *ctx);
 int cli_ac_buildtrie(struct cli_matcher *root);
 int cli_ac_init(struct cli_matcher *root, uint8_t mindepth, uint8_t maxdepth, uint8_t dconf_prefiltering);
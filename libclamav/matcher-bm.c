@@ -23,6 +23,7 @@
 #endif
 
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 #include "clamav.h"
 #include "memory.h"
@@ -32,13 +33,69 @@
 #include "matcher-bm.h"
 #include "filetypes.h"
 #include "filtering.h"
+#include "perflogging.h"
 
 #include "mpool.h"
+#include "arena.h"
 
 #define BM_MIN_LENGTH	3
 #define BM_BLOCK_SIZE	3
 #define HASH(a,b,c) (211 * a + 37 * b + c)
 
+/*
+ * Multi-literal engine (CL_ENGINE_BM_LITERAL)
+ *
+ * With BM_MIN_LENGTH == BM_BLOCK_SIZE the shift table above never lets
+ * cli_bm_scanbuff() skip a byte. The literal engine is Wu-Manber on the
+ * whole patterns (prefix included): every window of the first lit->win bytes
+ * (the shortest pattern, up to LIT_MAXWIN) is hashed LIT_BLOCK bytes at a
+ * time, so the scan advances up to win - LIT_BLOCK + 1 bytes per step.
+ * Candidates with a zero shift are packed per hash bucket together with
+ * their first LIT_BLOCK bytes and verified against a contiguous copy of the
+ * patterns.
+ *
+ * The BM scanner reports the first match by the position of the load
+ * balanced suffix and then by bm_suffix chain order. The literal engine keeps
+ * the best match by the same key and scans on until no pattern starting
+ * later can beat it, so both engines report the same signature.
+ */
+#define LIT_BLOCK	4
+#define LIT_MINWIN	6
+#define LIT_MAXWIN	32
+
+struct cli_bm_lit_patt {
+    uint32_t data;	/* offset in lit->arena */
+    uint32_t len;	/* prefix_length + length */
+    uint32_t anchor;	/* prefix_length */
+    uint32_t rank;	/* position in the bm_suffix chain */
+    struct cli_bm_patt *p;
+};
+
+struct cli_bm_lit_cand {
+    uint32_t head;	/* first LIT_BLOCK bytes of the pattern */
+    uint32_t patt;
+};
+
+struct cli_bm_lit {
+    unsigned int win, hbits;
+    uint8_t *shift;
+    uint32_t *bucket;	/* (1 << hbits) + 1 starts in cand */
+    struct cli_bm_lit_cand *cand;
+    struct cli_bm_lit_patt *patt;
+    unsigned char *arena;
+    uint32_t npatt;
+};
+
+static inline uint32_t lit_word(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline uint32_t lit_hash(const unsigned char *p, unsigned int hbits)
+{
+    return (lit_word(p) * 2654435761U) >> (32 - hbits);
+}
+
 int cli_bm_addpatt(struct cli_matcher *root, struct cli_bm_patt *pattern, const char *offset)
 {
 	uint16_t idx, i;
@@ -168,15 +225,15 @@ int cli_bm_initoff(const struct cli_matcher *root, struct cli_bm_off *data, cons
     }
 
     data->cnt = data->pos = 0;
-    data->offtab = (uint32_t *) cli_malloc(root->bm_patterns * sizeof(uint32_t));
+    data->offtab = (uint32_t *) cli_arena_malloc(root->bm_patterns * sizeof(uint32_t));
     if(!data->offtab) {
 	cli_errmsg("cli_bm_initoff: Can't allocate memory for data->offtab\n");
 	return CL_EMEM;
     }
-    data->offset = (uint32_t *) cli_malloc(root->bm_patterns * sizeof(uint32_t));
+    data->offset = (uint32_t *) cli_arena_malloc(root->bm_patterns * sizeof(uint32_t));
     if(!data->offset) {
 	cli_errmsg("cli_bm_initoff: Can't allocate memory for data->offset\n");
-	free(data->offtab);
+	cli_arena_free(data->offtab);
 	return CL_EMEM;
     }
     for(i = 0; i < root->bm_patterns; i++) {
@@ -188,8 +245,8 @@ int cli_bm_initoff(const struct cli_matcher *root, struct cli_bm_off *data, cons
 	    data->cnt++;
 	} else if((ret = cli_caloff(NULL, info, root->type, patt->offdata, &data->offset[patt->offset_min], NULL))) {
 	    cli_errmsg("cli_bm_initoff: Can't calculate relative offset in signature for %s\n", patt->virname);
-	    free(data->offtab);
-	    free(data->offset);
+	    cli_arena_free(data->offtab);
+	    cli_arena_free(data->offset);
 	    return ret;
 	} else if((data->offset[patt->offset_min] != CLI_OFF_NONE) && (data->offset[patt->offset_min] + patt->length <= info->fsize)) {
 	    if(!data->cnt || (data->offset[patt->offset_min] + patt->prefix_length != data->offtab[data->cnt - 1])) {
@@ -207,18 +264,128 @@ int cli_bm_initoff(const struct cli_matcher *root, struct cli_bm_off *data, cons
 
 void cli_bm_freeoff(struct cli_bm_off *data)
 {
-    free(data->offset);
+    cli_arena_free(data->offset);
     data->offset = NULL;
-    free(data->offtab);
+    cli_arena_free(data->offtab);
     data->offtab = NULL;
 }
 
+static void bm_lit_free(struct cli_bm_lit *lit)
+{
+    if(!lit)
+	return;
+    free(lit->shift);
+    free(lit->bucket);
+    free(lit->cand);
+    free(lit->patt);
+    free(lit->arena);
+    free(lit);
+}
+
+int cli_bm_build_literal(struct cli_matcher *root)
+{
+	struct cli_bm_lit *lit;
+	struct cli_bm_lit_patt *lp;
+	struct cli_bm_patt *p;
+	const unsigned char *pt;
+	uint32_t i, j, h, rank, npatt = 0, total = 0, minlen = 0xffffffff, entries, size;
+	unsigned int win;
+
+
+    bm_lit_free(root->bm_lit);
+    root->bm_lit = NULL;
+    if(!root->bm_suffix || root->bm_offmode)
+	return CL_SUCCESS;
+
+    for(i = 0; i < HASH(255, 255, 255) + 1; i++) {
+	for(p = root->bm_suffix[i]; p; p = p->next) {
+	    npatt++;
+	    total += p->length + p->prefix_length;
+	    minlen = MIN(minlen, (uint32_t) p->length + p->prefix_length);
+	}
+    }
+    if(!npatt)
+	return CL_SUCCESS;
+    if(minlen < LIT_MINWIN) {
+	cli_dbgmsg("cli_bm_build_literal: Shortest pattern in root[%u] has %u bytes, using the BM scanner\n", root->type, minlen);
+	return CL_SUCCESS;
+    }
+
+    win = MIN(minlen, LIT_MAXWIN);
+    entries = npatt * (win - LIT_BLOCK + 1);
+    for(h = 12; h < 20 && (1U << h) < entries * 8; h++);
+    size = 1U << h;
+
+    if(!(lit = (struct cli_bm_lit *) cli_calloc(1, sizeof(struct cli_bm_lit)))) {
+	cli_errmsg("cli_bm_build_literal: Can't allocate memory for lit\n");
+	return CL_EMEM;
+    }
+    lit->win = win;
+    lit->hbits = h;
+    lit->npatt = npatt;
+    lit->shift = (uint8_t *) cli_malloc(size);
+    lit->bucket = (uint32_t *) cli_calloc(size + 1, sizeof(uint32_t));
+    lit->cand = (struct cli_bm_lit_cand *) cli_malloc(npatt * sizeof(struct cli_bm_lit_cand));
+    lit->patt = (struct cli_bm_lit_patt *) cli_malloc(npatt * sizeof(struct cli_bm_lit_patt));
+    lit->arena = (unsigned char *) cli_malloc(total);
+    if(!lit->shift || !lit->bucket || !lit->cand || !lit->patt || !lit->arena) {
+	cli_errmsg("cli_bm_build_literal: Can't allocate memory for the literal tables\n");
+	bm_lit_free(lit);
+	return CL_EMEM;
+    }
+    memset(lit->shift, win - LIT_BLOCK + 1, size);
+
+    /* copy the patterns, count the bucket sizes */
+    lp = lit->patt;
+    total = 0;
+    for(i = 0; i < HASH(255, 255, 255) + 1; i++) {
+	for(rank = 0, p = root->bm_suffix[i]; p; p = p->next, rank++, lp++) {
+	    lp->data = total;
+	    lp->len = p->length + p->prefix_length;
+	    lp->anchor = p->prefix_length;
+	    lp->rank = rank;
+	    lp->p = p;
+	    pt = p->prefix ? p->prefix : p->pattern;
+	    memcpy(lit->arena + total, pt, lp->len);
+	    total += lp->len;
+
+	    for(j = LIT_BLOCK - 1; j < win; j++) {
+		h = lit_hash(pt + j - LIT_BLOCK + 1, lit->hbits);
+		if(lit->shift[h] > win - 1 - j)
+		    lit->shift[h] = win - 1 - j;
+	    }
+	    lit->bucket[lit_hash(pt + win - LIT_BLOCK, lit->hbits) + 1]++;
+	}
+    }
+
+    /* pack the candidates of each bucket */
+    for(h = 0; h < size; h++)
+	lit->bucket[h + 1] += lit->bucket[h];
+    for(i = 0; i < npatt; i++) {
+	pt = lit->arena + lit->patt[i].data;
+	h = lit_hash(pt + win - LIT_BLOCK, lit->hbits);
+	lit->cand[lit->bucket[h]].head = lit_word(pt);
+	lit->cand[lit->bucket[h]].patt = i;
+	lit->bucket[h]++;
+    }
+    for(h = size; h > 0; h--)
+	lit->bucket[h] = lit->bucket[h - 1];
+    lit->bucket[0] = 0;
+
+    cli_dbgmsg("cli_bm_build_literal: root[%u]: %u patterns, window %u, %u hash bits\n", root->type, npatt, win, lit->hbits);
+    root->bm_lit = lit;
+    return CL_SUCCESS;
+}
+
 void cli_bm_free(struct cli_matcher *root)
 {
 	struct cli_bm_patt *patt, *prev;
 	uint16_t i, size = HASH(255, 255, 255) + 1;
 
 
+    bm_lit_free(root->bm_lit);
+    root->bm_lit = NULL;
+
     if(root->bm_shift)
 	mpool_free(root->mempool, root->bm_shift);
 
@@ -244,6 +411,86 @@ void cli_bm_free(struct cli_matcher *root)
     }
 }
 
+static int bm_scan_literal(const unsigned char *buffer, uint32_t length, const char **virname, const struct cli_bm_patt **patt, const struct cli_matcher *root, uint32_t offset, const struct cli_target_info *info, uint32_t *viroffset)
+{
+	const struct cli_bm_lit *lit = root->bm_lit;
+	const struct cli_bm_lit_patt *lp, *best = NULL;
+	const struct cli_bm_lit_cand *c, *cend;
+	struct cli_bm_patt *p;
+	uint32_t e, s, h, head, off_min, off_max, best_anchor = 0;
+	unsigned int win = lit->win;
+	int ret;
+	uint64_t *cnt;
+
+    if(length < win)
+	return CL_CLEAN;
+
+    cnt = cli_counters();
+    for(e = win - 1; e < length; ) {
+	s = e - win + 1;
+	/* nothing that starts here can come before the best match */
+	if(best && s > best_anchor)
+	    break;
+
+	h = lit_hash(buffer + e - LIT_BLOCK + 1, lit->hbits);
+	if(lit->shift[h]) {
+	    e += lit->shift[h];
+	    if(cnt)
+		cnt[CL_COUNTER_BM_SHIFTS]++;
+	    continue;
+	}
+
+	head = lit_word(buffer + s);
+	for(c = &lit->cand[lit->bucket[h]], cend = &lit->cand[lit->bucket[h + 1]]; c < cend; c++) {
+	    if(c->head != head)
+		continue;
+	    lp = &lit->patt[c->patt];
+	    if(s + lp->len > length)
+		continue;
+	    if(best && (s + lp->anchor > best_anchor || (s + lp->anchor == best_anchor && lp->rank > best->rank)))
+		continue;
+	    if(cnt)
+		cnt[CL_COUNTER_BM_VERIFY]++;
+	    if(memcmp(buffer + s + LIT_BLOCK, lit->arena + lp->data + LIT_BLOCK, lp->len - LIT_BLOCK))
+		continue;
+
+	    p = lp->p;
+	    if((p->boundary & BM_BOUNDARY_EOL) && s + lp->len != length)
+		continue;
+	    if(p->offset_min != CLI_OFF_ANY) {
+		if(p->offdata[0] != CLI_OFF_ABSOLUTE) {
+		    if(!info)
+			continue;
+		    ret = cli_caloff(NULL, info, root->type, p->offdata, &off_min, &off_max);
+		    if(ret != CL_SUCCESS) {
+			cli_errmsg("cli_bm_scanbuff: Can't calculate relative offset in signature for %s\n", p->virname);
+			return ret;
+		    }
+		} else {
+		    off_min = p->offset_min;
+		    off_max = p->offset_max;
+		}
+		if(off_min == CLI_OFF_NONE || off_max < offset + s || off_min > offset + s)
+		    continue;
+	    }
+	    best = lp;
+	    best_anchor = s + lp->anchor;
+	}
+	e++;
+    }
+
+    if(!best)
+	return CL_CLEAN;
+    if(virname) {
+	*virname = best->p->virname;
+	if(viroffset)
+	    *viroffset = offset + best_anchor + best->len;
+    }
+    if(patt)
+	*patt = best->p;
+    return CL_VIRUS;
+}
+
 int cli_bm_scanbuff(const unsigned char *buffer, uint32_t length, const char **virname, const struct cli_bm_patt **patt, const struct cli_matcher *root, uint32_t offset, const struct cli_target_info *info, struct cli_bm_off *offdata, uint32_t *viroffset)
 {
 	uint32_t i, j, off, off_min, off_max;
@@ -253,10 +500,14 @@ int cli_bm_scanbuff(const unsigned char *buffer, uint32_t length, const char **v
 	const unsigned char *bp, *pt;
 	unsigned char prefix;
         int ret;
+	uint64_t *cnt;
 
     if(!root || !root->bm_shift)
 	return CL_CLEAN;
 
+    if(root->bm_lit && !offdata)
+	return bm_scan_literal(buffer, length, virname, patt, root, offset, info, viroffset);
+
     if(length < BM_MIN_LENGTH)
 	return CL_CLEAN;
 
@@ -273,6 +524,7 @@ int cli_bm_scanbuff(const unsigned char *buffer, uint32_t length, const char **v
 	    return CL_CLEAN;
 	i += offdata->offtab[offdata->pos] - offset;
     }
+    cnt = cli_counters();
     for(; i < length - BM_BLOCK_SIZE + 1; ) {
 	idx = HASH(buffer[i], buffer[i + 1], buffer[i + 2]);
 	shift = root->bm_shift[idx];
@@ -337,6 +589,8 @@ int cli_bm_scanbuff(const unsigned char *buffer, uint32_t length, const char **v
 		    pt = p->pattern;
 		}
 
+		if(cnt)
+		    cnt[CL_COUNTER_BM_VERIFY]++;
 		found = 1;
 		for(j = 0; j < p->length + p->prefix_length && off < length; j++, off++) {
 		    if(bp[j] != pt[j]) {
@@ -396,6 +650,8 @@ int cli_bm_scanbuff(const unsigned char *buffer, uint32_t length, const char **v
 	    i += offdata->offtab[offdata->pos] - off;
 	} else {
 	    i += shift;
+	    if(cnt)
+		cnt[CL_COUNTER_BM_SHIFTS]++;
 	}
 
     }
@@ -70,62 +70,103 @@ static const unsigned int hashlen[] = {
     32, /* CLI_HASH_SHA256 */
 };
 
+static int hm_grow(void **ptr, size_t nmemb, size_t size) {
+    void *p = cli_realloc(*ptr, nmemb * size);
+
+    if(!p)
+	return CL_EMEM;
+    *ptr = p;
+    return CL_SUCCESS;
+}
+
+/* The virus name is copied into the string table, the caller keeps its own */
 int hm_addhash_bin(struct cli_matcher *root, const void *binhash, enum CLI_HASH_TYPE type, uint32_t size, const char *virusname) {
     const unsigned int hlen = hashlen[type];
     const struct cli_htu32_element *item;
-    struct cli_sz_hash *szh;
+    struct cli_hm_table *tbl = &root->hm.tables[type];
     struct cli_htu32 *ht;
+    uint32_t bucket, nameoff = CLI_HM_NONAME;
     int i;
 
+    if(root->hm.flushed) {
+	cli_errmsg("hm_addhash_bin: hash tables are already compiled\n");
+	return CL_EARG;
+    }
+
     ht = &root->hm.sizehashes[type];
     if(!root->hm.sizehashes[type].capacity) {
 	i = cli_htu32_init(ht, 64, root->mempool);
 	if(i) return i;
     }
 
+    if(tbl->items == tbl->capacity) {
+	uint32_t cap = tbl->capacity ? tbl->capacity * 2 : 64;
+
+	if(hm_grow((void **)&tbl->hashes, cap, hlen) || hm_grow((void **)&tbl->names, cap, sizeof(*tbl->names)) || hm_grow((void **)&tbl->bucketof, cap, sizeof(*tbl->bucketof))) {
+	    cli_errmsg("hm_addhash_bin: failed to grow hash table to %u entries\n", cap);
+	    return CL_EMEM;
+	}
+	tbl->capacity = cap;
+    }
+
+    if(virusname) {
+	size_t len = strlen(virusname) + 1;
+
+	if((size_t)root->hm.strtab_len + len >= CLI_HM_NONAME) {
+	    cli_errmsg("hm_addhash_bin: string table is full\n");
+	    return CL_EMEM;
+	}
+	if(root->hm.strtab_len + len > root->hm.strtab_cap) {
+	    size_t cap = root->hm.strtab_cap ? root->hm.strtab_cap : 4096;
+
+	    while(cap < root->hm.strtab_len + len)
+		cap *= 2;
+	    if(cap >= CLI_HM_NONAME)
+		cap = CLI_HM_NONAME - 1;
+	    if(hm_grow((void **)&root->hm.strtab, cap, 1)) {
+		cli_errmsg("hm_addhash_bin: failed to grow string table to %lu bytes\n", (unsigned long)cap);
+		return CL_EMEM;
+	    }
+	    root->hm.strtab_cap = cap;
+	}
+	nameoff = root->hm.strtab_len;
+	memcpy(&root->hm.strtab[nameoff], virusname, len);
+    }
+
     item = cli_htu32_find(ht, size);
     if(!item) {
 	struct cli_htu32_element htitem;
-	szh = mpool_calloc(root->mempool, 1, sizeof(*szh));
-	if(!szh) {
-	    cli_errmsg("hm_addhash_bin: failed to allocate size hash\n");
-	    return CL_EMEM;
+
+	if(tbl->nbuckets == tbl->bucketcap) {
+	    uint32_t cap = tbl->bucketcap ? tbl->bucketcap * 2 : 64;
+
+	    if(hm_grow((void **)&tbl->buckets, cap, sizeof(*tbl->buckets))) {
+		cli_errmsg("hm_addhash_bin: failed to grow size table to %u entries\n", cap);
+		return CL_EMEM;
+	    }
+	    tbl->bucketcap = cap;
 	}
 
 	htitem.key = size;
-	htitem.data.as_ptr = szh;
+	htitem.data.as_ulong = tbl->nbuckets;
 	i = cli_htu32_insert(ht, &htitem, root->mempool);
 	if(i) {
 	    cli_errmsg("hm_addhash_bin: failed to add item to hashtab");
-	    mpool_free(root->mempool, szh);
 	    return i;
 	}
+	memset(&tbl->buckets[tbl->nbuckets], 0, sizeof(*tbl->buckets));
+	bucket = tbl->nbuckets++;
     } else
-	szh = (struct cli_sz_hash *)item->data.as_ptr;
+	bucket = item->data.as_ulong;
 
-    szh->items++;
-
-    szh->hash_array = mpool_realloc2(root->mempool, szh->hash_array, hlen * szh->items);
-    if(!szh->hash_array) {
-	cli_errmsg("hm_addhash_bin: failed to grow hash array to %u entries\n", szh->items);
-	szh->items=0;
-	mpool_free(root->mempool, szh->virusnames);
-	szh->virusnames = NULL;
-	return CL_EMEM;
-    }
-
-    szh->virusnames = mpool_realloc2(root->mempool, szh->virusnames, sizeof(*szh->virusnames) * szh->items);
-    if(!szh->virusnames) {
-	cli_errmsg("hm_addhash_bin: failed to grow virusname array to %u entries\n", szh->items);
-	szh->items=0;
-	mpool_free(root->mempool, szh->hash_array);
-	szh->hash_array = NULL;
-	return CL_EMEM;
-    }
+    tbl->buckets[bucket].items++;
+    memcpy(&tbl->hashes[tbl->items * hlen], binhash, hlen);
+    tbl->names[tbl->items] = nameoff;
+    tbl->bucketof[tbl->items] = bucket;
+    tbl->items++;
+    if(virusname)
+	root->hm.strtab_len += strlen(virusname) + 1;
 
-    memcpy(&szh->hash_array[(szh->items-1) * hlen], binhash, hlen);
-    szh->virusnames[(szh->items-1)] = virusname;
-    
     return 0;
 }
 
@@ -141,68 +182,202 @@ static inline int hm_cmp(const uint8_t *itm, const uint8_t *ref, unsigned int ke
 #endif
 }
 
-static void hm_sort(struct cli_sz_hash *szh, size_t l, size_t r, unsigned int keylen) {
+/* the leading word, mapped so that it grows in the order hm_cmp() sorts by */
+static inline uint32_t hm_prefix(const uint8_t *itm) {
+#if WORDS_BIGENDIAN == 0
+    return ~*(uint32_t *)itm;
+#else
+    return *(uint32_t *)itm;
+#endif
+}
+
+static void hm_sort(uint8_t *hashes, uint32_t *names, size_t l, size_t r, unsigned int keylen) {
     uint8_t piv[32], tmph[32];
     size_t l1, r1;
 
-    const char *tmpv;
+    uint32_t tmpv;
 
     if(l + 1 >= r)
 	return;
 
     l1 = l+1, r1 = r;
 
-    memcpy(piv, &szh->hash_array[keylen * l], keylen);
+    memcpy(piv, &hashes[keylen * l], keylen);
     while(l1 < r1) {
-	if(hm_cmp(&szh->hash_array[keylen * l1], piv, keylen) > 0) {
+	if(hm_cmp(&hashes[keylen * l1], piv, keylen) > 0) {
 	    r1--;
 	    if(l1 == r1) break;
-	    memcpy(tmph, &szh->hash_array[keylen * l1], keylen);
-	    tmpv = szh->virusnames[l1];
-	    memcpy(&szh->hash_array[keylen * l1], &szh->hash_array[keylen * r1], keylen);
-	    szh->virusnames[l1] = szh->virusnames[r1];
-	    memcpy(&szh->hash_array[keylen * r1], tmph, keylen);
-	    szh->virusnames[r1] = tmpv;
+	    memcpy(tmph, &hashes[keylen * l1], keylen);
+	    tmpv = names[l1];
+	    memcpy(&hashes[keylen * l1], &hashes[keylen * r1], keylen);
+	    names[l1] = names[r1];
+	    memcpy(&hashes[keylen * r1], tmph, keylen);
+	    names[r1] = tmpv;
 	} else
 	    l1++;
     }
 
     l1--;
     if(l1!=l) {
-	memcpy(tmph, &szh->hash_array[keylen * l1], keylen);
-	tmpv = szh->virusnames[l1];
-	memcpy(&szh->hash_array[keylen * l1], &szh->hash_array[keylen * l], keylen);
-	szh->virusnames[l1] = szh->virusnames[l];
-	memcpy(&szh->hash_array[keylen * l], tmph, keylen);
-	szh->virusnames[l] = tmpv;
+	memcpy(tmph, &hashes[keylen * l1], keylen);
+	tmpv = names[l1];
+	memcpy(&hashes[keylen * l1], &hashes[keylen * l], keylen);
+	names[l1] = names[l];
+	memcpy(&hashes[keylen * l], tmph, keylen);
+	names[l] = tmpv;
     }
 
-    hm_sort(szh, l, l1, keylen);
-    hm_sort(szh, r1, r, keylen);
+    hm_sort(hashes, names, l, l1, keylen);
+    hm_sort(hashes, names, r1, r, keylen);
 }
 
+/* Blocked Bloom filter keyed on (hash, size) in front of the buckets: all the
+ * probes of a key fall in the same 512 bit block so a miss costs one cache
+ * line. The hashes are digests, their bytes are already well distributed. */
+#define HM_BLOOM_BITS_PER_ITEM 12
+#define HM_BLOOM_BLOCK 16 /* words */
 
-void hm_flush(struct cli_matcher *root) {
-    enum CLI_HASH_TYPE type;
+static inline uint32_t *hm_bloom_block(const struct cli_hm_table *tbl, const uint8_t *hash, uint32_t size, uint32_t *b) {
+    uint32_t a = cli_readint32(&hash[4]) ^ (size * 0x9e3779b1);
 
-    if(!root)
-	return;
+    *b = cli_readint32(&hash[8]) ^ size;
+    return &tbl->bloom[(a & tbl->bloom_mask) * HM_BLOOM_BLOCK];
+}
 
-    for(type = CLI_HASH_MD5; type < CLI_HASH_AVAIL_TYPES; type++) {
-	struct cli_htu32 *ht = &root->hm.sizehashes[type];
-	const struct cli_htu32_element *item = NULL;
+static void hm_bloom_add(struct cli_hm_table *tbl, const uint8_t *hash, uint32_t size) {
+    uint32_t b, *blk = hm_bloom_block(tbl, hash, size, &b);
+    unsigned int i;
+
+    for(i = 0; i < 3; i++, b >>= 9)
+	blk[(b >> 5) & 15] |= 1U << (b & 31);
+}
+
+static inline int hm_bloom_test(const struct cli_hm_table *tbl, const uint8_t *hash, uint32_t size) {
+    uint32_t b;
+    const uint32_t *blk = hm_bloom_block(tbl, hash, size, &b);
+    unsigned int i;
+
+    for(i = 0; i < 3; i++, b >>= 9)
+	if(!(blk[(b >> 5) & 15] & (1U << (b & 31))))
+	    return 0;
+    return 1;
+}
+
+/* buckets at least this large get a directory of ~4-8 entries per slot */
+#define HM_DIR_MIN 64
+#define HM_DIR_MAXBITS 16
+
+static unsigned int hm_dirbits(uint32_t items) {
+    unsigned int bits = 0;
+
+    if(items < HM_DIR_MIN)
+	return 0;
+    while((items >> (bits + 1)) >= 4 && bits < HM_DIR_MAXBITS)
+	bits++;
+    return bits;
+}
+
+static void hm_build_dir(const struct cli_hm_table *tbl, const struct cli_sz_hash *szh, unsigned int keylen) {
+    const uint8_t *hashes = &tbl->hashes[szh->start * keylen];
+    uint32_t *dir = &tbl->dirs[szh->dir];
+    unsigned int p, n = 1 << szh->dirbits, shift = 32 - szh->dirbits;
+    uint32_t j = 0;
+
+    for(p = 0; p <= n; p++) {
+	while(j < szh->items && (hm_prefix(&hashes[j * keylen]) >> shift) < p)
+	    j++;
+	dir[p] = j;
+    }
+}
+
+static int hm_flush_table(struct cli_matcher *root, enum CLI_HASH_TYPE type) {
+    struct cli_hm_table *tbl = &root->hm.tables[type];
+    unsigned int keylen = hashlen[type];
+    uint8_t *hashes;
+    uint32_t *names, *dirs, i, pos = 0, ndirs = 0, key;
+    size_t blocks = 1;
+    const struct cli_htu32_element *item = NULL;
+
+    /* lay the buckets out back to back and move each entry in place */
+    for(i = 0; i < tbl->nbuckets; i++) {
+	struct cli_sz_hash *szh = &tbl->buckets[i];
+
+	szh->start = pos;
+	pos += szh->items;
+	if((szh->dirbits = hm_dirbits(szh->items))) {
+	    szh->dir = ndirs;
+	    ndirs += (1 << szh->dirbits) + 1;
+	}
+    }
+    hashes = cli_malloc(tbl->items * keylen);
+    names = cli_malloc(tbl->items * sizeof(*names));
+    dirs = ndirs ? cli_malloc(ndirs * sizeof(*dirs)) : NULL;
+    while(blocks * HM_BLOOM_BLOCK * 32 < (size_t)tbl->items * HM_BLOOM_BITS_PER_ITEM)
+	blocks <<= 1;
+    tbl->bloom = cli_calloc(blocks * HM_BLOOM_BLOCK, sizeof(*tbl->bloom));
+    if(!hashes || !names || (ndirs && !dirs) || !tbl->bloom) {
+	cli_errmsg("hm_flush: failed to allocate the tables for %u hashes\n", tbl->items);
+	free(hashes);
+	free(names);
+	free(dirs);
+	return CL_EMEM;
+    }
+    tbl->bloom_mask = blocks - 1;
+
+    for(i = 0; i < tbl->items; i++) {
+	struct cli_sz_hash *szh = &tbl->buckets[tbl->bucketof[i]];
+	uint32_t dst = szh->start++;
+
+	memcpy(&hashes[dst * keylen], &tbl->hashes[i * keylen], keylen);
+	names[dst] = tbl->names[i];
+    }
+    free(tbl->hashes);
+    free(tbl->names);
+    free(tbl->bucketof);
+    tbl->hashes = hashes;
+    tbl->names = names;
+    tbl->bucketof = NULL;
+    tbl->dirs = dirs;
+    tbl->capacity = tbl->items;
+
+    while((item = cli_htu32_next(&root->hm.sizehashes[type], item))) {
+	struct cli_sz_hash *szh = &tbl->buckets[item->data.as_ulong];
+
+	key = item->key;
+	szh->start -= szh->items;
+	if(szh->items > 1)
+	    hm_sort(hashes, names, szh->start, szh->start + szh->items, keylen);
+	for(i = szh->start; i < szh->start + szh->items; i++)
+	    hm_bloom_add(tbl, &hashes[i * keylen], key);
+	if(szh->dirbits)
+	    hm_build_dir(tbl, szh, keylen);
+    }
+    return CL_SUCCESS;
+}
+
+/* Sorts the buckets into their final packed layout and builds the lookup
+ * aids; no more hashes can be added afterwards. */
+int hm_flush(struct cli_matcher *root) {
+    enum CLI_HASH_TYPE type;
+    int ret;
+
+    if(!root || root->hm.flushed)
+	return CL_SUCCESS;
 
-	if(!root->hm.sizehashes[type].capacity)
-	    continue;
+    for(type = CLI_HASH_MD5; type < CLI_HASH_AVAIL_TYPES; type++)
+	if(root->hm.tables[type].items && (ret = hm_flush_table(root, type)))
+	    return ret;
 
-	while((item = cli_htu32_next(ht, item))) {
-	    struct cli_sz_hash *szh = (struct cli_sz_hash *)item->data.as_ptr;
-	    unsigned int keylen = hashlen[type];
+    if(root->hm.strtab_len < root->hm.strtab_cap) {
+	char *strtab = cli_realloc(root->hm.strtab, root->hm.strtab_len);
 
-	    if(szh->items > 1)
-		hm_sort(szh, 0, szh->items, keylen);
+	if(strtab) {
+	    root->hm.strtab = strtab;
+	    root->hm.strtab_cap = root->hm.strtab_len;
 	}
     }
+    root->hm.flushed = 1;
+    return CL_SUCCESS;
 }
 
 
@@ -212,35 +387,48 @@ int cli_hm_have_size(const struct cli_matcher *root, enum CLI_HASH_TYPE type, ui
 
 int cli_hm_scan(const unsigned char *digest, uint32_t size, const char **virname, const struct cli_matcher *root, enum CLI_HASH_TYPE type) {
     const struct cli_htu32_element *item;
+    const struct cli_hm_table *tbl;
+    const struct cli_sz_hash *szh;
+    const uint8_t *hashes;
     unsigned int keylen;
-    struct cli_sz_hash *szh;
     size_t l, r;
 
-    if(!digest || !size || size == 0xffffffff || !root || !root->hm.sizehashes[type].capacity)
+    if(!digest || !size || size == 0xffffffff || !root || !root->hm.sizehashes[type].capacity || !root->hm.flushed)
 	return CL_CLEAN;
 
     item = cli_htu32_find(&root->hm.sizehashes[type], size);
     if(!item)
 	return CL_CLEAN;
 
-    szh = (struct cli_sz_hash *)item->data.as_ptr;
+    tbl = &root->hm.tables[type];
+    if(!hm_bloom_test(tbl, digest, size))
+	return CL_CLEAN;
+
+    szh = &tbl->buckets[item->data.as_ulong];
     keylen = hashlen[type];
+    hashes = &tbl->hashes[szh->start * keylen];
 
     l = 0;
-    r = szh->items - 1;
-    while(l <= r) {
+    r = szh->items;
+    if(szh->dirbits) {
+	uint32_t p = hm_prefix(digest) >> (32 - szh->dirbits);
+
+	l = tbl->dirs[szh->dir + p];
+	r = tbl->dirs[szh->dir + p + 1];
+    }
+    while(l < r) {
 	size_t c = (l + r) / 2;
-	int res = hm_cmp(digest, &szh->hash_array[keylen * c], keylen);
+	int res = hm_cmp(digest, &hashes[keylen * c], keylen);
 
-	if(res < 0) {
-	    if(!c)
-		break;
-	    r = c - 1;
-	} else if(res > 0)
+	if(res < 0)
+	    r = c;
+	else if(res > 0)
 	    l = c + 1;
 	else {
-	    if(virname)
-		*virname = szh->virusnames[c];
+	    if(virname) {
+		uint32_t off = tbl->names[szh->start + c];
+		*virname = off == CLI_HM_NONAME ? NULL : &root->hm.strtab[off];
+	    }
 	    return CL_VIRUS;
 	}
     }
@@ -254,23 +442,16 @@ void hm_free(struct cli_matcher *root) {
 	return;
 
     for(type = CLI_HASH_MD5; type < CLI_HASH_AVAIL_TYPES; type++) {
-	struct cli_htu32 *ht = &root->hm.sizehashes[type];
-	const struct cli_htu32_element *item = NULL;
-
-	if(!root->hm.sizehashes[type].capacity)
-	    continue;
-
-	while((item = cli_htu32_next(ht, item))) {
-	    struct cli_sz_hash *szh = (struct cli_sz_hash *)item->data.as_ptr;
-	    unsigned int keylen = hashlen[type];
-
-	    mpool_free(root->mempool, szh->hash_array);
-	    while(szh->items)
-		mpool_free(root->mempool, (void *)szh->virusnames[--szh->items]);
-	    mpool_free(root->mempool, szh->virusnames);
-	    mpool_free(root->mempool, szh);
-	}
-	cli_htu32_free(ht, root->mempool);
+	struct cli_hm_table *tbl = &root->hm.tables[type];
+
+	free(tbl->buckets);
+	free(tbl->hashes);
+	free(tbl->names);
+	free(tbl->bucketof);
+	free(tbl->dirs);
+	free(tbl->bloom);
+	if(root->hm.sizehashes[type].capacity)
+	    cli_htu32_free(&root->hm.sizehashes[type], root->mempool);
     }
+    free(root->hm.strtab);
 }
-
@@ -37,20 +37,46 @@ enum CLI_HASH_TYPE {
     CLI_HASH_AVAIL_TYPES
 };
 
+/* All the hashes of a type are kept in one packed table; the entries of a
+ * file size form a contiguous, sorted bucket once hm_flush() has run. Large
+ * buckets get a directory indexed by the leading bits of the hash. */
 struct cli_sz_hash {
-    uint8_t *hash_array;
-    const char **virusnames;
+    uint32_t start;
     uint32_t items;
+    uint32_t dir;
+    uint32_t dirbits;
 };
 
+#define CLI_HM_NONAME 0xffffffff
+
+struct cli_hm_table {
+    struct cli_sz_hash *buckets;
+    uint32_t nbuckets;
+    uint32_t bucketcap;
+
+    uint8_t *hashes;
+    uint32_t *names;	/* offsets in strtab or CLI_HM_NONAME */
+    uint32_t *bucketof;	/* load time only */
+    uint32_t items;
+    uint32_t capacity;
+
+    uint32_t *dirs;
+    uint32_t *bloom;
+    uint32_t bloom_mask;
+};
 
 struct cli_hash_patt {
-    struct cli_htu32 sizehashes[CLI_HASH_AVAIL_TYPES];
+    struct cli_htu32 sizehashes[CLI_HASH_AVAIL_TYPES];	/* size -> bucket */
+    struct cli_hm_table tables[CLI_HASH_AVAIL_TYPES];
+    char *strtab;
+    uint32_t strtab_len;
+    uint32_t strtab_cap;
+    unsigned int flushed;
 };
 
 int hm_addhash_str(struct cli_matcher *root, const char *strhash, uint32_t size, const char *virusname);
 int hm_addhash_bin(struct cli_matcher *root, const void *binhash, enum CLI_HASH_TYPE type, uint32_t size, const char *virusname);
-void hm_flush(struct cli_matcher *root);
+int hm_flush(struct cli_matcher *root);
 int cli_hm_scan(const unsigned char *digest, uint32_t size, const char **virname, const struct cli_matcher *root, enum CLI_HASH_TYPE type);
 int cli_hm_have_size(const struct cli_matcher *root, enum CLI_HASH_TYPE type, uint32_t size);
 void hm_free(struct cli_matcher *root);
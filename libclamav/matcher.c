@@ -55,32 +55,29 @@
 #include "perflogging.h"
 #include "bytecode_priv.h"
 #include "bytecode_api_impl.h"
+#include "scanctx.h"
 #include "sha256.h"
 #include "sha1.h"
 
-#ifdef CLI_PERF_LOGGING
-
-static inline void PERF_LOG_FILTER(int32_t pos, int32_t length, int8_t trie)
+static inline void PERF_LOG_FILTER(int32_t pos, int reject)
 {
-    cli_perf_log_add(RAW_BYTES_SCANNED, length);
-    cli_perf_log_add(FILTER_BYTES_SCANNED, length - pos);
-    cli_perf_log_count2(TRIE_SCANNED, trie, length - pos);
+    uint64_t *cnt = cli_counters();
+
+    if (cnt) {
+	cnt[CL_COUNTER_FILTER_CALLS]++;
+	cnt[CL_COUNTER_FILTER_REJECTS] += reject;
+	cnt[CL_COUNTER_FILTER_SKIPPED] += pos;
+    }
 }
 
-static inline int PERF_LOG_TRIES(int8_t acmode, int8_t bm_called, int32_t length)
+static inline void PERF_LOG_TRIES(int8_t acmode, int8_t bm_called, int32_t length)
 {
     if (bm_called)
-	cli_perf_log_add(BM_SCANNED, length);
+	cli_counter_add(CL_COUNTER_BM_BYTES, length);
     if (acmode)
-	cli_perf_log_add(AC_SCANNED, length);
-    return 0;
+	cli_counter_add(CL_COUNTER_AC_BYTES, length);
 }
 
-#else
-static inline void PERF_LOG_FILTER(int32_t pos, uint32_t length, int8_t trie) {}
-static inline int PERF_LOG_TRIES(int8_t acmode, int8_t bm_called, int32_t length) { return 0; }
-#endif
-
 static inline int matcher_run(const struct cli_matcher *root,
 			      const unsigned char *buffer, uint32_t length,
 			      const char **virname, struct cli_ac_data *mdata,
@@ -107,16 +104,14 @@ static inline int matcher_run(const struct cli_matcher *root,
 	    /*  for safety always scan last maxpatlen bytes */
 	    pos = length - root->maxpatlen - 1;
 	    if (pos < 0) pos = 0;
-	    PERF_LOG_FILTER(pos, length, root->type);
+	    PERF_LOG_FILTER(pos, 1);
 	} else {
 	    /* must not cut buffer for 64[4-4]6161, because we must be able to check
 	     * 64! */
 	    pos = info.first_match - root->maxpatlen - 1;
 	    if (pos < 0) pos = 0;
-	    PERF_LOG_FILTER(pos, length, root->type);
+	    PERF_LOG_FILTER(pos, 0);
 	}
-    } else {
-	PERF_LOG_FILTER(0, length, root->type);
     }
 
     orig_length = length;
@@ -126,7 +121,7 @@ static inline int matcher_run(const struct cli_matcher *root,
     buffer += pos;
     offset += pos;
     if (!root->ac_only) {
-	PERF_LOG_TRIES(0, 1, length);
+	PERF_LOG_TRIES(0, 1, root->bm_offmode ? orig_length : length);
 	if (root->bm_offmode) {
 	    /* Don't use prefiltering for BM offset mode, since BM keeps tracks
 	     * of offsets itself, and doesn't work if we skip chunks of input
@@ -183,13 +178,13 @@ int cli_scanbuff(const unsigned char *buffer, uint32_t length, uint32_t offset,
 
     if(troot) {
 
-	if(!acdata && (ret = cli_ac_initdata(&mdata, troot->ac_partsigs, troot->ac_lsigs, troot->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN)))
+	if(!acdata && (ret = cli_scanctx_initdata(ctx->sctx, &mdata, troot)))
 	    return ret;
 
 	ret = matcher_run(troot, buffer, length, &virname, acdata ? (acdata[0]): (&mdata), offset, NULL, ftype, NULL, AC_SCAN_VIR, NULL, *ctx->fmap, NULL, NULL, ctx);
 
 	if(!acdata)
-	    cli_ac_freedata(&mdata);
+	    cli_scanctx_freedata(ctx->sctx, &mdata);
 
 	if(ret == CL_VIRUS || ret == CL_EMEM)
 	    return ret;
@@ -197,13 +192,13 @@ int cli_scanbuff(const unsigned char *buffer, uint32_t length, uint32_t offset,
 
     virname = NULL;
 
-    if(!acdata && (ret = cli_ac_initdata(&mdata, groot->ac_partsigs, groot->ac_lsigs, groot->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN)))
+    if(!acdata && (ret = cli_scanctx_initdata(ctx->sctx, &mdata, groot)))
 	return ret;
 
     ret = matcher_run(groot, buffer, length, &virname, acdata ? (acdata[1]): (&mdata), offset, NULL, ftype, NULL, AC_SCAN_VIR, NULL, *ctx->fmap, NULL, NULL, ctx);
 
     if(!acdata)
-	cli_ac_freedata(&mdata);
+	cli_scanctx_freedata(ctx->sctx, &mdata);
 
     return ret;
 }
@@ -575,7 +570,7 @@ int cli_scandesc(int desc, cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struc
     int ret = CL_EMEM, empty;
     fmap_t *map = *ctx->fmap;
 
-    if((*ctx->fmap = fmap_check_empty(desc, 0, 0, &empty))) {
+    if((*ctx->fmap = fmap_check_empty_engine(desc, 0, 0, &empty, ctx->engine))) {
 	ret = cli_fmap_scandesc(ctx, ftype, ftonly, ftoffset, acmode, acres, NULL);
 	map->dont_cache_flag = (*ctx->fmap)->dont_cache_flag;
 	funmap(*ctx->fmap);
@@ -586,18 +581,41 @@ int cli_scandesc(int desc, cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struc
     return ret;
 }
 
+/* Returns the first lsig from i on that can possibly match: one with a subsig
+ * match in this scan or one that matches on zero counters */
+static inline unsigned int lsig_next(const struct cli_matcher *root, const struct cli_ac_data *acdata, unsigned int i)
+{
+	unsigned int w = i / 32;
+	uint32_t pending;
+
+    if(!root->ac_lsig_always)
+	return i;
+    if(i >= root->ac_lsigs)
+	return root->ac_lsigs;
+    pending = (acdata->lsig_touched[w] | root->ac_lsig_always[w]) & (~0u << (i % 32));
+    while(!pending) {
+	if(++w >= (root->ac_lsigs + 31) / 32)
+	    return root->ac_lsigs;
+	pending = acdata->lsig_touched[w] | root->ac_lsig_always[w];
+    }
+#ifdef __GNUC__
+    return w * 32 + __builtin_ctz(pending);
+#else
+    for(i = 0; !(pending & (1u << i)); i++);
+    return w * 32 + i;
+#endif
+}
+
 int cli_lsig_eval(cli_ctx *ctx, struct cli_matcher *root, struct cli_ac_data *acdata, struct cli_target_info *target_info, const char *hash)
 {
-	unsigned int i, evalcnt;
-	uint64_t evalids;
+	unsigned int i;
 	fmap_t *map = *ctx->fmap;
 	unsigned int viruses_found = 0;
 
-    for(i = 0; i < root->ac_lsigs; i++) {
-	evalcnt = 0;
-	evalids = 0;
+    for(i = lsig_next(root, acdata, 0); i < root->ac_lsigs; i = lsig_next(root, acdata, i + 1)) {
+	cli_counter_add(CL_COUNTER_LSIG_EVALS, 1);
 	cli_ac_chkmacro(root, acdata, i);
-	if(cli_ac_chklsig(root->ac_lsigtable[i]->logic, root->ac_lsigtable[i]->logic + strlen(root->ac_lsigtable[i]->logic), acdata->lsigcnt[i], &evalcnt, &evalids, 0) == 1) {
+	if(cli_ac_lsig_match(root->ac_lsigtable[i], acdata->lsigcnt[i])) {
 	    if(root->ac_lsigtable[i]->tdb.container && root->ac_lsigtable[i]->tdb.container[0] != ctx->container_type)
 		continue;
 	    if(root->ac_lsigtable[i]->tdb.filesize && (root->ac_lsigtable[i]->tdb.filesize[0] > map->len || root->ac_lsigtable[i]->tdb.filesize[1] < map->len))
@@ -672,6 +690,62 @@ int cli_lsig_eval(cli_ctx *ctx, struct cli_matcher *root, struct cli_ac_data *ac
     return CL_CLEAN;
 }
 
+static inline int root_has_sigs(const struct cli_matcher *root)
+{
+    return root && (root->ac_patterns || root->bm_patterns || root->ac_lsigs);
+}
+
+int cli_scan_plan_build(struct cl_engine *engine)
+{
+	struct cli_scan_plan *plan;
+	unsigned int i, j, hflags = 0;
+	enum CLI_HASH_TYPE htype;
+	const struct cli_matcher *hroots[2];
+
+    if(!engine->scanplan) {
+	engine->scanplan = mpool_calloc(engine->mempool, CLI_PLAN_SLOTS, sizeof(*engine->scanplan));
+	if(!engine->scanplan) {
+	    cli_errmsg("cli_scan_plan_build: Can't allocate memory for scan plan\n");
+	    return CL_EMEM;
+	}
+    }
+
+    hroots[0] = engine->hm_hdb;
+    hroots[1] = engine->hm_fp;
+    for(htype = CLI_HASH_MD5; htype < CLI_HASH_AVAIL_TYPES; htype++) {
+	for(j = 0; j < 2; j++) {
+	    if(hroots[j] && hroots[j]->hm.sizehashes[htype].used)
+		hflags |= CLI_PLAN_MD5 << htype;
+	}
+    }
+
+    for(i = 0; i < CLI_PLAN_SLOTS; i++) {
+	cli_file_t ftype = i ? (cli_file_t) (i + CL_TYPENO - 1) : CL_TYPE_ANY;
+
+	plan = &engine->scanplan[i];
+	plan->flags = hflags;
+	plan->target = CLI_MTARGETS;
+	if(root_has_sigs(engine->root[0]))
+	    plan->flags |= CLI_PLAN_GROOT;
+	if(ftype == CL_TYPE_ANY)
+	    continue;
+	for(j = 1; j < CLI_MTARGETS; j++) {
+	    if(cli_mtargets[j].target == ftype) {
+		plan->target = j;
+		if(root_has_sigs(engine->root[j]))
+		    plan->flags |= CLI_PLAN_TROOT;
+		break;
+	    }
+	}
+    }
+
+    for(j = 0; j < CLI_MTARGETS; j++) {
+	if(engine->root[j] && !root_has_sigs(engine->root[j]))
+	    cli_dbgmsg("Matcher[%u]: %s: no signatures, will be skipped\n", j, cli_mtargets[j].name);
+    }
+    return CL_SUCCESS;
+}
+
 int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli_matched_type **ftoffset, unsigned int acmode, struct cli_ac_result **acres, unsigned char *refhash)
 {
 	const unsigned char *buff;
@@ -691,50 +765,69 @@ int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli
 	const char *virname = NULL;
 	uint32_t viroffset = 0;
 	uint32_t viruses_found = 0;
+	const struct cli_scan_plan *plan;
 
     if(!ctx->engine) {
 	cli_errmsg("cli_scandesc: engine == NULL\n");
 	return CL_ENULLARG;
     }
 
-    if(!ftonly)
-	groot = ctx->engine->root[0]; /* generic signatures */
+    memset(compute_hash, 0, sizeof(compute_hash));
 
-    if(ftype) {
-	for(i = 1; i < CLI_MTARGETS; i++) {
-	    if(cli_mtargets[i].target == ftype) {
-		troot = ctx->engine->root[i];
-		break;
+    hdb = ctx->engine->hm_hdb;
+    fp = ctx->engine->hm_fp;
+
+    if((plan = cli_scan_plan_get(ctx->engine, ftype))) {
+	i = plan->target;
+	if(!ftonly && (plan->flags & CLI_PLAN_GROOT))
+	    groot = ctx->engine->root[0];
+	if(i < CLI_MTARGETS && (plan->flags & CLI_PLAN_TROOT))
+	    troot = ctx->engine->root[i];
+	/* nothing that could match: skip the pass (and the target parsing) */
+	if(!groot && !troot && (ftonly || !hdb || (!refhash && !(plan->flags & (CLI_PLAN_MD5 | CLI_PLAN_SHA1 | CLI_PLAN_SHA256)))))
+	    return (acmode & AC_SCAN_FT) ? type : CL_CLEAN;
+    } else {
+	if(!ftonly)
+	    groot = ctx->engine->root[0]; /* generic signatures */
+
+	if(ftype) {
+	    for(i = 1; i < CLI_MTARGETS; i++) {
+		if(cli_mtargets[i].target == ftype) {
+		    troot = ctx->engine->root[i];
+		    break;
+		}
 	    }
 	}
     }
 
-    if(ftonly) {
-	if(!troot)
-	    return CL_CLEAN;
+    if(ftonly && !troot)
+	return CL_CLEAN;
 
+    maxpatlen = 0;
+    if(troot)
 	maxpatlen = troot->maxpatlen;
-    } else {
-	if(troot)
-	    maxpatlen = MAX(troot->maxpatlen, groot->maxpatlen);
-	else
-	    maxpatlen = groot->maxpatlen;
-    }
+    if(groot)
+	maxpatlen = MAX(maxpatlen, groot->maxpatlen);
 
     targetinfo(&info, i, map);
 
-    if(!ftonly)
-	if((ret = cli_ac_initdata(&gdata, groot->ac_partsigs, groot->ac_lsigs, groot->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN)) || (ret = cli_ac_caloff(groot, &gdata, &info))) {
+    if(groot) {
+	if(!(ret = cli_scanctx_initdata(ctx->sctx, &gdata, groot)) && (ret = cli_ac_caloff(groot, &gdata, &info)))
+	    cli_scanctx_freedata(ctx->sctx, &gdata);
+	if(ret) {
 	    if(info.exeinfo.section)
 		free(info.exeinfo.section);
 	    cli_hashset_destroy(&info.exeinfo.vinfo);
 	    return ret;
 	}
+    }
 
     if(troot) {
-	if((ret = cli_ac_initdata(&tdata, troot->ac_partsigs, troot->ac_lsigs, troot->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN)) || (ret = cli_ac_caloff(troot, &tdata, &info))) {
-	    if(!ftonly)
-		cli_ac_freedata(&gdata);
+	if(!(ret = cli_scanctx_initdata(ctx->sctx, &tdata, troot)) && (ret = cli_ac_caloff(troot, &tdata, &info)))
+	    cli_scanctx_freedata(ctx->sctx, &tdata);
+	if(ret) {
+	    if(groot)
+		cli_scanctx_freedata(ctx->sctx, &gdata);
 	    if(info.exeinfo.section)
 		free(info.exeinfo.section);
 	    cli_hashset_destroy(&info.exeinfo.vinfo);
@@ -743,9 +836,9 @@ int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli
 	if(troot->bm_offmode) {
 	    if(map->len >= CLI_DEFAULT_BM_OFFMODE_FSIZE) {
 		if((ret = cli_bm_initoff(troot, &toff, &info))) {
-		    if(!ftonly)
-			cli_ac_freedata(&gdata);
-		    cli_ac_freedata(&tdata);
+		    if(groot)
+			cli_scanctx_freedata(ctx->sctx, &gdata);
+		    cli_scanctx_freedata(ctx->sctx, &tdata);
 		    if(info.exeinfo.section)
 			free(info.exeinfo.section);
 		    cli_hashset_destroy(&info.exeinfo.vinfo);
@@ -756,9 +849,6 @@ int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli
 	}
     }
 
-    hdb = ctx->engine->hm_hdb;
-    fp = ctx->engine->hm_fp;
-
     if(!ftonly && hdb) {
 	if(!refhash) {
 	    if(cli_hm_have_size(hdb, CLI_HASH_MD5, map->len) || cli_hm_have_size(fp, CLI_HASH_MD5, map->len)) {
@@ -784,12 +874,23 @@ int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli
 	    compute_hash[CLI_HASH_SHA256] = 0;
     }
 
+    /* no matcher and no hash to compute, don't read the data */
+    if(!groot && !troot && !compute_hash[CLI_HASH_MD5] && !compute_hash[CLI_HASH_SHA1] && !compute_hash[CLI_HASH_SHA256])
+	offset = map->len;
+
     while(offset < map->len) {
 	bytes = MIN(map->len - offset, SCANBUFF);
+	fmap_readahead(map, offset);
 	if(!(buff = fmap_need_off_once(map, offset, bytes)))
 	    break;
 	if(ctx->scanned)
 	    *ctx->scanned += bytes / CL_COUNT_PRECISION;
+	if(ctx->stats) {
+	    if(troot)
+		ctx->stats->pub.bytes_root[i] += bytes;
+	    if(groot)
+		ctx->stats->pub.bytes_root[0] += bytes;
+	}
 
 	if(troot) {
             virname = NULL;
@@ -800,9 +901,9 @@ int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli
 		viruses_found++;
 	    }
 	    if((ret == CL_VIRUS && !SCAN_ALL) || ret == CL_EMEM) {
-		if(!ftonly)
-		    cli_ac_freedata(&gdata);
-		cli_ac_freedata(&tdata);
+		if(groot)
+		    cli_scanctx_freedata(ctx->sctx, &gdata);
+		cli_scanctx_freedata(ctx->sctx, &tdata);
 		if(bm_offmode)
 		    cli_bm_freeoff(&toff);
 		if(info.exeinfo.section)
@@ -812,7 +913,7 @@ int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli
 	    }
 	}
 
-	if(!ftonly) {
+	if(groot) {
 	    virname = NULL;
 	    viroffset = 0;
 	    ret = matcher_run(groot, buff, bytes, &virname, &gdata, offset, &info, ftype, ftoffset, acmode, acres, map, NULL, &viroffset, ctx);
@@ -821,9 +922,9 @@ int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli
 		viruses_found++;
 	    }
 	    if((ret == CL_VIRUS && !SCAN_ALL) || ret == CL_EMEM) {
-		cli_ac_freedata(&gdata);
+		cli_scanctx_freedata(ctx->sctx, &gdata);
 		if(troot) {
-		    cli_ac_freedata(&tdata);
+		    cli_scanctx_freedata(ctx->sctx, &tdata);
 		    if(bm_offmode)
 			cli_bm_freeoff(&toff);
 		}
@@ -835,7 +936,9 @@ int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli
 		if(ret > type)
 		    type = ret;
 	    }
+	}
 
+	if(!ftonly) {
 	    if(hdb && !SCAN_ALL) {
 		const void *data = buff + maxpatlen * (offset!=0);
 		uint32_t data_len = bytes - maxpatlen * (offset!=0);
@@ -898,7 +1001,7 @@ int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli
 	    ret = cli_lsig_eval(ctx, troot, &tdata, &info, refhash);
 	if (ret == CL_VIRUS)
 	    viruses_found++;
-	cli_ac_freedata(&tdata);
+	cli_scanctx_freedata(ctx->sctx, &tdata);
 	if(bm_offmode)
 	    cli_bm_freeoff(&toff);
     }
@@ -906,7 +1009,7 @@ int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli
     if(groot) {
 	if(ret != CL_VIRUS || SCAN_ALL)
 	    ret = cli_lsig_eval(ctx, groot, &gdata, &info, refhash);
-	cli_ac_freedata(&gdata);
+	cli_scanctx_freedata(ctx->sctx, &gdata);
     }
 
     if(info.exeinfo.section)
@@ -73,21 +73,37 @@ struct cli_lsig_tdb {
 #endif
 };
 
+/* One step of a compiled logical expression, see cli_ac_lsig_compile() */
+#define CLI_LSIG_OP_LEAF 0
+#define CLI_LSIG_OP_AND	 1
+#define CLI_LSIG_OP_OR	 2
+struct cli_lsig_op {
+    uint8_t type;
+    char mod;	    /* leaf or block modifier ('=', '<', '>') or 0 */
+    uint8_t id;	    /* subsignature id of a leaf */
+    uint32_t val1, val2;
+};
+
 struct cli_bc;
 struct cli_ac_lsig {
     uint32_t id;
     unsigned bc_idx;
     char *logic;
+    struct cli_lsig_op *prog; /* NULL if the logic could not be compiled */
+    uint16_t proglen;
+    uint8_t always; /* matches even when no subsignature did */
     const char *virname;
     struct cli_lsig_tdb tdb;
 };
 
+struct cli_bm_lit;
 struct cli_matcher {
     unsigned int type;
 
     /* Extended Boyer-Moore */
     uint8_t *bm_shift;
     struct cli_bm_patt **bm_suffix, **bm_pattab;
+    struct cli_bm_lit *bm_lit; /* multi-literal engine, CL_ENGINE_BM_LITERAL */
     uint32_t *soff, soff_len; /* for PE section sigs */
     uint32_t bm_offmode, bm_patterns, bm_reloff_num, bm_absoff_num;
 
@@ -97,6 +113,7 @@ struct cli_matcher {
     /* Extended Aho-Corasick */
     uint32_t ac_partsigs, ac_nodes, ac_patterns, ac_lsigs;
     struct cli_ac_lsig **ac_lsigtable;
+    uint32_t *ac_lsig_always; /* bitmap of the lsigs with ->always set */
     struct cli_ac_node *ac_root, **ac_nodetable;
     struct cli_ac_patt **ac_pattable;
     struct cli_ac_patt **ac_reloff;
@@ -164,6 +181,37 @@ static const struct cli_mtarget cli_mtargets[CLI_MTARGETS] =  {
 #define CLI_OFF_MACRO       8
 #define CLI_OFF_SE	    9
 
+/* Scan plan, computed by cl_engine_compile() for every file type. It tells
+ * cli_fmap_scandesc() which passes can possibly produce a match, so that
+ * matchers and hashes without any signatures are skipped altogether.
+ */
+#define CLI_PLAN_TROOT	    0x01    /* target root has signatures */
+#define CLI_PLAN_GROOT	    0x02    /* generic root has signatures */
+#define CLI_PLAN_MD5	    0x04    /* hdb/fp have MD5 hashes */
+#define CLI_PLAN_SHA1	    0x08    /* hdb/fp have SHA1 hashes */
+#define CLI_PLAN_SHA256	    0x10    /* hdb/fp have SHA256 hashes */
+
+struct cli_scan_plan {
+    uint8_t target;	/* idx in cli_mtargets, CLI_MTARGETS if none */
+    uint8_t flags;
+};
+
+/* CL_TYPE_ANY goes to slot 0, CL_TYPENO..CL_TYPE_IGNORED follow */
+#define CLI_PLAN_SLOTS (CL_TYPE_IGNORED - CL_TYPENO + 2)
+
+static inline const struct cli_scan_plan *cli_scan_plan_get(const struct cl_engine *engine, cli_file_t ftype)
+{
+    if(!engine->scanplan)
+	return NULL;
+    if(ftype == CL_TYPE_ANY)
+	return &engine->scanplan[0];
+    if(ftype < CL_TYPENO || ftype > CL_TYPE_IGNORED)
+	return NULL;
+    return &engine->scanplan[ftype - CL_TYPENO + 1];
+}
+
+int cli_scan_plan_build(struct cl_engine *engine);
+
 int cli_scanbuff(const unsigned char *buffer, uint32_t length, uint32_t offset, cli_ctx *ctx, cli_file_t ftype, struct cli_ac_data **acdata);
 
 int cli_scandesc(int desc, cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli_matched_type **ftoffset, unsigned int acmode, struct cli_ac_result **acres);
@@ -327,6 +327,9 @@ struct cl_engine *cl_engine_new(void)
     new->ac_only = 0;
     new->ac_mindepth = CLI_DEFAULT_AC_MINDEPTH;
     new->ac_maxdepth = CLI_DEFAULT_AC_MAXDEPTH;
+    new->bm_literal = 0;
+    new->fmap_flags = 0;
+    new->fmap_readahead = 0;
 
 #ifdef USE_MPOOL
     if(!(new->mempool = mpool_create())) {
@@ -453,6 +456,19 @@ int cl_engine_set_num(struct cl_engine *engine, enum cl_engine_field field, long
 	case CL_ENGINE_AC_MAXDEPTH:
 	    engine->ac_maxdepth = num;
 	    break;
+	case CL_ENGINE_BM_LITERAL:
+	    if (engine->dboptions & CL_DB_COMPILED) {
+		cli_errmsg("cl_engine_set_num: CL_ENGINE_BM_LITERAL cannot be set after engine was compiled\n");
+		return CL_EARG;
+	    }
+	    engine->bm_literal = num;
+	    break;
+	case CL_ENGINE_FMAP_FLAGS:
+	    engine->fmap_flags = num;
+	    break;
+	case CL_ENGINE_FMAP_READAHEAD:
+	    engine->fmap_readahead = num;
+	    break;
 	case CL_ENGINE_KEEPTMP:
 	    engine->keeptmp = num;
 	    break;
@@ -534,6 +550,12 @@ long long cl_engine_get_num(const struct cl_engine *engine, enum cl_engine_field
 	    return engine->ac_mindepth;
 	case CL_ENGINE_AC_MAXDEPTH:
 	    return engine->ac_maxdepth;
+	case CL_ENGINE_BM_LITERAL:
+	    return engine->bm_literal;
+	case CL_ENGINE_FMAP_FLAGS:
+	    return engine->fmap_flags;
+	case CL_ENGINE_FMAP_READAHEAD:
+	    return engine->fmap_readahead;
 	case CL_ENGINE_KEEPTMP:
 	    return engine->keeptmp;
 	case CL_ENGINE_BYTECODE_SECURITY:
@@ -610,6 +632,9 @@ struct cl_settings *cl_engine_settings_copy(const struct cl_engine *engine)
     settings->ac_only = engine->ac_only;
     settings->ac_mindepth = engine->ac_mindepth;
     settings->ac_maxdepth = engine->ac_maxdepth;
+    settings->bm_literal = engine->bm_literal;
+    settings->fmap_flags = engine->fmap_flags;
+    settings->fmap_readahead = engine->fmap_readahead;
     settings->tmpdir = engine->tmpdir ? strdup(engine->tmpdir) : NULL;
     settings->keeptmp = engine->keeptmp;
     settings->maxscansize = engine->maxscansize;
@@ -634,6 +659,7 @@ struct cl_settings *cl_engine_settings_copy(const struct cl_engine *engine)
     settings->cb_sigload = engine->cb_sigload;
     settings->cb_sigload_ctx = engine->cb_sigload_ctx;
     settings->cb_hash = engine->cb_hash;
+    settings->cb_stats = engine->cb_stats;
 
     return settings;
 }
@@ -643,6 +669,9 @@ int cl_engine_settings_apply(struct cl_engine *engine, const struct cl_settings
     engine->ac_only = settings->ac_only;
     engine->ac_mindepth = settings->ac_mindepth;
     engine->ac_maxdepth = settings->ac_maxdepth;
+    engine->bm_literal = settings->bm_literal;
+    engine->fmap_flags = settings->fmap_flags;
+    engine->fmap_readahead = settings->fmap_readahead;
     engine->keeptmp = settings->keeptmp;
     engine->maxscansize = settings->maxscansize;
     engine->maxfilesize = settings->maxfilesize;
@@ -685,6 +714,7 @@ int cl_engine_settings_apply(struct cl_engine *engine, const struct cl_settings
     engine->cb_sigload = settings->cb_sigload;
     engine->cb_sigload_ctx = settings->cb_sigload_ctx;
     engine->cb_hash = settings->cb_hash;
+    engine->cb_stats = settings->cb_stats;
 
     return CL_SUCCESS;
 }
@@ -1152,3 +1182,51 @@ void cl_engine_set_clcb_meta(struct cl_engine *engine, clcb_meta callback)
 {
     engine->cb_meta = callback;
 }
+
+void cl_engine_set_clcb_stats(struct cl_engine *engine, clcb_stats callback)
+{
+    engine->cb_stats = callback;
+}
+
+void cli_stats_time(struct cli_scan_stats *stats, int id, int start)
+{
+    struct timeval tv;
+    uint64_t now, elapsed;
+
+    if(start) {
+	if(stats->depth[id]++)
+	    return;
+    } else {
+	if(!stats->depth[id] || --stats->depth[id])
+	    return;
+    }
+    gettimeofday(&tv, NULL);
+    now = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+    if(start) {
+	stats->start[id] = now;
+	return;
+    }
+    elapsed = now - stats->start[id];
+    switch(id) {
+	case PERFT_SCAN:
+	    stats->pub.time_total += elapsed;
+	    break;
+	case PERFT_FT:
+	    stats->pub.time_filetype += elapsed;
+	    break;
+	case PERFT_CACHE:
+	    stats->pub.time_cache += elapsed;
+	    break;
+	case PERFT_RAW:
+	    stats->pub.time_raw += elapsed;
+	    break;
+	case PERFT_CONTAINER:
+	    stats->pub.time_container += elapsed;
+	    break;
+	case PERFT_BYTECODE:
+	    stats->pub.time_bytecode += elapsed;
+	    break;
+	default:
+	    break;
+    }
+}
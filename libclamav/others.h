@@ -108,6 +108,13 @@ typedef struct bitset_tag
         unsigned long length;
 } bitset_t;
 
+/* per-scan statistics, only allocated when engine->cb_stats is set */
+struct cli_scan_stats {
+    struct cl_scan_stats pub;
+    uint64_t start[PERFT_LAST];
+    unsigned int depth[PERFT_LAST];
+};
+
 /* internal clamav context */
 typedef struct cli_ctx_tag {
     const char **virname;
@@ -129,14 +136,20 @@ typedef struct cli_ctx_tag {
     struct cli_dconf *dconf;
     fmap_t **fmap;
     bitset_t* hook_lsig_matches;
+    struct cl_scan_context *sctx;
     void *cb_ctx;
     cli_events_t* perf;
+    struct cli_scan_stats *stats;
 #ifdef HAVE__INTERNAL__SHA_COLLECT
     char entry_filename[2048];
     int sha_collect;
 #endif
 } cli_ctx;
 
+void cli_stats_time(struct cli_scan_stats *stats, int id, int start);
+#define cli_stats_start(ctx, id) do { if((ctx)->stats) cli_stats_time((ctx)->stats, (id), 1); } while(0)
+#define cli_stats_stop(ctx, id) do { if((ctx)->stats) cli_stats_time((ctx)->stats, (id), 0); } while(0)
+
 
 typedef struct {uint64_t v[2][4];} icon_groupset;
 
@@ -190,6 +203,9 @@ struct cl_engine {
     uint32_t ac_only;
     uint32_t ac_mindepth;
     uint32_t ac_maxdepth;
+    uint32_t bm_literal;
+    uint32_t fmap_flags;
+    uint32_t fmap_readahead;
     char *tmpdir;
     uint32_t keeptmp;
 
@@ -214,6 +230,9 @@ struct cl_engine {
     /* Roots table */
     struct cli_matcher **root;
 
+    /* Per file type scan plan (see cli_scan_plan_build()) */
+    struct cli_scan_plan *scanplan;
+
     /* hash matcher for standard MD5 sigs */
     struct cli_matcher *hm_hdb;
     /* hash matcher for MD5 sigs for PE sections */
@@ -265,6 +284,7 @@ struct cl_engine {
     void *cb_sigload_ctx;
     clcb_hash cb_hash;
     clcb_meta cb_meta;
+    clcb_stats cb_stats;
 
     /* Used for bytecode */
     struct cli_all_bc bcs;
@@ -291,6 +311,9 @@ struct cl_settings {
     uint32_t ac_only;
     uint32_t ac_mindepth;
     uint32_t ac_maxdepth;
+    uint32_t bm_literal;
+    uint32_t fmap_flags;
+    uint32_t fmap_readahead;
     char *tmpdir;
     uint32_t keeptmp;
     uint64_t maxscansize;
@@ -312,6 +335,7 @@ struct cl_settings {
     void *cb_sigload_ctx;
     clcb_msg cb_msg;
     clcb_hash cb_hash;
+    clcb_stats cb_stats;
 
     /* Engine max settings */
     uint64_t maxembeddedpe;  /* max size to scan MSEXE for PE */
@@ -571,6 +595,9 @@ void cli_qsort(void *a, size_t n, size_t es, int (*cmp)(const void *, const void
 #define CLI_FTW_TRIM_SLASHES	    0x08
 #define CLI_FTW_STD (CLI_FTW_NEED_STAT | CLI_FTW_TRIM_SLASHES)
 
+/* hint the kernel to read files ahead of the callback (cli_ftw_mt only) */
+#define CLI_FTW_READAHEAD	    0x10
+
 enum cli_ftw_reason {
     visit_file,
     visit_directory_toplev, /* this is a directory at toplevel of recursion */
@@ -619,5 +646,17 @@ typedef int (*cli_ftw_pathchk)(const char *path, struct cli_ftw_cbdata *data);
  */
 int cli_ftw(char *base, int flags, int maxdepth, cli_ftw_cb callback, struct cli_ftw_cbdata *data, cli_ftw_pathchk pathchk);
 
+/*
+ * Same as cli_ftw(), but directories are read and stat()ed by up to
+ * threads walker threads while the calling thread runs the callback on
+ * the results, which are queued with a bounded queue. The callback is only
+ * ever called from the calling thread; pathchk is called from the walker
+ * threads and must be reentrant.
+ * Files within a directory keep the cli_ftw() order, but directories are
+ * visited concurrently. With threads < 2, or without thread support, this
+ * is cli_ftw().
+ */
+int cli_ftw_mt(char *base, int flags, int maxdepth, unsigned int threads, cli_ftw_cb callback, struct cli_ftw_cbdata *data, cli_ftw_pathchk pathchk);
+
 const char *cli_strerror(int errnum, char* buf, size_t len);
 #endif
@@ -485,9 +485,30 @@ static inline int ft_skipped(enum filetype ft)
     return ft != ft_regular && ft != ft_directory;
 }
 
+/* the *at() calls let the parallel walker stat an entry relative to the
+ * open directory instead of resolving the whole path again */
+#if defined(AT_FDCWD) && defined(AT_SYMLINK_NOFOLLOW) && !defined(_WIN32)
+#define FTW_HAVE_AT
+#if defined(HAVE_STAT64) && !defined(__FreeBSD__)
+#define FSTATAT fstatat64
+#else
+#define FSTATAT fstatat
+#endif
+#endif
+
+/* stat fname, or name relative to dirfd when dirfd != -1 */
+static int ftw_stat(int dirfd, const char *name, const char *fname, int follow, STATBUF *statbuf)
+{
+#ifdef FTW_HAVE_AT
+    if (dirfd != -1)
+	return FSTATAT(dirfd, name, statbuf, follow ? 0 : AT_SYMLINK_NOFOLLOW);
+#endif
+    return follow ? STAT(fname, statbuf) : LSTAT(fname, statbuf);
+}
+
 #define FOLLOW_SYMLINK_MASK (CLI_FTW_FOLLOW_FILE_SYMLINK | CLI_FTW_FOLLOW_DIR_SYMLINK)
-static int get_filetype(const char *fname, int flags, int need_stat,
-			 STATBUF *statbuf, enum filetype *ft)
+static int get_filetype_at(int dirfd, const char *name, const char *fname, int flags, int need_stat,
+			   STATBUF *statbuf, enum filetype *ft)
 {
     int stated = 0;
 
@@ -501,7 +522,7 @@ static int get_filetype(const char *fname, int flags, int need_stat,
 	     * to lstat(), we can just stat() directly.*/
 	    if (*ft != ft_link) {
 		/* need to lstat to determine if it is a symlink */
-		if (LSTAT(fname, statbuf) == -1)
+		if (ftw_stat(dirfd, name, fname, 0, statbuf) == -1)
 		    return -1;
 		if (S_ISLNK(statbuf->st_mode)) {
 		    *ft = ft_link;
@@ -520,7 +541,7 @@ static int get_filetype(const char *fname, int flags, int need_stat,
     }
 
     if (need_stat) {
-	if (STAT(fname, statbuf) == -1)
+	if (ftw_stat(dirfd, name, fname, 1, statbuf) == -1)
 	    return -1;
 	stated = 1;
     }
@@ -544,6 +565,12 @@ static int get_filetype(const char *fname, int flags, int need_stat,
     return stated;
 }
 
+static inline int get_filetype(const char *fname, int flags, int need_stat,
+			       STATBUF *statbuf, enum filetype *ft)
+{
+    return get_filetype_at(-1, NULL, fname, flags, need_stat, statbuf, ft);
+}
+
 static int handle_filetype(const char *fname, int flags,
 			   STATBUF *statbuf, int *stated, enum filetype *ft,
 			   cli_ftw_cb callback, struct cli_ftw_cbdata *data)
@@ -799,6 +826,475 @@ static int cli_ftw_dir(const char *dirname, int flags, int maxdepth, cli_ftw_cb
     return ret;
 }
 
+#ifdef CL_THREAD_SAFE
+/*
+ * Parallel walker: a few threads read and stat the directories, the calling
+ * thread runs the callback on what they find, pulling it from a bounded
+ * queue. Directories are handled like in cli_ftw_dir(), files first in
+ * inode order, but sibling directories are read concurrently so the order
+ * across directories isn't defined.
+ */
+
+/* how much of a queued file is hinted to the kernel for readahead */
+#define FTW_READAHEAD_MAX (512 * 1024)
+/* queued entries per walker thread */
+#define FTW_QUEUE_PER_THREAD 32
+
+struct ftw_item {
+    struct ftw_item *next;
+    enum cli_ftw_reason reason;
+    char *path;
+    STATBUF *statbuf;
+};
+
+struct ftw_dir {
+    struct ftw_dir *next;
+    char *path;
+    int maxdepth;
+};
+
+struct ftw_mt {
+    pthread_mutex_t mutex;
+    pthread_cond_t dir_cond;	/* a directory to read, or the walk is over */
+    pthread_cond_t item_cond;	/* an item for the callback, or the walk is over */
+    pthread_cond_t space_cond;	/* room in the item queue */
+    struct ftw_dir *dhead, **dtail;
+    struct ftw_item *ihead, **itail;
+    unsigned int icount, imax;
+    unsigned int dirs;		/* queued or being read */
+    int stop;
+    int emem;			/* an item couldn't be allocated */
+    int flags;
+    struct cli_ftw_cbdata *data;
+    cli_ftw_pathchk pathchk;
+};
+
+/* takes ownership of path and statbuf */
+static void ftw_mt_item(struct ftw_mt *mt, enum cli_ftw_reason reason, char *path, STATBUF *statbuf)
+{
+    struct ftw_item *item = cli_malloc(sizeof(*item));
+
+    pthread_mutex_lock(&mt->mutex);
+    if (!item) {
+	mt->emem = 1;
+	pthread_cond_signal(&mt->item_cond);
+    } else {
+	while (mt->icount >= mt->imax && !mt->stop)
+	    pthread_cond_wait(&mt->space_cond, &mt->mutex);
+	if (!mt->stop) {
+	    item->next = NULL;
+	    item->reason = reason;
+	    item->path = path;
+	    item->statbuf = statbuf;
+	    *mt->itail = item;
+	    mt->itail = &item->next;
+	    mt->icount++;
+	    pthread_cond_signal(&mt->item_cond);
+	    path = NULL;
+	    statbuf = NULL;
+	    item = NULL;
+	}
+    }
+    pthread_mutex_unlock(&mt->mutex);
+    free(item);
+    free(path);
+    free(statbuf);
+}
+
+static void ftw_mt_error(struct ftw_mt *mt, enum cli_ftw_reason reason, const char *path)
+{
+    char *copy = path ? cli_strdup(path) : NULL;
+
+    if (path && !copy)
+	reason = error_mem;
+    ftw_mt_item(mt, reason, copy, NULL);
+}
+
+/* takes ownership of path */
+static int ftw_mt_pushdir(struct ftw_mt *mt, char *path, int maxdepth)
+{
+    struct ftw_dir *dir = cli_malloc(sizeof(*dir));
+
+    if (!dir) {
+	free(path);
+	return -1;
+    }
+    dir->next = NULL;
+    dir->path = path;
+    dir->maxdepth = maxdepth;
+    pthread_mutex_lock(&mt->mutex);
+    *mt->dtail = dir;
+    mt->dtail = &dir->next;
+    mt->dirs++;
+    pthread_cond_signal(&mt->dir_cond);
+    pthread_mutex_unlock(&mt->mutex);
+    return 0;
+}
+
+static void ftw_mt_readahead(int dirfd, const char *name, const char *fname)
+{
+#ifdef POSIX_FADV_WILLNEED
+    int fd;
+
+#ifdef FTW_HAVE_AT
+    fd = openat(dirfd, name, O_RDONLY | O_NONBLOCK | O_NOCTTY);
+#else
+    fd = open(fname, O_RDONLY | O_NONBLOCK | O_NOCTTY);
+#endif
+    if (fd == -1)
+	return;
+    posix_fadvise(fd, 0, FTW_READAHEAD_MAX, POSIX_FADV_WILLNEED);
+    close(fd);
+#endif
+}
+
+static void ftw_mt_readdir(struct ftw_mt *mt, struct ftw_dir *dir)
+{
+    const char *dirname = dir->path;
+    int flags = mt->flags;
+    DIR *dd;
+    int dfd = -1;
+    struct dirent_data *entries = NULL;
+    size_t i, entries_cnt = 0;
+    struct dirent *dent;
+    int err = 0;
+
+    if (dir->maxdepth < 0) {
+	ftw_mt_error(mt, warning_skipped_dir, dirname);
+	return;
+    }
+#ifdef FTW_HAVE_AT
+    if ((dfd = open(dirname, O_RDONLY | O_NOCTTY | O_DIRECTORY)) == -1 || !(dd = fdopendir(dfd))) {
+	if (dfd != -1)
+	    close(dfd);
+	ftw_mt_error(mt, error_stat, dirname);
+	return;
+    }
+#else
+    if (!(dd = opendir(dirname))) {
+	ftw_mt_error(mt, error_stat, dirname);
+	return;
+    }
+#endif
+
+    errno = 0;
+    /* readdir() on a stream nobody else uses is safe */
+    while ((dent = readdir(dd))) {
+	int stated;
+	enum filetype ft;
+	char *fname;
+	STATBUF statbuf;
+	STATBUF *statbufp = NULL;
+
+	if (mt->stop)
+	    break;
+	if (!strcmp(dent->d_name, ".") || !strcmp(dent->d_name, ".."))
+	    continue;
+#ifdef _DIRENT_HAVE_D_TYPE
+	switch (dent->d_type) {
+	    case DT_DIR:
+		ft = ft_directory;
+		break;
+	    case DT_LNK:
+		if (!(flags & FOLLOW_SYMLINK_MASK)) {
+		    errno = 0;
+		    continue;
+		}
+		ft = ft_link;
+		break;
+	    case DT_REG:
+		ft = ft_regular;
+		break;
+	    case DT_UNKNOWN:
+		ft = ft_unknown;
+		break;
+	    default:
+		ft = ft_skipped_special;
+		break;
+	}
+#else
+	ft = ft_unknown;
+#endif
+	fname = (char *) cli_malloc(strlen(dirname) + strlen(dent->d_name) + 2);
+	if (!fname) {
+	    ftw_mt_error(mt, error_mem, dirname);
+	    errno = 0;
+	    continue;
+	}
+	if (!strcmp(dirname, PATHSEP))
+	    sprintf(fname, PATHSEP"%s", dent->d_name);
+	else
+	    sprintf(fname, "%s"PATHSEP"%s", dirname, dent->d_name);
+
+	if (mt->pathchk && mt->pathchk(fname, mt->data) == 1) {
+	    free(fname);
+	    errno = 0;
+	    continue;
+	}
+
+	stated = get_filetype_at(dfd, dent->d_name, fname, flags, flags & CLI_FTW_NEED_STAT, &statbuf, &ft);
+	if (stated == -1) {
+	    ftw_mt_item(mt, error_stat, fname, NULL);
+	    errno = 0;
+	    continue;
+	}
+	if (ft == ft_skipped_link || ft == ft_skipped_special) {
+	    if (stated && (statbufp = cli_malloc(sizeof(*statbufp))))
+		memcpy(statbufp, &statbuf, sizeof(statbuf));
+	    ftw_mt_item(mt, ft == ft_skipped_link ? warning_skipped_link : warning_skipped_special, fname, statbufp);
+	    errno = 0;
+	    continue;
+	}
+	if (ft_skipped(ft)) {
+	    free(fname);
+	    errno = 0;
+	    continue;
+	}
+
+	if (stated && (flags & CLI_FTW_NEED_STAT) && ft != ft_directory) {
+	    if (!(statbufp = cli_malloc(sizeof(*statbufp)))) {
+		ftw_mt_item(mt, error_mem, fname, NULL);
+		errno = 0;
+		continue;
+	    }
+	    memcpy(statbufp, &statbuf, sizeof(statbuf));
+	}
+
+	if (!(entries_cnt % 64)) {
+	    struct dirent_data *tmp = cli_realloc(entries, (entries_cnt + 64) * sizeof(*entries));
+	    if (!tmp) {
+		free(statbufp);
+		ftw_mt_item(mt, error_mem, fname, NULL);
+		errno = 0;
+		continue;
+	    }
+	    entries = tmp;
+	}
+	entries[entries_cnt].filename = fname;
+	entries[entries_cnt].statbuf = statbufp;
+	entries[entries_cnt].is_dir = ft == ft_directory;
+	entries[entries_cnt].dirname = NULL;
+#ifdef _XOPEN_UNIX
+	entries[entries_cnt].ino = dent->d_ino;
+#else
+	entries[entries_cnt].ino = -1;
+#endif
+	entries_cnt++;
+	errno = 0;
+    }
+    err = errno;
+    if (err) {
+	char errs[128];
+	cli_errmsg("Unable to readdir() directory %s: %s\n", dirname,
+		   cli_strerror(err, errs, sizeof(errs)));
+	ftw_mt_error(mt, error_stat, dirname);
+    }
+
+    if (entries) {
+	cli_qsort(entries, entries_cnt, sizeof(*entries), ftw_compare);
+	/* subdirectories go out first so the other threads can start on
+	 * them while the files are queued */
+	for (i = entries_cnt; i > 0 && entries[i - 1].is_dir; i--) {
+	    if (mt->stop || ftw_mt_pushdir(mt, entries[i - 1].filename, dir->maxdepth - 1))
+		break;
+	    entries[i - 1].filename = NULL;
+	}
+	for (i = 0; i < entries_cnt; i++) {
+	    struct dirent_data *entry = &entries[i];
+
+	    if (!entry->filename)
+		continue;
+	    if (entry->is_dir || mt->stop) {
+		if (entry->is_dir && !mt->stop)
+		    ftw_mt_error(mt, error_mem, entry->filename);
+		free(entry->filename);
+		free(entry->statbuf);
+		continue;
+	    }
+	    if (flags & CLI_FTW_READAHEAD)
+		ftw_mt_readahead(dfd, strrchr(entry->filename, *PATHSEP) + 1, entry->filename);
+	    ftw_mt_item(mt, visit_file, entry->filename, entry->statbuf);
+	}
+	free(entries);
+    }
+    closedir(dd);
+}
+
+static void *ftw_mt_worker(void *arg)
+{
+    struct ftw_mt *mt = arg;
+    struct ftw_dir *dir;
+
+    pthread_mutex_lock(&mt->mutex);
+    while (1) {
+	while (!mt->dhead && mt->dirs && !mt->stop)
+	    pthread_cond_wait(&mt->dir_cond, &mt->mutex);
+	if (mt->stop || !mt->dhead)
+	    break;
+	dir = mt->dhead;
+	if (!(mt->dhead = dir->next))
+	    mt->dtail = &mt->dhead;
+	pthread_mutex_unlock(&mt->mutex);
+
+	ftw_mt_readdir(mt, dir);
+	free(dir->path);
+	free(dir);
+
+	pthread_mutex_lock(&mt->mutex);
+	if (!--mt->dirs) {
+	    /* nothing left to read, wake up the others and the callback */
+	    pthread_cond_broadcast(&mt->dir_cond);
+	    pthread_cond_signal(&mt->item_cond);
+	}
+    }
+    pthread_mutex_unlock(&mt->mutex);
+    return NULL;
+}
+
+static int cli_ftw_mt_dir(char *dirname, int flags, int maxdepth, unsigned int threads, cli_ftw_cb callback, struct cli_ftw_cbdata *data, cli_ftw_pathchk pathchk)
+{
+    struct ftw_mt mt;
+    struct ftw_item *item;
+    struct ftw_dir *dir;
+    pthread_t *tids;
+    unsigned int i, started = 0;
+    char *path;
+    int ret = CL_SUCCESS;
+
+    if (!(tids = cli_malloc(threads * sizeof(*tids))))
+	return cli_ftw_dir(dirname, flags, maxdepth, callback, data, pathchk);
+    memset(&mt, 0, sizeof(mt));
+    pthread_mutex_init(&mt.mutex, NULL);
+    pthread_cond_init(&mt.dir_cond, NULL);
+    pthread_cond_init(&mt.item_cond, NULL);
+    pthread_cond_init(&mt.space_cond, NULL);
+    mt.dtail = &mt.dhead;
+    mt.itail = &mt.ihead;
+    mt.imax = threads * FTW_QUEUE_PER_THREAD;
+    mt.flags = flags;
+    mt.data = data;
+    mt.pathchk = pathchk;
+
+    if (!(path = cli_strdup(dirname)) || ftw_mt_pushdir(&mt, path, maxdepth)) {
+	ret = callback(NULL, NULL, dirname, error_mem, data);
+	goto done;
+    }
+    for (i = 0; i < threads; i++) {
+	if (pthread_create(&tids[i], NULL, ftw_mt_worker, &mt))
+	    break;
+	started++;
+    }
+    if (!started) {
+	/* no threads, walk it the old way */
+	ret = cli_ftw_dir(dirname, flags, maxdepth, callback, data, pathchk);
+	goto done;
+    }
+
+    pthread_mutex_lock(&mt.mutex);
+    while (1) {
+	while (!mt.ihead && !mt.emem && mt.dirs)
+	    pthread_cond_wait(&mt.item_cond, &mt.mutex);
+	if (mt.emem) {
+	    mt.emem = 0;
+	    pthread_mutex_unlock(&mt.mutex);
+	    ret = callback(NULL, NULL, NULL, error_mem, data);
+	    pthread_mutex_lock(&mt.mutex);
+	    if (ret != CL_SUCCESS)
+		break;
+	    continue;
+	}
+	if (!(item = mt.ihead))
+	    break;
+	if (!(mt.ihead = item->next))
+	    mt.itail = &mt.ihead;
+	mt.icount--;
+	pthread_cond_signal(&mt.space_cond);
+	pthread_mutex_unlock(&mt.mutex);
+
+	if (item->reason == visit_file) {
+	    /* the callback owns the name now */
+	    ret = callback(item->statbuf, item->path, item->path, visit_file, data);
+	} else {
+	    ret = callback(item->statbuf, NULL, item->path, item->reason, data);
+	    free(item->path);
+	}
+	free(item->statbuf);
+	free(item);
+
+	pthread_mutex_lock(&mt.mutex);
+	if (ret != CL_SUCCESS)
+	    break;
+    }
+    mt.stop = 1;
+    pthread_cond_broadcast(&mt.dir_cond);
+    pthread_cond_broadcast(&mt.space_cond);
+    pthread_mutex_unlock(&mt.mutex);
+    for (i = 0; i < started; i++)
+	pthread_join(tids[i], NULL);
+
+done:
+    while ((item = mt.ihead)) {
+	mt.ihead = item->next;
+	free(item->path);
+	free(item->statbuf);
+	free(item);
+    }
+    while ((dir = mt.dhead)) {
+	mt.dhead = dir->next;
+	free(dir->path);
+	free(dir);
+    }
+    pthread_cond_destroy(&mt.space_cond);
+    pthread_cond_destroy(&mt.item_cond);
+    pthread_cond_destroy(&mt.dir_cond);
+    pthread_mutex_destroy(&mt.mutex);
+    free(tids);
+    return ret;
+}
+#endif
+
+int cli_ftw_mt(char *path, int flags, int maxdepth, unsigned int threads, cli_ftw_cb callback, struct cli_ftw_cbdata *data, cli_ftw_pathchk pathchk)
+{
+#ifdef CL_THREAD_SAFE
+    STATBUF statbuf;
+    enum filetype ft = ft_unknown;
+    int stated = 0;
+    int ret;
+
+    if (threads < 2)
+	return cli_ftw(path, flags, maxdepth, callback, data, pathchk);
+
+    if (((flags & CLI_FTW_TRIM_SLASHES) || pathchk) && path[0] && path[1]) {
+	char *pathend;
+#ifndef _WIN32
+	while (path[0] == *PATHSEP && path[1] == *PATHSEP) path++;
+#endif
+	pathend = path + strlen(path);
+	while (pathend > path && pathend[-1] == *PATHSEP) --pathend;
+	*pathend = '\0';
+    }
+    if (pathchk && pathchk(path, data) == 1)
+	return CL_SUCCESS;
+    ret = handle_filetype(path, flags, &statbuf, &stated, &ft, callback, data);
+    if (ret != CL_SUCCESS)
+	return ret;
+    if (ft_skipped(ft))
+	return CL_SUCCESS;
+    if (ft != ft_directory) {
+	char *filename = cli_strdup(path);
+	if (!filename)
+	    return callback(stated ? &statbuf : NULL, NULL, path, error_mem, data);
+	return callback(stated ? &statbuf : NULL, filename, filename, visit_file, data);
+    }
+    ret = callback(stated ? &statbuf : NULL, NULL, path, visit_directory_toplev, data);
+    if (ret != CL_SUCCESS)
+	return ret;
+    return cli_ftw_mt_dir(path, flags, maxdepth, threads, callback, data, pathchk);
+#else
+    return cli_ftw(path, flags, maxdepth, callback, data, pathchk);
+#endif
+}
+
 /* strerror_r is not available everywhere, (and when it is there are two variants,
  * the XSI, and the GNU one, so provide a wrapper to make sure correct one is
  * used */
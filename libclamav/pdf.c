@@ -52,6 +52,7 @@ static	char	const	rcsid[] = "$Id: pdf.c,v 1.61 2007/02/12 20:46:09 njh Exp $";
 #include "str.h"
 #include "bytecode.h"
 #include "bytecode_api.h"
+#include "scanctx.h"
 #include "md5.h"
 #include "arc4.h"
 #include "rijndael.h"
@@ -91,6 +92,49 @@ static int xrefCheck(const char *xref, const char *eof)
     return -1;
 }
 
+/* Returns the number of objects announced by the xref section at xref:
+ * the sum of the subsection counts for a classic xref table, or /Size
+ * of a cross-reference stream. Only used to size the object array, the
+ * incremental object scan remains authoritative. */
+static unsigned xrefCount(const char *xref, const char *eof)
+{
+    const char *q;
+    unsigned long count = 0;
+
+    while (xref < eof && (*xref == ' ' || *xref == '\n' || *xref == '\r'))
+	xref++;
+    if (xref + 4 < eof && !memcmp(xref, "xref", 4)) {
+	q = xref + 4;
+	while (q < eof) {
+	    unsigned long n;
+	    while (q < eof && isspace(*q)) q++;
+	    /* subsection header: first_id count */
+	    if (q >= eof || !isdigit(*q))
+		break;
+	    while (q < eof && isdigit(*q)) q++;
+	    if (q >= eof || *q != ' ')
+		break;
+	    q++;
+	    if (q >= eof || !isdigit(*q))
+		break;
+	    n = strtoul(q, NULL, 10);
+	    count += n;
+	    while (q < eof && isdigit(*q)) q++;
+	    /* skip entries, 20 bytes each */
+	    while (q < eof && isspace(*q)) q++;
+	    if ((unsigned long)(eof - q) < n * 20)
+		break;
+	    q += n * 20;
+	}
+    } else if ((q = cli_memstr(xref, eof - xref, "/Size", 5))) {
+	q += 5;
+	while (q < eof && isspace(*q)) q++;
+	if (q < eof && isdigit(*q))
+	    count = strtoul(q, NULL, 10);
+    }
+    return count > UINT_MAX ? UINT_MAX : count;
+}
+
 enum enc_method {
     ENC_UNKNOWN,
     ENC_NONE,
@@ -100,9 +144,16 @@ enum enc_method {
     ENC_AESV3
 };
 
+struct pdf_objidx {
+    uint32_t id;
+    uint32_t idx;
+};
+
 struct pdf_struct {
     struct pdf_obj *objs;
     unsigned nobjs;
+    unsigned objs_size;
+    struct pdf_objidx *objidx;
     unsigned flags;
     unsigned enc_method_stream;
     unsigned enc_method_string;
@@ -121,6 +172,7 @@ struct pdf_struct {
     unsigned fileIDlen;
     char *key;
     unsigned keylen;
+    int need_contents;
 };
 
 /* define this to be noisy about things that we can't parse properly */
@@ -175,6 +227,9 @@ static int find_stream_bounds(const char *start, off_t bytesleft, off_t byteslef
     return 0;
 }
 
+static const char * const obj_keywords[] = { "stream", "endobj" };
+static const unsigned int obj_keywords_len[] = { 6, 6 };
+
 static int pdf_findobj(struct pdf_struct *pdf)
 {
     const char *start, *q, *q2, *q3, *eof;
@@ -183,10 +238,16 @@ static int pdf_findobj(struct pdf_struct *pdf)
     unsigned genid, objid;
 
     pdf->nobjs++;
-    pdf->objs = cli_realloc2(pdf->objs, sizeof(*pdf->objs)*pdf->nobjs);
-    if (!pdf->objs) {
-	cli_warnmsg("cli_pdf: out of memory parsing objects (%u)\n", pdf->nobjs);
-	return -1;
+    if (pdf->nobjs > pdf->objs_size) {
+	/* grow geometrically, the initial size comes from the xref table */
+	unsigned size = pdf->objs_size ? pdf->objs_size * 2 : 64;
+	struct pdf_obj *objs = cli_realloc(pdf->objs, sizeof(*pdf->objs)*size);
+	if (!objs) {
+	    cli_warnmsg("cli_pdf: out of memory parsing objects (%u)\n", pdf->nobjs);
+	    return -1;
+	}
+	pdf->objs = objs;
+	pdf->objs_size = size;
     }
     obj = &pdf->objs[pdf->nobjs-1];
     memset(obj, 0, sizeof(*obj));
@@ -226,7 +287,12 @@ static int pdf_findobj(struct pdf_struct *pdf)
 	if (!q2)
 	    q2 = pdf->map + pdf->size;
 	bytesleft -= q2 - q;
-	if (find_stream_bounds(q-1, q2-q, bytesleft + (q2-q), &p_stream, &p_endstream, 1)) {
+	/* most of the gaps between two objects have neither keyword, rule
+	 * both out in one pass before looking at them one by one */
+	if (!cli_memstr_any(q-1, q2-q+1, obj_keywords, obj_keywords_len, 2, NULL)) {
+	    q2++;
+	    bytesleft--;
+	} else if (find_stream_bounds(q-1, q2-q, bytesleft + (q2-q), &p_stream, &p_endstream, 1)) {
 	    obj->flags |= 1 << OBJ_STREAM;
 	    q2 = q-1 + p_endstream + 9;
 	    bytesleft -= q2 - q + 1;
@@ -250,13 +316,102 @@ static int pdf_findobj(struct pdf_struct *pdf)
     return 1;/* truncated */
 }
 
+/* Decoded objects are collected in memory and scanned from there. Objects
+ * larger than PDF_MEMOBJ_MAX (and every object when keeptmp is set) are
+ * spilled to a temporary file instead. */
+#define PDF_MEMOBJ_MAX (8*1024*1024)
+
+struct pdf_outbuf {
+    char *buf;
+    size_t len;
+    size_t size;
+    int fd;
+    char fullname[NAME_MAX + 1];
+};
+
+static void pdf_outbuf_init(struct pdf_outbuf *out, struct pdf_struct *pdf,
+			    const char *suffix, unsigned n)
+{
+    memset(out, 0, sizeof(*out));
+    out->fd = -1;
+    snprintf(out->fullname, sizeof(out->fullname), "%s"PATHSEP"pdf%02u%s",
+	     pdf->dir, n, suffix);
+}
+
+static int pdf_outbuf_spill(struct pdf_outbuf *out)
+{
+    out->fd = open(out->fullname,O_RDWR|O_CREAT|O_EXCL|O_TRUNC|O_BINARY, 0600);
+    if (out->fd < 0) {
+	char err[128];
+	cli_errmsg("cli_pdf: can't create temporary file %s: %s\n", out->fullname, cli_strerror(errno, err, sizeof(err)));
+	return CL_ETMPFILE;
+    }
+    if (out->len && cli_writen(out->fd, out->buf, out->len) != (int)out->len)
+	return CL_EWRITE;
+    free(out->buf);
+    out->buf = NULL;
+    out->size = 0;
+    return CL_SUCCESS;
+}
+
+static int pdf_outbuf_write(struct pdf_outbuf *out, const char *buf, size_t len)
+{
+    if (out->fd == -1 && out->len + len > PDF_MEMOBJ_MAX) {
+	if (pdf_outbuf_spill(out) != CL_SUCCESS)
+	    return -1;
+    }
+    if (out->fd != -1) {
+	int n = cli_writen(out->fd, buf, len);
+	if (n > 0)
+	    out->len += n;
+	return n;
+    }
+    if (out->len + len > out->size) {
+	size_t size = out->size ? out->size : BUFSIZ;
+	char *p;
+
+	while (size < out->len + len)
+	    size *= 2;
+	p = cli_realloc(out->buf, size);
+	if (!p)
+	    return -1;
+	out->buf = p;
+	out->size = size;
+    }
+    memcpy(out->buf + out->len, buf, len);
+    out->len += len;
+    return len;
+}
+
+static fmap_t *pdf_outbuf_map(struct pdf_outbuf *out)
+{
+    if (!out->len)
+	return NULL;
+    if (out->fd != -1)
+	return fmap(out->fd, 0, out->len);
+    return cl_fmap_open_memory(out->buf, out->len);
+}
+
+static int pdf_outbuf_free(struct pdf_outbuf *out, cli_ctx *ctx)
+{
+    int rc = CL_SUCCESS;
+
+    free(out->buf);
+    if (out->fd != -1) {
+	close(out->fd);
+	if (!ctx->engine->keeptmp && cli_unlink(out->fullname))
+	    rc = CL_EUNLINK;
+    }
+    return rc;
+}
+
 static int filter_writen(struct pdf_struct *pdf, struct pdf_obj *obj,
-			 int fout, const char *buf, off_t len, off_t *sum)
+			 struct pdf_outbuf *out, const char *buf, off_t len, off_t *sum)
 {
     if (cli_checklimits("pdf", pdf->ctx, *sum, 0, 0))
 	return len; /* pretend it was a successful write to suppress CL_EWRITE */
     *sum += len;
-    return cli_writen(fout, buf, len);
+    return pdf_outbuf_write(out, buf, len);
 }
 
 static void pdfobj_flag(struct pdf_struct *pdf, struct pdf_obj *obj, enum pdf_flag flag)
@@ -332,7 +487,7 @@ static void pdfobj_flag(struct pdf_struct *pdf, struct pdf_obj *obj, enum pdf_fl
 }
 
 static int filter_flatedecode(struct pdf_struct *pdf, struct pdf_obj *obj,
-			      const char *buf, off_t len, int fout, off_t *sum)
+			      const char *buf, off_t len, struct pdf_outbuf *fout, off_t *sum)
 {
     int skipped = 0;
     int zstat;
@@ -460,6 +615,36 @@ static int filter_flatedecode(struct pdf_struct *pdf, struct pdf_obj *obj,
     return CL_CLEAN;
 }
 
+static int objidx_cmp(const void *a, const void *b)
+{
+    const struct pdf_objidx *x = a, *y = b;
+    if (x->id != y->id)
+	return x->id < y->id ? -1 : 1;
+    return x->idx < y->idx ? -1 : (x->idx > y->idx);
+}
+
+/* Builds an index sorted by object id (and position for duplicate ids from
+ * incremental updates), so that indirect references resolve in O(log n) */
+static void pdf_build_objidx(struct pdf_struct *pdf)
+{
+    unsigned i;
+
+    free(pdf->objidx);
+    pdf->objidx = NULL;
+    if (pdf->nobjs < 2)
+	return;
+    pdf->objidx = cli_malloc(sizeof(*pdf->objidx) * pdf->nobjs);
+    if (!pdf->objidx) {
+	cli_dbgmsg("cli_pdf: no memory for object index, using linear lookup\n");
+	return;
+    }
+    for (i=0;i<pdf->nobjs;i++) {
+	pdf->objidx[i].id = pdf->objs[i].id;
+	pdf->objidx[i].idx = i;
+    }
+    qsort(pdf->objidx, pdf->nobjs, sizeof(*pdf->objidx), objidx_cmp);
+}
+
 static struct pdf_obj *find_obj(struct pdf_struct *pdf,
 				struct pdf_obj *obj, uint32_t objid)
 {
@@ -471,6 +656,26 @@ static struct pdf_obj *find_obj(struct pdf_struct *pdf,
 	i = obj - pdf->objs;
     else
 	i = 0;
+    if (pdf->objidx) {
+	unsigned lo = 0, hi = pdf->nobjs;
+	/* lower bound of objid */
+	while (lo < hi) {
+	    unsigned mid = lo + (hi - lo)/2;
+	    if (pdf->objidx[mid].id < objid)
+		lo = mid + 1;
+	    else
+		hi = mid;
+	}
+	if (lo == pdf->nobjs || pdf->objidx[lo].id != objid)
+	    return NULL;
+	/* same order as the linear search: first match at or after i,
+	 * otherwise wrap around to the first match */
+	for (j=lo;j<pdf->nobjs && pdf->objidx[j].id == objid;j++) {
+	    if (pdf->objidx[j].idx >= i)
+		return &pdf->objs[pdf->objidx[j].idx];
+	}
+	return &pdf->objs[pdf->objidx[lo].idx];
+    }
     for (j=i;j<pdf->nobjs;j++) {
 	obj = &pdf->objs[j];
 	if (obj->id == objid)
@@ -558,37 +763,25 @@ static int obj_size(struct pdf_struct *pdf, struct pdf_obj *obj, int binary)
     return pdf->offset - obj->start - 6;
 }
 
-static int run_pdf_hooks(struct pdf_struct *pdf, enum pdf_phase phase, int fd,
+static int run_pdf_hooks(struct pdf_struct *pdf, enum pdf_phase phase, fmap_t *objmap,
 			 int dumpid)
 {
     int ret;
     struct cli_bc_ctx *bc_ctx;
     cli_ctx *ctx = pdf->ctx;
-    fmap_t *map;
 
-    bc_ctx = cli_bytecode_context_alloc();
+    bc_ctx = cli_scanctx_bcctx_get(ctx->sctx);
     if (!bc_ctx) {
 	cli_errmsg("cli_pdf: can't allocate memory for bc_ctx");
 	return CL_EMEM;
     }
 
-    map = *ctx->fmap;
-    if (fd != -1) {
-	map = fmap(fd, 0, 0);
-	if (!map) {
-	    cli_warnmsg("can't mmap pdf extracted obj\n");
-	    map = *ctx->fmap;
-	    fd = -1;
-	}
-    }
     cli_bytecode_context_setpdf(bc_ctx, phase, pdf->nobjs, pdf->objs,
 				&pdf->flags, pdf->size, pdf->startoff);
     cli_bytecode_context_setctx(bc_ctx, ctx);
-    ret = cli_bytecode_runhook(ctx, ctx->engine, bc_ctx, BC_PDF, map);
-    cli_bytecode_context_destroy(bc_ctx);
-    if (fd != -1) {
-	funmap(map);
-    }
+    ret = cli_bytecode_runhook(ctx, ctx->engine, bc_ctx, BC_PDF,
+			       objmap ? objmap : *ctx->fmap);
+    cli_scanctx_bcctx_put(ctx->sctx, bc_ctx);
     return ret;
 }
 
@@ -752,7 +945,7 @@ enum cstate {
     CSTATE_TJ_PAROPEN
 };
 
-static void process(struct text_norm_state *s, enum cstate *st, const char *buf, int length, int fout)
+static void process(struct text_norm_state *s, enum cstate *st, const char *buf, int length, struct pdf_outbuf *fout)
 {
     do {
 	switch (*st) {
@@ -773,7 +966,7 @@ static void process(struct text_norm_state *s, enum cstate *st, const char *buf,
 		if (*buf == ')') *st = CSTATE_TJ;
 		else {
 		    if (text_normalize_buffer(s, buf, 1) != 1) {
-			cli_writen(fout, s->out, s->out_pos);
+			pdf_outbuf_write(fout, (const char *)s->out, s->out_pos);
 			text_normalize_reset(s);
 		    }
 		}
@@ -784,38 +977,56 @@ static void process(struct text_norm_state *s, enum cstate *st, const char *buf,
     } while (length > 0);
 }
 
-static int pdf_scan_contents(int fd, struct pdf_struct *pdf)
+/* cli_map_scandesc() drops anything of 5 bytes or less as too small to
+ * type, but a short decoded object can still match a hash or body
+ * signature, so those go to the scanner directly */
+static int pdf_scan_map(fmap_t *map, cli_ctx *ctx)
+{
+    int rc;
+
+    if (map->len > 5)
+	return cli_map_scandesc(map, 0, 0, ctx);
+    cli_dbgmsg("cli_pdf: scanning small object (%u bytes)\n", (unsigned int)map->len);
+    ctx->fmap++;
+    *ctx->fmap = map;
+    rc = cli_magic_scandesc_type(ctx, CL_TYPE_ANY);
+    ctx->fmap--;
+    return rc;
+}
+
+static int pdf_scan_contents(fmap_t *objmap, struct pdf_struct *pdf)
 {
     struct text_norm_state s;
-    char fullname[1024];
+    struct pdf_outbuf fout;
     char outbuff[BUFSIZ];
-    char inbuf[BUFSIZ];
-    int fout, n, rc;
+    const char *inbuf;
+    size_t off = 0;
+    fmap_t *map;
+    int rc = CL_CLEAN, rc2;
     enum cstate st = CSTATE_NONE;
 
-    snprintf(fullname, sizeof(fullname), "%s"PATHSEP"pdf%02u_c", pdf->dir, (pdf->files-1));
-    fout = open(fullname,O_RDWR|O_CREAT|O_EXCL|O_TRUNC|O_BINARY, 0600);
-    if (fout < 0) {
-	char err[128];
-	cli_errmsg("cli_pdf: can't create temporary file %s: %s\n", fullname, cli_strerror(errno, err, sizeof(err)));
-	return CL_ETMPFILE;
-    }
+    pdf_outbuf_init(&fout, pdf, "_c", pdf->files-1);
+    if (pdf->ctx->engine->keeptmp && (rc = pdf_outbuf_spill(&fout)) != CL_SUCCESS)
+	return rc;
 
     text_normalize_init(&s, outbuff, sizeof(outbuff));
-    while (1) {
-	n = cli_readn(fd, inbuf, sizeof(inbuf));
-	if (n <= 0)
+    while (off < objmap->len) {
+	size_t n = objmap->len - off > BUFSIZ ? BUFSIZ : objmap->len - off;
+	inbuf = fmap_need_off_once(objmap, off, n);
+	if (!inbuf)
 	    break;
-	process(&s, &st, inbuf, n, fout);
+	process(&s, &st, inbuf, n, &fout);
+	off += n;
     }
-    cli_writen(fout, s.out, s.out_pos);
+    pdf_outbuf_write(&fout, (const char *)s.out, s.out_pos);
 
-    lseek(fout, 0, SEEK_SET);
-    rc = cli_magic_scandesc(fout, pdf->ctx);
-    close(fout);
-    if (!pdf->ctx->engine->keeptmp)
-	if (cli_unlink(fullname) && rc != CL_VIRUS)
-	    rc = CL_EUNLINK;
+    if ((map = pdf_outbuf_map(&fout))) {
+	rc = pdf_scan_map(map, pdf->ctx);
+	funmap(map);
+    }
+    rc2 = pdf_outbuf_free(&fout, pdf->ctx);
+    if (rc2 && rc != CL_VIRUS)
+	rc = rc2;
     return rc;
 }
 
@@ -826,8 +1037,8 @@ static char *pdf_readstring(const char *q0, int len, const char *key, unsigned *
 
 static int pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj)
 {
-    char fullname[NAME_MAX + 1];
-    int fout;
+    struct pdf_outbuf fout;
+    fmap_t *map;
     off_t sum = 0;
     int rc = CL_SUCCESS;
     char *ascii_decoded = NULL;
@@ -852,14 +1063,16 @@ static int pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj)
     }
     if (!dump)
 	return CL_CLEAN;
+    /* decode lazily: nothing would look at the decoded data */
+    if (!pdf->need_contents && !(obj->flags & (1 << OBJ_FORCEDUMP))) {
+	cli_dbgmsg("cli_pdf: no consumer for obj %u %u, not decoding\n", obj->id>>8, obj->id&0xff);
+	return CL_CLEAN;
+    }
     cli_dbgmsg("cli_pdf: dumping obj %u %u\n", obj->id>>8, obj->id&0xff);
-    snprintf(fullname, sizeof(fullname), "%s"PATHSEP"pdf%02u", pdf->dir, pdf->files++);
-    fout = open(fullname,O_RDWR|O_CREAT|O_EXCL|O_TRUNC|O_BINARY, 0600);
-    if (fout < 0) {
-	char err[128];
-	cli_errmsg("cli_pdf: can't create temporary file %s: %s\n", fullname, cli_strerror(errno, err, sizeof(err)));
-	free(ascii_decoded);
-	return CL_ETMPFILE;
+    pdf_outbuf_init(&fout, pdf, "", pdf->files++);
+    if (pdf->ctx->engine->keeptmp && (rc = pdf_outbuf_spill(&fout)) != CL_SUCCESS) {
+	pdf_outbuf_free(&fout, pdf->ctx);
+	return rc;
     }
 
     do {
@@ -984,7 +1197,7 @@ static int pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj)
 
 	    if (obj->flags & (1 << OBJ_FILTER_FLATE)) {
 		cli_dbgmsg("cli_pdf: deflate len %ld (orig %ld)\n", ascii_decoded_size, (long)orig_length);
-		rc = filter_flatedecode(pdf, obj, flate_in, ascii_decoded_size, fout, &sum);
+		rc = filter_flatedecode(pdf, obj, flate_in, ascii_decoded_size, &fout, &sum);
                 if (rc == CL_EFORMAT) {
                     if (decrypted) {
                         flate_in = flate_orig;
@@ -992,13 +1205,14 @@ static int pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj)
                     }
 		    cli_dbgmsg("cli_pdf: dumping raw stream (probably encrypted)\n");
 		    noisy_warnmsg("cli_pdf: dumping raw stream, probably encrypted and we failed to decrypt'n");
-		    if (filter_writen(pdf, obj, fout, flate_in, ascii_decoded_size, &sum) != ascii_decoded_size) {
+		    if (filter_writen(pdf, obj, &fout, flate_in, ascii_decoded_size, &sum) != ascii_decoded_size) {
 			cli_errmsg("cli_pdf: failed to write output file\n");
-			return CL_EWRITE;
+			rc = CL_EWRITE;
+			break;
 		    }
                 }
 	    } else {
-		if (filter_writen(pdf, obj, fout, flate_in, ascii_decoded_size, &sum) != ascii_decoded_size)
+		if (filter_writen(pdf, obj, &fout, flate_in, ascii_decoded_size, &sum) != ascii_decoded_size)
 		    rc = CL_EWRITE;
 	    }
 	} else
@@ -1040,7 +1254,7 @@ static int pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj)
 		}
 	    }
 
-	    if (filter_writen(pdf, obj, fout, out, js_len, &sum) != js_len) {
+	    if (filter_writen(pdf, obj, &fout, out, js_len, &sum) != js_len) {
 		rc = CL_EWRITE;
                 free(js);
 		break;
@@ -1057,7 +1271,7 @@ static int pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj)
                 while (q2 > q && q2[-1] == ' ') q2--;
                 if (q2 > q) {
                     q--;
-                    filter_writen(pdf, obj, fout, q, q2 - q, &sum);
+                    filter_writen(pdf, obj, &fout, q, q2 - q, &sum);
                     q++;
                 }
             }
@@ -1066,40 +1280,38 @@ static int pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj)
       } while (bytesleft > 0);
     } else {
 	off_t bytesleft = obj_size(pdf, obj, 0);
-	if (filter_writen(pdf, obj, fout , pdf->map + obj->start, bytesleft,&sum) != bytesleft)
+	if (filter_writen(pdf, obj, &fout, pdf->map + obj->start, bytesleft,&sum) != bytesleft)
 	    rc = CL_EWRITE;
     }
     } while (0);
-    cli_dbgmsg("cli_pdf: extracted %ld bytes %u %u obj to %s\n", sum, obj->id>>8, obj->id&0xff, fullname);
-    if (sum) {
+    cli_dbgmsg("cli_pdf: extracted %ld bytes %u %u obj%s%s\n", sum, obj->id>>8, obj->id&0xff,
+	       fout.fd != -1 ? " to " : "", fout.fd != -1 ? fout.fullname : "");
+    if (sum && (map = pdf_outbuf_map(&fout))) {
 	int rc2;
 	cli_updatelimits(pdf->ctx, sum);
 	/* TODO: invoke bytecode on this pdf obj with metainformation associated
 	 * */
-	lseek(fout, 0, SEEK_SET);
-	rc2 = cli_magic_scandesc(fout, pdf->ctx);
+	rc2 = pdf_scan_map(map, pdf->ctx);
 	if (rc2 == CL_VIRUS || rc == CL_SUCCESS)
 	    rc = rc2;
 	if (rc == CL_CLEAN) {
-	    rc2 = run_pdf_hooks(pdf, PDF_PHASE_POSTDUMP, fout, obj - pdf->objs);
+	    rc2 = run_pdf_hooks(pdf, PDF_PHASE_POSTDUMP, map, obj - pdf->objs);
 	    if (rc2 == CL_VIRUS)
 		rc = rc2;
 	}
 	if (rc == CL_CLEAN && (obj->flags & (1 << OBJ_CONTENTS))) {
-	    lseek(fout, 0, SEEK_SET);
 	    cli_dbgmsg("cli_pdf: dumping contents %u %u\n", obj->id>>8, obj->id&0xff);
-	    rc2 = pdf_scan_contents(fout, pdf);
+	    rc2 = pdf_scan_contents(map, pdf);
 	    if (rc2 == CL_VIRUS)
 		rc = rc2;
 	    noisy_msg(pdf, "extracted text from obj %u %u\n", obj->id>>8, obj->id&0xff);
 	}
+	funmap(map);
     }
-    close(fout);
     free(ascii_decoded);
     free(decrypted);
-    if (!pdf->ctx->engine->keeptmp)
-	if (cli_unlink(fullname) && rc != CL_VIRUS)
-	    rc = CL_EUNLINK;
+    if (pdf_outbuf_free(&fout, pdf->ctx) && rc != CL_VIRUS)
+	rc = CL_EUNLINK;
     return rc;
 }
 
@@ -1942,6 +2154,48 @@ static void pdf_handle_enc(struct pdf_struct *pdf)
     free(UE);
 }
 
+/* Decoded objects are only worth producing when something will look at
+ * them: a bytecode PDF hook, an application callback, a signature or hash
+ * matcher, or a heuristic that is both enabled and able to fire on the
+ * extracted data. cb_hash is left out, it is only called on a detection. */
+static int pdf_need_contents(cli_ctx *ctx)
+{
+    const struct cl_engine *engine = ctx->engine;
+    const struct cli_dconf *dconf = engine->dconf;
+    unsigned i;
+
+    if (engine->hooks_cnt[BC_PDF - _BC_START_HOOKS])
+	return 1;
+    if (engine->cb_pre_cache || engine->cb_pre_scan || engine->cb_post_scan)
+	return 1;
+    if (engine->hm_hdb)
+	return 1;
+    if (SCAN_PE && (engine->hm_mdb || engine->iconcheck))
+	return 1;
+    if (SCAN_ARCHIVE && engine->cdb)
+	return 1;
+    if (SCAN_MAIL && engine->phishcheck)
+	return 1;
+    if (DETECT_ENCRYPTED || DETECT_BROKEN)
+	return 1;
+    if (SCAN_STRUCTURED && (dconf->other & OTHER_CONF_DLP))
+	return 1;
+    if (SCAN_ALGO) {
+	if (dconf->other & (OTHER_CONF_RIFF | OTHER_CONF_JPEG | OTHER_CONF_MYDOOMLOG))
+	    return 1;
+	if (SCAN_PE && (dconf->pe & (PE_CONF_PARITE | PE_CONF_KRIZ | PE_CONF_MAGISTR | PE_CONF_POLIPOS | PE_CONF_SWIZZOR)))
+	    return 1;
+    }
+    if (engine->root) {
+	for (i=0;i<CLI_MTARGETS;i++) {
+	    const struct cli_matcher *root = engine->root[i];
+	    if (root && (root->ac_patterns || root->bm_patterns || root->ac_lsigs || root->ac_partsigs))
+		return 1;
+	}
+    }
+    return 0;
+}
+
 int cli_pdf(const char *dir, cli_ctx *ctx, off_t offset)
 {
     struct pdf_struct pdf;
@@ -1952,7 +2206,7 @@ int cli_pdf(const char *dir, cli_ctx *ctx, off_t offset)
     long xref;
     const char *pdfver, *start, *eofmap, *q, *eof;
     int rc;
-    unsigned i;
+    unsigned i, xrefobjs = 0;
 
     cli_dbgmsg("in cli_pdf(%s)\n", dir);
     memset(&pdf, 0, sizeof(pdf));
@@ -2033,7 +2287,8 @@ int cli_pdf(const char *dir, cli_ctx *ctx, off_t offset)
 	    if (!q || xrefCheck(q, q+bytesleft) == -1) {
 		cli_dbgmsg("cli_pdf: did not find valid xref\n");
 		pdf.flags |= 1 << BAD_PDF_TRAILER;
-	    }
+	    } else
+		xrefobjs = xrefCount(q, q+bytesleft);
 	}
     }
     size -= offset;
@@ -2045,11 +2300,20 @@ int cli_pdf(const char *dir, cli_ctx *ctx, off_t offset)
 	cli_errmsg("cli_pdf: mmap() failed (3)\n");
 	return CL_EMAP;
     }
-    rc = run_pdf_hooks(&pdf, PDF_PHASE_PRE, -1, -1);
+    pdf.need_contents = pdf_need_contents(ctx);
+    rc = run_pdf_hooks(&pdf, PDF_PHASE_PRE, NULL, -1);
     if (rc) {
 	cli_dbgmsg("cli_pdf: returning %d\n", rc);
 	return rc == CL_BREAK ? CL_CLEAN : rc;
     }
+    /* an object takes at least a dozen bytes, don't trust bogus xref sizes */
+    if (xrefobjs > size / 12)
+	xrefobjs = size / 12;
+    if (xrefobjs) {
+	pdf.objs = cli_malloc(sizeof(*pdf.objs) * (xrefobjs + 1));
+	if (pdf.objs)
+	    pdf.objs_size = xrefobjs + 1;
+    }
     /* parse PDF and find obj offsets */
     while ((rc = pdf_findobj(&pdf)) > 0) {
 	struct pdf_obj *obj = &pdf.objs[pdf.nobjs-1];
@@ -2059,6 +2323,9 @@ int cli_pdf(const char *dir, cli_ctx *ctx, off_t offset)
 	pdf.nobjs--;
     if (rc == -1)
 	pdf.flags |= 1 << BAD_PDF_TOOMANYOBJS;
+    if (xrefobjs)
+	cli_dbgmsg("cli_pdf: xref announced %u objs, found %u\n", xrefobjs, pdf.nobjs);
+    pdf_build_objidx(&pdf);
 
     /* must parse after finding all objs, so we can flag indirect objects */
     for (i=0;i<pdf.nobjs;i++) {
@@ -2083,7 +2350,7 @@ int cli_pdf(const char *dir, cli_ctx *ctx, off_t offset)
     }
 
     if (!rc)
-	rc = run_pdf_hooks(&pdf, PDF_PHASE_PARSED, -1, -1);
+	rc = run_pdf_hooks(&pdf, PDF_PHASE_PARSED, NULL, -1);
     /* extract PDF objs */
     for (i=0;!rc && i<pdf.nobjs;i++) {
 	struct pdf_obj *obj = &pdf.objs[i];
@@ -2096,7 +2363,7 @@ int cli_pdf(const char *dir, cli_ctx *ctx, off_t offset)
 
    if (pdf.flags && !rc) {
 	cli_dbgmsg("cli_pdf: flags 0x%02x\n", pdf.flags);
-	rc = run_pdf_hooks(&pdf, PDF_PHASE_END, -1, -1);
+	rc = run_pdf_hooks(&pdf, PDF_PHASE_END, NULL, -1);
 	if (!rc && (ctx->options & CL_SCAN_ALGORITHMIC)) {
 	    if (pdf.flags & (1 << ESCAPED_COMMON_PDFNAME)) {
 		/* for example /Fl#61te#44#65#63#6f#64#65 instead of /FlateDecode */
@@ -2120,6 +2387,7 @@ int cli_pdf(const char *dir, cli_ctx *ctx, off_t offset)
     }
     cli_dbgmsg("cli_pdf: returning %d\n", rc);
     free(pdf.objs);
+    free(pdf.objidx);
     free(pdf.fileID);
     free(pdf.key);
     /* PDF hooks may abort, don't return CL_BREAK to caller! */
@@ -60,6 +60,7 @@
 #include "ishield.h"
 #include "asn1.h"
 #include "sha1.h"
+#include "scanctx.h"
 
 #define DCONF ctx->dconf->pe
 
@@ -1096,7 +1097,7 @@ int cli_scanpe(cli_ctx *ctx)
     pedata.hdr_size = hdr_size;
 
     /* Bytecode BC_PE_ALL hook */
-    bc_ctx = cli_bytecode_context_alloc();
+    bc_ctx = cli_scanctx_bcctx_get(ctx->sctx);
     if (!bc_ctx) {
 	cli_errmsg("cli_scanpe: can't allocate memory for bc_ctx\n");
 	return CL_EMEM;
@@ -1111,10 +1112,10 @@ int cli_scanpe(cli_ctx *ctx)
         case CL_VIRUS:
         case CL_BREAK:
             free(exe_sections);
-            cli_bytecode_context_destroy(bc_ctx);
+            cli_scanctx_bcctx_put(ctx->sctx, bc_ctx);
             return ret == CL_VIRUS ? CL_VIRUS : CL_CLEAN;
     }
-    cli_bytecode_context_destroy(bc_ctx);
+    cli_scanctx_bcctx_put(ctx->sctx, bc_ctx);
     /* Attempt to detect some popular polymorphic viruses */
 
     /* W32.Parite.B */
@@ -2279,7 +2280,7 @@ int cli_scanpe(cli_ctx *ctx)
     ctx->corrupted_input = corrupted_cur;
 
     /* Bytecode BC_PE_UNPACKER hook */
-    bc_ctx = cli_bytecode_context_alloc();
+    bc_ctx = cli_scanctx_bcctx_get(ctx->sctx);
     if (!bc_ctx) {
 	cli_errmsg("cli_scanpe: can't allocate memory for bc_ctx\n");
 	return CL_EMEM;
@@ -2290,17 +2291,17 @@ int cli_scanpe(cli_ctx *ctx)
     switch (ret) {
 	case CL_VIRUS:
 	    free(exe_sections);
-	    cli_bytecode_context_destroy(bc_ctx);
+	    cli_scanctx_bcctx_put(ctx->sctx, bc_ctx);
 	    return CL_VIRUS;
 	case CL_SUCCESS:
 	    ndesc = cli_bytecode_context_getresult_file(bc_ctx, &tempfile);
-	    cli_bytecode_context_destroy(bc_ctx);
+	    cli_scanctx_bcctx_put(ctx->sctx, bc_ctx);
 	    if (ndesc != -1 && tempfile) {
 		CLI_UNPRESULTS("bytecode PE hook", 1, 1, (0));
 	    }
 	    break;
 	default:
-	    cli_bytecode_context_destroy(bc_ctx);
+	    cli_scanctx_bcctx_put(ctx->sctx, bc_ctx);
     }
 
     free(exe_sections);
@@ -23,126 +23,163 @@
 #include "clamav-config.h"
 #endif
 
+#include <string.h>
+
 #include "perflogging.h"
-#include <stdio.h>
-#ifdef CLI_PERF_LOGGING
 
-__thread last_flushed = 0;
-__thread cli_perf_registered = 0;
-__thread uint64_t cli_perf_sum_tls[__LAST_SUMABLE];
-__thread uint64_t cli_perf_count_tls[__LAST_COUNTABLE][256];
+#ifdef CL_NOTHREADS
+#undef CL_THREAD_SAFE
+#endif
 
-uint64_t cli_perf_sum[__LAST_SUMABLE];
-uint64_t cli_perf_count[__LAST_COUNTABLE][256];
+#ifdef CL_THREAD_SAFE
+#include <pthread.h>
+#endif
 
-static pthread_key_t thread_exit_key;
-int pthread_key_create(pthread_key_t *key, void (*destr_function) (void *)); 
+/* keep each thread's counters on cache lines of their own */
+#define CNT_LINE 64
 
-static void cli_perf_thread_exit(void* arg)
-{
-	/* save counters into global */
-	cli_perf_flush();
-}
+struct cnt_block {
+    char pad0[CNT_LINE];
+    uint64_t val[CL_COUNTER_LAST];
+    char pad1[CNT_LINE];
+    struct cnt_block *next;
+    int in_use;
+};
+
+volatile int cli_counters_on = 0;
+
+/* blocks are never freed: a block released by an exiting thread keeps its
+ * values and gets reused by the next new thread */
+static struct cnt_block *cnt_blocks = NULL;
+/* values of all blocks at the last cl_counters_reset() */
+static uint64_t cnt_base[CL_COUNTER_LAST];
+/* used if we can't allocate a block */
+static struct cnt_block cnt_fallback;
+
+static const char *cnt_names[CL_COUNTER_LAST] = {
+    "filter_calls",
+    "filter_rejects",
+    "filter_skipped_bytes",
+    "ac_bytes",
+    "ac_final_nodes",
+    "ac_verify",
+    "bm_bytes",
+    "bm_shifts",
+    "bm_verify",
+    "lsig_evals",
+    "fmap_reads",
+    "fmap_pages",
+    "bytecode_runs"
+};
+
+#ifdef CL_THREAD_SAFE
+static pthread_mutex_t cnt_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t cnt_key;
+static pthread_once_t cnt_key_once = PTHREAD_ONCE_INIT;
 
-void __attribute__((constructor)) __cli_perf_init(void)
+static void cnt_thread_exit(void *arg)
 {
-	pthread_key_create(&thread_exit_key, cli_perf_thread_exit);
+    struct cnt_block *b = arg;
+
+    pthread_mutex_lock(&cnt_mutex);
+    b->in_use = 0;
+    pthread_mutex_unlock(&cnt_mutex);
 }
 
-void __attribute__((destructor)) __cli_perf_exit(void)
+static void cnt_key_alloc(void)
 {
-	cli_perf_thread_exit(NULL);
+    pthread_key_create(&cnt_key, cnt_thread_exit);
 }
 
-static int dummy;
-void cli_perf_register(void)
+uint64_t *cli_counters_block(void)
 {
-	/* set a fake key, so that destructor gets called */
-	pthread_setspecific(thread_exit_key, &dummy);
-	cli_perf_registered = 1;
+    struct cnt_block *b;
+
+    pthread_once(&cnt_key_once, cnt_key_alloc);
+    if((b = pthread_getspecific(cnt_key)))
+	return b->val;
+
+    pthread_mutex_lock(&cnt_mutex);
+    for(b = cnt_blocks; b && b->in_use; b = b->next);
+    if(!b && (b = cli_calloc(1, sizeof(*b)))) {
+	b->next = cnt_blocks;
+	cnt_blocks = b;
+    }
+    if(b)
+	b->in_use = 1;
+    pthread_mutex_unlock(&cnt_mutex);
+
+    if(!b)
+	return cnt_fallback.val;
+    pthread_setspecific(cnt_key, b);
+    return b->val;
 }
 
-static const char *perf_log_names_sum[__LAST_SUMABLE] = {
-	"raw scanned",
-	"filter scanned",
-	"AC scanned",
-	"BM scanned"
-};
+#define cnt_lock() pthread_mutex_lock(&cnt_mutex)
+#define cnt_unlock() pthread_mutex_unlock(&cnt_mutex)
+#else
 
-static const char *perf_log_names_cnt[__LAST_COUNTABLE] = {
-	"trie bytes scanned",
-	"filter position load",
-	"filter end load",
-	"trie pattern original length"
-};
-
-#define NONE __LAST_SUMABLE
-static enum perf_log_sumable perf_log_percent[__LAST_SUMABLE] = {
-	NONE,
-	RAW_BYTES_SCANNED,
-	RAW_BYTES_SCANNED,
-	RAW_BYTES_SCANNED,
-};
+uint64_t *cli_counters_block(void)
+{
+    return cnt_fallback.val;
+}
 
-static enum perf_log_countable perf_log_percent_cnt[__LAST_COUNTABLE] = {
-	RAW_BYTES_SCANNED,
-	NONE,
-	NONE,
-	NONE,
-};
+#define cnt_lock()
+#define cnt_unlock()
+#endif
 
-static void cli_perf_print(void)
+static void cnt_sum(uint64_t *sum)
 {
-	enum perf_log_sumable i;
-	enum perf_log_countable j;
-	unsigned k;
-
-	uint64_t raw_scanned = cli_perf_sum[RAW_BYTES_SCANNED];
-	const double MEGA = 1024*1024.0;
-
-	/* in multiscan mode multiple threads can output, so output a unique id
-	 * here*/
-	printf("PERF: %p\n", &cli_perf_registered);
-	for(i=0;i<__LAST_SUMABLE;i++) {
-		printf("PERF: %s: %g MB", perf_log_names_sum[i], cli_perf_sum[i] / MEGA);
-		if (perf_log_percent[i] != NONE)
-			printf("(%6.3f%%)", 100.0*cli_perf_sum[i] / cli_perf_sum[perf_log_percent[i]]);
-		printf("\n");
-	}
-	printf("\n");
-	for(j=0;j<__LAST_COUNTABLE;j++) {
-		printf("PERF: %s: ", perf_log_names_cnt[j]);
-		for (k=0;k<256;k++)
-			if (cli_perf_count[j][k]) {
-				printf(" %u -> %ju", k, cli_perf_count[j][k]);
-				if (perf_log_percent_cnt[j] != NONE)
-					printf("(%6.3f%%)", 100.0*cli_perf_count[j][k] / cli_perf_sum[perf_log_percent_cnt[j]]);
-			}
-		printf("\n");
-	}
-	printf("\n");
+    struct cnt_block *b;
+    unsigned int i;
+
+    for(i = 0; i < CL_COUNTER_LAST; i++)
+	sum[i] = cnt_fallback.val[i];
+    for(b = cnt_blocks; b; b = b->next)
+	for(i = 0; i < CL_COUNTER_LAST; i++)
+	    sum[i] += b->val[i];
 }
 
-static pthread_mutex_t cli_perf_log_mutex = PTHREAD_MUTEX_INITIALIZER;
-void cli_perf_flush(void)
+void cl_counters_enable(int enable)
 {
-	unsigned i, j;
+    cli_counters_on = !!enable;
+}
 
-	pthread_mutex_lock(&cli_perf_log_mutex);
+int cl_counters_enabled(void)
+{
+    return cli_counters_on;
+}
 
-	for (i = 0; i < __LAST_SUMABLE; i++) {
-		cli_perf_sum[i] += cli_perf_sum_tls[i];
-		cli_perf_sum_tls[i] = 0;
-	}
+unsigned int cl_counters_get(unsigned long long *values, unsigned int count)
+{
+    uint64_t sum[CL_COUNTER_LAST];
+    unsigned int i;
+
+    if(!values)
+	return 0;
+    if(count > CL_COUNTER_LAST)
+	count = CL_COUNTER_LAST;
+
+    cnt_lock();
+    cnt_sum(sum);
+    for(i = 0; i < count; i++)
+	values[i] = sum[i] - cnt_base[i];
+    cnt_unlock();
+    return count;
+}
 
-	for (i = 0; i < __LAST_COUNTABLE; i++) {
-		for (j = 0; j < 256; j++) {
-			cli_perf_count[i][j] += cli_perf_count_tls[i][j];
-			cli_perf_count_tls[i][j] = 0;
-		}
-	}
+void cl_counters_reset(void)
+{
+    /* the owning threads may be counting right now, so rather than
+     * clearing their blocks remember where we are */
+    cnt_lock();
+    cnt_sum(cnt_base);
+    cnt_unlock();
+}
 
-	cli_perf_print();
-	pthread_mutex_unlock(&cli_perf_log_mutex);
+const char *cl_counter_name(enum cl_counter counter)
+{
+    if((unsigned int)counter >= CL_COUNTER_LAST)
+	return NULL;
+    return cnt_names[counter];
 }
-#endif
@@ -22,81 +22,33 @@
 #ifndef PERFLOGGING_H
 #define PERFLOGGING_H
 
-/* this is a compile-time selectable, default off module to log certain
- * statistics, such as which tries are used, efficiency of filtering and so on.
- * it must have as little overhead as possible */
+/* Runtime switchable counters (see enum cl_counter) for the matchers, fmap
+ * and the bytecode engine. They must have as little overhead as possible:
+ * when they are off the cost is one predictable branch on a global flag,
+ * when they are on each thread increments its own cache line padded block,
+ * which is only summed up when somebody asks for the values. */
 
-/* #define CLI_PERF_LOGGING */
-#ifdef CLI_PERF_LOGGING
-
-#ifndef __GNUC__
-#error "Performance logging requires GNU C compatible compiler"
-#else
-/*TODO: maybe we need a GCC version check too here */
-#include <pthread.h>
-#include <assert.h>
+#include "clamav.h"
 #include "cltypes.h"
+#include "others.h"
 
-enum perf_log_sumable {
-	RAW_BYTES_SCANNED,
-	FILTER_BYTES_SCANNED,
-  AC_SCANNED,
-	BM_SCANNED,
-	__LAST_SUMABLE
-};
-
-enum perf_log_countable {
-	TRIE_SCANNED,
-	FILTER_LOAD,
-	FILTER_END_LOAD,
-	TRIE_ORIG_LEN,
-	__LAST_COUNTABLE
-};
-
-extern __thread int last_flushed;
-extern __thread int cli_perf_registered;
-extern __thread uint64_t cli_perf_sum_tls[__LAST_SUMABLE];
-extern __thread uint64_t cli_perf_count_tls[__LAST_COUNTABLE][256];
-extern __thread int last_flushed;
-
-extern uint64_t cli_perf_sum[__LAST_SUMABLE];
-extern uint64_t cli_perf_count[__LAST_COUNTABLE][256];
-
-void cli_perf_register(void);
-void cli_perf_flush(void);
-
-static inline void cli_perf_enter(void)
-{
-	if (!cli_perf_registered) cli_perf_register();
-	if (cli_perf_sum_tls[RAW_BYTES_SCANNED] - last_flushed > 100*1024*1024) {
-		cli_perf_flush();
-		last_flushed = cli_perf_sum_tls[RAW_BYTES_SCANNED];
-	}
-}
+extern volatile int cli_counters_on;
 
-static inline void cli_perf_log_add(enum perf_log_sumable kind, uint64_t add)
-{
-	cli_perf_enter();
-	assert( kind < __LAST_SUMABLE);
-	cli_perf_sum_tls[kind] += add;
-}
+uint64_t *cli_counters_block(void);
 
-static inline void cli_perf_log_count2(enum perf_log_countable kind, uint8_t event, uint64_t cnt)
+/* Returns the counter block of the calling thread, or NULL when counting is
+ * off. Fetch it once before a loop and bump the entries directly. */
+static inline uint64_t *cli_counters(void)
 {
-	cli_perf_enter();
-	assert( kind < __LAST_COUNTABLE);
-	cli_perf_count_tls[kind][event] += cnt;
+    if (LIKELY(!cli_counters_on))
+	return NULL;
+    return cli_counters_block();
 }
 
-static inline void cli_perf_log_count(enum perf_log_countable kind, uint8_t event)
+static inline void cli_counter_add(enum cl_counter counter, uint64_t n)
 {
-	cli_perf_log_count2(kind, event, 1);
+    if (UNLIKELY(cli_counters_on))
+	cli_counters_block()[counter] += n;
 }
 
 #endif
-
-#else
-#define cli_perf_log_count(a,b) do {} while(0)
-#endif
-
-#endif
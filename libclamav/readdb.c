@@ -1348,6 +1348,13 @@ static int load_oneldb(char *buffer, int chkpua, struct cl_engine *engine, unsig
 	return CL_EMEM;
     }
 
+    if((ret = cli_ac_lsig_compile(root, lsig))) {
+	FREE_TDB(tdb);
+	mpool_free(engine->mempool, lsig->logic);
+	mpool_free(engine->mempool, lsig);
+	return ret;
+    }
+
     lsigid[0] = lsig->id = root->ac_lsigs;
 
     root->ac_lsigs++;
@@ -2006,9 +2013,10 @@ static int cli_loadhash(FILE *fs, struct cl_engine *engine, unsigned int *signo,
 	    break;
 	}
 
-	if((ret = hm_addhash_str(db, tokens[md5_field], size, virname))) {
+	ret = hm_addhash_str(db, tokens[md5_field], size, virname);
+	mpool_free(engine->mempool, (void *)virname);
+	if(ret) {
 	    cli_errmsg("cli_loadhash: Malformed hash string at line %u\n", line);
-	    mpool_free(engine->mempool, (void *)virname);
 	    break;
 	}
 
@@ -3130,6 +3138,8 @@ int cl_engine_free(struct cl_engine *engine)
 		if(root->ac_lsigtable) {
 		    for(j = 0; j < root->ac_lsigs; j++) {
 			mpool_free(engine->mempool, root->ac_lsigtable[j]->logic);
+			if(root->ac_lsigtable[j]->prog)
+			    mpool_free(engine->mempool, root->ac_lsigtable[j]->prog);
 			FREE_TDB(root->ac_lsigtable[j]->tdb);
 			mpool_free(engine->mempool, root->ac_lsigtable[j]);
 		    }
@@ -3141,6 +3151,9 @@ int cl_engine_free(struct cl_engine *engine)
 	mpool_free(engine->mempool, engine->root);
     }
 
+    if(engine->scanplan)
+	mpool_free(engine->mempool, engine->scanplan);
+
     if((root = engine->hm_hdb)) {
 	hm_free(root);
 	mpool_free(engine->mempool, root);
@@ -3257,17 +3270,22 @@ int cl_engine_compile(struct cl_engine *engine)
 	if((root = engine->root[i])) {
 	    if((ret = cli_ac_buildtrie(root)))
 		return ret;
+	    if(engine->bm_literal && !root->ac_only && (ret = cli_bm_build_literal(root)))
+		return ret;
 	    cli_dbgmsg("Matcher[%u]: %s: AC sigs: %u (reloff: %u, absoff: %u) BM sigs: %u (reloff: %u, absoff: %u) maxpatlen %u %s\n", i, cli_mtargets[i].name, root->ac_patterns, root->ac_reloff_num, root->ac_absoff_num, root->bm_patterns, root->bm_reloff_num, root->bm_absoff_num, root->maxpatlen, root->ac_only ? "(ac_only mode)" : "");
 	}
     }
-    if(engine->hm_hdb)
-	hm_flush(engine->hm_hdb);
+    if(engine->hm_hdb && (ret = hm_flush(engine->hm_hdb)))
+	return ret;
+
+    if(engine->hm_mdb && (ret = hm_flush(engine->hm_mdb)))
+	return ret;
 
-    if(engine->hm_mdb)
-	hm_flush(engine->hm_mdb);
+    if(engine->hm_fp && (ret = hm_flush(engine->hm_fp)))
+	return ret;
 
-    if(engine->hm_fp)
-	hm_flush(engine->hm_fp);
+    if((ret = cli_scan_plan_build(engine)))
+	return ret;
 
     if((ret = cli_build_regex_list(engine->whitelist_matcher))) {
 	    return ret;
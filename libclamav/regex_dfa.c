@@ -0,0 +1,1146 @@
+/*
+ *  Lazily built DFA for matching a string against many regexes at once
+ *
+ *  Copyright (C) 2026 agent <agent@local>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <ctype.h>
+#ifdef CL_THREAD_SAFE
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "clamav.h"
+#include "others.h"
+#include "regex_dfa.h"
+
+#ifndef CL_THREAD_SAFE
+#define pthread_mutex_lock(x) 0
+#define pthread_mutex_unlock(x)
+#define pthread_mutex_init(a, b) 0
+#define pthread_mutex_destroy(a) do { } while(0)
+#define sched_yield() do { } while(0)
+#endif
+
+#ifdef HAVE_ATOMIC_BUILTINS
+#define rd_load(p, order) __atomic_load_n(p, order)
+#define rd_store(p, v, order) __atomic_store_n(p, v, order)
+#define rd_add(p, v) __atomic_add_fetch(p, v, __ATOMIC_SEQ_CST)
+#else
+/* cli_redfa_match() holds the mutex for the whole walk */
+#define rd_load(p, order) (*(p))
+#define rd_store(p, v, order) (*(p) = (v))
+#define rd_add(p, v) (*(p) += (v))
+#endif
+
+#define MODULE "regex_dfa: "
+
+/* limits on what gets compiled, the rest is left to cli_regexec() */
+#define REDFA_MAXPATLEN		4096
+#define REDFA_PATTERN_MAXSTATES	4096
+#define REDFA_MAXSTATES		(1 << 24)
+/* cache flushes allowed while matching one string before giving up */
+#define REDFA_MAXFLUSH		4
+/* and restarts after the other threads flushed it under the string */
+#define REDFA_MAXRESTART	16
+#define REDFA_BUCKETS		4096
+
+/*
+ * The NFA is a Thompson one: every pattern gets a chain of states ending in
+ * an RN_MATCH state carrying its id. States that consume a byte (RN_BYTE,
+ * RN_SET, RN_ANY) continue at out, RN_SPLIT at both out and arg, the
+ * assertions at out if they hold.
+ */
+enum {
+	RN_BYTE,
+	RN_SET,
+	RN_ANY,
+	RN_SPLIT,
+	RN_BOL,
+	RN_EOL,
+	RN_MATCH
+};
+
+struct rn_state {
+	unsigned char type;
+	unsigned char c;	/* RN_BYTE */
+	unsigned int out;
+	unsigned int arg;	/* RN_SPLIT: second out, RN_SET: set, RN_MATCH: id */
+};
+
+/*
+ * A DFA state is the set of NFA states the patterns can be in (after
+ * following the empty transitions), less the ones of the floating start
+ * set: every pattern may start matching at any position, so the start
+ * states of all of them are part of every set and need not be stored.
+ */
+struct rd_state {
+	struct rd_state *hnext;
+	uint32_t hash;
+	unsigned int nkernel;	/* the NFA states, sorted */
+	unsigned int nacc;	/* ids matched on entering the state */
+	unsigned int naccend;	/* ids matched if the string ends here */
+	unsigned int *data;
+	struct rd_state *next[1];	/* by byte class, NULL if not computed yet;
+					 * set once, with a release store */
+};
+
+struct cli_redfa {
+	/* the NFA */
+	struct rn_state *states;
+	unsigned int nstates, states_cap;
+	unsigned char (*sets)[32];
+	unsigned int nsets, sets_cap;
+	unsigned int *starts;
+	unsigned int nstarts, starts_cap;
+	uint32_t *compiled;
+	unsigned int nids;
+	int built;
+
+	/* set up by cli_redfa_build() */
+	unsigned char classes[256];
+	unsigned char reps[256];
+	unsigned int nclasses;
+	unsigned char *in_s0;
+	unsigned int *s0_out;	/* where the floating start set goes, by class */
+	unsigned int *s0_off;
+	unsigned int *always;	/* ids matching any string */
+	unsigned int nalways;
+	unsigned int *mark, gen;
+	unsigned int *stack, *set, *tmp, *ids;
+
+	/*
+	 * The DFA states built so far. With HAVE_ATOMIC_BUILTINS
+	 * cli_redfa_match() walks them without the mutex; it only takes it
+	 * to build a missing state, and stops counting in walkers while it
+	 * does. A flush frees the states once walkers drops to zero and then
+	 * bumps flush_gen, which tells the thread that was waiting for the
+	 * mutex whether its state is gone. The mutex covers the rest:
+	 * buckets, mem and the scratch sets. Without the builtins the whole
+	 * walk is done under the mutex and walkers stays zero.
+	 */
+	struct rd_state *start;
+	struct rd_state **buckets;
+	size_t mem;
+	unsigned int walkers;
+	unsigned int flush_gen;
+#ifdef CL_THREAD_SAFE
+	pthread_mutex_t mutex;
+#endif
+};
+
+/* ---------------- pattern parser ---------------- */
+
+enum {
+	RX_BYTE,
+	RX_SET,
+	RX_ANY,
+	RX_EMPTY,
+	RX_BOL,
+	RX_EOL,
+	RX_CAT,
+	RX_ALT,
+	RX_REPEAT
+};
+
+struct rx_node {
+	unsigned char type;
+	unsigned char c;
+	int left, right;
+	int min, max;	/* max -1: unbounded */
+	unsigned int set;
+};
+
+struct rx_parse {
+	struct cli_redfa *dfa;
+	const unsigned char *p, *end;
+	struct rx_node *nodes;
+	unsigned int nnodes, maxnodes;
+	unsigned int first_state;
+	int icase;
+};
+
+#define RX_MORE(P) ((P)->p < (P)->end)
+#define RX_MORE2(P) ((P)->p + 1 < (P)->end)
+
+static int rx_new(struct rx_parse *p, int type)
+{
+	struct rx_node *n;
+
+	if(p->nnodes == p->maxnodes)
+		return -1;
+	n = &p->nodes[p->nnodes];
+	memset(n, 0, sizeof(*n));
+	n->type = type;
+	n->left = n->right = -1;
+	return p->nnodes++;
+}
+
+static int rx_pair(struct rx_parse *p, int type, int left, int right)
+{
+	int n = rx_new(p, type);
+
+	if(n < 0)
+		return -1;
+	p->nodes[n].left = left;
+	p->nodes[n].right = right;
+	return n;
+}
+
+static int rx_set(struct rx_parse *p, const unsigned char *set)
+{
+	struct cli_redfa *dfa = p->dfa;
+	int n;
+
+	if(dfa->nsets == dfa->sets_cap) {
+		unsigned int cap = dfa->sets_cap ? dfa->sets_cap * 2 : 64;
+		unsigned char (*sets)[32] = cli_realloc(dfa->sets, cap * sizeof(*sets));
+		if(!sets)
+			return -1;
+		dfa->sets = sets;
+		dfa->sets_cap = cap;
+	}
+	if((n = rx_new(p, RX_SET)) < 0)
+		return -1;
+	memcpy(dfa->sets[dfa->nsets], set, 32);
+	p->nodes[n].set = dfa->nsets++;
+	return n;
+}
+
+#define SET_ADD(S, C) ((S)[(unsigned char)(C) >> 3] |= 1 << ((C) & 7))
+#define SET_HAS(S, C) ((S)[(unsigned char)(C) >> 3] & (1 << ((C) & 7)))
+
+static int rx_literal(struct rx_parse *p, unsigned char c)
+{
+	int n;
+
+	if(c >= 0x80)
+		return -1;
+	if(p->icase && isalpha(c)) {
+		unsigned char set[32];
+
+		memset(set, 0, sizeof(set));
+		SET_ADD(set, tolower(c));
+		SET_ADD(set, toupper(c));
+		return rx_set(p, set);
+	}
+	if((n = rx_new(p, RX_BYTE)) < 0)
+		return -1;
+	p->nodes[n].c = c;
+	return n;
+}
+
+static int rx_class(const char *name, size_t len, unsigned char *set)
+{
+	static const char *names[] = {
+		"alnum", "alpha", "blank", "cntrl", "digit", "graph",
+		"lower", "print", "punct", "space", "upper", "xdigit"
+	};
+	unsigned int i, c;
+	int in;
+
+	for(i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+		if(strlen(names[i]) == len && !strncmp(names[i], name, len))
+			break;
+	if(i == sizeof(names) / sizeof(names[0]))
+		return -1;
+	/* the same as the cclasses of the regex engine, which are ASCII only */
+	for(c = 1; c < 0x80; c++) {
+		switch(i) {
+			case 0: in = isalnum(c); break;
+			case 1: in = isalpha(c); break;
+			case 2: in = c == ' ' || c == '\t'; break;
+			case 3: in = iscntrl(c); break;
+			case 4: in = isdigit(c); break;
+			case 5: in = isgraph(c); break;
+			case 6: in = islower(c); break;
+			case 7: in = isprint(c); break;
+			case 8: in = ispunct(c); break;
+			case 9: in = isspace(c); break;
+			case 10: in = isupper(c); break;
+			default: in = isxdigit(c); break;
+		}
+		if(in)
+			SET_ADD(set, c);
+	}
+	return 0;
+}
+
+/* a character of a bracket expression, -1 for collating elements */
+static int rx_bsymbol(struct rx_parse *p)
+{
+	if(!RX_MORE(p) || (RX_MORE2(p) && p->p[0] == '[' && p->p[1] == '.') || *p->p >= 0x80)
+		return -1;
+	return *p->p++;
+}
+
+static int rx_bracket(struct rx_parse *p)
+{
+	unsigned char set[32];
+	int invert = 0, start, finish, c;
+
+	if(p->end - p->p >= 6 && (!memcmp(p->p, "[:<:]]", 6) || !memcmp(p->p, "[:>:]]", 6)))
+		return -1;
+	memset(set, 0, sizeof(set));
+	if(RX_MORE(p) && *p->p == '^') {
+		invert = 1;
+		p->p++;
+	}
+	if(RX_MORE(p) && (*p->p == ']' || *p->p == '-')) {
+		SET_ADD(set, *p->p);
+		p->p++;
+	}
+	while(RX_MORE(p) && *p->p != ']' && !(RX_MORE2(p) && p->p[0] == '-' && p->p[1] == ']')) {
+		if(*p->p == '-')
+			return -1;
+		if(*p->p == '[' && RX_MORE2(p) && p->p[1] == ':') {
+			const unsigned char *name = p->p += 2;
+			while(RX_MORE(p) && isalpha(*p->p))
+				p->p++;
+			if(rx_class((const char *)name, p->p - name, set) || !RX_MORE2(p) || p->p[0] != ':' || p->p[1] != ']')
+				return -1;
+			p->p += 2;
+			continue;
+		}
+		if(*p->p == '[' && RX_MORE2(p) && p->p[1] == '=')
+			return -1;
+		if((start = rx_bsymbol(p)) < 0)
+			return -1;
+		finish = start;
+		if(RX_MORE2(p) && p->p[0] == '-' && p->p[1] != ']') {
+			p->p++;
+			if(*p->p == '-') {
+				finish = '-';
+				p->p++;
+			} else if((finish = rx_bsymbol(p)) < 0)
+				return -1;
+		}
+		if(start > finish)
+			return -1;
+		for(c = start; c <= finish; c++)
+			SET_ADD(set, c);
+	}
+	if(RX_MORE(p) && *p->p == '-') {
+		SET_ADD(set, '-');
+		p->p++;
+	}
+	if(!RX_MORE(p) || *p->p != ']')
+		return -1;
+	p->p++;
+
+	if(p->icase)
+		for(c = 0; c < 0x80; c++)
+			if(isalpha(c) && SET_HAS(set, c)) {
+				SET_ADD(set, tolower(c));
+				SET_ADD(set, toupper(c));
+			}
+	if(invert)
+		for(c = 0; c < 32; c++)
+			set[c] = ~set[c];
+	return rx_set(p, set);
+}
+
+static int rx_count(struct rx_parse *p)
+{
+	int count = 0, digits = 0;
+
+	while(RX_MORE(p) && isdigit(*p->p) && count <= 255) {
+		count = count * 10 + *p->p++ - '0';
+		digits++;
+	}
+	return (digits && count <= 255) ? count : -1;
+}
+
+static int rx_ere(struct rx_parse *p, int stop);
+
+#define RX_IS_REPEAT(P) (RX_MORE(P) && (*(P)->p == '*' || *(P)->p == '+' || *(P)->p == '?' || \
+	    (*(P)->p == '{' && RX_MORE2(P) && isdigit((P)->p[1]))))
+
+/* an atom and its repetition, the same way as p_ere_exp() of the regex
+ * engine; anything it would reject is rejected here */
+static int rx_exp(struct rx_parse *p)
+{
+	int n, min, max, wascaret = 0;
+	unsigned char c = *p->p++;
+
+	switch(c) {
+		case '(':
+			if(!RX_MORE(p) || *p->p == '?')
+				return -1;
+			if(*p->p == ')') {
+				p->p++;
+				n = rx_new(p, RX_EMPTY);
+				break;
+			}
+			if((n = rx_ere(p, ')')) < 0 || !RX_MORE(p) || *p->p != ')')
+				return -1;
+			p->p++;
+			break;
+		case '^':
+			n = rx_new(p, RX_BOL);
+			wascaret = 1;
+			break;
+		case '$':
+			n = rx_new(p, RX_EOL);
+			break;
+		case ')':
+		case '|':
+		case '*':
+		case '+':
+		case '?':
+			return -1;
+		case '.':
+			n = rx_new(p, RX_ANY);
+			break;
+		case '[':
+			n = rx_bracket(p);
+			break;
+		case '\\':
+			if(!RX_MORE(p))
+				return -1;
+			n = rx_literal(p, *p->p++);
+			break;
+		case '{':
+			if(RX_MORE(p) && isdigit(*p->p))
+				return -1;
+			/* fall through */
+		default:
+			n = rx_literal(p, c);
+			break;
+	}
+	if(n < 0 || !RX_IS_REPEAT(p))
+		return n;
+	if(wascaret)
+		return -1;
+	switch(*p->p++) {
+		case '*':
+			min = 0;
+			max = -1;
+			break;
+		case '+':
+			min = 1;
+			max = -1;
+			break;
+		case '?':
+			min = 0;
+			max = 1;
+			break;
+		default:
+			if((min = rx_count(p)) < 0)
+				return -1;
+			max = min;
+			if(RX_MORE(p) && *p->p == ',') {
+				p->p++;
+				max = -1;
+				if(RX_MORE(p) && isdigit(*p->p) && ((max = rx_count(p)) < 0 || max < min))
+					return -1;
+			}
+			if(!RX_MORE(p) || *p->p != '}')
+				return -1;
+			p->p++;
+			break;
+	}
+	if(RX_IS_REPEAT(p))
+		return -1;
+	if((n = rx_pair(p, RX_REPEAT, n, -1)) < 0)
+		return -1;
+	p->nodes[n].min = min;
+	p->nodes[n].max = max;
+	return n;
+}
+
+static int rx_branch(struct rx_parse *p, int stop)
+{
+	int n = -1, e;
+
+	while(RX_MORE(p) && *p->p != '|' && *p->p != stop) {
+		if((e = rx_exp(p)) < 0)
+			return -1;
+		if(n < 0)
+			n = e;
+		else if((n = rx_pair(p, RX_CAT, n, e)) < 0)
+			return -1;
+	}
+	/* empty branches are an error for the regex engine */
+	return n;
+}
+
+static int rx_ere(struct rx_parse *p, int stop)
+{
+	int n = rx_branch(p, stop), r;
+
+	while(n >= 0 && RX_MORE(p) && *p->p == '|') {
+		p->p++;
+		if((r = rx_branch(p, stop)) < 0)
+			return -1;
+		n = rx_pair(p, RX_ALT, n, r);
+	}
+	return n;
+}
+
+/* ---------------- NFA construction ---------------- */
+
+static int rn_new(struct rx_parse *p, int type, unsigned int out, unsigned int arg)
+{
+	struct cli_redfa *dfa = p->dfa;
+	struct rn_state *st;
+
+	if(dfa->nstates - p->first_state >= REDFA_PATTERN_MAXSTATES || dfa->nstates >= REDFA_MAXSTATES)
+		return -1;
+	if(dfa->nstates == dfa->states_cap) {
+		unsigned int cap = dfa->states_cap ? dfa->states_cap * 2 : 1024;
+		struct rn_state *states = cli_realloc(dfa->states, cap * sizeof(*states));
+		if(!states)
+			return -1;
+		dfa->states = states;
+		dfa->states_cap = cap;
+	}
+	st = &dfa->states[dfa->nstates];
+	st->type = type;
+	st->c = 0;
+	st->out = out;
+	st->arg = arg;
+	return dfa->nstates++;
+}
+
+/* builds the states for node n, continuing at next; returns the first one */
+static int rx_compile(struct rx_parse *p, int n, int next)
+{
+	const struct rx_node *node = &p->nodes[n];
+	int i, s, t;
+
+	switch(node->type) {
+		case RX_BYTE:
+			if((s = rn_new(p, RN_BYTE, next, 0)) >= 0)
+				p->dfa->states[s].c = node->c;
+			return s;
+		case RX_SET:
+			return rn_new(p, RN_SET, next, node->set);
+		case RX_ANY:
+			return rn_new(p, RN_ANY, next, 0);
+		case RX_EMPTY:
+			return next;
+		case RX_BOL:
+			return rn_new(p, RN_BOL, next, 0);
+		case RX_EOL:
+			return rn_new(p, RN_EOL, next, 0);
+		case RX_CAT:
+			if((t = rx_compile(p, node->right, next)) < 0)
+				return -1;
+			return rx_compile(p, node->left, t);
+		case RX_ALT:
+			if((s = rx_compile(p, node->left, next)) < 0 || (t = rx_compile(p, node->right, next)) < 0)
+				return -1;
+			return rn_new(p, RN_SPLIT, s, t);
+		case RX_REPEAT:
+			t = next;
+			i = node->min;
+			if(node->max < 0) {
+				/* loop back through a split: x* starts at the split,
+				 * x+ at x itself */
+				if((s = rn_new(p, RN_SPLIT, 0, next)) < 0 || (t = rx_compile(p, node->left, s)) < 0)
+					return -1;
+				p->dfa->states[s].out = t;
+				if(!i)
+					t = s;
+				else
+					i--;
+			} else {
+				int j;
+				for(j = node->min; j < node->max; j++) {
+					if((s = rx_compile(p, node->left, t)) < 0 || (t = rn_new(p, RN_SPLIT, s, next)) < 0)
+						return -1;
+				}
+			}
+			for(; i > 0; i--)
+				if((t = rx_compile(p, node->left, t)) < 0)
+					return -1;
+			return t;
+	}
+	return -1;
+}
+
+static void build_free(struct cli_redfa *dfa);
+static void cache_flush(struct cli_redfa *dfa);
+
+struct cli_redfa *cli_redfa_new(void)
+{
+	struct cli_redfa *dfa = cli_calloc(1, sizeof(*dfa));
+
+	if(!dfa)
+		return NULL;
+	if(pthread_mutex_init(&dfa->mutex, NULL)) {
+		free(dfa);
+		return NULL;
+	}
+	return dfa;
+}
+
+void cli_redfa_free(struct cli_redfa *dfa)
+{
+	if(!dfa)
+		return;
+	build_free(dfa);
+	free(dfa->states);
+	free(dfa->sets);
+	free(dfa->starts);
+	free(dfa->compiled);
+	pthread_mutex_destroy(&dfa->mutex);
+	free(dfa);
+}
+
+int cli_redfa_add(struct cli_redfa *dfa, const char *pattern, unsigned int id)
+{
+	struct rx_parse p;
+	const unsigned int nsets = dfa->nsets;
+	size_t len = strlen(pattern);
+	int n, match, start;
+
+	if(!strncmp(pattern, "(?i)", 4)) {
+		/* the same prefix as cli_regcomp() understands */
+		p.icase = 1;
+		pattern += 4;
+		len -= 4;
+	} else
+		p.icase = 0;
+	if(!len || len > REDFA_MAXPATLEN)
+		return CL_EPARSE;
+	p.dfa = dfa;
+	p.p = (const unsigned char *)pattern;
+	p.end = p.p + len;
+	p.first_state = dfa->nstates;
+	p.nnodes = 0;
+	p.maxnodes = 3 * len + 8;
+	if(!(p.nodes = cli_malloc(p.maxnodes * sizeof(*p.nodes))))
+		return CL_EMEM;
+
+	if((n = rx_ere(&p, 256)) < 0 || RX_MORE(&p) ||
+	   (match = rn_new(&p, RN_MATCH, 0, id)) < 0 || (start = rx_compile(&p, n, match)) < 0) {
+		/* drop whatever was added for this pattern */
+		free(p.nodes);
+		dfa->nstates = p.first_state;
+		dfa->nsets = nsets;
+		return CL_EPARSE;
+	}
+	free(p.nodes);
+
+	if(dfa->nstarts == dfa->starts_cap) {
+		unsigned int cap = dfa->starts_cap ? dfa->starts_cap * 2 : 64;
+		unsigned int *starts = cli_realloc(dfa->starts, cap * sizeof(*starts));
+		if(!starts)
+			goto oom;
+		dfa->starts = starts;
+		dfa->starts_cap = cap;
+	}
+	if(id >= dfa->nids) {
+		const unsigned int words = (dfa->nids + 31) / 32, nwords = (id + 32) / 32;
+		if(nwords > words) {
+			uint32_t *compiled = cli_realloc(dfa->compiled, nwords * sizeof(*compiled));
+			if(!compiled)
+				goto oom;
+			memset(compiled + words, 0, (nwords - words) * sizeof(*compiled));
+			dfa->compiled = compiled;
+		}
+		dfa->nids = id + 1;
+	}
+	dfa->starts[dfa->nstarts++] = start;
+	dfa->compiled[id >> 5] |= 1U << (id & 31);
+	/* needs to be built again */
+	dfa->built = 0;
+	return CL_SUCCESS;
+
+oom:
+	dfa->nstates = p.first_state;
+	dfa->nsets = nsets;
+	return CL_EMEM;
+}
+
+int cli_redfa_has(const struct cli_redfa *dfa, unsigned int id)
+{
+	return dfa && dfa->built && id < dfa->nids && (dfa->compiled[id >> 5] & (1U << (id & 31)));
+}
+
+/* ---------------- DFA ---------------- */
+
+#define RD_BOL 1	/* at the start of the string */
+#define RD_EOL 2	/* at the end of the string */
+
+static void new_gen(struct cli_redfa *dfa)
+{
+	if(!++dfa->gen) {
+		memset(dfa->mark, 0, dfa->nstates * sizeof(*dfa->mark));
+		dfa->gen = 1;
+	}
+}
+
+/* Adds the states reachable from st without consuming a byte to out. The
+ * floating start set is left out, and not walked either unless at the start
+ * of the string, where the assertions let more states through. */
+static void closure(struct cli_redfa *dfa, unsigned int st, int flags, unsigned int *out, unsigned int *n)
+{
+	unsigned int sp = 0;
+
+	dfa->stack[sp++] = st;
+	while(sp) {
+		const struct rn_state *s;
+		int in_s0;
+
+		st = dfa->stack[--sp];
+		if(dfa->mark[st] == dfa->gen)
+			continue;
+		dfa->mark[st] = dfa->gen;
+		in_s0 = dfa->in_s0 && dfa->in_s0[st];
+		if(in_s0 && !(flags & RD_BOL))
+			continue;
+		s = &dfa->states[st];
+		switch(s->type) {
+			case RN_SPLIT:
+				dfa->stack[sp++] = s->arg;
+				dfa->stack[sp++] = s->out;
+				break;
+			case RN_BOL:
+				if(flags & RD_BOL)
+					dfa->stack[sp++] = s->out;
+				break;
+			case RN_EOL:
+				if(flags & RD_EOL) {
+					dfa->stack[sp++] = s->out;
+					break;
+				}
+				/* fall through */
+			default:
+				if(!in_s0)
+					out[(*n)++] = st;
+				break;
+		}
+	}
+}
+
+static inline int accepts(const struct cli_redfa *dfa, const struct rn_state *s, unsigned char c)
+{
+	switch(s->type) {
+		case RN_BYTE:
+			return s->c == c;
+		case RN_SET:
+			return SET_HAS(dfa->sets[s->arg], c);
+		case RN_ANY:
+			return 1;
+	}
+	return 0;
+}
+
+/* the ids of the patterns matching once the string ends in the given states */
+static unsigned int end_ids(struct cli_redfa *dfa, const unsigned int *set, unsigned int n, unsigned int *ids)
+{
+	unsigned int i, m = 0, cnt = 0;
+
+	new_gen(dfa);
+	for(i = 0; i < n; i++)
+		if(dfa->states[set[i]].type == RN_EOL)
+			closure(dfa, dfa->states[set[i]].out, RD_EOL, dfa->tmp, &m);
+	for(i = 0; i < m; i++)
+		if(dfa->states[dfa->tmp[i]].type == RN_MATCH)
+			ids[cnt++] = dfa->states[dfa->tmp[i]].arg;
+	return cnt;
+}
+
+static int cmp_uint(const void *a, const void *b)
+{
+	const unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* the state for the n NFA states in dfa->set; NULL with full set if it
+ * doesn't fit in the cache */
+static struct rd_state *state_get(struct cli_redfa *dfa, unsigned int n, int *full)
+{
+	unsigned int *set = dfa->set, i, nacc = 0, nend;
+	uint32_t hash = 2166136261U;
+	struct rd_state *s;
+	size_t size;
+
+	*full = 0;
+	qsort(set, n, sizeof(*set), cmp_uint);
+	for(i = 0; i < n; i++)
+		hash = (hash ^ set[i]) * 16777619U;
+	for(s = dfa->buckets[hash & (REDFA_BUCKETS - 1)]; s; s = s->hnext)
+		if(s->hash == hash && s->nkernel == n && !memcmp(s->data, set, n * sizeof(*set)))
+			return s;
+
+	for(i = 0; i < n; i++)
+		if(dfa->states[set[i]].type == RN_MATCH)
+			dfa->ids[nacc++] = dfa->states[set[i]].arg;
+	nend = end_ids(dfa, set, n, dfa->ids + nacc);
+
+	size = offsetof(struct rd_state, next) + dfa->nclasses * sizeof(s->next[0]) + (n + nacc + nend) * sizeof(*set);
+	if(dfa->mem + size > REDFA_MAXMEM) {
+		*full = 1;
+		return NULL;
+	}
+	if(!(s = cli_calloc(1, size)))
+		return NULL;
+	s->hash = hash;
+	s->nkernel = n;
+	s->nacc = nacc;
+	s->naccend = nend;
+	s->data = (unsigned int *)&s->next[dfa->nclasses];
+	memcpy(s->data, set, n * sizeof(*set));
+	memcpy(s->data + n, dfa->ids, (nacc + nend) * sizeof(*set));
+	s->hnext = dfa->buckets[hash & (REDFA_BUCKETS - 1)];
+	dfa->buckets[hash & (REDFA_BUCKETS - 1)] = s;
+	dfa->mem += size;
+	return s;
+}
+
+static void cache_flush(struct cli_redfa *dfa)
+{
+	unsigned int i;
+
+	if(!dfa->buckets)
+		return;
+	/* a walker that comes in from now on finds no start state and waits
+	 * for the mutex; the ones already in there are let out first */
+	rd_store(&dfa->start, NULL, __ATOMIC_SEQ_CST);
+	while(rd_load(&dfa->walkers, __ATOMIC_SEQ_CST))
+		sched_yield();
+	for(i = 0; i < REDFA_BUCKETS; i++) {
+		struct rd_state *s = dfa->buckets[i], *nxt;
+		while(s) {
+			nxt = s->hnext;
+			free(s);
+			s = nxt;
+		}
+		dfa->buckets[i] = NULL;
+	}
+	dfa->mem = 0;
+	rd_add(&dfa->flush_gen, 1);
+}
+
+/* looks the set up, flushing the cache if it's full */
+static struct rd_state *state_get_flush(struct cli_redfa *dfa, unsigned int n, unsigned int *flushes, int *flushed)
+{
+	struct rd_state *s;
+	int full;
+
+	*flushed = 0;
+	if((s = state_get(dfa, n, &full)) || !full)
+		return s;
+	if(++*flushes > REDFA_MAXFLUSH) {
+		cli_dbgmsg(MODULE "state cache too small for this string\n");
+		return NULL;
+	}
+	cache_flush(dfa);
+	*flushed = 1;
+	return state_get(dfa, n, &full);
+}
+
+static struct rd_state *start_state(struct cli_redfa *dfa, unsigned int *flushes)
+{
+	unsigned int i, n = 0;
+	struct rd_state *s;
+	int flushed;
+
+	new_gen(dfa);
+	for(i = 0; i < dfa->nstarts; i++)
+		closure(dfa, dfa->starts[i], RD_BOL, dfa->set, &n);
+	s = state_get_flush(dfa, n, flushes, &flushed);
+	rd_store(&dfa->start, s, __ATOMIC_SEQ_CST);
+	return s;
+}
+
+static struct rd_state *transition(struct cli_redfa *dfa, struct rd_state *s, unsigned int k, unsigned int *flushes)
+{
+	const unsigned char c = dfa->reps[k];
+	unsigned int i, n = 0;
+	struct rd_state *t;
+	int flushed;
+
+	new_gen(dfa);
+	for(i = 0; i < s->nkernel; i++) {
+		const struct rn_state *st = &dfa->states[s->data[i]];
+		if(accepts(dfa, st, c))
+			closure(dfa, st->out, 0, dfa->set, &n);
+	}
+	for(i = dfa->s0_off[k]; i < dfa->s0_off[k + 1]; i++)
+		closure(dfa, dfa->s0_out[i], 0, dfa->set, &n);
+	t = state_get_flush(dfa, n, flushes, &flushed);
+	/* s is gone if the cache was flushed */
+	if(t && !flushed)
+		rd_store(&s->next[k], t, __ATOMIC_RELEASE);
+	return t;
+}
+
+#ifdef HAVE_ATOMIC_BUILTINS
+/*
+ * Builds the transition of s on class k, or the start state with s NULL,
+ * for a walker; it is not one while it waits for the mutex, so s can be
+ * flushed meanwhile: the start state is returned then, and *restarts is
+ * incremented. The caller is a walker again if a state is returned.
+ */
+static struct rd_state *walk_build(struct cli_redfa *dfa, struct rd_state *s, unsigned int k, unsigned int *flushes, unsigned int *restarts, int *ret)
+{
+	const unsigned int gen = rd_load(&dfa->flush_gen, __ATOMIC_SEQ_CST);
+	struct rd_state *t;
+
+	rd_add(&dfa->walkers, -1);
+	if(pthread_mutex_lock(&dfa->mutex)) {
+		*ret = CL_ELOCK;
+		return NULL;
+	}
+	if(s && gen != dfa->flush_gen) {
+		if(++*restarts > REDFA_MAXRESTART) {
+			cli_dbgmsg(MODULE "state cache flushed too often under this string\n");
+			t = NULL;
+			goto done;
+		}
+		s = NULL;
+	}
+	if(!s)
+		t = dfa->start ? dfa->start : start_state(dfa, flushes);
+	else
+		t = s->next[k] ? s->next[k] : transition(dfa, s, k, flushes);
+done:
+	if(t)
+		rd_add(&dfa->walkers, 1);
+	else
+		*ret = CL_EMAXSIZE;
+	pthread_mutex_unlock(&dfa->mutex);
+	return t;
+}
+#endif
+
+static void build_free(struct cli_redfa *dfa)
+{
+	cache_flush(dfa);
+	free(dfa->buckets);
+	free(dfa->in_s0);
+	free(dfa->s0_out);
+	free(dfa->s0_off);
+	free(dfa->always);
+	free(dfa->mark);
+	free(dfa->stack);
+	free(dfa->set);
+	free(dfa->tmp);
+	free(dfa->ids);
+	dfa->buckets = NULL;
+	dfa->in_s0 = NULL;
+	dfa->s0_out = dfa->s0_off = dfa->always = NULL;
+	dfa->mark = dfa->stack = dfa->set = dfa->tmp = dfa->ids = NULL;
+	dfa->built = 0;
+}
+
+/* splits the classes by membership in set */
+static void refine(struct cli_redfa *dfa, const unsigned char *set)
+{
+	short map[512];
+	unsigned int c, n = 0;
+
+	memset(map, -1, sizeof(map));
+	for(c = 0; c < 256; c++) {
+		const unsigned int key = dfa->classes[c] * 2 + !!SET_HAS(set, c);
+		if(map[key] < 0)
+			map[key] = n++;
+		dfa->classes[c] = map[key];
+	}
+	dfa->nclasses = n;
+}
+
+int cli_redfa_build(struct cli_redfa *dfa)
+{
+	unsigned char seen[32], set[32];
+	unsigned int i, k, n = 0, m, cnt;
+	unsigned int nstates = dfa->nstates;
+
+	build_free(dfa);
+	if(!dfa->nstarts)
+		return CL_SUCCESS;
+
+	/* bytes that no pattern tells apart share their transitions */
+	memset(dfa->classes, 0, sizeof(dfa->classes));
+	dfa->nclasses = 1;
+	memset(seen, 0, sizeof(seen));
+	for(i = 0; i < nstates; i++) {
+		const struct rn_state *st = &dfa->states[i];
+		if(st->type == RN_BYTE && !SET_HAS(seen, st->c)) {
+			SET_ADD(seen, st->c);
+			memset(set, 0, sizeof(set));
+			SET_ADD(set, st->c);
+			refine(dfa, set);
+		}
+	}
+	for(i = 0; i < dfa->nsets; i++)
+		refine(dfa, dfa->sets[i]);
+	for(i = 256; i > 0; i--)
+		dfa->reps[dfa->classes[i - 1]] = i - 1;
+
+	dfa->mark = cli_calloc(nstates, sizeof(*dfa->mark));
+	dfa->stack = cli_malloc((2 * nstates + 1) * sizeof(*dfa->stack));
+	dfa->set = cli_malloc(nstates * sizeof(*dfa->set));
+	dfa->tmp = cli_malloc(nstates * sizeof(*dfa->tmp));
+	dfa->ids = cli_malloc(2 * dfa->nstarts * sizeof(*dfa->ids));
+	dfa->always = cli_malloc(2 * dfa->nstarts * sizeof(*dfa->always));
+	dfa->s0_off = cli_calloc(dfa->nclasses + 1, sizeof(*dfa->s0_off));
+	dfa->buckets = cli_calloc(REDFA_BUCKETS, sizeof(*dfa->buckets));
+	if(!dfa->mark || !dfa->stack || !dfa->set || !dfa->tmp || !dfa->ids || !dfa->always || !dfa->s0_off || !dfa->buckets)
+		goto oom;
+	dfa->gen = 0;
+
+	/* the floating start set: where every pattern is before its first
+	 * byte, anywhere but at the start of the string */
+	new_gen(dfa);
+	for(i = 0; i < dfa->nstarts; i++)
+		closure(dfa, dfa->starts[i], 0, dfa->set, &n);
+	if(!(dfa->in_s0 = cli_calloc(nstates, sizeof(*dfa->in_s0))))
+		goto oom;
+	for(i = 0; i < nstates; i++)
+		if(dfa->mark[i] == dfa->gen && dfa->states[i].type != RN_BOL)
+			dfa->in_s0[i] = 1;
+
+	/* patterns matching the empty string, or any string at its end */
+	cnt = 0;
+	for(i = 0; i < n; i++)
+		if(dfa->states[dfa->set[i]].type == RN_MATCH)
+			dfa->always[cnt++] = dfa->states[dfa->set[i]].arg;
+	/* in_s0 is set, but the closures from its own states walk it */
+	{
+		unsigned char *in_s0 = dfa->in_s0;
+		dfa->in_s0 = NULL;
+		cnt += end_ids(dfa, dfa->set, n, dfa->always + cnt);
+		dfa->in_s0 = in_s0;
+	}
+	dfa->nalways = cnt;
+
+	/* where the start set goes on each class */
+	for(m = 0, k = 0; k < dfa->nclasses; k++) {
+		dfa->s0_off[k] = m;
+		for(i = 0; i < n; i++)
+			if(accepts(dfa, &dfa->states[dfa->set[i]], dfa->reps[k]))
+				m++;
+	}
+	dfa->s0_off[k] = m;
+	if(!(dfa->s0_out = cli_malloc((m ? m : 1) * sizeof(*dfa->s0_out))))
+		goto oom;
+	for(m = 0, k = 0; k < dfa->nclasses; k++)
+		for(i = 0; i < n; i++)
+			if(accepts(dfa, &dfa->states[dfa->set[i]], dfa->reps[k]))
+				dfa->s0_out[m++] = dfa->states[dfa->set[i]].out;
+
+	cli_dbgmsg(MODULE "%u patterns, %u NFA states, %u byte classes, %u start states\n",
+		   dfa->nstarts, nstates, dfa->nclasses, n);
+	dfa->built = 1;
+	return CL_SUCCESS;
+
+oom:
+	cli_errmsg(MODULE "Can't allocate memory for the DFA\n");
+	build_free(dfa);
+	return CL_EMEM;
+}
+
+static inline void set_ids(uint32_t *matched, const unsigned int *ids, unsigned int n)
+{
+	unsigned int i;
+
+	for(i = 0; i < n; i++)
+		matched[ids[i] >> 5] |= 1U << (ids[i] & 31);
+}
+
+#ifdef HAVE_ATOMIC_BUILTINS
+int cli_redfa_match(struct cli_redfa *dfa, const unsigned char *buf, size_t len, uint32_t *matched)
+{
+	struct rd_state *s, *t;
+	unsigned int flushes = 0, restarts = 0, seen;
+	size_t pos;
+	int ret = CL_SUCCESS;
+
+	if(!dfa || !dfa->built || !len)
+		return CL_EARG;
+	/* the cached states are walked by all the threads at once, only the
+	 * missing ones are built under the mutex, see struct cli_redfa */
+	rd_add(&dfa->walkers, 1);
+	if(!(s = rd_load(&dfa->start, __ATOMIC_SEQ_CST)) && !(s = walk_build(dfa, NULL, 0, &flushes, &restarts, &ret)))
+		return ret;
+	set_ids(matched, s->data + s->nkernel, s->nacc);
+	for(pos = 0; pos < len; ) {
+		const unsigned int k = dfa->classes[buf[pos]];
+
+		if(!(t = rd_load(&s->next[k], __ATOMIC_ACQUIRE))) {
+			seen = restarts;
+			if(!(t = walk_build(dfa, s, k, &flushes, &restarts, &ret)))
+				return ret;
+			if(restarts != seen) {
+				/* the ids found so far are found again */
+				s = t;
+				pos = 0;
+				continue;
+			}
+		}
+		s = t;
+		if(s->nacc)
+			set_ids(matched, s->data + s->nkernel, s->nacc);
+		pos++;
+	}
+	set_ids(matched, s->data + s->nkernel + s->nacc, s->naccend);
+	set_ids(matched, dfa->always, dfa->nalways);
+	rd_add(&dfa->walkers, -1);
+	return ret;
+}
+#else
+int cli_redfa_match(struct cli_redfa *dfa, const unsigned char *buf, size_t len, uint32_t *matched)
+{
+	struct rd_state *s;
+	unsigned int flushes = 0;
+	size_t pos;
+	int ret = CL_SUCCESS;
+
+	if(!dfa || !dfa->built || !len)
+		return CL_EARG;
+	/* no atomic loads and stores here: the walk is done under the mutex,
+	 * the states are built as they are needed */
+	if(pthread_mutex_lock(&dfa->mutex))
+		return CL_ELOCK;
+	if(!(s = dfa->start) && !(s = start_state(dfa, &flushes))) {
+		ret = CL_EMAXSIZE;
+		goto done;
+	}
+	set_ids(matched, s->data + s->nkernel, s->nacc);
+	for(pos = 0; pos < len; pos++) {
+		const unsigned int k = dfa->classes[buf[pos]];
+		struct rd_state *t = s->next[k];
+
+		if(!t && !(t = transition(dfa, s, k, &flushes))) {
+			ret = CL_EMAXSIZE;
+			goto done;
+		}
+		s = t;
+		if(s->nacc)
+			set_ids(matched, s->data + s->nkernel, s->nacc);
+	}
+	set_ids(matched, s->data + s->nkernel + s->nacc, s->naccend);
+	set_ids(matched, dfa->always, dfa->nalways);
+
+done:
+	pthread_mutex_unlock(&dfa->mutex);
+	return ret;
+}
+#endif
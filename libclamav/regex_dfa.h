@@ -0,0 +1,59 @@
+/*
+ *  Lazily built DFA for matching a string against many regexes at once
+ *
+ *  Copyright (C) 2026 agent <agent@local>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#ifndef _REGEX_DFA_H
+#define _REGEX_DFA_H
+
+#include "cltypes.h"
+
+/*
+ * The regexes of a regex_matcher are compiled into one NFA, which is turned
+ * into a DFA state by state while URLs are matched against it; one pass over
+ * a URL tells which of the regexes match it, the same as cli_regexec() would
+ * for each of them (they are searched for anywhere in the string, ^ and $
+ * anchor at its ends).
+ *
+ * cli_redfa_add() returns CL_EPARSE for the patterns it can't express
+ * (collating elements, [[:<:]] and friends, non-ASCII bytes, huge bounds),
+ * and cli_redfa_match() gives up when the states needed by a single string
+ * don't fit in REDFA_MAXMEM; the caller runs cli_regexec() in both cases.
+ */
+
+/* memory for the cached DFA states, flushed when full */
+#define REDFA_MAXMEM (4 * 1024 * 1024)
+
+struct cli_redfa;
+
+struct cli_redfa *cli_redfa_new(void);
+void cli_redfa_free(struct cli_redfa *dfa);
+
+/* id is the caller's index of the regex, the bit it gets in the result */
+int cli_redfa_add(struct cli_redfa *dfa, const char *pattern, unsigned int id);
+int cli_redfa_build(struct cli_redfa *dfa);
+
+/* nonzero if the regex with this id was compiled into the DFA */
+int cli_redfa_has(const struct cli_redfa *dfa, unsigned int id);
+
+/* sets the bits of the ids that match buf in matched, which must have room
+ * for the highest id added; returns CL_SUCCESS or an error if the DFA can't
+ * tell (the bits are not valid then) */
+int cli_redfa_match(struct cli_redfa *dfa, const unsigned char *buf, size_t len, uint32_t *matched);
+
+#endif
@@ -175,9 +175,10 @@ int regex_list_match(struct regex_matcher* matcher,char* real_url,const char* di
 	{
 		char *buffer = cli_malloc(buffer_len+1);
 		char *bufrev;
-		int rc = 0, root;
+		int rc = 0, root, dfa_done = 0;
 		struct cli_ac_data mdata;
 		struct cli_ac_result *res = NULL;
+		uint32_t *dfa_matched = NULL;
 
 		if(!buffer)
 			return CL_EMEM;
@@ -227,6 +228,20 @@ int regex_list_match(struct regex_matcher* matcher,char* real_url,const char* di
 				if (!regex->preg) {
 					/* we matched a static pattern */
 					rc = validate_subdomain(regex, pre_fixup, buffer, buffer_len, real_url, real_len, orig_real_url);
+				} else if (cli_redfa_has(matcher->dfa, regex->idx)) {
+					if (!dfa_done) {
+						/* one pass tells about all the regexes */
+						dfa_done = 1;
+						dfa_matched = cli_calloc((matcher->regex_cnt + 31) / 32, sizeof(*dfa_matched));
+						if (dfa_matched && cli_redfa_match(matcher->dfa, (const unsigned char*)buffer, strlen(buffer), dfa_matched)) {
+							free(dfa_matched);
+							dfa_matched = NULL;
+						}
+					}
+					if (dfa_matched)
+						rc = !!(dfa_matched[regex->idx >> 5] & (1U << (regex->idx & 31)));
+					else
+						rc = !cli_regexec(regex->preg, buffer, 0, NULL, 0);
 				} else {
 					rc = !cli_regexec(regex->preg, buffer, 0, NULL, 0);
 				}
@@ -240,6 +255,7 @@ int regex_list_match(struct regex_matcher* matcher,char* real_url,const char* di
 			}
 		}
 		free(buffer);
+		free(dfa_matched);
 		if(!rc)
 			cli_dbgmsg("Lookup result: not in regex list\n");
 		else
@@ -284,6 +300,9 @@ int init_regex_list(struct regex_matcher* matcher, uint8_t dconf_prefiltering)
 		return rc;
 	}
 	filter_init(&matcher->filter);
+	/* without it every regex goes through cli_regexec() */
+	if(!(matcher->dfa = cli_redfa_new()))
+		cli_dbgmsg("init_regex_list: can't allocate the regex DFA\n");
 	return CL_SUCCESS;
 }
 
@@ -517,6 +536,10 @@ int cli_build_regex_list(struct regex_matcher* matcher)
 	cli_hashtab_free(&matcher->suffix_hash);
 	if(( rc = cli_ac_buildtrie(&matcher->suffixes) ))
 		return rc;
+	if(matcher->dfa && cli_redfa_build(matcher->dfa)) {
+		cli_redfa_free(matcher->dfa);
+		matcher->dfa = NULL;
+	}
 	matcher->list_built=1;
 	cli_hashset_destroy(&matcher->sha256_pfx_set);
 
@@ -552,6 +575,8 @@ void regex_list_done(struct regex_matcher* matcher)
 			}
 			mpool_free(matcher->mempool, matcher->all_pregs);
 		}
+		cli_redfa_free(matcher->dfa);
+		matcher->dfa = NULL;
 		cli_hashtab_free(&matcher->suffix_hash);
 		cli_bm_free(&matcher->sha256_hashes);
 		cli_bm_free(&matcher->hostkey_prefix);
@@ -633,6 +658,7 @@ static int add_pattern_suffix(void *cbdata, const char *suffix, size_t suffix_le
 		return CL_EMEM;
 	regex->pattern = iregex->pattern ? cli_strdup(iregex->pattern) : NULL;
 	regex->preg = iregex->preg;
+	regex->idx = iregex->preg ? (int)matcher->regex_cnt - 1 : -1;
 	regex->nxt = NULL;
 	el = cli_hashtab_find(&matcher->suffix_hash, suffix, suffix_len);
 	/* TODO: what if suffixes are prefixes of eachother and only one will
@@ -694,6 +720,7 @@ static int add_static_pattern(struct regex_matcher *matcher, char* pattern)
 	regex.nxt = NULL;
 	regex.pattern = cli_strdup(pattern);
 	regex.preg = NULL;
+	regex.idx = -1;
 	rc = add_pattern_suffix(matcher, pattern, len, &regex);
 	free(regex.pattern);
 	return rc;
@@ -728,6 +755,8 @@ int regex_list_add_pattern(struct regex_matcher *matcher, char *pattern)
 	rc = cli_regex2suffix(pattern, preg, add_pattern_suffix, (void*)matcher);
 	if(rc) {
 		cli_regfree(preg);
+	} else if(matcher->dfa && cli_redfa_add(matcher->dfa, pattern, matcher->regex_cnt - 1) != CL_SUCCESS) {
+		cli_dbgmsg("regex_list_add_pattern: %s is left to the regex engine\n", pattern);
 	}
 
 	return rc;
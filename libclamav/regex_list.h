@@ -29,6 +29,7 @@
 #include "matcher.h"
 #include "filtering.h"
 #include "hashtab.h"
+#include "regex_dfa.h"
 #include <zlib.h> /* for gzFile */
 
 #include "mpool.h"
@@ -45,6 +46,7 @@ struct regex_matcher {
 	size_t root_regex_idx;
 	size_t regex_cnt;
 	regex_t **all_pregs;
+	struct cli_redfa *dfa;
 	struct cli_matcher suffixes;
 	struct cli_matcher sha256_hashes;
 	struct cli_hashset sha256_pfx_set;
@@ -428,6 +428,7 @@ int cli_regex2suffix(const char *pattern, regex_t *preg, suffix_callback cb, voi
 	assert(pattern);
 
 	regex.preg = preg;
+	regex.idx = -1;
 	rc = cli_regcomp(regex.preg, pattern, REG_EXTENDED);
 	if(rc) {
 		size_t buflen = cli_regerror(rc, regex.preg, NULL, 0);
@@ -26,6 +26,7 @@
 struct regex_list {
 	char *pattern;
 	regex_t *preg;
+	int idx;	/* in regex_matcher.all_pregs, -1 for static patterns */
 	struct regex_list *nxt;
 };
 typedef int (*suffix_callback)(void *cbdata, const char *suffix, size_t len, const struct regex_list *regex);
@@ -0,0 +1,130 @@
+/*
+ *  Reusable per-thread scan state
+ *
+ *  Copyright (C) 2026 agent <agent@local>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "clamav.h"
+#include "others.h"
+#include "default.h"
+#include "arena.h"
+#include "matcher.h"
+#include "matcher-ac.h"
+#include "bytecode.h"
+#include "scanctx.h"
+
+struct cl_scan_context *cl_scan_context_new(void)
+{
+    struct cl_scan_context *sctx = cli_calloc(1, sizeof(*sctx));
+
+    if(!sctx)
+	cli_errmsg("cl_scan_context_new: Can't allocate memory for the scan context\n");
+    return sctx;
+}
+
+void cl_scan_context_reset(struct cl_scan_context *sctx)
+{
+	unsigned int i;
+
+    if(!sctx)
+	return;
+    for(i = 0; i < sctx->nacdata; i++)
+	cli_ac_freedata(&sctx->acdata[i]);
+    sctx->nacdata = 0;
+    for(i = 0; i < sctx->nbcctx; i++)
+	cli_bytecode_context_destroy(sctx->bcctx[i]);
+    sctx->nbcctx = 0;
+    sctx->engine = NULL;
+}
+
+void cl_scan_context_free(struct cl_scan_context *sctx)
+{
+    cl_scan_context_reset(sctx);
+    free(sctx);
+}
+
+void cli_scanctx_attach(struct cl_scan_context *sctx, const struct cl_engine *engine)
+{
+    if(sctx->engine != engine) {
+	cl_scan_context_reset(sctx);
+	sctx->engine = engine;
+    }
+}
+
+int cli_scanctx_initdata(struct cl_scan_context *sctx, struct cli_ac_data *data, const struct cli_matcher *root)
+{
+	uint32_t partsigs = 0, lsigs = 0, reloffsigs = 0;
+	unsigned int i;
+	int ret;
+
+    if(root) {
+	partsigs = root->ac_partsigs;
+	lsigs = root->ac_lsigs;
+	reloffsigs = root->ac_reloff_num;
+    }
+
+    if(!sctx)
+	return cli_ac_initdata(data, partsigs, lsigs, reloffsigs, CLI_DEFAULT_AC_TRACKLEN);
+
+    for(i = 0; i < sctx->nacdata; i++) {
+	if(sctx->acdata[i].partsigs == partsigs && sctx->acdata[i].lsigs == lsigs && sctx->acdata[i].reloffsigs == reloffsigs) {
+	    *data = sctx->acdata[i];
+	    sctx->acdata[i] = sctx->acdata[--sctx->nacdata];
+	    return CL_SUCCESS;
+	}
+    }
+
+    /* the tables outlive the scan, keep them out of the arena */
+    cli_arena_pin();
+    ret = cli_ac_initdata(data, partsigs, lsigs, reloffsigs, CLI_DEFAULT_AC_TRACKLEN);
+    cli_arena_unpin();
+    return ret;
+}
+
+void cli_scanctx_freedata(struct cl_scan_context *sctx, struct cli_ac_data *data)
+{
+    if(!sctx || sctx->nacdata == CLI_SCANCTX_ACDATA) {
+	cli_ac_freedata(data);
+	return;
+    }
+    cli_ac_resetdata(data);
+    sctx->acdata[sctx->nacdata++] = *data;
+}
+
+struct cli_bc_ctx *cli_scanctx_bcctx_get(struct cl_scan_context *sctx)
+{
+    if(sctx && sctx->nbcctx)
+	return sctx->bcctx[--sctx->nbcctx];
+    return cli_bytecode_context_alloc();
+}
+
+void cli_scanctx_bcctx_put(struct cl_scan_context *sctx, struct cli_bc_ctx *bc_ctx)
+{
+    if(!sctx || sctx->nbcctx == CLI_SCANCTX_BCCTX) {
+	cli_bytecode_context_destroy(bc_ctx);
+	return;
+    }
+    cli_bytecode_context_reinit(bc_ctx);
+    sctx->bcctx[sctx->nbcctx++] = bc_ctx;
+}
@@ -0,0 +1,66 @@
+/*
+ *  Reusable per-thread scan state
+ *
+ *  Copyright (C) 2026 agent <agent@local>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#ifndef __SCANCTX_H
+#define __SCANCTX_H
+
+#include "clamav.h"
+#include "others.h"
+#include "matcher.h"
+#include "matcher-ac.h"
+#include "bytecode.h"
+
+/*
+ * A struct cl_scan_context keeps the working state of the matchers between
+ * the scans of one thread (see cl_scan_context_new() in clamav.h), so that
+ * a file does not pay for setting up tables sized by the whole database.
+ *
+ * The cli_ac_data tables are only reused for roots of the same geometry
+ * (partsigs, lsigs and reloffsigs), which is all they depend on; nested
+ * scans take their own entry out of the pool, so up to
+ * CLI_SCANCTX_ACDATA of them are kept. Everything is handed back reset,
+ * the per-scan parts (lsig state pages, offmatrix rows) go back to the
+ * arena before the scan ends.
+ *
+ * Without a scan context (sctx == NULL) the helpers below fall back to
+ * plain cli_ac_initdata()/cli_bytecode_context_alloc() and friends.
+ */
+#define CLI_SCANCTX_ACDATA 8
+#define CLI_SCANCTX_BCCTX 4
+
+struct cl_scan_context {
+    const struct cl_engine *engine;
+    struct cli_ac_data acdata[CLI_SCANCTX_ACDATA];
+    unsigned int nacdata;
+    struct cli_bc_ctx *bcctx[CLI_SCANCTX_BCCTX];
+    unsigned int nbcctx;
+};
+
+/* called by scan_common(), drops whatever was cached for another engine */
+void cli_scanctx_attach(struct cl_scan_context *sctx, const struct cl_engine *engine);
+
+/* root may be NULL, which gives an empty cli_ac_data */
+int cli_scanctx_initdata(struct cl_scan_context *sctx, struct cli_ac_data *data, const struct cli_matcher *root);
+void cli_scanctx_freedata(struct cl_scan_context *sctx, struct cli_ac_data *data);
+
+struct cli_bc_ctx *cli_scanctx_bcctx_get(struct cl_scan_context *sctx);
+void cli_scanctx_bcctx_put(struct cl_scan_context *sctx, struct cli_bc_ctx *bc_ctx);
+
+#endif
@@ -42,6 +42,9 @@
 #ifdef HAVE_SYS_TIMES_H
 #include <sys/times.h>
 #endif
+#ifdef CL_THREAD_SAFE
+#include <pthread.h>
+#endif
 
 #define DCONF_ARCH  ctx->dconf->archive
 #define DCONF_DOC   ctx->dconf->doc
@@ -55,6 +58,8 @@
 #include "matcher-ac.h"
 #include "matcher-bm.h"
 #include "matcher.h"
+#include "arena.h"
+#include "scanctx.h"
 #include "ole2_extract.h"
 #include "vba_extract.h"
 #include "msexpand.h"
@@ -800,11 +805,11 @@ static int vba_scandata(const unsigned char *data, unsigned int len, cli_ctx *ct
 	int ret;
 	unsigned int viruses_found = 0;
 
-    if((ret = cli_ac_initdata(&tmdata, troot->ac_partsigs, troot->ac_lsigs, troot->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN)))
+    if((ret = cli_scanctx_initdata(ctx->sctx, &tmdata, troot)))
 	return ret;
 
-    if((ret = cli_ac_initdata(&gmdata, groot->ac_partsigs, groot->ac_lsigs, groot->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN))) {
-	cli_ac_freedata(&tmdata);
+    if((ret = cli_scanctx_initdata(ctx->sctx, &gmdata, groot))) {
+	cli_scanctx_freedata(ctx->sctx, &tmdata);
 	return ret;
     }
     mdata[0] = &tmdata;
@@ -821,8 +826,8 @@ static int vba_scandata(const unsigned char *data, unsigned int len, cli_ctx *ct
 		viruses_found++;
 	    ret = cli_lsig_eval(ctx, groot, &gmdata, NULL, NULL);
     }
-    cli_ac_freedata(&tmdata);
-    cli_ac_freedata(&gmdata);
+    cli_scanctx_freedata(ctx->sctx, &tmdata);
+    cli_scanctx_freedata(ctx->sctx, &gmdata);
 
     if (viruses_found)
 	return CL_VIRUS;
@@ -1040,13 +1045,34 @@ static int cli_vba_scandir(const char *dirname, cli_ctx *ctx, struct uniq *U)
     return ret;
 }
 
+/* cli_scandesc() for a normalized view kept in memory */
+static int cli_scanhtml_view(const unsigned char *buf, size_t len, cli_ctx *ctx)
+{
+    fmap_t *map = *ctx->fmap;
+    int ret;
+
+    if(!len)
+	return CL_CLEAN;
+    if(!(*ctx->fmap = cl_fmap_open_memory(buf, len))) {
+	*ctx->fmap = map;
+	return CL_EMEM;
+    }
+    ret = cli_fmap_scandesc(ctx, CL_TYPE_HTML, 0, NULL, AC_SCAN_VIR, NULL, NULL);
+    map->dont_cache_flag = (*ctx->fmap)->dont_cache_flag;
+    funmap(*ctx->fmap);
+    *ctx->fmap = map;
+    return ret;
+}
+
 static int cli_scanhtml(cli_ctx *ctx)
 {
     char *tempname, fullname[1024];
-    int ret=CL_CLEAN, fd;
+    int ret=CL_CLEAN, fd, tmpdir = 1;
     fmap_t *map = *ctx->fmap;
     unsigned int viruses_found = 0;
     uint64_t curr_len = map->len;
+    const struct cli_scan_plan *plan;
+    struct html_views views;
 
     cli_dbgmsg("in cli_scanhtml()\n");
 
@@ -1059,43 +1085,70 @@ static int cli_scanhtml(cli_ctx *ctx)
     if(!(tempname = cli_gentemp(ctx->engine->tmpdir)))
 	return CL_EMEM;
 
-    if(mkdir(tempname, 0700)) {
-        cli_errmsg("cli_scanhtml: Can't create temporary directory %s\n", tempname);
-	free(tempname);
-        return CL_ETMPDIR;
-    }
+    if(!ctx->engine->keeptmp) {
+	/* scan the views from memory and don't produce those no signature
+	 * can match; tempname is only created for scripts and RFC2397 data */
+	views.want = 0;
+	plan = cli_scan_plan_get(ctx->engine, CL_TYPE_HTML);
+	if(!plan || (plan->flags & (CLI_PLAN_TROOT | CLI_PLAN_GROOT | CLI_PLAN_MD5 | CLI_PLAN_SHA1 | CLI_PLAN_SHA256))) {
+	    views.want = HTML_VIEW_NOCOMMENT;
+	    /* CL_ENGINE_MAX_HTMLNOTAGS */
+	    if(curr_len <= ctx->engine->maxhtmlnotags)
+		views.want |= HTML_VIEW_NOTAGS;
+	    else
+		cli_dbgmsg("cli_scanhtml: skipping notags (normalized size over MaxHTMLNoTags)\n");
+	} else {
+	    cli_dbgmsg("cli_scanhtml: no signatures for normalized HTML, skipping the views\n");
+	}
 
-    cli_dbgmsg("cli_scanhtml: using tempdir %s\n", tempname);
+	html_normalise_map_views(map, tempname, &views, ctx->dconf);
+	tmpdir = views.tmpdir;
+	if(tmpdir)
+	    cli_dbgmsg("cli_scanhtml: using tempdir %s\n", tempname);
 
-    html_normalise_map(map, tempname, NULL, ctx->dconf);
-    snprintf(fullname, 1024, "%s"PATHSEP"nocomment.html", tempname);
-    fd = open(fullname, O_RDONLY|O_BINARY);
-    if (fd >= 0) {
-	if ((ret = cli_scandesc(fd, ctx, CL_TYPE_HTML, 0, NULL, AC_SCAN_VIR, NULL)) == CL_VIRUS)
+	if((ret = cli_scanhtml_view(views.nocomment, views.nocomment_len, ctx)) == CL_VIRUS)
 	    viruses_found++;
-	close(fd);
-    }
+	if(ret == CL_CLEAN || (ret == CL_VIRUS && SCAN_ALL)) {
+	    if((ret = cli_scanhtml_view(views.notags, views.notags_len, ctx)) == CL_VIRUS)
+		viruses_found++;
+	}
+	html_views_free(&views);
+    } else {
+	if(mkdir(tempname, 0700)) {
+	    cli_errmsg("cli_scanhtml: Can't create temporary directory %s\n", tempname);
+	    free(tempname);
+	    return CL_ETMPDIR;
+	}
+
+	cli_dbgmsg("cli_scanhtml: using tempdir %s\n", tempname);
 
-    if(ret == CL_CLEAN || (ret == CL_VIRUS && SCAN_ALL)) {
-        /* CL_ENGINE_MAX_HTMLNOTAGS */
-        curr_len = map->len;
-        if (curr_len > ctx->engine->maxhtmlnotags) {
-	    /* we're not interested in scanning large files in notags form */
-            /* TODO: don't even create notags if file is over limit */
-            cli_dbgmsg("cli_scanhtml: skipping notags (normalized size over MaxHTMLNoTags)\n");
+	html_normalise_map(map, tempname, NULL, ctx->dconf);
+	snprintf(fullname, 1024, "%s"PATHSEP"nocomment.html", tempname);
+	fd = open(fullname, O_RDONLY|O_BINARY);
+	if (fd >= 0) {
+	    if ((ret = cli_scandesc(fd, ctx, CL_TYPE_HTML, 0, NULL, AC_SCAN_VIR, NULL)) == CL_VIRUS)
+		viruses_found++;
+	    close(fd);
 	}
-        else {
-            snprintf(fullname, 1024, "%s"PATHSEP"notags.html", tempname);
-            fd = open(fullname, O_RDONLY|O_BINARY);
-            if(fd >= 0) {
-                if ((ret = cli_scandesc(fd, ctx, CL_TYPE_HTML, 0, NULL, AC_SCAN_VIR, NULL)) == CL_VIRUS) 
-                    viruses_found++;
-                close(fd);
-            }
-        }
-    }
-
-    if(ret == CL_CLEAN || (ret == CL_VIRUS && SCAN_ALL)) {
+
+	if(ret == CL_CLEAN || (ret == CL_VIRUS && SCAN_ALL)) {
+	    /* CL_ENGINE_MAX_HTMLNOTAGS */
+	    if (curr_len > ctx->engine->maxhtmlnotags) {
+		/* we're not interested in scanning large files in notags form */
+		cli_dbgmsg("cli_scanhtml: skipping notags (normalized size over MaxHTMLNoTags)\n");
+	    } else {
+		snprintf(fullname, 1024, "%s"PATHSEP"notags.html", tempname);
+		fd = open(fullname, O_RDONLY|O_BINARY);
+		if(fd >= 0) {
+		    if ((ret = cli_scandesc(fd, ctx, CL_TYPE_HTML, 0, NULL, AC_SCAN_VIR, NULL)) == CL_VIRUS)
+			viruses_found++;
+		    close(fd);
+		}
+	    }
+	}
+    }
+
+    if(tmpdir && (ret == CL_CLEAN || (ret == CL_VIRUS && SCAN_ALL))) {
 	    snprintf(fullname, 1024, "%s"PATHSEP"javascript", tempname);
 	    fd = open(fullname, O_RDONLY|O_BINARY);
 	    if(fd >= 0) {
@@ -1109,12 +1162,12 @@ static int cli_scanhtml(cli_ctx *ctx)
 	    }
     }
 
-    if (ret == CL_CLEAN || (ret == CL_VIRUS && SCAN_ALL)) {
+    if (tmpdir && (ret == CL_CLEAN || (ret == CL_VIRUS && SCAN_ALL))) {
 	snprintf(fullname, 1024, "%s"PATHSEP"rfc2397", tempname);
 	ret = cli_scandir(fullname, ctx);
     }
 
-    if(!ctx->engine->keeptmp)
+    if(tmpdir && !ctx->engine->keeptmp)
         cli_rmdirs(tempname);
 
     free(tempname);
@@ -1173,11 +1226,11 @@ static int cli_scanscript(cli_ctx *ctx)
 	text_normalize_init(&state, normalized, SCANBUFF + maxpatlen);
 	ret = CL_CLEAN;
 
-	if ((ret = cli_ac_initdata(&tmdata, troot?troot->ac_partsigs:0, troot?troot->ac_lsigs:0, troot?troot->ac_reloff_num:0, CLI_DEFAULT_AC_TRACKLEN))) 
+	if ((ret = cli_scanctx_initdata(ctx->sctx, &tmdata, troot)))
 	    return ret;
 
-	if ((ret = cli_ac_initdata(&gmdata, groot->ac_partsigs, groot->ac_lsigs, groot->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN))) {
-	    cli_ac_freedata(&tmdata);
+	if ((ret = cli_scanctx_initdata(ctx->sctx, &gmdata, groot))) {
+	    cli_scanctx_freedata(ctx->sctx, &tmdata);
 	    return ret;
 	}
 	mdata[0] = &tmdata;
@@ -1230,8 +1283,8 @@ static int cli_scanscript(cli_ctx *ctx)
 		if ((ret = cli_lsig_eval(ctx, groot, &gmdata, NULL, NULL)) == CL_VIRUS)
 		    viruses_found++;
 	}
-	cli_ac_freedata(&tmdata);
-	cli_ac_freedata(&gmdata);
+	cli_scanctx_freedata(ctx->sctx, &tmdata);
+	cli_scanctx_freedata(ctx->sctx, &gmdata);
 
 	if (SCAN_ALL && viruses_found)
 	    return CL_VIRUS;
@@ -1957,31 +2010,35 @@ static inline void perf_done(cli_ctx* ctx)
 
 static inline void perf_start(cli_ctx* ctx, int id)
 {
+    cli_stats_start(ctx, id);
     cli_event_time_start(ctx->perf, id);
 }
 
 static inline void perf_stop(cli_ctx* ctx, int id)
 {
+    cli_stats_stop(ctx, id);
     cli_event_time_stop(ctx->perf, id);
 }
 
 static inline void perf_nested_start(cli_ctx* ctx, int id, int nestedid)
 {
+    cli_stats_start(ctx, id);
     cli_event_time_nested_start(ctx->perf, id, nestedid);
 }
 
 static inline void perf_nested_stop(cli_ctx* ctx, int id, int nestedid)
 {
+    cli_stats_stop(ctx, id);
     cli_event_time_nested_stop(ctx->perf, id, nestedid);
 }
 
 
 #else
 static inline void perf_init(cli_ctx* ctx) {}
-static inline void perf_start(cli_ctx* ctx, int id){}
-static inline void perf_stop(cli_ctx* ctx, int id){}
-static inline void perf_nested_start(cli_ctx* ctx, int id, int nestedid){}
-static inline void perf_nested_stop(cli_ctx* ctx, int id, int nestedid){}
+static inline void perf_start(cli_ctx* ctx, int id){ cli_stats_start(ctx, id); }
+static inline void perf_stop(cli_ctx* ctx, int id){ cli_stats_stop(ctx, id); }
+static inline void perf_nested_start(cli_ctx* ctx, int id, int nestedid){ cli_stats_start(ctx, id); }
+static inline void perf_nested_stop(cli_ctx* ctx, int id, int nestedid){ cli_stats_stop(ctx, id); }
 static inline void perf_done(cli_ctx* ctx){}
 #endif
 
@@ -2300,7 +2357,7 @@ static int magic_scandesc(cli_ctx *ctx, cli_file_t type)
 
     perf_start(ctx, PERFT_FT);
     if(type == CL_TYPE_ANY)
-	type = cli_filetype2(*ctx->fmap, ctx->engine);
+	type = cli_filetype2(*ctx->fmap, ctx->engine, ctx->sctx);
     perf_stop(ctx, PERFT_FT);
     if(type == CL_TYPE_ERROR) {
 	cli_dbgmsg("cli_magic_scandesc: cli_filetype2 returned CL_TYPE_ERROR\n");
@@ -2310,12 +2367,18 @@ static int magic_scandesc(cli_ctx *ctx, cli_file_t type)
     hashed_size = 0;
     CALL_PRESCAN_CB(cb_pre_cache);
 
+    if(ctx->stats)
+	ctx->stats->pub.files++;
     perf_start(ctx, PERFT_CACHE);
     res = cache_check(hash, ctx);
     if(res != CL_VIRUS) {
 	perf_stop(ctx, PERFT_CACHE);
+	if(ctx->stats)
+	    ctx->stats->pub.cache_hits++;
 	early_ret_from_magicscan(res);
     }
+    if(ctx->stats)
+	ctx->stats->pub.cache_misses++;
 
     perf_stop(ctx, PERFT_CACHE);
     hashed_size = (*ctx->fmap)->len;
@@ -2761,7 +2824,7 @@ static int magic_scandesc(cli_ctx *ctx, cli_file_t type)
 int cli_magic_scandesc(int desc, cli_ctx *ctx)
 {
     STATBUF sb;
-    int ret;
+    int ret, empty;
 
 #ifdef HAVE__INTERNAL__SHA_COLLECT
     if(ctx->sha_collect>0) ctx->sha_collect = 0;
@@ -2778,7 +2841,7 @@ int cli_magic_scandesc(int desc, cli_ctx *ctx)
 
     ctx->fmap++;
     perf_start(ctx, PERFT_MAP);
-    if(!(*ctx->fmap = fmap(desc, 0, sb.st_size))) {
+    if(!(*ctx->fmap = fmap_check_empty_engine(desc, 0, sb.st_size, &empty, ctx->engine))) {
 	cli_errmsg("CRITICAL: fmap() failed\n");
 	ctx->fmap--;
 	perf_stop(ctx, PERFT_MAP);
@@ -2862,7 +2925,7 @@ int cli_mem_scandesc(const void *buffer, size_t length, cli_ctx *ctx)
     return ret;
 }
 
-static int scan_common(int desc, cl_fmap_t *map, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, void *context)
+static int scan_common(int desc, cl_fmap_t *map, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, void *context, struct cl_scan_context *sctx)
 {
     cli_ctx ctx;
     int rc;
@@ -2880,14 +2943,23 @@ static int scan_common(int desc, cl_fmap_t *map, const char **virname, unsigned
     ctx.container_size = 0;
     ctx.dconf = (struct cli_dconf *) engine->dconf;
     ctx.cb_ctx = context;
-    ctx.fmap = cli_calloc(sizeof(fmap_t *), ctx.engine->maxreclevel + 2);
-    if(!ctx.fmap)
+    if((ctx.sctx = sctx))
+	cli_scanctx_attach(sctx, engine);
+    if(cli_arena_enter())
+	return CL_EMEM;
+    ctx.fmap = cli_arena_calloc(sizeof(fmap_t *), ctx.engine->maxreclevel + 2);
+    if(!ctx.fmap) {
+	cli_arena_leave();
 	return CL_EMEM;
+    }
     if (!(ctx.hook_lsig_matches = cli_bitset_init())) {
-	free(ctx.fmap);
+	cli_arena_free(ctx.fmap);
+	cli_arena_leave();
 	return CL_EMEM;
     }
     perf_init(&ctx);
+    if(engine->cb_stats && (ctx.stats = cli_calloc(1, sizeof(*ctx.stats))))
+	cli_stats_start(&ctx, PERFT_SCAN);
 
 #ifdef HAVE__INTERNAL__SHA_COLLECT
     if(scanoptions & CL_SCAN_INTERNAL_COLLECT_SHA) {
@@ -2915,22 +2987,133 @@ static int scan_common(int desc, cl_fmap_t *map, const char **virname, unsigned
     }
 
     cli_bitset_free(ctx.hook_lsig_matches);
-    free(ctx.fmap);
+    cli_arena_free(ctx.fmap);
+    cli_arena_leave();
     if(rc == CL_CLEAN && ctx.found_possibly_unwanted)
 	rc = CL_VIRUS;
     cli_logg_unsetup();
     perf_done(&ctx);
+    if(ctx.stats) {
+	cli_stats_stop(&ctx, PERFT_SCAN);
+	engine->cb_stats(&ctx.stats->pub, rc, context);
+	free(ctx.stats);
+    }
     return rc;
 }
 
 int cl_scandesc_callback(int desc, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, void *context)
 {
-    return scan_common(desc, NULL, virname, scanned, engine, scanoptions, context);
+    return scan_common(desc, NULL, virname, scanned, engine, scanoptions, context, NULL);
+}
+
+int cl_scandesc_context(int desc, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, void *context, struct cl_scan_context *sctx)
+{
+    return scan_common(desc, NULL, virname, scanned, engine, scanoptions, context, sctx);
 }
 
 int cl_scanmap_callback(cl_fmap_t *map, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, void *context)
 {
-    return scan_common(-1, map, virname, scanned, engine, scanoptions, context);
+    return scan_common(-1, map, virname, scanned, engine, scanoptions, context, NULL);
+}
+
+int cl_scanmap_context(cl_fmap_t *map, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, void *context, struct cl_scan_context *sctx)
+{
+    return scan_common(-1, map, virname, scanned, engine, scanoptions, context, sctx);
+}
+
+struct scan_batch {
+    struct cl_scan_item *items;
+    unsigned int nitems, next;
+    const struct cl_engine *engine;
+    unsigned int scanoptions;
+#ifdef CL_THREAD_SAFE
+    pthread_mutex_t mutex;
+#endif
+};
+
+static void batch_scanitem(struct scan_batch *b, struct cl_scan_item *item, struct cl_scan_context *sctx)
+{
+	cl_fmap_t *map = item->map;
+
+    item->virname = NULL;
+    if(!map && !item->len) {
+	item->result = CL_CLEAN;
+	return;
+    }
+    if(!map && !(map = cl_fmap_open_memory(item->data, item->len))) {
+	item->result = CL_EMEM;
+	return;
+    }
+    item->result = scan_common(-1, map, &item->virname, NULL, b->engine, b->scanoptions, item->context, sctx);
+    if(map != item->map)
+	cl_fmap_close(map);
+}
+
+/* every worker takes the next item until there are none left, so a large
+ * item doesn't hold up the small ones queued behind it */
+static void *batch_worker(void *arg)
+{
+	struct scan_batch *b = arg;
+	struct cl_scan_context *sctx = cl_scan_context_new();
+	unsigned int i;
+
+    while(1) {
+#ifdef CL_THREAD_SAFE
+	pthread_mutex_lock(&b->mutex);
+#endif
+	i = b->next++;
+#ifdef CL_THREAD_SAFE
+	pthread_mutex_unlock(&b->mutex);
+#endif
+	if(i >= b->nitems)
+	    break;
+	batch_scanitem(b, &b->items[i], sctx);
+    }
+    cl_scan_context_free(sctx);
+    return NULL;
+}
+
+int cl_scanmap_batch(struct cl_scan_item *items, unsigned int nitems, const struct cl_engine *engine, unsigned int scanoptions, unsigned int threads)
+{
+	struct scan_batch b;
+#ifdef CL_THREAD_SAFE
+	pthread_t *tids = NULL;
+	unsigned int i, started = 0;
+#endif
+
+    if(!items || !engine)
+	return CL_ENULLARG;
+
+    b.items = items;
+    b.nitems = nitems;
+    b.next = 0;
+    b.engine = engine;
+    b.scanoptions = scanoptions;
+
+#ifdef CL_THREAD_SAFE
+    if(threads > nitems)
+	threads = nitems;
+    pthread_mutex_init(&b.mutex, NULL);
+    /* the calling thread is one of the workers */
+    if(threads > 1 && (tids = cli_malloc((threads - 1) * sizeof(*tids)))) {
+	for(i = 0; i < threads - 1; i++) {
+	    if(pthread_create(&tids[started], NULL, batch_worker, &b))
+		break;
+	    started++;
+	}
+	if(started < threads - 1)
+	    cli_warnmsg("cl_scanmap_batch: only %u of %u threads could be started\n", started + 1, threads);
+    }
+    batch_worker(&b);
+    for(i = 0; i < started; i++)
+	pthread_join(tids[i], NULL);
+    free(tids);
+    pthread_mutex_destroy(&b.mutex);
+#else
+    batch_worker(&b);
+#endif
+
+    return CL_SUCCESS;
 }
 
 int cli_found_possibly_unwanted(cli_ctx* ctx)
@@ -2975,6 +3158,11 @@ int cl_scanfile(const char *filename, const char **virname, unsigned long int *s
 }
 
 int cl_scanfile_callback(const char *filename, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, void *context)
+{
+    return cl_scanfile_context(filename, virname, scanned, engine, scanoptions, context, NULL);
+}
+
+int cl_scanfile_context(const char *filename, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, void *context, struct cl_scan_context *sctx)
 {
 	int fd, ret;
 	const char *fname = cli_to_utf8_maybe_alloc(filename);
@@ -2988,7 +3176,7 @@ int cl_scanfile_callback(const char *filename, const char **virname, unsigned lo
     if(fname != filename)
 	free((void*)fname);
 
-    ret = cl_scandesc_callback(fd, virname, scanned, engine, scanoptions, context);
+    ret = cl_scandesc_context(fd, virname, scanned, engine, scanoptions, context, sctx);
     close(fd);
 
     return ret;
@@ -369,18 +369,25 @@ char *cli_strtokbuf(const char *input, int fieldno, const char *delim, char *out
     return output;
 }
 
-const char *cli_memstr(const char *haystack, unsigned int hs, const char *needle, unsigned int ns)
-{
-	unsigned int i, s1, s2;
+/* cli_memstr() and cli_memstr_any() are on the hot paths of the PDF, mail,
+ * bytecode and unpacker code. The vector versions test the first and the
+ * last byte of the needle at 16 (SSE2) or 32 (AVX2) positions at once and
+ * only memcmp() the candidates; the best one the CPU supports is picked on
+ * first use. The scalar versions are the reference and handle the tails. */
 
-    if(!hs || !ns || hs < ns)
-	return NULL;
+/* the multi-needle vector loops keep one pair of compares per needle */
+#define MEMSTR_ANY_VEC 8
 
-    if(needle == haystack)
-	return haystack;
+typedef const char *(*memstr_fn_t)(const char *, unsigned int, const char *, unsigned int);
+typedef const char *(*memstr_any_fn_t)(const char *, unsigned int, const char * const *, const unsigned int *, unsigned int, unsigned int, unsigned int, unsigned int *);
 
-    if(ns == 1)
-	return memchr(haystack, needle[0], hs);
+static memstr_fn_t memstr_fn;
+static memstr_any_fn_t memstr_any_fn;
+
+/* needs hs >= ns >= 2 */
+static const char *memstr_scalar(const char *haystack, unsigned int hs, const char *needle, unsigned int ns)
+{
+	unsigned int i, s1, s2;
 
     if(needle[0] == needle[1]) {
 	s1 = 2;
@@ -402,6 +409,222 @@ const char *cli_memstr(const char *haystack, unsigned int hs, const char *needle
     return NULL;
 }
 
+/* needs hs >= minlen; empty needles never match */
+static const char *memstr_any_scalar(const char *haystack, unsigned int hs, const char * const *needles, const unsigned int *ns, unsigned int n, unsigned int minlen, unsigned int maxlen, unsigned int *idx)
+{
+	unsigned char first[256];
+	unsigned int i, j;
+
+    (void) maxlen;
+    memset(first, 0, sizeof(first));
+    for(j = 0; j < n; j++)
+	if(ns[j])
+	    first[(unsigned char) needles[j][0]] = 1;
+
+    for(i = 0; i <= hs - minlen; i++) {
+	if(!first[(unsigned char) haystack[i]])
+	    continue;
+	for(j = 0; j < n; j++) {
+	    if(ns[j] && ns[j] <= hs - i && needles[j][0] == haystack[i] && !memcmp(needles[j] + 1, haystack + i + 1, ns[j] - 1)) {
+		*idx = j;
+		return &haystack[i];
+	    }
+	}
+    }
+
+    return NULL;
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__))
+#define MEMSTR_X86
+#include <immintrin.h>
+
+/* the candidates of one block, in order; every needle fits at all of them */
+static inline const char *memstr_any_check(const char *p, unsigned int mask, const char * const *needles, const unsigned int *ns, unsigned int n, unsigned int *idx)
+{
+	unsigned int bit, j;
+
+    while(mask) {
+	bit = __builtin_ctz(mask);
+	for(j = 0; j < n; j++) {
+	    if(ns[j] && needles[j][0] == p[bit] && !memcmp(needles[j] + 1, p + bit + 1, ns[j] - 1)) {
+		*idx = j;
+		return p + bit;
+	    }
+	}
+	mask &= mask - 1;
+    }
+    return NULL;
+}
+
+__attribute__((target("sse2")))
+static const char *memstr_sse2(const char *haystack, unsigned int hs, const char *needle, unsigned int ns)
+{
+	const __m128i f = _mm_set1_epi8(needle[0]), l = _mm_set1_epi8(needle[ns - 1]);
+	unsigned int i, mask, bit;
+	__m128i a, b;
+
+    for(i = 0; hs - i - ns + 1 >= 16; i += 16) {
+	a = _mm_loadu_si128((const __m128i *) (haystack + i));
+	b = _mm_loadu_si128((const __m128i *) (haystack + i + ns - 1));
+	mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, f), _mm_cmpeq_epi8(b, l)));
+	while(mask) {
+	    bit = __builtin_ctz(mask);
+	    if(!memcmp(haystack + i + bit + 1, needle + 1, ns - 2))
+		return haystack + i + bit;
+	    mask &= mask - 1;
+	}
+    }
+    return hs - i >= ns ? memstr_scalar(haystack + i, hs - i, needle, ns) : NULL;
+}
+
+__attribute__((target("sse2")))
+static const char *memstr_any_sse2(const char *haystack, unsigned int hs, const char * const *needles, const unsigned int *ns, unsigned int n, unsigned int minlen, unsigned int maxlen, unsigned int *idx)
+{
+	__m128i f[MEMSTR_ANY_VEC], l[MEMSTR_ANY_VEC], m, a, b;
+	unsigned int i, j;
+	const char *r;
+
+    if(n > MEMSTR_ANY_VEC)
+	return memstr_any_scalar(haystack, hs, needles, ns, n, minlen, maxlen, idx);
+    for(j = 0; j < n; j++) {
+	f[j] = _mm_set1_epi8(ns[j] ? needles[j][0] : 0);
+	l[j] = _mm_set1_epi8(ns[j] ? needles[j][ns[j] - 1] : 0);
+    }
+    for(i = 0; hs - i >= maxlen && hs - i - maxlen + 1 >= 16; i += 16) {
+	a = _mm_loadu_si128((const __m128i *) (haystack + i));
+	m = _mm_setzero_si128();
+	for(j = 0; j < n; j++) {
+	    if(!ns[j])
+		continue;
+	    b = _mm_loadu_si128((const __m128i *) (haystack + i + ns[j] - 1));
+	    m = _mm_or_si128(m, _mm_and_si128(_mm_cmpeq_epi8(a, f[j]), _mm_cmpeq_epi8(b, l[j])));
+	}
+	if((r = memstr_any_check(haystack + i, _mm_movemask_epi8(m), needles, ns, n, idx)))
+	    return r;
+    }
+    return hs - i >= minlen ? memstr_any_scalar(haystack + i, hs - i, needles, ns, n, minlen, maxlen, idx) : NULL;
+}
+
+__attribute__((target("avx2")))
+static const char *memstr_avx2(const char *haystack, unsigned int hs, const char *needle, unsigned int ns)
+{
+	const __m256i f = _mm256_set1_epi8(needle[0]), l = _mm256_set1_epi8(needle[ns - 1]);
+	unsigned int i, mask, bit;
+	__m256i a, b;
+
+    for(i = 0; hs - i - ns + 1 >= 32; i += 32) {
+	a = _mm256_loadu_si256((const __m256i *) (haystack + i));
+	b = _mm256_loadu_si256((const __m256i *) (haystack + i + ns - 1));
+	mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, f), _mm256_cmpeq_epi8(b, l)));
+	while(mask) {
+	    bit = __builtin_ctz(mask);
+	    if(!memcmp(haystack + i + bit + 1, needle + 1, ns - 2))
+		return haystack + i + bit;
+	    mask &= mask - 1;
+	}
+    }
+    return hs - i >= ns ? memstr_sse2(haystack + i, hs - i, needle, ns) : NULL;
+}
+
+__attribute__((target("avx2")))
+static const char *memstr_any_avx2(const char *haystack, unsigned int hs, const char * const *needles, const unsigned int *ns, unsigned int n, unsigned int minlen, unsigned int maxlen, unsigned int *idx)
+{
+	__m256i f[MEMSTR_ANY_VEC], l[MEMSTR_ANY_VEC], m, a, b;
+	unsigned int i, j;
+	const char *r;
+
+    if(n > MEMSTR_ANY_VEC)
+	return memstr_any_scalar(haystack, hs, needles, ns, n, minlen, maxlen, idx);
+    for(j = 0; j < n; j++) {
+	f[j] = _mm256_set1_epi8(ns[j] ? needles[j][0] : 0);
+	l[j] = _mm256_set1_epi8(ns[j] ? needles[j][ns[j] - 1] : 0);
+    }
+    for(i = 0; hs - i >= maxlen && hs - i - maxlen + 1 >= 32; i += 32) {
+	a = _mm256_loadu_si256((const __m256i *) (haystack + i));
+	m = _mm256_setzero_si256();
+	for(j = 0; j < n; j++) {
+	    if(!ns[j])
+		continue;
+	    b = _mm256_loadu_si256((const __m256i *) (haystack + i + ns[j] - 1));
+	    m = _mm256_or_si256(m, _mm256_and_si256(_mm256_cmpeq_epi8(a, f[j]), _mm256_cmpeq_epi8(b, l[j])));
+	}
+	if((r = memstr_any_check(haystack + i, _mm256_movemask_epi8(m), needles, ns, n, idx)))
+	    return r;
+    }
+    return hs - i >= minlen ? memstr_any_sse2(haystack + i, hs - i, needles, ns, n, minlen, maxlen, idx) : NULL;
+}
+#endif
+
+int cli_memstr_select(enum cli_memstr_impl impl)
+{
+#ifdef MEMSTR_X86
+    __builtin_cpu_init();
+    if(impl == CLI_MEMSTR_AUTO)
+	impl = __builtin_cpu_supports("avx2") ? CLI_MEMSTR_AVX2 : (__builtin_cpu_supports("sse2") ? CLI_MEMSTR_SSE2 : CLI_MEMSTR_SCALAR);
+    switch(impl) {
+	case CLI_MEMSTR_AVX2:
+	    if(!__builtin_cpu_supports("avx2"))
+		return -1;
+	    memstr_any_fn = memstr_any_avx2;
+	    memstr_fn = memstr_avx2;
+	    return 0;
+	case CLI_MEMSTR_SSE2:
+	    if(!__builtin_cpu_supports("sse2"))
+		return -1;
+	    memstr_any_fn = memstr_any_sse2;
+	    memstr_fn = memstr_sse2;
+	    return 0;
+	default:
+	    break;
+    }
+#endif
+    if(impl != CLI_MEMSTR_AUTO && impl != CLI_MEMSTR_SCALAR)
+	return -1;
+    memstr_any_fn = memstr_any_scalar;
+    memstr_fn = memstr_scalar;
+    return 0;
+}
+
+const char *cli_memstr(const char *haystack, unsigned int hs, const char *needle, unsigned int ns)
+{
+    if(!hs || !ns || hs < ns)
+	return NULL;
+
+    if(needle == haystack)
+	return haystack;
+
+    if(ns == 1)
+	return memchr(haystack, needle[0], hs);
+
+    /* racing threads pick the same implementation */
+    if(!memstr_fn)
+	cli_memstr_select(CLI_MEMSTR_AUTO);
+    return memstr_fn(haystack, hs, needle, ns);
+}
+
+const char *cli_memstr_any(const char *haystack, unsigned int hs, const char * const *needles, const unsigned int *ns, unsigned int n, unsigned int *idx)
+{
+	unsigned int j, minlen = 0, maxlen = 0, dummy;
+
+    if(!idx)
+	idx = &dummy;
+    for(j = 0; j < n; j++) {
+	if(!ns[j])
+	    continue;
+	if(!minlen || ns[j] < minlen)
+	    minlen = ns[j];
+	if(ns[j] > maxlen)
+	    maxlen = ns[j];
+    }
+    if(!hs || !minlen || hs < minlen)
+	return NULL;
+
+    if(!memstr_any_fn)
+	cli_memstr_select(CLI_MEMSTR_AUTO);
+    return memstr_any_fn(haystack, hs, needles, ns, n, minlen, maxlen, idx);
+}
+
 char *cli_strrcpy(char *dest, const char *source) /* by NJH */
 {
 
@@ -43,6 +43,18 @@ char *cli_str2hex(const char *string, unsigned int len);
 char *cli_utf16toascii(const char *str, unsigned int length);
 char *cli_strtokbuf(const char *input, int fieldno, const char *delim, char *output);
 const char *cli_memstr(const char *haystack, unsigned int hs, const char *needle, unsigned int ns);
+/* earliest match of any of the n needles, *idx (if not NULL) tells which
+ * one; at equal offsets the first needle in the list wins */
+const char *cli_memstr_any(const char *haystack, unsigned int hs, const char * const *needles, const unsigned int *ns, unsigned int n, unsigned int *idx);
+
+/* cli_memstr() implementations; tests and benchmarks can force one */
+enum cli_memstr_impl {
+    CLI_MEMSTR_AUTO = 0,
+    CLI_MEMSTR_SCALAR,
+    CLI_MEMSTR_SSE2,
+    CLI_MEMSTR_AVX2
+};
+int cli_memstr_select(enum cli_memstr_impl impl);
 char *cli_strrcpy(char *dest, const char *source);
 size_t cli_strtokenize(char *buffer, const char delim, const size_t token_count, const char **tokens);
 int cli_isnumber(const char *str);
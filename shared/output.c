@@ -60,8 +60,13 @@
 
 #ifdef CL_THREAD_SAFE
 #include <pthread.h>
+#include <sched.h>
 pthread_mutex_t logg_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t mdprintf_mutex = PTHREAD_MUTEX_INITIALIZER;
+#ifdef __GNUC__
+/* the ring below needs the __sync builtins */
+#define LOGG_ASYNC
+#endif
 #endif
 
 #if defined(C_LINUX) && defined(HAVE_LIBINTL_H)
@@ -272,6 +277,7 @@ static int logg_open(void)
 
 void logg_close(void)
 {
+    logg_async_stop();
 #if defined(USE_SYSLOG) && !defined(C_AIX)
     if(logg_syslog)
     	closelog();
@@ -308,55 +314,22 @@ void logg_close(void)
  *  $	  no	   mprintf     no	yes   LOG_DEBUG
  *  none  yes	   mprintf     yes	yes   LOG_INFO
  */
-int logg(const char *str, ...)
+/* logg_mutex held */
+static int logg_write(char *buff, time_t currtime, int batch)
 {
-	va_list args;
-	char buffer[1025], *abuffer = NULL, *buff;
-	time_t currtime;
-	size_t len;
 	mode_t old_umask;
 #ifdef F_WRLCK
 	struct flock fl;
 #endif
 
-    if ((*str == '$' && logg_verbose < 2) ||
-	(*str == '*' && !logg_verbose))
-	return 0;
-
-    ARGLEN(args, str, len);
-    if(len <= sizeof(buffer)) {
-	len = sizeof(buffer);
-	buff = buffer;
-    } else {
-	abuffer = malloc(len);
-	if(!abuffer) {
-	    len = sizeof(buffer);
-	    buff = buffer;
-	} else {
-	    buff = abuffer;
-	}
-    }
-    va_start(args, str);
-    vsnprintf(buff, len, str, args);
-    va_end(args);
-    buff[len - 1] = 0;
-
-#ifdef CL_THREAD_SAFE
-    pthread_mutex_lock(&logg_mutex);
-#endif
-
-    logg_open();
+    if(!batch)
+	logg_open();
 
     if(!logg_fp && logg_file) {
         old_umask = umask(0037);
         if((logg_fp = fopen(logg_file, "at")) == NULL) {
             umask(old_umask);
-#ifdef CL_THREAD_SAFE
-            pthread_mutex_unlock(&logg_mutex);
-#endif
             printf("ERROR: Can't open %s in append mode (check permissions!).\n", logg_file);
-            if(len > sizeof(buffer))
-                free(abuffer);
             return -1;
         } else umask(old_umask);
 
@@ -371,12 +344,7 @@ int logg(const char *str, ...)
                 else
 #endif
                 {
-#ifdef CL_THREAD_SAFE
-                    pthread_mutex_unlock(&logg_mutex);
-#endif
                     printf("ERROR: %s is locked by another process\n", logg_file);
-                    if(len > sizeof(buffer))
-                    free(abuffer);
                     return -1;
                 }
             }
@@ -385,13 +353,13 @@ int logg(const char *str, ...)
     }
 
 	if(logg_fp) {
-	    char flush = !logg_noflush;
+	    /* a batch is flushed as a whole by the writer thread */
+	    char flush = !logg_noflush && !batch;
             /* Need to avoid logging time for verbose messages when logverbose
                is not set or we get a bunch of timestamps in the log without
                newlines... */
 	    if(logg_time && ((*buff != '*') || logg_verbose)) {
 	        char timestr[32];
-		time(&currtime);
 		cli_ctime(&currtime, timestr, sizeof(timestr));
 		/* cut trailing \n */
 		timestr[strlen(timestr)-1] = '\0';
@@ -400,11 +368,11 @@ int logg(const char *str, ...)
 
 	    if(*buff == '!') {
 		fprintf(logg_fp, "ERROR: %s", buff + 1);
-		flush = 1;
+		flush = !batch;
 	    } else if(*buff == '^') {
 		if(!logg_nowarn)
 		    fprintf(logg_fp, "WARNING: %s", buff + 1);
-		flush = 1;
+		flush = !batch;
 	    } else if(*buff == '*' || *buff == '$') {
 		    fprintf(logg_fp, "%s", buff + 1);
 	    } else if(*buff == '#' || *buff == '~') {
@@ -437,14 +405,277 @@ int logg(const char *str, ...)
 
     }
 #endif
+    return 0;
+}
+
+#ifdef LOGG_ASYNC
+/*
+ * Asynchronous logging: logg() formats the message on the calling thread
+ * and puts it in a bounded multi-producer ring (one sequence number per
+ * slot, producers claim slots with a CAS on the head), a writer thread
+ * drains it in batches under logg_mutex, checks the rotation once per
+ * batch and flushes once per batch. When the ring is full verbose and
+ * debug messages are dropped and counted, everything else waits for room.
+ */
+#define LOGG_RING_SIZE 4096	/* power of 2 */
+#define LOGG_SLOT_TEXT 256
+#define LOGG_IDLE_WAIT 200	/* ms, bounds a missed wakeup */
+
+struct logg_slot {
+    volatile unsigned long seq;
+    time_t time;
+    char *ext;			/* messages that don't fit in text */
+    char text[LOGG_SLOT_TEXT];
+};
+
+static struct {
+    struct logg_slot *slots;
+    volatile unsigned long head;	/* next slot to claim */
+    unsigned long tail;			/* writer only */
+    volatile unsigned long dropped;
+    volatile unsigned int users;	/* logg() calls on their way into the ring */
+    volatile int on, stop, idle;
+    pthread_t writer;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} logg_ring = { NULL, 0, 0, 0, 0, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+/* returns 0 if queued, 1 if dropped; takes over abuffer */
+static int logg_enqueue(const char *buff, char *abuffer)
+{
+	struct logg_slot *slot;
+	unsigned long pos;
+	long dif;
+	int spins = 0;
+
+    pos = logg_ring.head;
+    while(1) {
+	slot = &logg_ring.slots[pos & (LOGG_RING_SIZE - 1)];
+	dif = (long) (slot->seq - pos);
+	__sync_synchronize();
+	if(!dif) {
+	    if(__sync_bool_compare_and_swap(&logg_ring.head, pos, pos + 1))
+		break;
+	    pos = logg_ring.head;
+	} else if(dif < 0) {
+	    /* full */
+	    if(*buff == '*' || *buff == '$') {
+		__sync_fetch_and_add(&logg_ring.dropped, 1);
+		free(abuffer);
+		return 1;
+	    }
+	    if(++spins > 16)
+		usleep(1000);
+	    else
+		sched_yield();
+	    pos = logg_ring.head;
+	} else {
+	    pos = logg_ring.head;
+	}
+    }
+
+    time(&slot->time);
+    if(abuffer || strlen(buff) >= sizeof(slot->text)) {
+	if(!(slot->ext = abuffer ? abuffer : strdup(buff))) {
+	    /* truncated, but still a line */
+	    memcpy(slot->text, buff, sizeof(slot->text) - 2);
+	    slot->text[sizeof(slot->text) - 2] = '\n';
+	    slot->text[sizeof(slot->text) - 1] = 0;
+	}
+    } else {
+	slot->ext = NULL;
+	strcpy(slot->text, buff);
+    }
+    __sync_synchronize();
+    slot->seq = pos + 1;
+    __sync_synchronize();
+
+    if(logg_ring.idle) {
+	pthread_mutex_lock(&logg_ring.mutex);
+	pthread_cond_signal(&logg_ring.cond);
+	pthread_mutex_unlock(&logg_ring.mutex);
+    }
+    return 0;
+}
+
+/* writer only; returns the number of messages written */
+static unsigned int logg_drain(void)
+{
+	struct logg_slot *slot;
+	unsigned long dropped;
+	unsigned int n = 0;
+	char msg[64];
+
+    while(1) {
+	slot = &logg_ring.slots[logg_ring.tail & (LOGG_RING_SIZE - 1)];
+	if(slot->seq != logg_ring.tail + 1)
+	    break;
+	__sync_synchronize();
+	if(!n) {
+	    pthread_mutex_lock(&logg_mutex);
+	    logg_open();
+	}
+	logg_write(slot->ext ? slot->ext : slot->text, slot->time, 1);
+	free(slot->ext);
+	slot->ext = NULL;
+	__sync_synchronize();
+	slot->seq = logg_ring.tail + LOGG_RING_SIZE;
+	logg_ring.tail++;
+	if(++n == LOGG_RING_SIZE)
+	    break;
+    }
+    if((dropped = logg_ring.dropped)) {
+	__sync_fetch_and_sub(&logg_ring.dropped, dropped);
+	if(!n) {
+	    pthread_mutex_lock(&logg_mutex);
+	    logg_open();
+	}
+	snprintf(msg, sizeof(msg), "^%lu verbose log messages dropped\n", dropped);
+	logg_write(msg, time(NULL), 1);
+	n++;
+    }
+    if(n) {
+	if(logg_fp)
+	    fflush(logg_fp);
+	pthread_mutex_unlock(&logg_mutex);
+    }
+    return n;
+}
+
+static void *logg_writer(void *arg)
+{
+	struct timespec to;
+	struct timeval tv;
+
+    while(1) {
+	if(logg_drain())
+	    continue;
+	if(logg_ring.stop)
+	    break;
+	pthread_mutex_lock(&logg_ring.mutex);
+	logg_ring.idle = 1;
+	__sync_synchronize();
+	if(!logg_ring.stop && logg_ring.slots[logg_ring.tail & (LOGG_RING_SIZE - 1)].seq != logg_ring.tail + 1) {
+	    gettimeofday(&tv, NULL);
+	    to.tv_sec = tv.tv_sec;
+	    to.tv_nsec = tv.tv_usec * 1000 + LOGG_IDLE_WAIT * 1000000L;
+	    if(to.tv_nsec >= 1000000000L) {
+		to.tv_sec++;
+		to.tv_nsec -= 1000000000L;
+	    }
+	    pthread_cond_timedwait(&logg_ring.cond, &logg_ring.mutex, &to);
+	}
+	logg_ring.idle = 0;
+	pthread_mutex_unlock(&logg_ring.mutex);
+    }
+    return arg;
+}
+
+int logg_async_start(void)
+{
+	unsigned long i;
+
+    if(logg_ring.on)
+	return 0;
+    if(!(logg_ring.slots = calloc(LOGG_RING_SIZE, sizeof(*logg_ring.slots))))
+	return -1;
+    for(i = 0; i < LOGG_RING_SIZE; i++)
+	logg_ring.slots[i].seq = i;
+    logg_ring.head = logg_ring.tail = 0;
+    logg_ring.dropped = 0;
+    logg_ring.stop = 0;
+    if(pthread_create(&logg_ring.writer, NULL, logg_writer, NULL)) {
+	free(logg_ring.slots);
+	logg_ring.slots = NULL;
+	return -1;
+    }
+    __sync_synchronize();
+    logg_ring.on = 1;
+    return 0;
+}
+
+void logg_async_stop(void)
+{
+    if(!logg_ring.on)
+	return;
+    /* new messages go the synchronous way; wait for the ones already on
+     * their way in, the writer empties the ring */
+    logg_ring.on = 0;
+    __sync_synchronize();
+    while(logg_ring.users)
+	sched_yield();
+    pthread_mutex_lock(&logg_ring.mutex);
+    logg_ring.stop = 1;
+    pthread_cond_signal(&logg_ring.cond);
+    pthread_mutex_unlock(&logg_ring.mutex);
+    pthread_join(logg_ring.writer, NULL);
+    logg_drain();
+    free(logg_ring.slots);
+    logg_ring.slots = NULL;
+}
+#else
+int logg_async_start(void)
+{
+    return -1;
+}
+
+void logg_async_stop(void)
+{
+}
+#endif
+
+int logg(const char *str, ...)
+{
+	va_list args;
+	char buffer[1025], *abuffer = NULL, *buff;
+	size_t len;
+	int ret;
+
+    if ((*str == '$' && logg_verbose < 2) ||
+	(*str == '*' && !logg_verbose))
+	return 0;
+
+    ARGLEN(args, str, len);
+    if(len <= sizeof(buffer)) {
+	len = sizeof(buffer);
+	buff = buffer;
+    } else {
+	abuffer = malloc(len);
+	if(!abuffer) {
+	    len = sizeof(buffer);
+	    buff = buffer;
+	} else {
+	    buff = abuffer;
+	}
+    }
+    va_start(args, str);
+    vsnprintf(buff, len, str, args);
+    va_end(args);
+    buff[len - 1] = 0;
+
+#ifdef LOGG_ASYNC
+    if(logg_ring.on) {
+	__sync_fetch_and_add(&logg_ring.users, 1);
+	if(logg_ring.on) {
+	    logg_enqueue(buff, len > sizeof(buffer) ? abuffer : NULL);
+	    __sync_fetch_and_sub(&logg_ring.users, 1);
+	    return 0;
+	}
+	__sync_fetch_and_sub(&logg_ring.users, 1);
+    }
+#endif
 
+#ifdef CL_THREAD_SAFE
+    pthread_mutex_lock(&logg_mutex);
+#endif
+    ret = logg_write(buff, time(NULL), 0);
 #ifdef CL_THREAD_SAFE
     pthread_mutex_unlock(&logg_mutex);
 #endif
 
     if(len > sizeof(buffer))
 	free(abuffer);
-    return 0;
+    return ret;
 }
 
 void mprintf(const char *str, ...)
@@ -40,6 +40,11 @@ int logg(const char *str, ...);
 #endif
 
 void logg_close(void);
+
+/* move the writing of logg() messages to a thread of its own, returns -1 if
+ * that's not possible; logg_close() stops it after writing what's queued */
+int logg_async_start(void);
+void logg_async_stop(void);
 extern short int logg_verbose, logg_nowarn, logg_lock, logg_time, logg_noflush, logg_rotate;
 extern off_t logg_size;
 extern const char *logg_file;
@@ -0,0 +1,42 @@
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+/* Helpers shared by the bench_* programs, each of which is a single file:
+ * the corpus generator and the clock. Same seed, same corpus everywhere. */
+
+#include <stdlib.h>
+#include <sys/time.h>
+
+/* xorshift64*: tiny, fast and identical everywhere */
+static unsigned long long rnd_state;
+
+static inline unsigned long long rnd(void)
+{
+    rnd_state ^= rnd_state >> 12;
+    rnd_state ^= rnd_state << 25;
+    rnd_state ^= rnd_state >> 27;
+    return rnd_state * 2685821657736338717ULL;
+}
+
+static inline void rnd_seed(unsigned long long s)
+{
+    rnd_state = s ? s : 1;
+}
+
+static inline unsigned long long now_ns(void)
+{
+	struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000000ULL + tv.tv_usec * 1000ULL;
+}
+
+/* qsort() comparator for latency samples */
+static inline int cmp_ull(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *) a, y = *(const unsigned long long *) b;
+
+    return x < y ? -1 : (x > y);
+}
+
+#endif
@@ -0,0 +1,487 @@
+/*
+ *  Throughput benchmark for the JavaScript normalizer
+ *
+ *  Copyright (C) 2026 agent <agent@local>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+/*
+ * Runs the normalizer over deterministic minified and obfuscated scripts
+ * (and over any files given on the command line), fed in space-terminated
+ * chunks of up to 8 KB the way htmlnorm.c hands them over. Besides the
+ * throughput it prints a hash of the normalized output: two builds must
+ * agree on it for the same seed and sizes, or the normalizer changed its
+ * output.
+ * Before timing anything the check_jsnorm.c inputs (also the "references"
+ * corpus) and the scripts in unit_tests/input are normalized and compared
+ * with their reference outputs; it refuses to run if any of them differs.
+ *
+ * Run it with "make bench-jsnorm" in unit_tests; BENCH_FLAGS is passed on.
+ */
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "../libclamav/clamav.h"
+#include "../libclamav/others.h"
+#include "../libclamav/dconf.h"
+#include "../libclamav/fmap.h"
+#include "../libclamav/htmlnorm.h"
+#include "../libclamav/jsparse/js-norm.h"
+#include "jsnorm_tests.h"
+#include "bench_common.h"
+
+#define CHUNK 8192
+
+static unsigned int rounds = 5;
+static unsigned long corpus_size = 4 * 1024 * 1024;
+static unsigned long long seed = 0x636c616d6176ULL;
+
+/* corpora */
+
+struct corpus {
+    char *buf;
+    unsigned long len, size;
+};
+
+static void put(struct corpus *c, const char *s)
+{
+	size_t l = strlen(s);
+
+    if(c->len + l < c->size) {
+	memcpy(c->buf + c->len, s, l);
+	c->len += l;
+    }
+}
+
+static void putf(struct corpus *c, const char *fmt, unsigned long a, unsigned long b)
+{
+	char tmp[64];
+
+    snprintf(tmp, sizeof(tmp), fmt, a, b);
+    put(c, tmp);
+}
+
+static const char *members[] = {
+    "length", "push", "charAt", "substr", "indexOf", "createElement",
+    "appendChild", "style", "width", "getElementById", "prototype", "call"
+};
+
+/* short names, dense punctuation, the odd space: what minifiers emit */
+static void gen_minified(struct corpus *c)
+{
+	unsigned long depth = 0, v;
+
+    while(c->len + 128 < c->size) {
+	v = rnd() % 12;
+	switch(v) {
+	    case 0:
+		putf(c, "function f%lu(a,b%lu){", rnd() % 100, rnd() % 10);
+		depth++;
+		break;
+	    case 1:
+		if(depth) {
+		    put(c, "return a}");
+		    depth--;
+		    break;
+		}
+		/* fall through */
+	    case 2:
+		putf(c, "var v%lu=%lu+b.", rnd() % 100, rnd() % 100000);
+		put(c, members[rnd() % (sizeof(members) / sizeof(members[0]))]);
+		put(c, ";");
+		break;
+	    case 3:
+		putf(c, "if(a%lu>%lu){b++}else{b--}", rnd() % 10, rnd() % 1000);
+		break;
+	    case 4:
+		putf(c, "for(var i=0;i<%lu;i++)a[i]=%lu.5;", rnd() % 64, rnd() % 1000);
+		break;
+	    case 5:
+		put(c, "x.");
+		put(c, members[rnd() % (sizeof(members) / sizeof(members[0]))]);
+		putf(c, "(\"s%lu\",%lu);", rnd() % 1000, rnd() % 10);
+		break;
+	    default:
+		putf(c, "t%lu=t%lu*2;", rnd() % 50, rnd() % 50);
+		break;
+	}
+	if(!(rnd() % 8))
+	    put(c, " ");
+    }
+    while(depth--)
+	put(c, "}");
+    put(c, " ");
+}
+
+/* long hex names, string concatenation, escaped payloads, eval */
+static void gen_obfuscated(struct corpus *c)
+{
+	unsigned long i, n;
+
+    while(c->len + 512 < c->size) {
+	switch(rnd() % 5) {
+	    case 0:
+		putf(c, "var _0x%lx%lx=[", rnd() & 0xffff, rnd() & 0xff);
+		n = 4 + rnd() % 8;
+		for(i = 0; i < n; i++)
+		    putf(c, i ? ",\"\\x%02lx\\x%02lx\"" : "\"\\x%02lx\\x%02lx\"", 0x41 + rnd() % 26, 0x61 + rnd() % 26);
+		put(c, "];");
+		break;
+	    case 1:
+		putf(c, "_0x%lx+=\"%lx\"", rnd() & 0xffff, rnd());
+		n = 2 + rnd() % 6;
+		for(i = 0; i < n; i++)
+		    putf(c, "+\"%lx%lx\"", rnd(), rnd() & 0xffff);
+		put(c, "; ");
+		break;
+	    case 2:
+		put(c, "document.write(unescape(\"");
+		n = 8 + rnd() % 24;
+		for(i = 0; i < n; i++)
+		    putf(c, "%%%02lx%%%02lx", 0x61 + rnd() % 26, 0x30 + rnd() % 10);
+		put(c, "\")); ");
+		break;
+	    case 3:
+		putf(c, "eval(\"var q%lu=%lu;\"); ", rnd() % 100, rnd() % 100);
+		break;
+	    default:
+		putf(c, "function _0x%lx(_0x%lx){return _0x1[", rnd() & 0xffffff, rnd() & 0xffff);
+		putf(c, "_0x%lx-%lu]} ", rnd() & 0xffff, rnd() % 100);
+		break;
+	}
+    }
+}
+
+/* the check_jsnorm.c inputs, over and over; only the complete statements,
+ * an unterminated string would swallow everything after it */
+static void gen_references(struct corpus *c)
+{
+	unsigned int i, added;
+
+    do {
+	added = 0;
+	for(i = 0; i < sizeof(js_tests) / sizeof(js_tests[0]); i++) {
+	    const char *in = js_tests[i].in;
+	    size_t l = strlen(in);
+
+	    if(!l || (in[l - 1] != ';' && in[l - 1] != '}') || c->len + l + 1 >= c->size)
+		continue;
+	    put(c, in);
+	    put(c, " ");
+	    added++;
+	}
+    } while(added);
+}
+
+static int load_file(struct corpus *c, const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	ssize_t n;
+
+    if(fd < 0)
+	return -1;
+    c->len = 0;
+    while(c->len < c->size && (n = read(fd, c->buf + c->len, c->size - c->len)) > 0)
+	c->len += n;
+    close(fd);
+    return 0;
+}
+
+/* one full run, returns the hash of the normalized output or 0 on error */
+static unsigned long long run(const struct corpus *c, const char *dir)
+{
+	struct parser_state *state;
+	unsigned long off = 0, n;
+	unsigned long long h = 0xcbf29ce484222325ULL;
+	char path[1024], buf[CHUNK];
+	ssize_t r, i;
+	int fd;
+
+    if(!(state = cli_js_init()))
+	return 0;
+    while(off < c->len) {
+	n = c->len - off;
+	if(n > CHUNK) {
+	    /* rewind to a space like cli_readchunk() does */
+	    n = CHUNK;
+	    while(n > 1 && c->buf[off + n - 1] != ' ')
+		n--;
+	    if(n == 1)
+		n = CHUNK;
+	}
+	cli_js_process_buffer(state, c->buf + off, n);
+	off += n;
+    }
+    cli_js_parse_done(state);
+    cli_js_output(state, dir);
+    cli_js_destroy(state);
+
+    snprintf(path, sizeof(path), "%s"PATHSEP"javascript", dir);
+    if((fd = open(path, O_RDONLY)) < 0)
+	return 0;
+    while((r = read(fd, buf, sizeof(buf))) > 0)
+	for(i = 0; i < r; i++)
+	    h = (h ^ (unsigned char)buf[i]) * 0x100000001b3ULL;
+    close(fd);
+    unlink(path);
+    return h;
+}
+
+/* reference checks */
+
+static const char *srcdir(void)
+{
+	const char *dir = getenv("srcdir");
+
+    return dir ? dir : SRCDIR;
+}
+
+/* compares dir/javascript with len bytes at ref */
+static int same_output(const char *dir, const char *ref, size_t len)
+{
+	char path[1024], buf[CHUNK];
+	size_t off = 0;
+	ssize_t r;
+	int fd, same = 1;
+
+    snprintf(path, sizeof(path), "%s"PATHSEP"javascript", dir);
+    if((fd = open(path, O_RDONLY)) < 0)
+	return 0;
+    while(same && (r = read(fd, buf, sizeof(buf))) > 0) {
+	if(off + r > len || memcmp(buf, ref + off, r))
+	    same = 0;
+	off += r;
+    }
+    close(fd);
+    unlink(path);
+    return same && off == len;
+}
+
+/* normalizes in like tokenizer_test() in check_jsnorm.c: all at once, or
+ * split in two halves */
+static int check_js(const char *in, const char *expected, int split, const char *dir)
+{
+	struct parser_state *state;
+	size_t len = strlen(in);
+
+    if(!(state = cli_js_init()))
+	return 0;
+    if(split) {
+	cli_js_process_buffer(state, in, len / 2);
+	cli_js_process_buffer(state, in + len / 2, len - len / 2);
+    } else {
+	cli_js_process_buffer(state, in, len);
+    }
+    cli_js_parse_done(state);
+    cli_js_output(state, dir);
+    cli_js_destroy(state);
+    return same_output(dir, expected, strlen(expected));
+}
+
+/* the scripts of an unit_tests/input page against the check_htmlnorm.c
+ * reference */
+static int check_html(const char *input, const char *jsref, const struct cli_dconf *dconf, const char *dir)
+{
+	char path[1024];
+	struct corpus ref;
+	fmap_t *map;
+	int fd, ok = 0;
+
+    ref.size = 1024 * 1024;
+    if(!(ref.buf = malloc(ref.size)))
+	return 0;
+    snprintf(path, sizeof(path), "%s"PATHSEP"%s", srcdir(), jsref);
+    if(load_file(&ref, path)) {
+	fprintf(stderr, "Can't read %s\n", path);
+	free(ref.buf);
+	return 0;
+    }
+    snprintf(path, sizeof(path), "%s"PATHSEP"%s", srcdir(), input);
+    if((fd = open(path, O_RDONLY)) < 0) {
+	fprintf(stderr, "Can't open %s\n", path);
+	free(ref.buf);
+	return 0;
+    }
+    if((map = fmap(fd, 0, 0))) {
+	if(html_normalise_map(map, dir, NULL, dconf) == 1)
+	    ok = same_output(dir, ref.buf, ref.len);
+	funmap(map);
+    }
+    close(fd);
+    free(ref.buf);
+    return ok;
+}
+
+/* returns the number of outputs that differ from their reference */
+static unsigned int check_references(const char *dir)
+{
+	static const struct {
+	    const char *input;
+	    const char *jsref;
+	} html[] = {
+	    { "input/htmlnorm_encode.html", "encode.js.ref" },
+	    { "input/htmlnorm_js_test.html", "js.js.ref" }
+	};
+	struct cli_dconf *dconf;
+	unsigned int i, split, n = 0, bad = 0;
+#ifdef USE_MPOOL
+	mpool_t *pool = mpool_create();
+#else
+	void *pool = NULL;
+#endif
+
+    prepare();
+    for(i = 0; i < sizeof(js_tests) / sizeof(js_tests[0]); i++) {
+	for(split = 0; split < 2; split++, n++) {
+	    if(!check_js(js_tests[i].in, js_tests[i].expected, split, dir)) {
+		printf("check_jsnorm.c test %u (%s) differs from its reference\n", i, split ? "split" : "whole");
+		bad++;
+	    }
+	}
+    }
+
+    if(!(dconf = cli_mpool_dconf_init(pool))) {
+	fprintf(stderr, "Can't initialize dconf\n");
+	return bad + 1;
+    }
+    for(i = 0; i < sizeof(html) / sizeof(html[0]); i++, n++) {
+	if(!check_html(html[i].input, html[i].jsref, dconf, dir)) {
+	    printf("%s differs from %s\n", html[i].input, html[i].jsref);
+	    bad++;
+	}
+    }
+    mpool_free(pool, dconf);
+#ifdef USE_MPOOL
+    mpool_destroy(pool);
+#endif
+
+    printf("Reference outputs: %u of %u match\n\n", n - bad, n);
+    return bad;
+}
+
+static void bench(const char *name, const struct corpus *c, const char *dir)
+{
+	unsigned long long *lat, t, hash = 0, h;
+	unsigned int i, stable = 1;
+
+    if(!(lat = malloc(rounds * sizeof(*lat))))
+	return;
+    for(i = 0; i < rounds; i++) {
+	t = now_ns();
+	h = run(c, dir);
+	lat[i] = now_ns() - t;
+	if(i && h != hash)
+	    stable = 0;
+	hash = h;
+    }
+    if(!stable)
+	hash = 0; /* shows up as a mismatch against any other build */
+    qsort(lat, rounds, sizeof(*lat), cmp_ull);
+    printf("%-24s %10lu %10.1f %10.3f %10.3f  %016llx\n", name, c->len,
+	   c->len / 1048576.0 / (lat[rounds / 2] / 1e9), lat[0] / 1e6, lat[rounds / 2] / 1e6, hash);
+    free(lat);
+}
+
+static void help(void)
+{
+    printf("Usage: bench_jsnorm [options] [FILE...]\n\n");
+    printf("    -s KB          size of each generated corpus (%lu)\n", corpus_size / 1024);
+    printf("    -r NUM         rounds (%u)\n", rounds);
+    printf("    -S NUM         random seed (%llu)\n", seed);
+    printf("\nFILEs are normalized as they are, in addition to the generated scripts\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct corpus c;
+	char *dir;
+	int opt, ret = 1;
+
+    while((opt = getopt(argc, argv, "s:r:S:h")) != -1) {
+	switch(opt) {
+	    case 's': corpus_size = strtoul(optarg, NULL, 10) * 1024; break;
+	    case 'r': rounds = atoi(optarg); break;
+	    case 'S': seed = strtoull(optarg, NULL, 10); break;
+	    default: help(); return opt != 'h';
+	}
+    }
+    if(!corpus_size || !rounds) {
+	help();
+	return 1;
+    }
+
+    if(cl_init(CL_INIT_DEFAULT) != CL_SUCCESS) {
+	fprintf(stderr, "Can't initialize libclamav\n");
+	return 1;
+    }
+    if(!(dir = cli_gentemp(NULL)) || mkdir(dir, 0700)) {
+	fprintf(stderr, "Can't create the temporary directory\n");
+	free(dir);
+	return 1;
+    }
+    if(check_references(dir)) {
+	fprintf(stderr, "The normalizer output changed, not benchmarking it\n");
+	goto done;
+    }
+
+    c.size = corpus_size;
+    if(!(c.buf = malloc(c.size))) {
+	fprintf(stderr, "Can't allocate %lu bytes\n", c.size);
+	goto done;
+    }
+
+    printf("Corpora: %lu KB, seed %llu, %u rounds\n\n", corpus_size / 1024, seed, rounds);
+    printf("%-24s %10s %10s %10s %10s  %-16s\n", "corpus", "bytes", "MB/s", "best ms", "p50 ms", "output hash");
+
+    rnd_seed(seed);
+    c.len = 0;
+    gen_minified(&c);
+    bench("minified", &c, dir);
+
+    rnd_seed(seed + 1);
+    c.len = 0;
+    gen_obfuscated(&c);
+    bench("obfuscated", &c, dir);
+
+    c.len = 0;
+    gen_references(&c);
+    bench("references", &c, dir);
+
+    for(; optind < argc; optind++) {
+	if(load_file(&c, argv[optind])) {
+	    fprintf(stderr, "Can't read %s\n", argv[optind]);
+	    continue;
+	}
+	bench(argv[optind], &c, dir);
+    }
+    ret = 0;
+    free(c.buf);
+
+done:
+    cli_rmdirs(dir);
+    free(dir);
+    return ret;
+}
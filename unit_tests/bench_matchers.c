@@ -0,0 +1,603 @@
+/*
+ *  Throughput benchmark for the matcher engines
+ *
+ *  Copyright (C) 2026 agent <agent@local>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+/*
+ * Loads a signature set through cl_load() (a real database or a synthetic
+ * one generated from a seed), builds deterministic input corpora and times
+ * the prefilter, the AC and BM matchers, the hash lookups and full scans on
+ * them, along with every cli_memstr() implementation the CPU has.
+ * Same seed and sizes give the same databases and corpora, so numbers
+ * from two builds can be compared directly.
+ *
+ * Run it with "make bench" in unit_tests; BENCH_FLAGS is passed on.
+ */
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "../libclamav/clamav.h"
+#include "../libclamav/others.h"
+#include "../libclamav/matcher.h"
+#include "../libclamav/matcher-ac.h"
+#include "../libclamav/matcher-bm.h"
+#include "../libclamav/matcher-hash.h"
+#include "../libclamav/filtering.h"
+#include "../libclamav/str.h"
+#include "../libclamav/default.h"
+#include "bench_common.h"
+
+#ifndef MIN
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+
+/* hash lookups are too fast to time one by one */
+#define HM_BATCH 256
+
+static unsigned int rounds = 5;
+static unsigned long corpus_size = 4 * 1024 * 1024;
+static unsigned long file_size = 64 * 1024;
+static unsigned int nsigs = 2000, nhashes = 10000;
+static unsigned long long seed = 0x636c616d6176ULL;
+
+/* latency samples of one engine on one corpus */
+struct bench_res {
+    unsigned long long *lat;
+    unsigned int cnt, max;
+    unsigned long long bytes;
+    unsigned long long total;
+};
+
+static int res_add(struct bench_res *r, unsigned long long ns, unsigned long long bytes)
+{
+    if(r->cnt == r->max) {
+	unsigned long long *lat = realloc(r->lat, (r->max * 2 + 64) * sizeof(*lat));
+	if(!lat)
+	    return -1;
+	r->lat = lat;
+	r->max = r->max * 2 + 64;
+    }
+    r->lat[r->cnt++] = ns;
+    r->bytes += bytes;
+    r->total += ns;
+    return 0;
+}
+
+static void res_print(const char *corpus, const char *engine, struct bench_res *r, unsigned int div)
+{
+	double secs;
+
+    if(!r->cnt) {
+	printf("%-10s %-8s %10s\n", corpus, engine, "n/a");
+	return;
+    }
+    qsort(r->lat, r->cnt, sizeof(*r->lat), cmp_ull);
+    secs = r->total / 1e9;
+    /* div turns batch samples into per call latencies */
+    printf("%-10s %-8s %10u %10.1f %10.3f %10.3f %10.3f %10.3f\n", corpus, engine,
+	   r->cnt * div, r->bytes ? r->bytes / 1048576.0 / secs : (r->cnt * div) / secs / 1e6,
+	   r->lat[r->cnt / 2] / 1e3 / div, r->lat[r->cnt * 9 / 10] / 1e3 / div,
+	   r->lat[r->cnt * 99 / 100] / 1e3 / div, r->lat[r->cnt - 1] / 1e3 / div);
+    free(r->lat);
+    memset(r, 0, sizeof(*r));
+}
+
+/* corpora */
+
+static const char *words[] = {
+    "the", "of", "and", "to", "in", "is", "that", "for", "it", "with", "as",
+    "was", "on", "be", "by", "this", "are", "from", "or", "have", "an",
+    "which", "file", "system", "program", "windows", "document", "http",
+    "www", "script", "function", "return", "var", "if", "else", "data"
+};
+
+static const char *pe_strings[] = {
+    "kernel32.dll", "user32.dll", "GetProcAddress", "LoadLibraryA",
+    "VirtualAlloc", "CreateFileA", "WriteFile", "ExitProcess", ".text",
+    ".rdata", ".data", ".rsrc", "MessageBoxA", "RegOpenKeyExA"
+};
+
+static void gen_random(unsigned char *buf, unsigned long len)
+{
+	unsigned long i;
+
+    for(i = 0; i < len; i++)
+	buf[i] = rnd() >> 56;
+}
+
+static void gen_text(unsigned char *buf, unsigned long len)
+{
+	unsigned long i = 0;
+	size_t wl;
+	const char *w;
+
+    while(i < len) {
+	w = words[rnd() % (sizeof(words) / sizeof(words[0]))];
+	wl = strlen(w);
+	if(wl > len - i)
+	    wl = len - i;
+	memcpy(buf + i, w, wl);
+	i += wl;
+	if(i < len)
+	    buf[i++] = (rnd() % 12) ? ' ' : ((rnd() % 3) ? '.' : '\n');
+    }
+}
+
+/* an MZ/PE header followed by function-like code, import names and
+ * padding, repeated every 64KB or so */
+static void gen_pe(unsigned char *buf, unsigned long len)
+{
+	static const unsigned char prologue[] = { 0x55, 0x8b, 0xec, 0x83, 0xec };
+	static const char stub[] = "This program cannot be run in DOS mode.\r\r\n$";
+	unsigned long i = 0, blk;
+	size_t l;
+	const char *s;
+
+    while(i < len) {
+	blk = i + 65536;
+	if(blk > len)
+	    blk = len;
+	if(blk - i > 512) {
+	    memset(buf + i, 0, 512);
+	    memcpy(buf + i, "MZ\x90", 3);
+	    memcpy(buf + i + 0x40, stub, sizeof(stub) - 1);
+	    memcpy(buf + i + 0x80, "PE\0\0\x4c\x01", 6);
+	    i += 512;
+	}
+	while(i < blk) {
+	    switch(rnd() % 8) {
+		case 0:
+		    l = MIN(sizeof(prologue), blk - i);
+		    memcpy(buf + i, prologue, l);
+		    i += l;
+		    break;
+		case 1:
+		    /* call rel32 */
+		    buf[i++] = 0xe8;
+		    for(l = 0; l < 4 && i < blk; l++)
+			buf[i++] = (l < 2) ? rnd() >> 56 : 0;
+		    break;
+		case 2:
+		    s = pe_strings[rnd() % (sizeof(pe_strings) / sizeof(pe_strings[0]))];
+		    l = MIN(strlen(s) + 1, blk - i);
+		    memcpy(buf + i, s, l);
+		    i += l;
+		    break;
+		case 3:
+		    l = MIN(rnd() % 64, blk - i);
+		    memset(buf + i, (rnd() & 1) ? 0 : 0x90, l);
+		    i += l;
+		    break;
+		default:
+		    l = MIN(rnd() % 16 + 1, blk - i);
+		    gen_random(buf + i, l);
+		    i += l;
+	    }
+	}
+    }
+}
+
+/* deflated text, stream after stream */
+static int gen_compressed(unsigned char *buf, unsigned long len)
+{
+	unsigned char *text;
+	unsigned long i = 0;
+	uLongf dlen;
+	unsigned char *tmp;
+
+    if(!(text = malloc(SCANBUFF)) || !(tmp = malloc(compressBound(SCANBUFF)))) {
+	free(text);
+	return -1;
+    }
+    while(i < len) {
+	gen_text(text, SCANBUFF);
+	dlen = compressBound(SCANBUFF);
+	if(compress2(tmp, &dlen, text, SCANBUFF, Z_DEFAULT_COMPRESSION) != Z_OK) {
+	    free(text);
+	    free(tmp);
+	    return -1;
+	}
+	if(dlen > len - i)
+	    dlen = len - i;
+	memcpy(buf + i, tmp, dlen);
+	i += dlen;
+    }
+    free(text);
+    free(tmp);
+    return 0;
+}
+
+/* synthetic database */
+
+static void hexput(FILE *f, const unsigned char *p, size_t len)
+{
+	size_t i;
+
+    for(i = 0; i < len; i++)
+	fprintf(f, "%02x", p[i]);
+}
+
+static void sig_bytes(unsigned char *p, size_t len)
+{
+	const char *s;
+	size_t l;
+
+    /* half the signatures start with something common in the corpora so
+     * the prefilter lets them through and the tries have work to do; the
+     * random tail keeps them from matching */
+    if(rnd() & 1) {
+	if(rnd() & 1)
+	    s = words[rnd() % (sizeof(words) / sizeof(words[0]))];
+	else
+	    s = pe_strings[rnd() % (sizeof(pe_strings) / sizeof(pe_strings[0]))];
+	l = MIN(strlen(s), len - 4);
+	memcpy(p, s, l);
+	gen_random(p + l, len - l);
+    } else {
+	gen_random(p, len);
+    }
+}
+
+static unsigned char *hm_digests;
+static unsigned int *hm_sizes;
+
+static int gen_db(const char *dir)
+{
+	char path[512];
+	unsigned char pat[64];
+	unsigned int i, len;
+	FILE *f;
+
+    snprintf(path, sizeof(path), "%s/bench.ndb", dir);
+    if(!(f = fopen(path, "w")))
+	return -1;
+    for(i = 0; i < nsigs; i++) {
+	len = 12 + rnd() % 20;
+	sig_bytes(pat, len);
+	fprintf(f, "Bench.Sig-%u:%u:*:", i, (i % 4 == 3) ? 1 : 0);
+	switch(i % 3) {
+	    case 0: /* static, BM */
+		hexput(f, pat, len);
+		break;
+	    case 1: /* wildcards, AC */
+		hexput(f, pat, len / 2);
+		fputs("??", f);
+		hexput(f, pat + len / 2 + 1, len - len / 2 - 1);
+		break;
+	    default: /* alternatives and ranges, AC */
+		hexput(f, pat, 4);
+		fprintf(f, "{%u-%u}", 1 + (unsigned int)(rnd() % 4), 6 + (unsigned int)(rnd() % 8));
+		hexput(f, pat + 4, 4);
+		fprintf(f, "(%02x|%02x)", pat[8], pat[9]);
+		hexput(f, pat + 10, len - 10);
+	}
+	fputc('\n', f);
+    }
+    fclose(f);
+
+    snprintf(path, sizeof(path), "%s/bench.hdb", dir);
+    if(!(f = fopen(path, "w")))
+	return -1;
+    if(!(hm_digests = malloc(nhashes * 16)) || !(hm_sizes = malloc(nhashes * sizeof(*hm_sizes))))
+	return -1;
+    for(i = 0; i < nhashes; i++) {
+	gen_random(hm_digests + i * 16, 16);
+	hm_sizes[i] = 1024 + rnd() % 65536;
+	hexput(f, hm_digests + i * 16, 16);
+	fprintf(f, ":%u:Bench.Hash-%u\n", hm_sizes[i], i);
+    }
+    fclose(f);
+    return 0;
+}
+
+/* runs */
+
+static void bench_filter(const struct cli_matcher *root, const unsigned char *buf, unsigned long len, struct bench_res *r)
+{
+	unsigned long off, n;
+	unsigned long long t;
+	volatile long ret;
+
+    for(off = 0; off < len; off += n) {
+	n = MIN(SCANBUFF, len - off);
+	t = now_ns();
+	ret = filter_search(root->filter, buf + off, n);
+	res_add(r, now_ns() - t, n);
+    }
+    (void) ret;
+}
+
+static int bench_ac(const struct cli_matcher *root, const unsigned char *buf, unsigned long len, struct bench_res *r)
+{
+	struct cli_ac_data mdata;
+	const char *virname;
+	unsigned long off, n;
+	unsigned long long t;
+
+    if(cli_ac_initdata(&mdata, root->ac_partsigs, root->ac_lsigs, root->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN))
+	return -1;
+    cli_ac_caloff(root, &mdata, NULL);
+    for(off = 0; off < len; off += n) {
+	n = MIN(SCANBUFF, len - off);
+	t = now_ns();
+	cli_ac_scanbuff(buf + off, n, &virname, NULL, NULL, root, &mdata, off, 0, NULL, AC_SCAN_VIR, NULL);
+	res_add(r, now_ns() - t, n);
+    }
+    cli_ac_freedata(&mdata);
+    return 0;
+}
+
+static void bench_bm(const struct cli_matcher *root, const unsigned char *buf, unsigned long len, struct bench_res *r)
+{
+	const char *virname;
+	unsigned long off, n;
+	unsigned long long t;
+
+    for(off = 0; off < len; off += n) {
+	n = MIN(SCANBUFF, len - off);
+	t = now_ns();
+	cli_bm_scanbuff(buf + off, n, &virname, NULL, root, off, NULL, NULL, NULL);
+	res_add(r, now_ns() - t, n);
+    }
+}
+
+/* half of the lookups hit when the database is synthetic */
+static void bench_hm(const struct cli_matcher *hm, struct bench_res *r)
+{
+	unsigned char digest[16];
+	unsigned int i, j, size;
+	unsigned long long t, sum;
+	const char *virname;
+
+    for(i = 0; i < nhashes; i += HM_BATCH) {
+	sum = 0;
+	for(j = 0; j < HM_BATCH; j++) {
+	    if(hm_digests && (rnd() & 1)) {
+		unsigned int k = rnd() % nhashes;
+		memcpy(digest, hm_digests + k * 16, 16);
+		size = hm_sizes[k];
+	    } else {
+		gen_random(digest, 16);
+		size = 1024 + rnd() % 65536;
+	    }
+	    t = now_ns();
+	    cli_hm_scan(digest, size, &virname, hm, CLI_HASH_MD5);
+	    sum += now_ns() - t;
+	}
+	res_add(r, sum, 0);
+    }
+}
+
+/* the keywords pdf_findobj() and friends look for; every match is
+ * skipped over so each call covers the whole buffer */
+static const char * const memstr_needles[] = { "endobj", "stream", "/JavaScript" };
+static const unsigned int memstr_needles_len[] = { 6, 6, 11 };
+
+static const char *memstr_names[][2] = {
+    { NULL, NULL },
+    { "str-sc", "any-sc" },
+    { "str-sse2", "any-sse2" },
+    { "str-avx2", "any-avx2" }
+};
+
+static void bench_memstr(const unsigned char *buf, unsigned long len, int any, struct bench_res *r)
+{
+	unsigned long off, n;
+	unsigned long long t;
+	const char *p, *end;
+
+    for(off = 0; off < len; off += n) {
+	n = MIN(SCANBUFF, len - off);
+	p = (const char *) buf + off;
+	end = p + n;
+	t = now_ns();
+	if(any) {
+	    while((p = cli_memstr_any(p, end - p, memstr_needles, memstr_needles_len, 3, NULL)))
+		p++;
+	} else {
+	    while((p = cli_memstr(p, end - p, memstr_needles[0], memstr_needles_len[0])))
+		p++;
+	}
+	res_add(r, now_ns() - t, n);
+    }
+}
+
+static void bench_scan(const struct cl_engine *engine, unsigned char *buf, unsigned long len, unsigned int round, struct bench_res *r)
+{
+	unsigned long off, n;
+	unsigned long long t;
+	unsigned long scanned;
+	const char *virname;
+	cl_fmap_t *map;
+
+    for(off = 0; off < len; off += n) {
+	n = MIN(file_size, len - off);
+	/* a different file each round, or we'd only time the cache */
+	memcpy(buf + off + n - sizeof(round), &round, MIN(sizeof(round), n));
+	if(!(map = cl_fmap_open_memory(buf + off, n)))
+	    continue;
+	scanned = 0;
+	t = now_ns();
+	cl_scanmap_callback(map, &virname, &scanned, engine, CL_SCAN_STDOPT, NULL);
+	res_add(r, now_ns() - t, n);
+	cl_fmap_close(map);
+    }
+}
+
+static void help(void)
+{
+    printf("Usage: bench_matchers [options]\n\n");
+    printf("    -d FILE/DIR    load this database instead of a synthetic one\n");
+    printf("    -n NUM         number of synthetic body signatures (%u)\n", nsigs);
+    printf("    -H NUM         number of synthetic hash signatures (%u)\n", nhashes);
+    printf("    -s KB          size of each corpus (%lu)\n", corpus_size / 1024);
+    printf("    -f KB          file size for full scans (%lu)\n", file_size / 1024);
+    printf("    -r NUM         rounds (%u)\n", rounds);
+    printf("    -S NUM         random seed (%llu)\n", seed);
+    printf("    -L             also time the multi-literal engine (bm-lit)\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *dbpath = NULL;
+	char *tmpdir = NULL;
+	struct cl_engine *engine;
+	struct cli_matcher *root;
+	unsigned int sigs = 0, c, i;
+	unsigned char *buf;
+	struct bench_res res_filter, res_ac, res_bm, res_bmlit, res_hm, res_scan, res_memstr[CLI_MEMSTR_AVX2 + 1][2];
+	struct cli_bm_lit *lit;
+	unsigned long long t;
+	int opt, ret = 1, impl, any, literal = 0;
+	static const char *corpora[] = { "random", "text", "pe", "compressed" };
+
+    while((opt = getopt(argc, argv, "d:n:H:s:f:r:S:Lh")) != -1) {
+	switch(opt) {
+	    case 'd': dbpath = optarg; break;
+	    case 'n': nsigs = atoi(optarg); break;
+	    case 'H': nhashes = atoi(optarg); break;
+	    case 's': corpus_size = strtoul(optarg, NULL, 10) * 1024; break;
+	    case 'f': file_size = strtoul(optarg, NULL, 10) * 1024; break;
+	    case 'r': rounds = atoi(optarg); break;
+	    case 'S': seed = strtoull(optarg, NULL, 10); break;
+	    case 'L': literal = 1; break;
+	    default: help(); return opt != 'h';
+	}
+    }
+    if(!corpus_size || !file_size || !rounds) {
+	help();
+	return 1;
+    }
+
+    if(cl_init(CL_INIT_DEFAULT) != CL_SUCCESS || !(engine = cl_engine_new())) {
+	fprintf(stderr, "Can't initialize libclamav\n");
+	return 1;
+    }
+
+    if(literal)
+	cl_engine_set_num(engine, CL_ENGINE_BM_LITERAL, 1);
+    rnd_seed(seed);
+    if(!dbpath) {
+	if(!(tmpdir = cli_gentemp(NULL)) || mkdir(tmpdir, 0700) || gen_db(tmpdir)) {
+	    fprintf(stderr, "Can't generate the synthetic database\n");
+	    goto done;
+	}
+	dbpath = tmpdir;
+    }
+    t = now_ns();
+    if(cl_load(dbpath, engine, &sigs, CL_DB_STDOPT) != CL_SUCCESS || cl_engine_compile(engine) != CL_SUCCESS) {
+	fprintf(stderr, "Can't load %s\n", dbpath);
+	goto done;
+    }
+    printf("Loaded %u signatures from %s in %.3f s\n", sigs, tmpdir ? "synthetic database" : dbpath, (now_ns() - t) / 1e9);
+    printf("Corpora: %lu KB each, seed %llu, %u rounds\n\n", corpus_size / 1024, seed, rounds);
+    printf("%-10s %-8s %10s %10s %10s %10s %10s %10s\n", "corpus", "engine", "calls", "MB/s", "p50 us", "p90 us", "p99 us", "max us");
+
+    if(!(buf = malloc(corpus_size))) {
+	fprintf(stderr, "Can't allocate %lu bytes\n", corpus_size);
+	goto done;
+    }
+    root = engine->root[0];
+    memset(&res_filter, 0, sizeof(res_filter));
+    memset(&res_ac, 0, sizeof(res_ac));
+    memset(&res_bm, 0, sizeof(res_bm));
+    memset(&res_bmlit, 0, sizeof(res_bmlit));
+    memset(&res_hm, 0, sizeof(res_hm));
+    memset(&res_scan, 0, sizeof(res_scan));
+    memset(res_memstr, 0, sizeof(res_memstr));
+    for(c = 0; c < sizeof(corpora) / sizeof(corpora[0]); c++) {
+	rnd_seed(seed + c + 1);
+	switch(c) {
+	    case 0: gen_random(buf, corpus_size); break;
+	    case 1: gen_text(buf, corpus_size); break;
+	    case 2: gen_pe(buf, corpus_size); break;
+	    default:
+		if(gen_compressed(buf, corpus_size)) {
+		    fprintf(stderr, "Can't generate the compressed corpus\n");
+		    free(buf);
+		    goto done;
+		}
+	}
+	for(i = 0; i < rounds; i++) {
+	    if(root && root->filter)
+		bench_filter(root, buf, corpus_size, &res_filter);
+	    if(root && root->ac_root && bench_ac(root, buf, corpus_size, &res_ac)) {
+		fprintf(stderr, "Can't initialize AC data\n");
+		free(buf);
+		goto done;
+	    }
+	    if(root && root->bm_shift) {
+		/* "bm" is always the classic scanner */
+		lit = root->bm_lit;
+		root->bm_lit = NULL;
+		bench_bm(root, buf, corpus_size, &res_bm);
+		root->bm_lit = lit;
+		if(lit)
+		    bench_bm(root, buf, corpus_size, &res_bmlit);
+	    }
+	    bench_scan(engine, buf, corpus_size, i, &res_scan);
+	    for(impl = CLI_MEMSTR_SCALAR; impl <= CLI_MEMSTR_AVX2; impl++) {
+		if(cli_memstr_select(impl))
+		    continue;
+		for(any = 0; any < 2; any++)
+		    bench_memstr(buf, corpus_size, any, &res_memstr[impl][any]);
+	    }
+	    cli_memstr_select(CLI_MEMSTR_AUTO);
+	}
+	res_print(corpora[c], "filter", &res_filter, 1);
+	res_print(corpora[c], "ac", &res_ac, 1);
+	res_print(corpora[c], "bm", &res_bm, 1);
+	if(literal)
+	    res_print(corpora[c], "bm-lit", &res_bmlit, 1);
+	res_print(corpora[c], "scan", &res_scan, 1);
+	for(impl = CLI_MEMSTR_SCALAR; impl <= CLI_MEMSTR_AVX2; impl++)
+	    for(any = 0; any < 2; any++)
+		if(res_memstr[impl][any].cnt)
+		    res_print(corpora[c], memstr_names[impl][any], &res_memstr[impl][any], 1);
+    }
+    /* the input doesn't matter for hash lookups */
+    if(engine->hm_hdb) {
+	rnd_seed(seed);
+	for(i = 0; i < rounds; i++)
+	    bench_hm(engine->hm_hdb, &res_hm);
+	printf("\n%-10s %-8s %10s %10s %10s %10s %10s %10s\n", "", "engine", "lookups", "M/s", "p50 us", "p90 us", "p99 us", "max us");
+	res_print("", "hm", &res_hm, HM_BATCH);
+    }
+    free(buf);
+    ret = 0;
+
+done:
+    cl_engine_free(engine);
+    if(tmpdir) {
+	cli_rmdirs(tmpdir);
+	free(tmpdir);
+    }
+    free(hm_digests);
+    free(hm_sizes);
+    return ret;
+}
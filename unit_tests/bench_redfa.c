@@ -0,0 +1,350 @@
+/*
+ *  Multi-threaded benchmark for the URL regex DFA
+ *
+ *  Copyright (C) 2026 agent <agent@local>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+/*
+ * Compiles deterministic sets of URL regexes into one cli_redfa and has 1,
+ * 2, 4, ... threads match the same list of URLs against it at once, the way
+ * the clamd scanning threads share the phishing matcher. The "urls" set fits
+ * in the state cache once it is warm; the "thrash" set needs more states
+ * than REDFA_MAXMEM, so the cache is flushed while the threads walk it.
+ * Every result is compared with the one of a single threaded run first.
+ *
+ * Run it with "make bench-redfa" in unit_tests; BENCH_FLAGS is passed on.
+ */
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "../libclamav/clamav.h"
+#include "../libclamav/others.h"
+#include "../libclamav/regex_dfa.h"
+#include "bench_common.h"
+
+static unsigned int rounds = 3, max_threads = 8;
+static unsigned int npatterns = 100, nurls = 20000;
+static unsigned long long seed = 0x636c616d6176ULL;
+
+static const char *words[] = {
+    "paypal", "ebay", "bank", "secure", "login", "account", "update",
+    "verify", "online", "signin", "wellsfargo", "chase", "amazon", "apple",
+    "support", "service", "billing", "confirm", "webscr", "customer"
+};
+
+static const char *tlds[] = { "com", "net", "org", "info", "biz", "co.uk", "de", "ru" };
+
+#define WORD() words[rnd() % (sizeof(words) / sizeof(words[0]))]
+#define TLD() tlds[rnd() % (sizeof(tlds) / sizeof(tlds[0]))]
+
+/* a benchmark run: the patterns and the URLs matched against them */
+struct set {
+    char **patterns;
+    unsigned int npatterns;
+    char **urls;
+    size_t *lens;
+    unsigned int nurls;
+    unsigned long bytes;
+    struct cli_redfa *dfa;
+    unsigned int words;	/* of the result bitmap */
+    uint32_t *ref;	/* single threaded results, by URL */
+    unsigned char *ref_ok;
+};
+
+static char *xstrdup(const char *s)
+{
+	char *d = strdup(s);
+
+    if(!d) {
+	fprintf(stderr, "Out of memory\n");
+	exit(1);
+    }
+    return d;
+}
+
+static void gen_url_patterns(struct set *st)
+{
+	char tmp[256];
+	unsigned int i;
+
+    for(i = 0; i < st->npatterns; i++) {
+	switch(i % 4) {
+	    case 0:
+		snprintf(tmp, sizeof(tmp), "^https?://([a-z0-9-]+\\.)*%s[0-9]*\\.%s(/|$)", WORD(), TLD());
+		break;
+	    case 1:
+		snprintf(tmp, sizeof(tmp), "%s[.-]%s\\.[a-z]{2,4}/.*%s", WORD(), WORD(), WORD());
+		break;
+	    case 2:
+		snprintf(tmp, sizeof(tmp), "(?i)/%s/[a-z]+\\.(php|html?)\\?id=[0-9]+$", WORD());
+		break;
+	    default:
+		snprintf(tmp, sizeof(tmp), "^[a-z]+://[0-9]{1,3}\\.[0-9]{1,3}\\.[0-9]{1,3}\\.[0-9]{1,3}/%s", WORD());
+	}
+	st->patterns[i] = xstrdup(tmp);
+    }
+}
+
+static void gen_urls(struct set *st)
+{
+	char tmp[256];
+	unsigned int i;
+
+    for(i = 0; i < st->nurls; i++) {
+	switch(rnd() % 4) {
+	    case 0:
+		snprintf(tmp, sizeof(tmp), "http://www.%s%u.%s/%s/%s.php?id=%u", WORD(), (unsigned int)(rnd() % 100),
+			 TLD(), WORD(), WORD(), (unsigned int)(rnd() % 100000));
+		break;
+	    case 1:
+		snprintf(tmp, sizeof(tmp), "https://%s-%s.%s/%s/index.html", WORD(), WORD(), TLD(), WORD());
+		break;
+	    case 2:
+		snprintf(tmp, sizeof(tmp), "http://%u.%u.%u.%u/%s/", (unsigned int)(rnd() % 256), (unsigned int)(rnd() % 256),
+			 (unsigned int)(rnd() % 256), (unsigned int)(rnd() % 256), WORD());
+		break;
+	    default:
+		snprintf(tmp, sizeof(tmp), "https://%s.%s.%s/", WORD(), WORD(), TLD());
+	}
+	st->urls[i] = xstrdup(tmp);
+    }
+}
+
+/* a byte followed by a bounded run of anything: the DFA has to keep track
+ * of where every such run started, so its states don't fit in the cache */
+static void gen_thrash_patterns(struct set *st)
+{
+	char tmp[64];
+	unsigned int i;
+
+    for(i = 0; i < st->npatterns; i++) {
+	snprintf(tmp, sizeof(tmp), "%c.{%u}%c", 'a' + (int)(rnd() % 26), 6 + (unsigned int)(rnd() % 6), 'a' + (int)(rnd() % 26));
+	st->patterns[i] = xstrdup(tmp);
+    }
+}
+
+static void gen_thrash_urls(struct set *st)
+{
+	char tmp[96];
+	unsigned int i, j, len;
+
+    for(i = 0; i < st->nurls; i++) {
+	len = 32 + rnd() % 48;
+	for(j = 0; j < len; j++)
+	    tmp[j] = 'a' + rnd() % 26;
+	tmp[len] = 0;
+	st->urls[i] = xstrdup(tmp);
+    }
+}
+
+static int set_init(struct set *st, unsigned int np, unsigned int nu, void (*gen_patterns)(struct set *), void (*gen_u)(struct set *))
+{
+	unsigned int i, n = 0;
+
+    memset(st, 0, sizeof(*st));
+    st->npatterns = np;
+    st->nurls = nu;
+    st->words = (np + 31) / 32;
+    st->patterns = calloc(np, sizeof(*st->patterns));
+    st->urls = calloc(nu, sizeof(*st->urls));
+    st->lens = calloc(nu, sizeof(*st->lens));
+    st->ref = calloc((size_t)nu * st->words, sizeof(*st->ref));
+    st->ref_ok = calloc(nu, 1);
+    if(!st->patterns || !st->urls || !st->lens || !st->ref || !st->ref_ok || !(st->dfa = cli_redfa_new())) {
+	fprintf(stderr, "Out of memory\n");
+	return -1;
+    }
+    gen_patterns(st);
+    gen_u(st);
+    for(i = 0; i < nu; i++) {
+	st->lens[i] = strlen(st->urls[i]);
+	st->bytes += st->lens[i];
+    }
+    for(i = 0; i < np; i++)
+	if(cli_redfa_add(st->dfa, st->patterns[i], i) == CL_SUCCESS)
+	    n++;
+    if(cli_redfa_build(st->dfa) != CL_SUCCESS) {
+	fprintf(stderr, "Can't build the DFA\n");
+	return -1;
+    }
+    /* also warms the cache up */
+    for(i = 0; i < nu; i++)
+	st->ref_ok[i] = cli_redfa_match(st->dfa, (const unsigned char *)st->urls[i], st->lens[i], st->ref + (size_t)i * st->words) == CL_SUCCESS;
+    printf("%u of %u patterns in the DFA, %u URLs, %lu bytes\n", n, np, nu, st->bytes);
+    return 0;
+}
+
+static void set_free(struct set *st)
+{
+	unsigned int i;
+
+    for(i = 0; i < st->npatterns; i++)
+	free(st->patterns[i]);
+    for(i = 0; i < st->nurls; i++)
+	free(st->urls[i]);
+    free(st->patterns);
+    free(st->urls);
+    free(st->lens);
+    free(st->ref);
+    free(st->ref_ok);
+    cli_redfa_free(st->dfa);
+}
+
+struct worker {
+    pthread_t tid;
+    struct set *st;
+    unsigned int first;	/* where in the list this thread starts */
+    unsigned long gave_up, wrong;
+};
+
+static void *worker_run(void *arg)
+{
+	struct worker *w = arg;
+	struct set *st = w->st;
+	uint32_t *bits;
+	unsigned int i, u;
+
+    if(!(bits = malloc(st->words * sizeof(*bits))))
+	return NULL;
+    for(i = 0; i < st->nurls; i++) {
+	u = (w->first + i) % st->nurls;
+	memset(bits, 0, st->words * sizeof(*bits));
+	if(cli_redfa_match(st->dfa, (const unsigned char *)st->urls[u], st->lens[u], bits) != CL_SUCCESS) {
+	    w->gave_up++;
+	    continue;
+	}
+	if(st->ref_ok[u] && memcmp(bits, st->ref + (size_t)u * st->words, st->words * sizeof(*bits)))
+	    w->wrong++;
+    }
+    free(bits);
+    return NULL;
+}
+
+static int bench(const char *name, struct set *st)
+{
+	struct worker *w;
+	unsigned long long t, best;
+	unsigned long gave_up, wrong;
+	unsigned int n, r, i;
+	int ret = 0;
+
+    if(!(w = calloc(max_threads, sizeof(*w))))
+	return -1;
+    for(n = 1; n <= max_threads; n *= 2) {
+	best = 0;
+	gave_up = wrong = 0;
+	for(r = 0; r < rounds; r++) {
+	    memset(w, 0, n * sizeof(*w));
+	    t = now_ns();
+	    for(i = 0; i < n; i++) {
+		w[i].st = st;
+		w[i].first = i * (st->nurls / n);
+		if(pthread_create(&w[i].tid, NULL, worker_run, &w[i])) {
+		    fprintf(stderr, "Can't create a thread\n");
+		    n = i;
+		    ret = -1;
+		    break;
+		}
+	    }
+	    for(i = 0; i < n; i++) {
+		pthread_join(w[i].tid, NULL);
+		gave_up += w[i].gave_up;
+		wrong += w[i].wrong;
+	    }
+	    t = now_ns() - t;
+	    if(!best || t < best)
+		best = t;
+	    if(ret)
+		break;
+	}
+	if(ret)
+	    break;
+	/* every thread matched the whole list */
+	printf("%-8s %7u %12.3f %10.1f %10.3f %10lu %8lu\n", name, n,
+	       (double)st->nurls * n / (best / 1e9) / 1e6, (double)st->bytes * n / 1048576.0 / (best / 1e9),
+	       best / 1e6, gave_up, wrong);
+	if(wrong)
+	    ret = -1;
+    }
+    free(w);
+    return ret;
+}
+
+static void help(void)
+{
+    printf("Usage: bench_redfa [options]\n\n");
+    printf("    -p NUM         patterns (%u)\n", npatterns);
+    printf("    -u NUM         URLs (%u)\n", nurls);
+    printf("    -t NUM         most threads (%u)\n", max_threads);
+    printf("    -r NUM         rounds (%u)\n", rounds);
+    printf("    -S NUM         random seed (%llu)\n", seed);
+}
+
+int main(int argc, char **argv)
+{
+	struct set st;
+	int opt, ret = 0;
+
+    while((opt = getopt(argc, argv, "p:u:t:r:S:h")) != -1) {
+	switch(opt) {
+	    case 'p': npatterns = atoi(optarg); break;
+	    case 'u': nurls = atoi(optarg); break;
+	    case 't': max_threads = atoi(optarg); break;
+	    case 'r': rounds = atoi(optarg); break;
+	    case 'S': seed = strtoull(optarg, NULL, 10); break;
+	    default: help(); return opt != 'h';
+	}
+    }
+    if(!npatterns || !nurls || !max_threads || !rounds) {
+	help();
+	return 1;
+    }
+
+    if(cl_init(CL_INIT_DEFAULT) != CL_SUCCESS) {
+	fprintf(stderr, "Can't initialize libclamav\n");
+	return 1;
+    }
+
+    printf("Seed %llu, best of %u rounds, every thread matches every URL\n\n", seed, rounds);
+
+    rnd_seed(seed);
+    if(set_init(&st, npatterns, nurls, gen_url_patterns, gen_urls))
+	return 1;
+    printf("%-8s %7s %12s %10s %10s %10s %8s\n", "set", "threads", "M URLs/s", "MB/s", "best ms", "gave up", "wrong");
+    ret |= bench("urls", &st);
+    set_free(&st);
+    printf("\n");
+
+    rnd_seed(seed + 1);
+    if(set_init(&st, 64, nurls / 4, gen_thrash_patterns, gen_thrash_urls))
+	return 1;
+    printf("%-8s %7s %12s %10s %10s %10s %8s\n", "set", "threads", "M URLs/s", "MB/s", "best ms", "gave up", "wrong");
+    ret |= bench("thrash", &st);
+    set_free(&st);
+
+    if(ret)
+	fprintf(stderr, "Some threads got results that differ from the single threaded ones\n");
+    return ret ? 1 : 0;
+}
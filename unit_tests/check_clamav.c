@@ -18,6 +18,7 @@
 #include "../libclamav/version.h"
 #include "../libclamav/dsig.h"
 #include "../libclamav/sha256.h"
+#include "../libclamav/arena.h"
 #include "checks.h"
 
 /* extern void cl_free(struct cl_engine *engine); */
@@ -326,6 +327,116 @@ START_TEST (test_cl_scandesc_callback_allscan)
 }
 END_TEST
 
+START_TEST (test_cl_scandesc_context)
+{
+    const char *virname = NULL;
+    char file[256];
+    unsigned long size;
+    unsigned long int scanned = 0;
+    struct cl_scan_context *sctx;
+    int ret, i;
+
+    int fd = get_test_file(_i, file, sizeof(file), &size);
+
+    sctx = cl_scan_context_new();
+    fail_unless(!!sctx, "cl_scan_context_new");
+    /* the second scan runs on the state cached by the first */
+    for (i = 0; i < 2; i++) {
+	cli_dbgmsg("scanning (scandesc_context) %s\n", file);
+	lseek(fd, 0, SEEK_SET);
+	ret = cl_scandesc_context(fd, &virname, &scanned, g_engine, CL_SCAN_STDOPT, NULL, sctx);
+	cli_dbgmsg("scan end (scandesc_context) %s\n", file);
+
+	fail_unless_fmt(ret == CL_VIRUS, "cl_scandesc_context failed for %s: %s", file, cl_strerror(ret));
+	fail_unless_fmt(virname && !strcmp(virname, "ClamAV-Test-File.UNOFFICIAL"), "virusname: %s", virname);
+    }
+    cl_scan_context_free(sctx);
+    close(fd);
+}
+END_TEST
+
+START_TEST (test_cl_scandesc_fmap)
+{
+    static const unsigned int flags[] = { CL_FMAP_MMAP, CL_FMAP_MMAP, CL_FMAP_HUGEPAGES, CL_FMAP_HUGEPAGES };
+    static const unsigned int readahead[] = { 0, 65536, 0, 65536 };
+    const char *virname = NULL;
+    char file[256];
+    unsigned long size;
+    unsigned long int scanned = 0;
+    int ret, i;
+
+    int fd = get_test_file(_i, file, sizeof(file), &size);
+
+    for (i = 0; i < sizeof(flags)/sizeof(flags[0]); i++) {
+	cl_engine_set_num(g_engine, CL_ENGINE_FMAP_FLAGS, flags[i]);
+	cl_engine_set_num(g_engine, CL_ENGINE_FMAP_READAHEAD, readahead[i]);
+	cli_dbgmsg("scanning (scandesc_fmap %u/%u) %s\n", flags[i], readahead[i], file);
+	lseek(fd, 0, SEEK_SET);
+	ret = cl_scandesc(fd, &virname, &scanned, g_engine, CL_SCAN_STDOPT);
+	cli_dbgmsg("scan end (scandesc_fmap) %s\n", file);
+
+	fail_unless_fmt(ret == CL_VIRUS, "cl_scandesc failed for %s with fmap flags %u: %s", file, flags[i], cl_strerror(ret));
+	fail_unless_fmt(virname && !strcmp(virname, "ClamAV-Test-File.UNOFFICIAL"), "virusname: %s", virname);
+    }
+    cl_engine_set_num(g_engine, CL_ENGINE_FMAP_FLAGS, 0);
+    cl_engine_set_num(g_engine, CL_ENGINE_FMAP_READAHEAD, 0);
+    close(fd);
+}
+END_TEST
+
+START_TEST (test_cl_counters)
+{
+    unsigned long long values[CL_COUNTER_LAST + 1];
+    const char *virname = NULL;
+    char file[256];
+    unsigned long size;
+    unsigned long int scanned = 0;
+    unsigned int i;
+    int ret;
+
+    int fd = get_test_file(_i, file, sizeof(file), &size);
+
+    /* off by default, scanning must not move them */
+    fail_unless(!cl_counters_enabled(), "counters enabled by default");
+    cl_counters_reset();
+    ret = cl_scandesc(fd, &virname, &scanned, g_engine, CL_SCAN_STDOPT);
+    fail_unless_fmt(ret == CL_VIRUS, "cl_scandesc failed for %s: %s", file, cl_strerror(ret));
+    fail_unless(cl_counters_get(values, CL_COUNTER_LAST + 1) == CL_COUNTER_LAST, "cl_counters_get count");
+    for (i = 0; i < CL_COUNTER_LAST; i++)
+	fail_unless_fmt(!values[i], "%s moved while disabled: %llu", cl_counter_name(i), values[i]);
+
+    cl_counters_enable(1);
+    fail_unless(cl_counters_enabled(), "cl_counters_enable");
+    lseek(fd, 0, SEEK_SET);
+    ret = cl_scandesc(fd, &virname, &scanned, g_engine, CL_SCAN_STDOPT);
+    fail_unless_fmt(ret == CL_VIRUS, "cl_scandesc failed for %s: %s", file, cl_strerror(ret));
+    fail_unless(cl_counters_get(values, CL_COUNTER_LAST) == CL_COUNTER_LAST, "cl_counters_get count");
+    fail_unless_fmt(values[CL_COUNTER_FMAP_PAGES] > 0, "no fmap pages counted for %s", file);
+    fail_unless_fmt(values[CL_COUNTER_FMAP_READS] > 0, "no fmap reads counted for %s", file);
+    fail_unless_fmt(values[CL_COUNTER_FMAP_READS] <= values[CL_COUNTER_FMAP_PAGES],
+		    "%llu fmap reads for %llu pages of %s", values[CL_COUNTER_FMAP_READS], values[CL_COUNTER_FMAP_PAGES], file);
+    fail_unless_fmt(values[CL_COUNTER_FILTER_CALLS] > 0, "no prefilter calls counted for %s", file);
+    fail_unless_fmt(values[CL_COUNTER_AC_BYTES] > 0, "no AC bytes counted for %s", file);
+    fail_unless_fmt(values[CL_COUNTER_FILTER_REJECTS] <= values[CL_COUNTER_FILTER_CALLS],
+		    "%llu prefilter rejects for %llu calls", values[CL_COUNTER_FILTER_REJECTS], values[CL_COUNTER_FILTER_CALLS]);
+
+    /* reset starts over from zero, disabling freezes them */
+    cl_counters_reset();
+    cl_counters_enable(0);
+    lseek(fd, 0, SEEK_SET);
+    ret = cl_scandesc(fd, &virname, &scanned, g_engine, CL_SCAN_STDOPT);
+    fail_unless_fmt(ret == CL_VIRUS, "cl_scandesc failed for %s: %s", file, cl_strerror(ret));
+    fail_unless(cl_counters_get(values, 1) == 1, "cl_counters_get partial count");
+    cl_counters_get(values, CL_COUNTER_LAST);
+    for (i = 0; i < CL_COUNTER_LAST; i++) {
+	fail_unless_fmt(!values[i], "%s not reset: %llu", cl_counter_name(i), values[i]);
+	fail_unless_fmt(cl_counter_name(i) != NULL, "counter %u has no name", i);
+    }
+    fail_unless(!cl_counter_name(CL_COUNTER_LAST), "cl_counter_name out of range");
+    close(fd);
+}
+END_TEST
+
 #endif
 
 /* int cl_load(const char *path, struct cl_engine **engine, unsigned int *signo, unsigned int options) */
@@ -553,6 +664,47 @@ START_TEST (test_cl_scanmap_callback_mem_allscan)
 END_TEST
 #endif
 
+/* all the test files in memory, each followed by a clean item */
+START_TEST (test_cl_scanmap_batch)
+{
+    static const char clean[] = "clean item";
+    struct cl_scan_item *items;
+    void **mem;
+    unsigned long size;
+    char file[256];
+    unsigned i;
+    int fd, ret;
+
+    items = calloc(testfiles_n * 2, sizeof(*items));
+    mem = calloc(testfiles_n, sizeof(*mem));
+    fail_unless(items && mem, "calloc");
+    for (i = 0; i < testfiles_n; i++) {
+	fd = get_test_file(i, file, sizeof(file), &size);
+	mem[i] = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	fail_unless(mem[i] != MAP_FAILED, "mmap");
+	close(fd);
+	items[2*i].data = mem[i];
+	items[2*i].len = size;
+	items[2*i+1].data = clean;
+	items[2*i+1].len = sizeof(clean) - 1;
+    }
+
+    ret = cl_scanmap_batch(items, testfiles_n * 2, g_engine, CL_SCAN_STDOPT, 4);
+    fail_unless_fmt(ret == CL_SUCCESS, "cl_scanmap_batch failed: %s", cl_strerror(ret));
+    for (i = 0; i < testfiles_n; i++) {
+	fail_unless_fmt(items[2*i].result == CL_VIRUS, "cl_scanmap_batch failed for %s: %s", testfiles[i], cl_strerror(items[2*i].result));
+	fail_unless_fmt(items[2*i].virname && !strcmp(items[2*i].virname, "ClamAV-Test-File.UNOFFICIAL"), "virusname: %s for %s", items[2*i].virname, testfiles[i]);
+	fail_unless_fmt(items[2*i+1].result == CL_CLEAN, "clean item %u: %s", i, cl_strerror(items[2*i+1].result));
+	fail_unless_fmt(!items[2*i+1].virname, "clean item %u matched %s", i, items[2*i+1].virname);
+    }
+
+    for (i = 0; i < testfiles_n; i++)
+	munmap(mem[i], items[2*i].len);
+    free(mem);
+    free(items);
+}
+END_TEST
+
 static Suite *test_cl_suite(void)
 {
     Suite *s = suite_create("cl_api");
@@ -586,6 +738,9 @@ static Suite *test_cl_suite(void)
     tcase_add_loop_test(tc_cl_scan, test_cl_scanfile_allscan, 0, expected_testfiles);
     tcase_add_loop_test(tc_cl_scan, test_cl_scandesc_callback, 0, expected_testfiles);
     tcase_add_loop_test(tc_cl_scan, test_cl_scandesc_callback_allscan, 0, expected_testfiles);
+    tcase_add_loop_test(tc_cl_scan, test_cl_scandesc_context, 0, expected_testfiles);
+    tcase_add_loop_test(tc_cl_scan, test_cl_scandesc_fmap, 0, expected_testfiles);
+    tcase_add_loop_test(tc_cl_scan, test_cl_counters, 0, expected_testfiles);
     tcase_add_loop_test(tc_cl_scan, test_cl_scanfile_callback, 0, expected_testfiles);
     tcase_add_loop_test(tc_cl_scan, test_cl_scanfile_callback_allscan, 0, expected_testfiles);
     tcase_add_loop_test(tc_cl_scan, test_cl_scanmap_callback_handle, 0, expected_testfiles);
@@ -593,6 +748,7 @@ static Suite *test_cl_suite(void)
     tcase_add_loop_test(tc_cl_scan, test_cl_scanmap_callback_mem, 0, expected_testfiles);
     tcase_add_loop_test(tc_cl_scan, test_cl_scanmap_callback_mem_allscan, 0, expected_testfiles);
 #endif
+    tcase_add_test(tc_cl_scan, test_cl_scanmap_batch);
     return s;
 }
 
@@ -773,11 +929,93 @@ START_TEST (test_sha256)
 }
 END_TEST
 
+START_TEST (test_cli_arena)
+{
+    char *a, *b, *c, *d, *big;
+
+    /* no scan in progress: plain heap blocks */
+    a = cli_arena_malloc(100);
+    fail_unless(!!a, "cli_arena_malloc() failed outside of the arena");
+    memset(a, 0x55, 100);
+    cli_arena_free(a);
+
+    fail_unless(cli_arena_enter() == CL_SUCCESS, "cli_arena_enter() failed");
+    a = cli_arena_malloc(10);
+    b = cli_arena_calloc(10, 10);
+    c = cli_arena_malloc(1000);
+    fail_unless(a && b && c, "cli_arena_malloc() failed");
+    fail_unless(!((unsigned long)a & 15) && !((unsigned long)b & 15) && !((unsigned long)c & 15), "misaligned block");
+    fail_unless(b >= a + 10 && c >= b + 100, "overlapping blocks");
+    fail_unless(!b[0] && !b[99], "cli_arena_calloc() didn't clear the block");
+
+    /* b is released together with c, in either order */
+    cli_arena_free(b);
+    cli_arena_free(c);
+    d = cli_arena_malloc(50);
+    fail_unless(d == b, "freed space not reused");
+
+    /* larger than a chunk */
+    big = cli_arena_malloc(CLI_ARENA_CHUNK * 2);
+    fail_unless(!!big, "cli_arena_malloc() failed for a large block");
+    memset(big, 0xaa, CLI_ARENA_CHUNK * 2);
+
+    /* nested scans share the arena */
+    fail_unless(cli_arena_enter() == CL_SUCCESS, "nested cli_arena_enter() failed");
+    c = cli_arena_malloc(10);
+    fail_unless(c + 10 <= big || c >= big + CLI_ARENA_CHUNK * 2, "nested block overlaps");
+    cli_arena_free(c);
+    cli_arena_leave();
+
+    cli_arena_free(big);
+    cli_arena_free(d);
+    /* a is left behind on purpose, cli_arena_leave() drops it */
+    cli_arena_leave();
+
+    fail_unless(cli_arena_enter() == CL_SUCCESS, "cli_arena_enter() failed");
+    b = cli_arena_malloc(10);
+    fail_unless(b == a, "arena not reset");
+    cli_arena_free(b);
+    cli_arena_leave();
+}
+END_TEST
+
+START_TEST (test_cli_arena_regrow)
+{
+    char *pinned[3], *blk[3], *small, *big;
+    int i;
+
+    /* leave a few empty chunks, each too small for the next block, past
+     * the current one */
+    fail_unless(cli_arena_enter() == CL_SUCCESS, "cli_arena_enter() failed");
+    for(i = 0; i < 3; i++) {
+	cli_arena_pin();
+	pinned[i] = cli_arena_malloc(100);
+	cli_arena_unpin();
+	blk[i] = cli_arena_malloc(CLI_ARENA_CHUNK / 4 * 3);
+	fail_unless(pinned[i] && blk[i], "cli_arena_malloc() failed");
+	memset(blk[i], i, CLI_ARENA_CHUNK / 4 * 3);
+    }
+    for(i = 2; i >= 0; i--) {
+	cli_arena_free(blk[i]);
+	cli_arena_free(pinned[i]);
+    }
+    small = cli_arena_malloc(100);
+    big = cli_arena_malloc(CLI_ARENA_CHUNK * 4);
+    fail_unless(small && big, "cli_arena_malloc() failed");
+    memset(big, 0xaa, CLI_ARENA_CHUNK * 4);
+    fail_unless(small + 100 <= big || small >= big + CLI_ARENA_CHUNK * 4, "large block overlaps");
+    cli_arena_free(big);
+    cli_arena_free(small);
+    cli_arena_leave();
+}
+END_TEST
+
 static Suite *test_cli_suite(void)
 {
     Suite *s = suite_create("cli");
     TCase *tc_cli_others = tcase_create("byteorder_macros");
     TCase *tc_cli_dsig = tcase_create("digital signatures");
+    TCase *tc_cli_arena = tcase_create("arena");
 
     suite_add_tcase (s, tc_cli_others);
     tcase_add_checked_fixture (tc_cli_others, data_setup, data_teardown);
@@ -789,6 +1027,10 @@ static Suite *test_cli_suite(void)
     tcase_add_loop_test(tc_cli_dsig, test_cli_dsig, 0, dsig_tests_cnt);
     tcase_add_test(tc_cli_dsig, test_sha256);
 
+    suite_add_tcase (s, tc_cli_arena);
+    tcase_add_test(tc_cli_arena, test_cli_arena);
+    tcase_add_test(tc_cli_arena, test_cli_arena_regrow);
+
     return s;
 }
 #endif /* CHECK_HAVE_LOOPS */
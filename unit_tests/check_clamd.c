@@ -152,7 +152,10 @@ static void commands_teardown(void)
 
 #define VERSION_REPLY "ClamAV "REPO_VERSION""VERSION_SUFFIX
 
-#define VCMDS_REPLY VERSION_REPLY"| COMMANDS: SCAN QUIT RELOAD PING CONTSCAN VERSIONCOMMANDS VERSION STREAM END SHUTDOWN MULTISCAN FILDES STATS IDSESSION INSTREAM DETSTATSCLEAR DETSTATS ALLMATCHSCAN"
+#define VCMDS_REPLY VERSION_REPLY"| COMMANDS: SCAN QUIT RELOAD PING CONTSCAN VERSIONCOMMANDS VERSION STREAM END SHUTDOWN MULTISCAN FILDES STATS IDSESSION INSTREAM DETSTATSCLEAR DETSTATS ALLMATCHSCAN TELEMETRY COUNTERSCLEAR COUNTERS"
+
+/* the test config doesn't enable TelemetryRecords */
+#define TELEMETRY_OFF_REPLY "{\"summary\":{\"scans\":0,\"records\":0,\"cache_hits\":0,\"cache_misses\":0,\"cache_hit_ratio\":0.0000,\"queue_wait_avg_us\":0,\"queue_wait_max_us\":0}}"
 
 enum idsession_support {
     IDS_OK, /* accepted */
@@ -174,6 +177,7 @@ static struct basic_test {
     {"RELOAD", NULL, "RELOADING", 1, 0, IDS_REJECT},
     {"VERSION", NULL, VERSION_REPLY, 1, 0, IDS_OK},
     {"VERSIONCOMMANDS", NULL, VCMDS_REPLY, 0, 0, IDS_REJECT},
+    {"TELEMETRY", NULL, TELEMETRY_OFF_REPLY, 0, 0, IDS_REJECT},
     {"SCAN "SCANFILE, NULL, FOUNDREPLY, 1, 0, IDS_OK},
     {"SCAN "CLEANFILE, NULL, CLEANREPLY, 1, 0, IDS_OK},
     {"CONTSCAN "SCANFILE, NULL, FOUNDREPLY, 1, 0, IDS_REJECT},
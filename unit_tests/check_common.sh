@@ -253,6 +253,7 @@ run_clamdscan_fileonly() {
 run_clamdscan() {
     run_clamdscan_fileonly $*
     rm -f clamdscan-fdpass.log clamdscan-multiscan-fdpass.log clamdscan-stream.log clamdscan-multiscan-stream.log
+    rm -f clamdscan-pipeline-fdpass.log clamdscan-pipeline-stream.log
     set +e
     $CLAMDSCAN --quiet --config-file=test-clamd.conf $* --fdpass --log=clamdscan-fdpass.log
     if test $? = 2; then 
@@ -270,6 +271,14 @@ run_clamdscan() {
     if test $? = 2; then 
 	die "Failed to run clamdscan (instream + multiscan)!"
     fi
+    $CLAMDSCAN --quiet --config-file=test-clamd.conf $* --connections=4 --fdpass --log=clamdscan-pipeline-fdpass.log
+    if test $? = 2; then
+	die "Failed to run clamdscan (fdpass + 4 connections)!"
+    fi
+    $CLAMDSCAN --quiet --config-file=test-clamd.conf $* --connections=4 --stream --log=clamdscan-pipeline-stream.log
+    if test $? = 2; then
+	die "Failed to run clamdscan (instream + 4 connections)!"
+    fi
     set -e
 }
 
@@ -308,6 +317,8 @@ test_clamd1() {
     NINFECTED_MULTI_FDPASS=`grep "Infected files" clamdscan-multiscan-fdpass.log | cut -f2 -d:|sed -e 's/ //g'`
     NINFECTED_STREAM=`grep "Infected files" clamdscan-stream.log | cut -f2 -d:|sed -e 's/ //g'`
     NINFECTED_MULTI_STREAM=`grep "Infected files" clamdscan-multiscan-stream.log | cut -f2 -d:|sed -e 's/ //g'`
+    NINFECTED_PIPE_FDPASS=`grep "Infected files" clamdscan-pipeline-fdpass.log | cut -f2 -d:|sed -e 's/ //g'`
+    NINFECTED_PIPE_STREAM=`grep "Infected files" clamdscan-pipeline-stream.log | cut -f2 -d:|sed -e 's/ //g'`
     if test "$NFILES" -ne "0$NINFECTED"; then
 	scan_failed clamdscan.log "clamd did not detect all testfiles correctly!"
     fi
@@ -326,6 +337,12 @@ test_clamd1() {
     if test "$NFILES" -ne "0$NINFECTED_MULTI_STREAM"; then
 	scan_failed clamdscan-multiscan-stream.log "clamd did not detect all testfiles correctly in multiscan+stream mode!"
     fi
+    if test "$NFILES" -ne "0$NINFECTED_PIPE_FDPASS"; then
+	scan_failed clamdscan-pipeline-fdpass.log "clamd did not detect all testfiles correctly in fdpass mode over 4 connections!"
+    fi
+    if test "$NFILES" -ne "0$NINFECTED_PIPE_STREAM"; then
+	scan_failed clamdscan-pipeline-stream.log "clamd did not detect all testfiles correctly in stream mode over 4 connections!"
+    fi
     # Test HeuristicScanPrecedence off feature
     run_clamdscan ../clam-phish-exe
     grep "ClamAV-Test-File" clamdscan.log >/dev/null 2>/dev/null;
@@ -354,6 +371,7 @@ test_clamd3() {
     test_start $1
     echo "VirusEvent $abs_srcdir/virusaction-test.sh `pwd` \"Virus found: %v\"" >>test-clamd.conf
     echo "HeuristicScanPrecedence yes" >>test-clamd.conf
+    echo "IOUring yes" >>test-clamd.conf
     start_clamd
     # Test HeuristicScanPrecedence feature
     run_clamdscan ../clam-phish-exe
@@ -375,5 +393,29 @@ test_clamd3() {
     grep "Virus found: ClamAV-Test-File.UNOFFICIAL" test-clamd.log >/dev/null 2>/dev/null ||
 	{ cat test-clamd.log || true; die "Virusaction test failed"; }
 
+    # Test IOUring reads (pread() where io_uring is not available)
+    run_clamdscan_fileonly $TESTFILES
+    NINFECTED=`grep "Infected files" clamdscan.log | cut -f2 -d:|sed -e 's/ //g'`
+    NINFECTED_MULTI=`grep "Infected files" clamdscan-multiscan.log | cut -f2 -d:|sed -e 's/ //g'`
+    if test "$NFILES" -ne "0$NINFECTED"; then
+	scan_failed clamdscan.log "clamd did not detect all testfiles correctly with IOUring!"
+    fi
+    if test "$NFILES" -ne "0$NINFECTED_MULTI"; then
+	scan_failed clamdscan-multiscan.log "clamd did not detect all testfiles correctly in multiscan mode with IOUring!"
+    fi
+
+    # RAR-SFX with IOUring: unrar needs the descriptor behind the map
+    if test "X$unrar_disabled" != "X1"; then
+	dd if=/dev/zero of=clam-sfx.exe bs=4096 count=1 2>/dev/null
+	cat $TOP/test/clam-v2.rar >>clam-sfx.exe
+	run_clamdscan_fileonly `pwd`/clam-sfx.exe
+	grep "ClamAV-Test-File" clamdscan.log >/dev/null 2>/dev/null ||
+	    { cat clamdscan.log; die "RAR-SFX test with IOUring failed!"; }
+	grep "ClamAV-Test-File" clamdscan-multiscan.log >/dev/null 2>/dev/null ||
+	    { cat clamdscan-multiscan.log; die "RAR-SFX test with IOUring failed in multiscan mode!"; }
+    else
+	echo "*** UNRAR is disabled, skipping the RAR-SFX test"
+    fi
+
     test_end $1
 }
@@ -144,6 +144,57 @@ START_TEST (test_htmlnorm_api)
 	close(fd);
 }
 END_TEST
+
+START_TEST (test_htmlnorm_views)
+{
+	int fd, reffd, jsfd;
+	struct html_views views;
+	char filename[4096];
+	fmap_t *map;
+
+	fd = open_testfile(tests[_i].input);
+	fail_unless(fd > 0,"open_testfile failed");
+
+	map = fmap(fd, 0, 0);
+	fail_unless(!!map, "fmap failed");
+
+	views.want = HTML_VIEW_NOCOMMENT | HTML_VIEW_NOTAGS;
+	fail_unless(html_normalise_map_views(map, dir, &views, dconf) == 1, "html_normalise_map_views failed");
+	fail_unless(!!views.nocomment && !!views.notags, "views not produced");
+	if (tests[_i].nocommentref) {
+		reffd = open_testfile(tests[_i].nocommentref);
+		diff_file_mem(reffd, (const char*)views.nocomment, views.nocomment_len);
+	}
+	if (tests[_i].notagsref) {
+		reffd = open_testfile(tests[_i].notagsref);
+		diff_file_mem(reffd, (const char*)views.notags, views.notags_len);
+	}
+	if (tests[_i].jsref) {
+		fail_unless(views.tmpdir, "no tempdir for the scripts");
+		snprintf(filename, sizeof(filename), "%s/javascript", dir);
+		jsfd = open(filename, O_RDONLY);
+		fail_unless(jsfd > 0,"unable to open: %s", filename);
+		diff_files(jsfd, open_testfile(tests[_i].jsref));
+	}
+	if (views.tmpdir)
+		fail_unless(cli_rmdirs(dir) == 0, "rmdirs failed");
+	html_views_free(&views);
+
+	views.want = HTML_VIEW_NOTAGS;
+	fail_unless(html_normalise_map_views(map, dir, &views, dconf) == 1, "html_normalise_map_views failed");
+	fail_unless(!views.nocomment && !views.nocomment_len, "unwanted view produced");
+	if (tests[_i].notagsref) {
+		reffd = open_testfile(tests[_i].notagsref);
+		diff_file_mem(reffd, (const char*)views.notags, views.notags_len);
+	}
+	if (views.tmpdir)
+		fail_unless(cli_rmdirs(dir) == 0, "rmdirs failed");
+	html_views_free(&views);
+
+	funmap(map);
+	close(fd);
+}
+END_TEST
 #endif
 
 START_TEST(test_screnc_nullterminate)
@@ -170,6 +221,7 @@ Suite *test_htmlnorm_suite(void)
 	suite_add_tcase (s, tc_htmlnorm_api);
 #ifdef CHECK_HAVE_LOOPS	
 	tcase_add_loop_test(tc_htmlnorm_api, test_htmlnorm_api, 0, sizeof(tests)/sizeof(tests[0]));
+	tcase_add_loop_test(tc_htmlnorm_api, test_htmlnorm_views, 0, sizeof(tests)/sizeof(tests[0]));
 #endif
 	tcase_add_unchecked_fixture(tc_htmlnorm_api,
 					htmlnorm_setup, htmlnorm_teardown);
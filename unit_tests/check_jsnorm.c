@@ -42,6 +42,7 @@
 #include "../libclamav/jsparse/generated/keywords.h"
 #include "../libclamav/jsparse/generated/operators.h"
 #include "checks.h"
+#include "jsnorm_tests.h"
 
 struct test {
 	const char *str;
@@ -253,132 +254,6 @@ static void tokenizer_test(const char *in, const char *expected, int split)
 	diff_file_mem(fd, expected, len);
 }
 
-static const char jstest_buf0[] =
-"function foo(a, b) {\n"\
-"var x = 1.9e2*2*a/ 4.;\n"\
-"var y = 'test\\'tst';//var\n"\
-"x=b[5],/* multiline\nvar z=6;\nsome*some/other**/"\
-"z=x/y;/* multiline oneline */var t=z/a;\n"\
-"z=[test;testi];"\
-"document.writeln('something\n');}";
-
-static const char jstest_expected0[] =
-"<script>function n000(n001,n002){"\
-"var n003=190*2*n001/4;"\
-"var n004=\"test\'tst\";"\
-"n003=n002[5],"\
-"z=n003/n004;var n005=z/n001;"\
-"z=[test;testi];"\
-"document.writeln(\"something \");}</script>";
-
-static const char jstest_buf1[] =
-"function () { var id\\u1234tx;}";
-
-static const char jstest_expected1[] =
-"<script>function(){var n000;}</script>";
-
-static const char jstest_buf2[] =
-"function () { var tst=\"a\"+'bc'+     'd'; }";
-
-static const char jstest_expected2[] =
-"<script>function(){var n000=\"abcd\";}</script>";
-
-static const char jstest_buf3[] =
-"dF('bmfsu%2639%2638x11u%2638%263%3A%264C1');";
-
-static const char jstest_expected3[] =
-"<script>alert(\"w00t\");</script>";
-
-#define B64 "bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb"
-
-/* TODO: document.write should be normalized too */
-static char jstest_buf4[] =
-"qbphzrag.jevgr(harfpncr('%3P%73%63%72%69%70%74%20%6P%61%6R%67%75%61%67%65%3Q%22%6N%61%76%61%73%63%72%69%70%74%22%3R%66%75%6R%63%74%69%6S%6R%20%64%46%28%73%29%7O%76%61%72%20%73%31%3Q%75%6R%65%73%63%61%70%65%28%73%2R%73%75%62%73%74%72%28%30%2P%73%2R%6P%65%6R%67%74%68%2Q%31%29%29%3O%20%76%61%72%20%74%3Q%27%27%3O%66%6S%72%28%69%3Q%30%3O%69%3P%73%31%2R%6P%65%6R%67%74%68%3O%69%2O%2O%29%74%2O%3Q%53%74%72%69%6R%67%2R%66%72%6S%6Q%43%68%61%72%43%6S%64%65%28%73%31%2R%63%68%61%72%43%6S%64%65%41%74%28%69%29%2Q%73%2R%73%75%62%73%74%72%28%73%2R%6P%65%6R%67%74%68%2Q%31%2P%31%29%29%3O%64%6S%63%75%6Q%65%6R%74%2R%77%72%69%74%65%28%75%6R%65%73%63%61%70%65%28%74%29%29%3O%7Q%3P%2S%73%63%72%69%70%74%3R'));riny(qS('tV%285%3O%285%3Nsdwjl%28585%3N7%28586Q%28585%3N7%3P%7P55l%28585%3N7%3P%28585%3N7%28586R%28585%3N8T5%285%3N%285%3P%286R3'));";
-
-static char jstest_expected4[] =
-"<fpevcg>qbphzrag.jevgr(\"<fpevcg ynathntr=\"wninfpevcg\">shapgvba qs(f){ine f1=harfpncr(f.fhofge(0,f.yratgu-1)); ine g='';sbe(v=0;v<f1.yratgu;v++)g+=fgevat.sebzpunepbqr(f1.punepbqrng(v)-f.fhofge(f.yratgu-1,1));qbphzrag.jevgr(harfpncr(g));}</fpevcg>\");riny();nyreg(\"j00g\");</fpevcg>";
-
-static char jstest_buf5[] =
-"shapgvba (c,n,p,x,r,e){}('0(\\'1\\');',2,2,'nyreg|j00g'.fcyvg('|'),0,{});";
-
-static const char jstest_expected5[] =
-"<script>function(n000,n001,n002,n003,n004,n005){}(alert(\"w00t\"););</script>";
-
-static const char jstest_buf6[] =
-"function $(p,a,c,k,e,d){} something(); $('0(\\'1\\');',2,2,'alert|w00t'.split('|'),0,{});";
-
-static const char jstest_expected6[] =
-"<script>function n000(n001,n002,n003,n004,n005,n006){}something();$(alert(\"w00t\"););</script>";
-
-static const char jstest_buf7[] =
-"var z=\"tst" B64 "tst\";";
-
-static const char jstest_expected7[] =
-"<script>var n000=\"tst" B64 "tst\";</script>";
-
-static const char jstest_buf8[] =
-"var z=\'tst" B64 "tst\';";
-
-static const char jstest_expected8[] =
-"<script>var n000=\"tst" B64 "tst\";</script>";
-
-static char jstest_buf9[] =
-"riny(harfpncr('%61%6p%65%72%74%28%27%74%65%73%74%27%29%3o'));";
-
-static const char jstest_expected9[] =
-"<script>alert(\"test\");</script>";
-
-static const char jstest_buf10[] =
-"function $ $() dF(x); function (p,a,c,k,e,r){function $(){}";
-
-static const char jstest_expected10[] =
-"<script>function n000 n000()n001(x);function(n002,n003,n004,n005,n006,n007){function n008(){}</script>";
-
-static const char jstest_buf11[] =
-"var x=123456789 ;";
-
-static const char jstest_expected11[] =
-"<script>var n000=123456789;</script>";
-
-static const char jstest_buf12[] =
-"var x='test\\u0000test';";
-
-static const char jstest_expected12[] =
-"<script>var n000=\"test\x1test\";</script>";
-
-static const char jstest_buf13[] =
-"var x\\s12345";
-
-static const char jstest_expected13[] =
-"<script>var n000</script>";
-
-static const char jstest_buf14[] =
-"document.write(unescape('test%20test";
-
-static const char jstest_expected14[] =
-"<script>document.write(\"test test\")</script>";
-
-static struct {
-	const char *in;
-	const char *expected;
-} js_tests[] = {
-	{jstest_buf0, jstest_expected0},
-	{jstest_buf1, jstest_expected1},
-	{jstest_buf2, jstest_expected2},
-	{jstest_buf3, jstest_expected3},
-	{jstest_buf4, jstest_expected4},
-	{jstest_buf5, jstest_expected5},
-	{jstest_buf6, jstest_expected6},
-	{jstest_buf7, jstest_expected7},
-	{jstest_buf8, jstest_expected8},
-	{jstest_buf9, jstest_expected9},
-	{jstest_buf10, jstest_expected10},
-	{jstest_buf11, jstest_expected11},
-	{jstest_buf12, jstest_expected12},
-	{jstest_buf13, jstest_expected13},
-	{jstest_buf14, jstest_expected14}
-};
-
 #ifdef CHECK_HAVE_LOOPS
 START_TEST (tokenizer_basic)
 {
@@ -437,25 +312,6 @@ START_TEST (screnc_infloop)
 }
 END_TEST
 
-static void prepare_s(char *s)
-{
-	char xlat[] = "NOPQRSTUVWXYZABCDEFGHIJKLM[\\]^_`nopqrstuvwxyzabcdefghijklm";
-	while(*s) {
-		if(isalpha(*s)) {
-			*s = xlat[*s - 'A'];
-		}
-		s++;
-	}
-}
-
-static void prepare(void)
-{
-	prepare_s(jstest_buf4);
-	prepare_s(jstest_expected4);
-	prepare_s(jstest_buf5);
-	prepare_s(jstest_buf9);
-}
-
 Suite *test_jsnorm_suite(void)
 {
     Suite *s = suite_create("jsnorm");
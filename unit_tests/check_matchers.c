@@ -30,8 +30,10 @@
 #include "../libclamav/matcher.h"
 #include "../libclamav/matcher-ac.h"
 #include "../libclamav/matcher-bm.h"
+#include "../libclamav/matcher-hash.h"
 #include "../libclamav/others.h"
 #include "../libclamav/default.h"
+#include "../libclamav/scanctx.h"
 #include "checks.h"
 
 static const struct ac_testdata_s {
@@ -123,6 +125,58 @@ START_TEST (test_ac_scanbuff) {
 }
 END_TEST
 
+START_TEST (test_ac_resetdata) {
+	struct cli_ac_data mdata;
+	struct cli_matcher *root;
+	unsigned int i;
+	int ret;
+
+    root = ctx.engine->root[0];
+    fail_unless(root != NULL, "root == NULL");
+    root->ac_only = 1;
+
+#ifdef USE_MPOOL
+    root->mempool = mpool_create();
+#endif
+    ret = cli_ac_init(root, CLI_DEFAULT_AC_MINDEPTH, CLI_DEFAULT_AC_MAXDEPTH, 1);
+    fail_unless(ret == CL_SUCCESS, "cli_ac_init() failed");
+
+    for(i = 0; ac_testdata[i].data; i++) {
+	ret = cli_parse_add(root, ac_testdata[i].virname, ac_testdata[i].hexsig, 0, 0, "*", 0, NULL, 0);
+	fail_unless(ret == CL_SUCCESS, "cli_parse_add() failed");
+    }
+
+    ret = cli_ac_buildtrie(root);
+    fail_unless(ret == CL_SUCCESS, "cli_ac_buildtrie() failed");
+
+    ctx.sctx = cl_scan_context_new();
+    fail_unless(!!ctx.sctx, "cl_scan_context_new() failed");
+
+    for(i = 0; i < 3; i++) {
+	/* Test_3 split over two buffers of the same scan */
+	ret = cli_scanctx_initdata(ctx.sctx, &mdata, root);
+	fail_unless(ret == CL_SUCCESS, "cli_scanctx_initdata() failed");
+	ret = cli_ac_scanbuff((const unsigned char *) "aaaabbbbcccccddddd", 18, &virname, NULL, NULL, root, &mdata, 0, 0, NULL, AC_SCAN_VIR, NULL);
+	fail_unless_fmt(ret == CL_CLEAN, "cli_ac_scanbuff() matched the first parts only (round %u)", i);
+	ret = cli_ac_scanbuff((const unsigned char *) "eeee", 4, &virname, NULL, NULL, root, &mdata, 100, 0, NULL, AC_SCAN_VIR, NULL);
+	fail_unless_fmt(ret == CL_VIRUS, "cli_ac_scanbuff() failed for Test_3 (round %u)", i);
+	fail_unless_fmt(!strncmp(virname, "Test_3", 6), "Test_3 matched with %s", virname);
+	cli_scanctx_freedata(ctx.sctx, &mdata);
+
+	/* the next scan must not see the partial matches of the last one */
+	ret = cli_scanctx_initdata(ctx.sctx, &mdata, root);
+	fail_unless(ret == CL_SUCCESS, "cli_scanctx_initdata() failed");
+	ret = cli_ac_scanbuff((const unsigned char *) "eeee", 4, &virname, NULL, NULL, root, &mdata, 100, 0, NULL, AC_SCAN_VIR, NULL);
+	fail_unless_fmt(ret == CL_CLEAN, "cached cli_ac_data not reset (round %u)", i);
+	cli_scanctx_freedata(ctx.sctx, &mdata);
+    }
+    fail_unless_fmt(ctx.sctx->nacdata == 1, "%u cached cli_ac_data instead of 1", ctx.sctx->nacdata);
+
+    cl_scan_context_free(ctx.sctx);
+    ctx.sctx = NULL;
+}
+END_TEST
+
 START_TEST (test_bm_scanbuff) {
 	struct cli_matcher *root;
 	const char *virname = NULL;
@@ -151,6 +205,78 @@ START_TEST (test_bm_scanbuff) {
 }
 END_TEST
 
+static unsigned int lit_seed;
+
+static unsigned int lit_rand(void)
+{
+    lit_seed = lit_seed * 1103515245 + 12345;
+    return (lit_seed >> 16) & 0x7fff;
+}
+
+START_TEST (test_bm_literal) {
+	struct cli_matcher *root;
+	struct cli_bm_lit *lit;
+	unsigned char pats[300][24], buf[512];
+	unsigned int plen[300], i, j, k, len, pos;
+	char name[32], hex[49], offset[16];
+	const char *virname1, *virname2;
+	uint32_t viroff1, viroff2;
+	int ret1, ret2;
+
+    root = ctx.engine->root[0];
+    fail_unless(root != NULL, "root == NULL");
+    ret1 = cli_bm_init(root);
+    fail_unless(ret1 == CL_SUCCESS, "cli_bm_init() failed");
+
+    /* a small alphabet gives shared prefixes, overlaps and full chains */
+    lit_seed = 1;
+    for(i = 0; i < 300; i++) {
+	plen[i] = 6 + lit_rand() % 19;
+	for(j = 0; j < plen[i]; j++) {
+	    pats[i][j] = 'a' + lit_rand() % 4;
+	    sprintf(hex + 2 * j, "%02x", pats[i][j]);
+	}
+	snprintf(name, sizeof(name), "Lit-%u", i);
+	if(i % 10 == 9)
+	    snprintf(offset, sizeof(offset), "%u", lit_rand() % 64);
+	else
+	    strcpy(offset, "*");
+	ret1 = cli_parse_add(root, name, hex, 0, 0, offset, 0, NULL, 0);
+	fail_unless(ret1 == CL_SUCCESS, "cli_parse_add() failed");
+    }
+    ret1 = cli_bm_build_literal(root);
+    fail_unless(ret1 == CL_SUCCESS, "cli_bm_build_literal() failed");
+    fail_unless(root->bm_lit != NULL, "literal engine not built");
+
+    for(i = 0; i < 2000; i++) {
+	len = 16 + lit_rand() % (sizeof(buf) - 16);
+	for(j = 0; j < len; j++)
+	    buf[j] = 'a' + lit_rand() % ((i & 1) ? 4 : 8);
+	for(k = lit_rand() % 3; k; k--) {
+	    j = lit_rand() % 300;
+	    if(plen[j] <= len) {
+		pos = lit_rand() % (len - plen[j] + 1);
+		memcpy(buf + pos, pats[j], plen[j]);
+	    }
+	}
+	pos = lit_rand() % 8;
+
+	virname1 = virname2 = NULL;
+	viroff1 = viroff2 = 0;
+	ret1 = cli_bm_scanbuff(buf + pos, len - pos, &virname1, NULL, root, pos, NULL, NULL, &viroff1);
+	lit = root->bm_lit;
+	root->bm_lit = NULL;
+	ret2 = cli_bm_scanbuff(buf + pos, len - pos, &virname2, NULL, root, pos, NULL, NULL, &viroff2);
+	root->bm_lit = lit;
+	fail_unless_fmt(ret1 == ret2, "buffer %u: literal engine returned %d, BM %d", i, ret1, ret2);
+	if(ret1 == CL_VIRUS) {
+	    fail_unless_fmt(!strcmp(virname1, virname2), "buffer %u: literal engine matched %s, BM %s", i, virname1, virname2);
+	    fail_unless_fmt(viroff1 == viroff2, "buffer %u: literal engine reported offset %u, BM %u", i, viroff1, viroff2);
+	}
+    }
+}
+END_TEST
+
 START_TEST (test_ac_scanbuff_allscan) {
 	struct cli_ac_data mdata;
 	struct cli_matcher *root;
@@ -227,6 +353,128 @@ START_TEST (test_bm_scanbuff_allscan) {
 }
 END_TEST
 
+/* one large bucket with a directory and many small ones */
+#define HM_TESTSIGS 2000
+#define HM_BIGSIZE 4242
+
+static void hm_testhash(unsigned char *h, unsigned int i)
+{
+    uint32_t x = i * 2654435761U + 1;
+    unsigned int j;
+
+    for(j = 0; j < 16; j++) {
+	x = x * 1103515245 + 12345;
+	h[j] = x >> 24;
+    }
+}
+
+static uint32_t hm_testsize(unsigned int i)
+{
+    return (i & 1) ? HM_BIGSIZE : 1 + i % 300;
+}
+
+START_TEST (test_hm_scan) {
+	struct cli_matcher *root;
+	unsigned char h[16];
+	char name[32];
+	const char *virname;
+	unsigned int i;
+	int ret;
+
+    root = ctx.engine->root[0];
+    fail_unless(root != NULL, "root == NULL");
+
+    for(i = 0; i < HM_TESTSIGS; i++) {
+	hm_testhash(h, i);
+	snprintf(name, sizeof(name), "Hash-%u", i);
+	ret = hm_addhash_bin(root, h, CLI_HASH_MD5, hm_testsize(i), (i % 7) ? name : NULL);
+	fail_unless(ret == CL_SUCCESS, "hm_addhash_bin() failed");
+    }
+    ret = hm_flush(root);
+    fail_unless(ret == CL_SUCCESS, "hm_flush() failed");
+    ret = hm_addhash_bin(root, h, CLI_HASH_MD5, 1, "Late");
+    fail_unless(ret != CL_SUCCESS, "hm_addhash_bin() succeeded after hm_flush()");
+
+    for(i = 0; i < HM_TESTSIGS; i++) {
+	hm_testhash(h, i);
+	virname = "none";
+	ret = cli_hm_scan(h, hm_testsize(i), &virname, root, CLI_HASH_MD5);
+	fail_unless_fmt(ret == CL_VIRUS, "hash %u not found", i);
+	if(i % 7) {
+	    snprintf(name, sizeof(name), "Hash-%u", i);
+	    fail_unless_fmt(virname && !strcmp(virname, name), "hash %u matched %s", i, virname);
+	} else
+	    fail_unless_fmt(!virname, "hash %u should have no name", i);
+
+	ret = cli_hm_scan(h, hm_testsize(i) + 1000, &virname, root, CLI_HASH_MD5);
+	fail_unless_fmt(ret == CL_CLEAN, "hash %u matched with the wrong size", i);
+	h[i % 16] ^= 0x80;
+	ret = cli_hm_scan(h, hm_testsize(i), &virname, root, CLI_HASH_MD5);
+	fail_unless_fmt(ret == CL_CLEAN, "altered hash %u matched", i);
+    }
+    fail_unless(cli_hm_have_size(root, CLI_HASH_MD5, HM_BIGSIZE), "cli_hm_have_size() failed");
+    fail_unless(!cli_hm_have_size(root, CLI_HASH_SHA1, HM_BIGSIZE), "cli_hm_have_size() matched the wrong type");
+    hm_free(root);
+}
+END_TEST
+
+static const char *lsig_testexprs[] = {
+    "0",
+    "0&1&(2|3)>2",
+    "(0|1|2)>1,2",
+    "0=0",
+    "(0&1)=0",
+    "0>2&1<3",
+    "((0|1)&(2|3))>3,2&4",
+    "0|1|2|3|4",
+    "(0|1)<2|2",
+    "0&(1|2)>1&((3&4)|5=2)",
+    "((0&1)|(2&3))>2,2",
+    "(0|(1&2)>1)=2&3",
+    "((0|1|2)>1,2&(3|4))|(5&6&7)<2",
+    NULL
+};
+
+START_TEST (test_lsig_compile) {
+	struct cli_matcher *root;
+	struct cli_ac_lsig lsig;
+	uint32_t cnt[64];
+	unsigned int i, j, k, evalcnt, seed = 1;
+	uint64_t evalids;
+	int ret, expected;
+
+    root = ctx.engine->root[0];
+    fail_unless(root != NULL, "root == NULL");
+
+    for(i = 0; lsig_testexprs[i]; i++) {
+	memset(&lsig, 0, sizeof(lsig));
+	lsig.logic = (char *) lsig_testexprs[i];
+	ret = cli_ac_lsig_compile(root, &lsig);
+	fail_unless_fmt(ret == CL_SUCCESS, "cli_ac_lsig_compile() failed for %s", lsig.logic);
+	fail_unless_fmt(lsig.prog != NULL, "%s not compiled", lsig.logic);
+
+	memset(cnt, 0, sizeof(cnt));
+	evalcnt = 0;
+	evalids = 0;
+	expected = cli_ac_chklsig(lsig.logic, lsig.logic + strlen(lsig.logic), cnt, &evalcnt, &evalids, 0) == 1;
+	fail_unless_fmt(lsig.always == expected, "wrong always flag for %s", lsig.logic);
+
+	for(j = 0; j < 2000; j++) {
+	    for(k = 0; k < 8; k++) {
+		seed = seed * 1103515245 + 12345;
+		cnt[k] = (seed >> 16) % 4;
+	    }
+	    evalcnt = 0;
+	    evalids = 0;
+	    expected = cli_ac_chklsig(lsig.logic, lsig.logic + strlen(lsig.logic), cnt, &evalcnt, &evalids, 0) == 1;
+	    ret = cli_ac_lsig_match(&lsig, cnt);
+	    fail_unless_fmt(ret == expected, "%s evaluated to %d instead of %d", lsig.logic, ret, expected);
+	}
+	mpool_free(root->mempool, lsig.prog);
+    }
+}
+END_TEST
+
 Suite *test_matchers_suite(void)
 {
     Suite *s = suite_create("matchers");
@@ -235,9 +483,13 @@ Suite *test_matchers_suite(void)
     suite_add_tcase(s, tc_matchers);
     tcase_add_checked_fixture (tc_matchers, setup, teardown);
     tcase_add_test(tc_matchers, test_ac_scanbuff);
+    tcase_add_test(tc_matchers, test_ac_resetdata);
     tcase_add_test(tc_matchers, test_bm_scanbuff);
+    tcase_add_test(tc_matchers, test_bm_literal);
     tcase_add_test(tc_matchers, test_ac_scanbuff_allscan);
     tcase_add_test(tc_matchers, test_bm_scanbuff_allscan);
+    tcase_add_test(tc_matchers, test_hm_scan);
+    tcase_add_test(tc_matchers, test_lsig_compile);
     return s;
 }
 
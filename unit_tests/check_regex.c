@@ -28,6 +28,9 @@
 #include <limits.h>
 #include <string.h>
 #include <check.h>
+#ifdef CL_THREAD_SAFE
+#include <pthread.h>
+#endif
 #include "../libclamav/clamav.h"
 #include "../libclamav/others.h"
 #include "../libclamav/mbox.h"
@@ -36,6 +39,7 @@
 #include "../libclamav/phishcheck.h"
 #include "../libclamav/regex_suffix.h"
 #include "../libclamav/regex_list.h"
+#include "../libclamav/regex_dfa.h"
 #include "../libclamav/phish_domaincheck_db.h"
 #include "../libclamav/phish_whitelist.h"
 #include "checks.h"
@@ -565,6 +569,143 @@ START_TEST (test_regexes)
     cli_regfree(&reg);
 }
 END_TEST
+
+/* the DFA must agree with cli_regexec() on every one of these */
+static const char *rd_regex[] = {
+    "\\.exe$",
+    "(?i)\\.exe$",
+    "^http://(www\\.)?paypal\\.com/",
+    ".+\\.amazon\\.(at|ca|co\\.uk|co\\.jp|de|fr)/",
+    "(?i)^[a-z0-9-]+\\.ebay\\.com:",
+    "[[:digit:]]{1,3}(\\.[[:digit:]]{1,3}){3}",
+    "a{2,3}b*c?$",
+    "^$",
+    "x*",
+    "[^/]+/[]a-]",
+    "(ab|a)(bc|c)",
+    "{a}",
+    "()b"
+};
+
+static const char *rd_text[] = {
+    "test.exe", "test.eXe", "test.exe.txt",
+    "http://paypal.com/", "http://www.paypal.com/x", "xhttp://paypal.com/",
+    "www.amazon.de/", "amazon.de/", "x.amazon.co.uk/:",
+    "sign-in.EBAY.com:", "a.b.ebay.com:",
+    "10.0.0.1/", "1.2.3/", "1234.5.6.7",
+    "aab", "aaac", "abbc", "a", "/a", "host/]", "host/-",
+    "abc", "{a}", "b", "\\x"
+};
+
+START_TEST (test_redfa)
+{
+    struct cli_redfa *dfa = cli_redfa_new();
+    regex_t reg[sizeof(rd_regex)/sizeof(rd_regex[0])];
+    const char *text = rd_text[_i];
+    uint32_t matched[1] = { 0 };
+    unsigned int i;
+    int match;
+
+    fail_unless(!!dfa, "cli_redfa_new");
+    for(i = 0; i < sizeof(rd_regex)/sizeof(rd_regex[0]); i++) {
+	fail_unless(cli_regcomp(&reg[i], rd_regex[i], REG_EXTENDED | REG_NOSUB) == 0, "cli_regcomp");
+	fail_unless_fmt(cli_redfa_add(dfa, rd_regex[i], i) == CL_SUCCESS, "cli_redfa_add failed for %s\n", rd_regex[i]);
+    }
+    fail_unless(cli_redfa_add(dfa, "[[.a.]]", i) == CL_EPARSE, "collating elements are left to the regex engine");
+    fail_unless(cli_redfa_build(dfa) == CL_SUCCESS, "cli_redfa_build");
+    fail_unless(!cli_redfa_has(dfa, i), "cli_redfa_has");
+    fail_unless(cli_redfa_match(dfa, (const unsigned char *)text, strlen(text), matched) == CL_SUCCESS, "cli_redfa_match");
+    for(i = 0; i < sizeof(rd_regex)/sizeof(rd_regex[0]); i++) {
+	match = cli_regexec(&reg[i], text, 0, NULL, 0) != REG_NOMATCH;
+	fail_unless_fmt(match == !!(matched[0] & (1U << i)), "DFA and cli_regexec disagree on %s and %s\n", rd_regex[i], text);
+	cli_regfree(&reg[i]);
+    }
+    cli_redfa_free(dfa);
+}
+END_TEST
+
+#ifdef CL_THREAD_SAFE
+/* enough states for the cache to be flushed while the threads walk it */
+#define RD_THREADS 4
+#define RD_NPAT 64
+#define RD_NTEXT 1000
+
+struct rd_thread {
+    struct cli_redfa *dfa;
+    char (*text)[80];
+    const uint32_t *ref;
+    unsigned int first, done, wrong;
+};
+
+static void *rd_thread_run(void *arg)
+{
+    struct rd_thread *t = arg;
+    unsigned int i, j;
+    uint32_t m[2];
+
+    for(i = 0; i < RD_NTEXT; i++) {
+	j = (t->first + i) % RD_NTEXT;
+	m[0] = m[1] = 0;
+	if(cli_redfa_match(t->dfa, (const unsigned char *)t->text[j], strlen(t->text[j]), m) != CL_SUCCESS)
+	    continue;
+	t->done++;
+	if(m[0] != t->ref[2 * j] || m[1] != t->ref[2 * j + 1])
+	    t->wrong++;
+    }
+    return NULL;
+}
+
+START_TEST (test_redfa_threads)
+{
+    struct cli_redfa *dfa = cli_redfa_new();
+    static char text[RD_NTEXT][80];
+    static uint32_t ref[2 * RD_NTEXT];
+    struct rd_thread t[RD_THREADS];
+    pthread_t tid[RD_THREADS];
+    regex_t reg[RD_NPAT];
+    char pat[16];
+    unsigned int i, j, len, r = 1;
+
+    fail_unless(!!dfa, "cli_redfa_new");
+    for(i = 0; i < RD_NPAT; i++) {
+	r = r * 1103515245 + 12345;
+	snprintf(pat, sizeof(pat), "%c.{%u}%c", 'a' + (r >> 16) % 26, 6 + (r >> 8) % 6, 'a' + (r >> 20) % 26);
+	fail_unless(cli_regcomp(&reg[i], pat, REG_EXTENDED | REG_NOSUB) == 0, "cli_regcomp");
+	fail_unless_fmt(cli_redfa_add(dfa, pat, i) == CL_SUCCESS, "cli_redfa_add failed for %s\n", pat);
+    }
+    fail_unless(cli_redfa_build(dfa) == CL_SUCCESS, "cli_redfa_build");
+    for(i = 0; i < RD_NTEXT; i++) {
+	r = r * 1103515245 + 12345;
+	len = 32 + (r >> 16) % 40;
+	for(j = 0; j < len; j++) {
+	    r = r * 1103515245 + 12345;
+	    text[i][j] = 'a' + (r >> 16) % 26;
+	}
+	text[i][len] = 0;
+	for(j = 0; j < RD_NPAT; j++)
+	    if(cli_regexec(&reg[j], text[i], 0, NULL, 0) != REG_NOMATCH)
+		ref[2 * i + j / 32] |= 1U << (j % 32);
+    }
+    for(i = 0; i < RD_NPAT; i++)
+	cli_regfree(&reg[i]);
+
+    memset(t, 0, sizeof(t));
+    for(i = 0; i < RD_THREADS; i++) {
+	t[i].dfa = dfa;
+	t[i].text = text;
+	t[i].ref = ref;
+	t[i].first = i * RD_NTEXT / RD_THREADS;
+	fail_unless(!pthread_create(&tid[i], NULL, rd_thread_run, &t[i]), "pthread_create");
+    }
+    for(i = 0; i < RD_THREADS; i++) {
+	pthread_join(tid[i], NULL);
+	fail_unless_fmt(t[i].done > RD_NTEXT / 2, "thread %u gave up on %u strings\n", i, RD_NTEXT - t[i].done);
+	fail_unless_fmt(!t[i].wrong, "thread %u: DFA and cli_regexec disagree on %u strings\n", i, t[i].wrong);
+    }
+    cli_redfa_free(dfa);
+}
+END_TEST
+#endif
 #endif
 
 START_TEST(phishing_fake_test)
@@ -655,6 +796,10 @@ Suite *test_regex_suite(void)
 	suite_add_tcase(s, tc_regex);
 #ifdef CHECK_HAVE_LOOPS
 	tcase_add_loop_test(tc_regex, test_regexes, 0, sizeof(rg)/sizeof(rg[0]));
+	tcase_add_loop_test(tc_regex, test_redfa, 0, sizeof(rd_text)/sizeof(rd_text[0]));
+#ifdef CL_THREAD_SAFE
+	tcase_add_test(tc_regex, test_redfa_threads);
+#endif
 #endif
 	return s;
 }
@@ -250,6 +250,128 @@ START_TEST(test_u16_u8)
 }
 END_TEST
 
+/* cli_memstr() and cli_memstr_any() against a naive search, on every
+ * implementation the CPU has. Haystacks sit at the very end of their
+ * allocation so over-reads show up under valgrind. A three letter
+ * alphabet keeps partial and overlapping matches frequent. */
+
+static unsigned int memstr_seed;
+
+static unsigned int memstr_rnd(void)
+{
+    memstr_seed = memstr_seed * 1103515245 + 12345;
+    return memstr_seed >> 16;
+}
+
+static const char *memstr_naive(const char *h, unsigned int hs, const char *n, unsigned int ns)
+{
+	unsigned int i;
+
+    if(!hs || !ns || hs < ns)
+	return NULL;
+    for(i = 0; i <= hs - ns; i++)
+	if(!memcmp(h + i, n, ns))
+	    return h + i;
+    return NULL;
+}
+
+static void memstr_fill(char *p, unsigned int len)
+{
+	unsigned int i;
+
+    for(i = 0; i < len; i++)
+	p[i] = "abc"[memstr_rnd() % 3];
+}
+
+/* a needle taken from the haystack half the time, random otherwise */
+static void memstr_needle(char *n, unsigned int ns, const char *h, unsigned int hs)
+{
+    if(hs >= ns && memstr_rnd() % 2)
+	memcpy(n, h + memstr_rnd() % (hs - ns + 1), ns);
+    else
+	memstr_fill(n, ns);
+}
+
+START_TEST (test_memstr)
+{
+	char *buf, *h, needle[80];
+	unsigned int hs, ns, k;
+	const char *r, *e;
+
+    if(cli_memstr_select(_i))
+	return;
+    memstr_seed = 1;
+    buf = malloc(300);
+    fail_unless(!!buf, "malloc");
+    for(hs = 0; hs <= 300; hs++) {
+	h = buf + 300 - hs;
+	for(ns = 0; ns <= 70; ns++) {
+	    for(k = 0; k < 8; k++) {
+		memstr_fill(h, hs);
+		memstr_needle(needle, ns, h, hs);
+		r = cli_memstr(h, hs, needle, ns);
+		e = memstr_naive(h, hs, needle, ns);
+		fail_unless_fmt(r == e, "cli_memstr impl %d hs %u ns %u: got %d expected %d", _i, hs, ns,
+				r ? (int)(r - h) : -1, e ? (int)(e - h) : -1);
+	    }
+	}
+    }
+    /* binary needles */
+    memset(buf, 0, 300);
+    buf[299] = '\xff';
+    fail_unless(cli_memstr(buf, 300, "\x00\xff", 2) == buf + 298, "cli_memstr binary needle");
+    fail_unless(!cli_memstr(buf, 299, "\x00\xff", 2), "cli_memstr binary needle past end");
+    free(buf);
+    cli_memstr_select(CLI_MEMSTR_AUTO);
+}
+END_TEST
+
+START_TEST (test_memstr_any)
+{
+	char *buf, *h, needles[12][40];
+	const char *np[12];
+	unsigned int ns[12], hs, n, j, k, idx, eidx;
+	const char *r, *e, *t;
+
+    if(cli_memstr_select(_i))
+	return;
+    memstr_seed = 2;
+    buf = malloc(300);
+    fail_unless(!!buf, "malloc");
+    for(hs = 0; hs <= 300; hs += 3) {
+	h = buf + 300 - hs;
+	/* up to 12 needles, past what the vector loops handle */
+	for(n = 1; n <= 12; n++) {
+	    for(k = 0; k < 16; k++) {
+		memstr_fill(h, hs);
+		for(j = 0; j < n; j++) {
+		    /* an empty needle now and then, it never matches */
+		    ns[j] = (memstr_rnd() % 16) ? 1 + memstr_rnd() % 39 : 0;
+		    memstr_needle(needles[j], ns[j], h, hs);
+		    np[j] = needles[j];
+		}
+		e = NULL;
+		eidx = 0;
+		for(j = 0; j < n; j++) {
+		    t = memstr_naive(h, hs, np[j], ns[j]);
+		    if(t && (!e || t < e)) {
+			e = t;
+			eidx = j;
+		    }
+		}
+		idx = ~0u;
+		r = cli_memstr_any(h, hs, np, ns, n, &idx);
+		fail_unless_fmt(r == e, "cli_memstr_any impl %d hs %u n %u: got %d expected %d", _i, hs, n,
+				r ? (int)(r - h) : -1, e ? (int)(e - h) : -1);
+		fail_unless_fmt(!e || idx == eidx, "cli_memstr_any impl %d hs %u n %u: needle %u expected %u", _i, hs, n, idx, eidx);
+	    }
+	}
+    }
+    free(buf);
+    cli_memstr_select(CLI_MEMSTR_AUTO);
+}
+END_TEST
+
 #endif
 
 Suite *test_str_suite(void)
@@ -276,6 +398,8 @@ Suite *test_str_suite(void)
     tcase_add_test(tc_str, hex2str);
 #ifdef CHECK_HAVE_LOOPS
     tcase_add_loop_test(tc_str, test_u16_u8, 0, sizeof(u16_tests)/sizeof(u16_tests[0]));
+    tcase_add_loop_test(tc_str, test_memstr, CLI_MEMSTR_SCALAR, CLI_MEMSTR_AVX2 + 1);
+    tcase_add_loop_test(tc_str, test_memstr_any, CLI_MEMSTR_SCALAR, CLI_MEMSTR_AVX2 + 1);
 #endif
 
     tc_decodeline = tcase_create("decodeline");
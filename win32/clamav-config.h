@@ -128,6 +128,9 @@
 /* Define to 1 if you have the `argz_stringify' function. */
 /* #undef HAVE_ARGZ_STRINGIFY */
 
+/* Define to 1 if the compiler has the __atomic builtins */
+/* #undef HAVE_ATOMIC_BUILTINS */
+
 /* attrib aligned */
 /* #undef HAVE_ATTRIB_ALIGNED */
 
@@ -237,6 +240,9 @@
 /* Define to 1 if you have the <limits.h> header file. */
 #define HAVE_LIMITS_H 1
 
+/* Define to 1 if you have the <linux/io_uring.h> header file. */
+/* #undef HAVE_LINUX_IO_URING_H */
+
 /* Define this if a modern libltdl is already installed */
 #define HAVE_LTDL 1
 
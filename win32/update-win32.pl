@@ -59,6 +59,7 @@ my %CONF = (
     'HAVE_ARGZ_INSERT' => -1,
     'HAVE_ARGZ_NEXT' => -1,
     'HAVE_ARGZ_STRINGIFY' => -1,
+    'HAVE_ATOMIC_BUILTINS' => -1,
     'HAVE_ATTRIB_ALIGNED' => -1,
     'HAVE_ATTRIB_PACKED' => -1,
     'HAVE_BZLIB_H' => '1',
@@ -96,6 +97,7 @@ my %CONF = (
     'HAVE_LIBPDCURSES' => -1,
     'HAVE_LIBZ' => '1',
     'HAVE_LIMITS_H' => '1',
+    'HAVE_LINUX_IO_URING_H' => -1,
     'HAVE_LTDL' => '1',
     'HAVE_MACH_O_DYLD_H' => -1,
     'HAVE_MADVISE' => -1,